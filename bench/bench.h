@@ -0,0 +1,41 @@
+#ifndef BERGEN_BENCH_BENCH_H
+#define BERGEN_BENCH_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Runs the operation being measured iterations times */
+typedef void (*bench_func)(void *data, size_t iterations);
+
+/*
+ * Runs func once for a tenth of iterations to warm up, then times it for all
+ * of them and prints the time and allocations per operation. The counts are
+ * fixed, so that runs on different trees do the same work.
+ */
+void bench_run(const char *name, size_t iterations, bench_func func, void *data);
+
+/* What a generated program has, in total */
+struct corpus_options {
+	size_t num_labels; /* Each loads the address of another */
+	size_t num_equs;
+	size_t num_macro_uses;
+	size_t num_tables; /* Of .db lines */
+	size_t table_length; /* Bytes in each table */
+	size_t num_segments; /* Started by .org */
+};
+
+/* Scale 1 is about 4000 lines */
+void corpus_options_init(struct corpus_options *options, size_t scale);
+
+void corpus_generate(FILE *file, const struct corpus_options *options);
+
+/* Assembles corpora of doubling sizes, and fails if anything grows faster */
+int scale_run(void);
+
+void bench_expression(void);
+void bench_label(void);
+void bench_lexer(void);
+void bench_object(void);
+void bench_parse(void);
+
+#endif /* BERGEN_BENCH_BENCH_H */
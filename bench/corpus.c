@@ -0,0 +1,94 @@
+/*
+ * bench/corpus.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/libc.h>
+
+/* Segments are placed in this many slots of SEGMENT_SPACING bytes from $4000 */
+#define SEGMENT_SLOTS 32
+#define SEGMENT_SPACING 0x400
+
+void corpus_options_init(struct corpus_options *options, size_t scale)
+{
+	options->num_labels = 1000 * scale;
+	options->num_equs = 250 * scale;
+	options->num_macro_uses = 1000 * scale;
+	options->num_tables = 250 * scale;
+	options->table_length = 32;
+	options->num_segments = options->num_labels / 16;
+}
+
+/* How many of total fall to the index-th of num parts */
+static size_t share(size_t total, size_t num, size_t index)
+{
+	return total * (index + 1) / num - total * index / num;
+}
+
+static void write_table(FILE *file, size_t index, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		if (i % 16 == 0)
+			bergen_fprintf(file, "%s\t.db ", i ? "\n" : "");
+		else
+			bergen_fprintf(file, ", ");
+		bergen_fprintf(file, "$%02X", (unsigned int) ((index * 31 + i) & 0xFF));
+	}
+	bergen_fprintf(file, "\n");
+}
+
+void corpus_generate(FILE *file, const struct corpus_options *options)
+{
+	size_t num_labels = options->num_labels > 0 ? options->num_labels : 1;
+	size_t num_segments = options->num_segments > 0 ? options->num_segments : 1;
+	size_t i, j, segment = 0, macro_use = 0, table = 0;
+
+	bergen_fprintf(file, "; Generated by bench --corpus\n");
+	bergen_fprintf(file, "#define LOAD(r, v) ld r, v\n");
+	for (i = 0; i < options->num_equs; i++)
+		bergen_fprintf(file, "e%lu .equ (%lu * 7) & $FF\n", (unsigned long) i, (unsigned long) i);
+
+	for (i = 0; i < num_labels; i++) {
+		/* Each segment starts a few labels further along */
+		if (segment < num_segments && i == num_labels * segment / num_segments) {
+			bergen_fprintf(file, ".org $%04X\n", (unsigned int) (0x4000 + segment % SEGMENT_SLOTS * SEGMENT_SPACING));
+			segment++;
+		}
+
+		/* References go both ways */
+		bergen_fprintf(file, "l%lu:\n", (unsigned long) i);
+		bergen_fprintf(file, "\tld hl, l%lu\n", (unsigned long) (i * 7919 % num_labels));
+
+		for (j = share(options->num_macro_uses, num_labels, i); j > 0; j--, macro_use++) {
+			if (options->num_equs > 0)
+				bergen_fprintf(file, "\tLOAD(a, e%lu)\n", (unsigned long) (macro_use % options->num_equs));
+			else
+				bergen_fprintf(file, "\tLOAD(a, %lu)\n", (unsigned long) (macro_use & 0xFF));
+		}
+
+		for (j = share(options->num_tables, num_labels, i); j > 0; j--, table++)
+			write_table(file, table, options->table_length);
+	}
+}
@@ -0,0 +1,89 @@
+/*
+ * bench/expression.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/expression.h>
+
+#include <bergen/libc.h>
+
+struct expression_data {
+	const char *str;
+	struct label_list labels;
+	struct lex_token_list tokens;
+	expr_value result;
+};
+
+static void run_expr_evaluate(void *data, size_t iterations)
+{
+	struct expression_data *expression = data;
+	struct expr_data expr;
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		expr_data_init_easy(&expr, expression->str, '@');
+		expr.labels = &expression->labels;
+		error_free(expr_evaluate(&expr, &expression->result));
+		expr_data_destroy(&expr);
+	}
+}
+
+/* The tokenizer and the evaluator, without the lexer */
+static void run_expr_evaluate_tokens(void *data, size_t iterations)
+{
+	struct expression_data *expression = data;
+	struct expr_data expr;
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		expr_data_init_easy(&expr, expression->str, '@');
+		expr.labels = &expression->labels;
+		error_free(expr_evaluate_tokens(&expr, expression->tokens.tokens, expression->tokens.num_tokens, &expression->result));
+		expr_data_destroy(&expr);
+	}
+}
+
+void bench_expression(void)
+{
+	struct expression_data expression;
+
+	label_list_init(&expression.labels);
+	label_list_append_easy(&expression.labels, "start", 0x9D95);
+	label_list_append_easy(&expression.labels, "table", 0xA000);
+	lex_token_list_init(&expression.tokens);
+
+	expression.str = "42";
+	lex_line(expression.str, bergen_strlen(expression.str), &expression.tokens);
+	bench_run("expr_evaluate/constant", 2000000, run_expr_evaluate, &expression);
+	bench_run("expr_evaluate_tokens/constant", 2000000, run_expr_evaluate_tokens, &expression);
+
+	expression.str = "(table + 2 * 3) & $FF00 | start >> 8";
+	lex_token_list_destroy(&expression.tokens);
+	lex_token_list_init(&expression.tokens);
+	lex_line(expression.str, bergen_strlen(expression.str), &expression.tokens);
+	bench_run("expr_evaluate/labels", 1000000, run_expr_evaluate, &expression);
+	bench_run("expr_evaluate_tokens/labels", 1000000, run_expr_evaluate_tokens, &expression);
+
+	lex_token_list_destroy(&expression.tokens);
+	label_list_destroy(&expression.labels);
+}
@@ -0,0 +1,72 @@
+/*
+ * bench/label.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/label.h>
+
+#include <bergen/libc.h>
+
+#define NUM_LABELS 4096
+
+struct label_data {
+	struct label_list labels;
+	char names[NUM_LABELS][16]; /* Looked up in turn */
+	size_t lengths[NUM_LABELS];
+	size_t found;
+};
+
+static void run_find_label(void *data, size_t iterations)
+{
+	struct label_data *label = data;
+	size_t i;
+
+	for (i = 0; i < iterations; i++)
+		label->found += label_list_find_label(&label->labels, label->names[i % NUM_LABELS], label->lengths[i % NUM_LABELS]) != NULL;
+}
+
+static void make_names(struct label_data *label, const char *prefix)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_LABELS; i++)
+		label->lengths[i] = bergen_snprintf(label->names[i], sizeof(label->names[i]), "%s%lu", prefix, (unsigned long) i);
+}
+
+void bench_label(void)
+{
+	struct label_data label;
+	size_t i;
+
+	label_list_init(&label.labels);
+	make_names(&label, "label");
+	for (i = 0; i < NUM_LABELS; i++)
+		label_list_append(&label.labels, label.names[i], label.lengths[i], i);
+	label.found = 0;
+
+	bench_run("label_list_find_label/hit", 4000000, run_find_label, &label);
+	make_names(&label, "other");
+	bench_run("label_list_find_label/miss", 4000000, run_find_label, &label);
+
+	label_list_destroy(&label.labels);
+}
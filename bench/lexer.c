@@ -0,0 +1,58 @@
+/*
+ * bench/lexer.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/lexer.h>
+
+#include <bergen/libc.h>
+
+struct lexer_data {
+	const char *line;
+	size_t num_tokens;
+};
+
+static void run_lex_line(void *data, size_t iterations)
+{
+	struct lexer_data *lexer = data;
+	struct lex_token_list tokens;
+	size_t i, length = bergen_strlen(lexer->line);
+
+	for (i = 0; i < iterations; i++) {
+		lex_token_list_init(&tokens);
+		lex_line(lexer->line, length, &tokens);
+		lexer->num_tokens += tokens.num_tokens;
+		lex_token_list_destroy(&tokens);
+	}
+}
+
+void bench_lexer(void)
+{
+	struct lexer_data lexer;
+
+	lexer.num_tokens = 0;
+	lexer.line = "loop:\tld (ix + 3), a ; next one";
+	bench_run("lex_line/instruction", 2000000, run_lex_line, &lexer);
+	lexer.line = "\t.db \"Hello, world!\", 0, $FF, %1010, 'x'";
+	bench_run("lex_line/data", 2000000, run_lex_line, &lexer);
+}
@@ -0,0 +1,143 @@
+/*
+ * bench/main.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/alloc.h>
+
+#include <bergen/libc.h>
+
+static const char *filter = NULL;
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static uint64_t total_allocs(const struct alloc_stats *stats)
+{
+	uint64_t total = 0;
+	size_t i;
+
+	for (i = 0; i < ALLOC_NUM_TAGS; i++)
+		total += stats->tags[i].allocs + stats->tags[i].reallocs;
+	return total;
+}
+
+static uint64_t total_bytes(const struct alloc_stats *stats)
+{
+	uint64_t total = 0;
+	size_t i;
+
+	for (i = 0; i < ALLOC_NUM_TAGS; i++)
+		total += stats->tags[i].bytes;
+	return total;
+}
+
+void bench_run(const char *name, size_t iterations, bench_func func, void *data)
+{
+	struct alloc_stats before, after;
+	uint64_t start, elapsed;
+
+	if (filter && !bergen_strstr(name, filter))
+		return;
+
+	func(data, iterations / 10 > 0 ? iterations / 10 : 1);
+
+	alloc_collect(&before);
+	start = now_ns();
+	func(data, iterations);
+	elapsed = now_ns() - start;
+	alloc_collect(&after);
+
+	/* Counting allocations slows them down, so a build either times or counts */
+	bergen_fprintf(stdout, "%-32s %10lu", name, (unsigned long) iterations);
+	if (ALLOC_ACCOUNTING)
+		bergen_fprintf(stdout, " %12s %12.2f %12.1f\n", "-",
+			(double) (total_allocs(&after) - total_allocs(&before)) / iterations,
+			(double) (total_bytes(&after) - total_bytes(&before)) / iterations);
+	else
+		bergen_fprintf(stdout, " %12.1f %12s %12s\n", (double) elapsed / iterations, "-", "-");
+	bergen_fflush(stdout);
+}
+
+static int parse_size(const char *arg, const char *name, size_t *value)
+{
+	size_t length = bergen_strlen(name);
+	char *end;
+
+	if (bergen_strncmp(arg, name, length) || arg[length] != '=')
+		return 0;
+	*value = bergen_strtoull(arg + length + 1, &end, 10);
+	return *end == '\0' && end != arg + length + 1;
+}
+
+/* "--corpus [scale=N] [labels=N] ..." writes a generated program to stdout */
+static int generate(int argc, char **argv)
+{
+	struct corpus_options options;
+	size_t scale = 1;
+	int i;
+
+	for (i = 2; i < argc; i++) {
+		if (parse_size(argv[i], "scale", &scale))
+			continue;
+	}
+	corpus_options_init(&options, scale);
+
+	for (i = 2; i < argc; i++) {
+		if (!parse_size(argv[i], "scale", &scale) && !parse_size(argv[i], "labels", &options.num_labels)
+				&& !parse_size(argv[i], "equs", &options.num_equs) && !parse_size(argv[i], "macros", &options.num_macro_uses)
+				&& !parse_size(argv[i], "tables", &options.num_tables) && !parse_size(argv[i], "table_length", &options.table_length)
+				&& !parse_size(argv[i], "segments", &options.num_segments)) {
+			bergen_fprintf(stderr, "bench: unknown corpus option %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	corpus_generate(stdout, &options);
+	return EXIT_SUCCESS;
+}
+
+/* An argument only runs the benchmarks whose names contain it */
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !bergen_strcmp(argv[1], "--scale"))
+		return scale_run();
+	if (argc > 1 && !bergen_strcmp(argv[1], "--corpus"))
+		return generate(argc, argv);
+	if (argc > 1)
+		filter = argv[1];
+
+	bergen_fprintf(stdout, "%-32s %10s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op", "bytes/op");
+	bench_expression();
+	bench_label();
+	bench_lexer();
+	bench_object();
+	bench_parse();
+
+	return 0;
+}
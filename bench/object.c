@@ -0,0 +1,93 @@
+/*
+ * bench/object.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/object.h>
+
+#include <bergen/libc.h>
+
+/* Written to a fresh output every so often, so that it doesn't keep growing */
+#define OUTPUT_SIZE 16384
+
+struct object_data {
+	size_t write_length;
+	struct object_output output; /* For the writers */
+	FILE *file;
+};
+
+static void run_write(void *data, size_t iterations)
+{
+	struct object_data *object = data;
+	struct object_output output;
+	const char buf[16] = { 0 };
+	size_t i, written = 0;
+
+	object_output_init(&output);
+	for (i = 0; i < iterations; i++) {
+		if (written + object->write_length > OUTPUT_SIZE) {
+			object_output_destroy(&output);
+			object_output_init(&output);
+			written = 0;
+		}
+		object_output_write(&output, buf, object->write_length);
+		written += object->write_length;
+	}
+	object_output_destroy(&output);
+}
+
+static void run_write_to_binary(void *data, size_t iterations)
+{
+	struct object_data *object = data;
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		bergen_rewind(object->file);
+		error_free(object_output_write_to_binary(&object->output, object->file));
+	}
+}
+
+void bench_object(void)
+{
+	struct object_data object;
+	char buf[256];
+	size_t i;
+
+	object.write_length = 1;
+	bench_run("object_output_write/1", 10000000, run_write, &object);
+	object.write_length = 3;
+	bench_run("object_output_write/3", 10000000, run_write, &object);
+
+	/* 64 segments of 256 bytes, with gaps between them */
+	object_output_init(&object.output);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+	for (i = 0; i < 64; i++) {
+		object_output_set_address(&object.output, 0x4000 + i * 512);
+		object_output_write(&object.output, buf, sizeof(buf));
+	}
+	object.file = bergen_tmpfile();
+	bench_run("object_output_write_to_binary/64", 20000, run_write_to_binary, &object);
+	bergen_fclose(object.file);
+	object_output_destroy(&object.output);
+}
@@ -0,0 +1,56 @@
+/*
+ * bench/parse.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/parse.h>
+
+#include <bergen/libc.h>
+
+struct parse_data {
+	const char *str;
+	char buf[256];
+	size_t total;
+};
+
+static void run_parse_string_data(void *data, size_t iterations)
+{
+	struct parse_data *parse = data;
+	size_t i, length = bergen_strlen(parse->str), buf_length;
+
+	for (i = 0; i < iterations; i++) {
+		buf_length = sizeof(parse->buf);
+		parse->total += parse_string_data(parse->str, length, parse->buf, &buf_length);
+	}
+}
+
+void bench_parse(void)
+{
+	struct parse_data parse;
+
+	parse.total = 0;
+	parse.str = "\"Hello, world!\"";
+	bench_run("parse_string_data/plain", 4000000, run_parse_string_data, &parse);
+	parse.str = "\"Line one\\nLine two\\t\\\"quoted\\\"\\\\\"";
+	bench_run("parse_string_data/escapes", 4000000, run_parse_string_data, &parse);
+}
@@ -0,0 +1,205 @@
+/*
+ * bench/scale.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "bench.h"
+
+#include <bergen/alloc.h>
+#include <bergen/assembler.h>
+
+#include <bergen/libc.h>
+
+#include <math.h>
+
+#define NUM_SIZES 6
+#define NUM_RUNS 3 /* The fastest one counts */
+
+/* Beyond this, doubling the input more than doubles the cost */
+#define MAX_EXPONENT 1.2
+
+struct scale_result {
+	size_t scale;
+	size_t lines;
+	double ms;
+	uint64_t peak_bytes;
+};
+
+static double now_ms(void)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static size_t count_lines(const char *path)
+{
+	FILE *file = bergen_fopen(path, "r");
+	size_t lines = 0;
+	int c;
+
+	if (!file)
+		return 0;
+	while ((c = bergen_fgetc(file)) != EOF)
+		lines += c == '\n';
+	bergen_fclose(file);
+	return lines;
+}
+
+/* Returns 0 if the corpus doesn't assemble, which is a bug in one or the other */
+static int measure(const char *path, struct scale_result *result)
+{
+	struct include_manager im;
+	struct include_file *file;
+	struct assembler as;
+	struct alloc_stats stats;
+	struct error *err;
+	uint64_t live;
+	double start, ms;
+	int run;
+
+	result->ms = 0;
+	result->peak_bytes = 0;
+	for (run = 0; run < NUM_RUNS; run++) {
+		include_manager_init(&im);
+		assembler_init(&as, &im);
+		alloc_collect(&stats);
+		live = stats.live;
+		alloc_reset_peak();
+
+		start = now_ms();
+		if (!(err = include_manager_load(&im, path, &file)))
+			err = assembler_assemble(&as, file);
+		ms = now_ms() - start;
+
+		if (err) {
+			error_print(err, &im.sources, stderr);
+			error_free(err);
+			assembler_destroy(&as);
+			include_manager_destroy(&im);
+			return 0;
+		}
+
+		if (run == 0 || ms < result->ms)
+			result->ms = ms;
+		alloc_collect(&stats);
+		result->peak_bytes = stats.peak_live - live;
+
+		assembler_destroy(&as);
+		include_manager_destroy(&im);
+	}
+	return 1;
+}
+
+/* Least squares slope of log(y) over log(x) */
+static double exponent(const struct scale_result *results, size_t num, int memory)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, x, y;
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		x = log((double) results[i].lines);
+		y = log(memory ? (double) results[i].peak_bytes : results[i].ms);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	return (num * sxy - sx * sy) / (num * sxx - sx * sx);
+}
+
+int scale_run(void)
+{
+	char dir[] = "/tmp/bergen-scale-XXXXXX", path[PATH_MAX];
+	struct scale_result results[NUM_SIZES], *result;
+	struct corpus_options options;
+	double time_exponent, memory_exponent;
+	FILE *file;
+	size_t i;
+	int status = EXIT_SUCCESS;
+
+	if (!bergen_mkdtemp(dir)) {
+		bergen_fprintf(stderr, "bench: can't make a directory for the corpora\n");
+		return EXIT_FAILURE;
+	}
+
+	bergen_fprintf(stdout, "%8s %10s %10s %8s %12s %8s\n", "scale", "lines", "ms", "x", "peak KB", "x");
+	for (i = 0; i < NUM_SIZES; i++) {
+		result = &results[i];
+		result->scale = (size_t) 1 << i;
+
+		bergen_snprintf(path, sizeof(path), "%s/corpus-%lu.z80", dir, (unsigned long) result->scale);
+		corpus_options_init(&options, result->scale);
+		if (!(file = bergen_fopen(path, "w"))) {
+			status = EXIT_FAILURE;
+			break;
+		}
+		corpus_generate(file, &options);
+		bergen_fclose(file);
+		result->lines = count_lines(path);
+
+		if (!measure(path, result)) {
+			bergen_unlink(path);
+			status = EXIT_FAILURE;
+			break;
+		}
+		bergen_unlink(path);
+
+		/* Like bench_run(), a build either times or measures memory */
+		bergen_fprintf(stdout, "%8lu %10lu", (unsigned long) result->scale, (unsigned long) result->lines);
+		if (ALLOC_ACCOUNTING)
+			bergen_fprintf(stdout, " %10s %8s", "-", "");
+		else if (i > 0)
+			bergen_fprintf(stdout, " %10.2f %8.2f", result->ms, result->ms / results[i - 1].ms);
+		else
+			bergen_fprintf(stdout, " %10.2f %8s", result->ms, "");
+		if (!ALLOC_ACCOUNTING)
+			bergen_fprintf(stdout, " %12s %8s\n", "-", "");
+		else if (i > 0)
+			bergen_fprintf(stdout, " %12.1f %8.2f\n", result->peak_bytes / 1024.0, (double) result->peak_bytes / results[i - 1].peak_bytes);
+		else
+			bergen_fprintf(stdout, " %12.1f %8s\n", result->peak_bytes / 1024.0, "");
+		bergen_fflush(stdout);
+	}
+	bergen_rmdir(dir);
+
+	if (status != EXIT_SUCCESS)
+		return status;
+
+	/* Small inputs are noisy, so the fit starts at the second size */
+	if (!ALLOC_ACCOUNTING) {
+		time_exponent = exponent(results + 1, NUM_SIZES - 1, 0);
+		bergen_fprintf(stdout, "time grows as lines^%.2f\n", time_exponent);
+		if (time_exponent > MAX_EXPONENT) {
+			bergen_fprintf(stdout, "bench: time grows faster than lines^%.1f\n", MAX_EXPONENT);
+			status = EXIT_FAILURE;
+		}
+	} else {
+		memory_exponent = exponent(results + 1, NUM_SIZES - 1, 1);
+		bergen_fprintf(stdout, "peak memory grows as lines^%.2f\n", memory_exponent);
+		if (memory_exponent > MAX_EXPONENT) {
+			bergen_fprintf(stdout, "bench: peak memory grows faster than lines^%.1f\n", MAX_EXPONENT);
+			status = EXIT_FAILURE;
+		}
+	}
+	return status;
+}
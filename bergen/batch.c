@@ -0,0 +1,628 @@
+/*
+ * bergen/batch.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "batch.h"
+
+#include <bergen/arena.h>
+#include <bergen/assembler.h>
+#include <bergen/cache.h>
+#include <bergen/depend.h>
+#include <bergen/libc.h>
+#include <bergen/pool.h>
+#include <bergen/version.h>
+
+static void usage(FILE *file)
+{
+	bergen_fprintf(file,
+		"Usage: bergen [options] input [output]\n"
+		"       bergen [options] --jobs N input...\n"
+		"\n"
+		"Options:\n"
+		"  -o, --output FILE    Write the output to FILE instead of input.bin or input.hex\n"
+		"  -f, --format FORMAT  Output format: bin (default) or hex (Intel hex)\n"
+		"  -I DIR               Search DIR for #include files\n"
+		"  -j, --jobs N         Assemble every input given, N at a time; with fewer inputs,\n"
+		"                       the threads left over share the encoding of each\n"
+		"  -MD                  Write the files each output depends on to output.d, for make\n"
+		"  -MF FILE             Write them to FILE instead\n"
+		"  -MP                  Add a phony target for each include, like cc -MP\n"
+		"      --if-changed     Skip inputs whose files and options haven't changed since\n"
+		"                       the last time, going by output.stamp\n"
+		"      --cache DIR      Keep assembled programs in DIR, and reuse them for inputs\n"
+		"                       that preprocess the same (default $BERGEN_CACHE_DIR)\n"
+		"      --stats          Print the time taken by each phase and counts of what was\n"
+		"                       done; --stats=json prints them as JSON\n"
+		"      --profile[=N]    Print the N source lines and macros that took longest to\n"
+		"                       assemble, over every pass (default 20)\n"
+		"      --trace FILE     Write a Chrome trace of the phases, includes, outputs and\n"
+		"                       macro expansions to FILE, for chrome://tracing or Perfetto\n"
+		"      --trace-threshold US\n"
+		"                       Leave out macro expansions quicker than US microseconds\n"
+		"                       (default 10)\n"
+		"      --watch          Assemble again whenever an input or include changes\n"
+		"      --server         Keep includes loaded and assemble for clients on the socket\n"
+		"      --client         Assemble on the server if there is one, with the same results\n"
+		"      --socket PATH    Socket of the server, instead of bergen.sock in\n"
+		"                       $XDG_RUNTIME_DIR or /tmp/bergen-UID\n"
+		"  -h, --help           Show this help\n"
+		"      --version        Show the version of bergen\n");
+}
+
+static int is_option(const char *arg, const char *short_name, const char *long_name)
+{
+	return (short_name && !bergen_strcmp(arg, short_name)) || (long_name && !bergen_strcmp(arg, long_name));
+}
+
+static int parse_threshold(const char *value, uint64_t *threshold_ns)
+{
+	char *end;
+	long long n = bergen_strtoll(value, &end, 10);
+
+	if (*value == '\0' || *end != '\0' || n < 0) {
+		bergen_fprintf(stderr, "bergen: invalid trace threshold %s\n", value);
+		return 0;
+	}
+	*threshold_ns = (uint64_t) n * 1000;
+	return 1;
+}
+
+static int parse_profile_top(const char *value, size_t *top)
+{
+	char *end;
+	long long n = bergen_strtoll(value, &end, 10);
+
+	if (*value == '\0' || *end != '\0' || n < 1) {
+		bergen_fprintf(stderr, "bergen: invalid number of lines to profile %s\n", value);
+		return 0;
+	}
+	*top = n;
+	return 1;
+}
+
+static int parse_jobs(const char *value, size_t *jobs)
+{
+	char *end;
+	long long n = bergen_strtoll(value, &end, 10);
+
+	if (*value == '\0' || *end != '\0' || n < 1) {
+		bergen_fprintf(stderr, "bergen: invalid number of jobs %s\n", value);
+		return 0;
+	}
+	*jobs = n;
+	return 1;
+}
+
+int options_parse(struct options *options, int argc, char **argv)
+{
+	int i;
+	const char *value;
+
+	options->inputs = bergen_malloc(sizeof(*options->inputs) * argc);
+	options->num_inputs = 0;
+	options->output = NULL;
+	options->format = OUTPUT_FORMAT_BINARY;
+	options->include_paths = bergen_malloc(sizeof(*options->include_paths) * argc);
+	options->num_include_paths = 0;
+	options->jobs = 0;
+	options->depend = 0;
+	options->depend_path = NULL;
+	options->depend_phony = 0;
+	options->if_changed = 0;
+	options->cache_dir = bergen_getenv("BERGEN_CACHE_DIR");
+	if (options->cache_dir && !*options->cache_dir)
+		options->cache_dir = NULL;
+	options->stats_format = STATS_FORMAT_NONE;
+	options->profile_top = 0;
+	options->trace_path = NULL;
+	options->trace_threshold_ns = 10000;
+	options->watch = 0;
+	options->server = 0;
+	options->client = 0;
+	options->socket_path = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (is_option(argv[i], "-h", "--help")) {
+			usage(stdout);
+			return EXIT_SUCCESS;
+		}
+
+		if (is_option(argv[i], NULL, "--version")) {
+			bergen_fprintf(stdout, "bergen %s\n", BERGEN_VERSION);
+			return EXIT_SUCCESS;
+		}
+		if (is_option(argv[i], "-MD", NULL)) {
+			options->depend = 1;
+			continue;
+		}
+		if (is_option(argv[i], "-MP", NULL)) {
+			options->depend_phony = 1;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--if-changed")) {
+			options->if_changed = 1;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--stats") || is_option(argv[i], NULL, "--stats=text")) {
+			options->stats_format = STATS_FORMAT_TEXT;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--stats=json")) {
+			options->stats_format = STATS_FORMAT_JSON;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--profile")) {
+			options->profile_top = 20;
+			continue;
+		}
+		if (!bergen_strncmp(argv[i], "--profile=", 10)) {
+			if (!parse_profile_top(argv[i] + 10, &options->profile_top))
+				return EXIT_USAGE;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--watch")) {
+			options->watch = 1;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--server")) {
+			options->server = 1;
+			continue;
+		}
+		if (is_option(argv[i], NULL, "--client")) {
+			options->client = 1;
+			continue;
+		}
+
+		if (is_option(argv[i], "-o", "--output") || is_option(argv[i], "-f", "--format") || is_option(argv[i], "-I", NULL) || is_option(argv[i], "-j", "--jobs") || is_option(argv[i], NULL, "--socket") || is_option(argv[i], NULL, "--cache") || is_option(argv[i], NULL, "--trace") || is_option(argv[i], NULL, "--trace-threshold") || is_option(argv[i], "-MF", NULL)) {
+			if (i + 1 >= argc) {
+				bergen_fprintf(stderr, "bergen: %s needs an argument\n", argv[i]);
+				return EXIT_USAGE;
+			}
+			value = argv[++i];
+		} else if (!bergen_strncmp(argv[i], "-I", 2)) {
+			options->include_paths[options->num_include_paths++] = argv[i] + 2;
+			continue;
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			bergen_fprintf(stderr, "bergen: unknown option %s\n", argv[i]);
+			return EXIT_USAGE;
+		} else {
+			options->inputs[options->num_inputs++] = argv[i];
+			continue;
+		}
+
+		if (is_option(argv[i - 1], "-o", "--output")) {
+			options->output = value;
+		} else if (is_option(argv[i - 1], "-I", NULL)) {
+			options->include_paths[options->num_include_paths++] = value;
+		} else if (is_option(argv[i - 1], "-MF", NULL)) {
+			options->depend_path = value;
+			options->depend = 1;
+		} else if (is_option(argv[i - 1], NULL, "--socket")) {
+			options->socket_path = value;
+		} else if (is_option(argv[i - 1], NULL, "--cache")) {
+			options->cache_dir = value;
+		} else if (is_option(argv[i - 1], NULL, "--trace")) {
+			options->trace_path = value;
+		} else if (is_option(argv[i - 1], NULL, "--trace-threshold")) {
+			if (!parse_threshold(value, &options->trace_threshold_ns))
+				return EXIT_USAGE;
+		} else if (is_option(argv[i - 1], "-j", "--jobs")) {
+			if (!parse_jobs(value, &options->jobs))
+				return EXIT_USAGE;
+		} else if (!bergen_strcmp(value, "bin")) {
+			options->format = OUTPUT_FORMAT_BINARY;
+		} else if (!bergen_strcmp(value, "hex")) {
+			options->format = OUTPUT_FORMAT_INTEL_HEX;
+		} else {
+			bergen_fprintf(stderr, "bergen: unknown output format %s\n", value);
+			return EXIT_USAGE;
+		}
+	}
+
+	if (options->watch && options->if_changed) {
+		bergen_fprintf(stderr, "bergen: --if-changed can't be used with --watch\n");
+		return EXIT_USAGE;
+	}
+	if (options->server + options->client + options->watch > 1) {
+		bergen_fprintf(stderr, "bergen: only one of --watch, --server and --client can be used\n");
+		return EXIT_USAGE;
+	}
+	if (options->stats_format != STATS_FORMAT_NONE && (options->server || options->client)) {
+		bergen_fprintf(stderr, "bergen: --stats can't be used with --server or --client\n");
+		return EXIT_USAGE;
+	}
+	if (options->profile_top && (options->server || options->client)) {
+		bergen_fprintf(stderr, "bergen: --profile can't be used with --server or --client\n");
+		return EXIT_USAGE;
+	}
+	if (options->trace_path && (options->server || options->client)) {
+		bergen_fprintf(stderr, "bergen: --trace can't be used with --server or --client\n");
+		return EXIT_USAGE;
+	}
+	if (options->server) {
+		if (options->num_inputs > 0 || options->output) {
+			bergen_fprintf(stderr, "bergen: the server takes its inputs from clients\n");
+			return EXIT_USAGE;
+		}
+		return -1;
+	}
+
+	if (options->num_inputs == 0) {
+		usage(stderr);
+		return EXIT_USAGE;
+	}
+
+	/* Without --jobs, a second argument names the output */
+	if (!options->jobs && options->num_inputs == 2 && !options->output) {
+		options->output = options->inputs[1];
+		options->num_inputs = 1;
+	}
+	if (!options->jobs && options->num_inputs > 1) {
+		bergen_fprintf(stderr, "bergen: too many arguments\n");
+		return EXIT_USAGE;
+	}
+	if (options->output && options->num_inputs > 1) {
+		bergen_fprintf(stderr, "bergen: -o can't be used with several inputs\n");
+		return EXIT_USAGE;
+	}
+	if (options->depend_path && options->num_inputs > 1) {
+		bergen_fprintf(stderr, "bergen: -MF can't be used with several inputs\n");
+		return EXIT_USAGE;
+	}
+	return -1;
+}
+
+void options_destroy(struct options *options)
+{
+	bergen_free(options->inputs);
+	bergen_free(options->include_paths);
+}
+
+/* replace_extension("dir/prog.z80", ".bin") is "dir/prog.bin" */
+static char *replace_extension(const char *path, const char *extension)
+{
+	const char *dot = bergen_strrchr(path, '.'), *slash = bergen_strrchr(path, '/');
+	size_t length = dot && (!slash || dot > slash) ? (size_t) (dot - path) : bergen_strlen(path);
+	char *result = bergen_malloc(length + bergen_strlen(extension) + 1);
+
+	bergen_memcpy(result, path, length);
+	bergen_strcpy(result + length, extension);
+	return result;
+}
+
+/* "prog.bin" becomes "prog.bin.stamp", so that prog.bin and prog.hex don't share one */
+static char *append_extension(const char *path, const char *extension)
+{
+	size_t length = bergen_strlen(path);
+	char *result = bergen_malloc(length + bergen_strlen(extension) + 1);
+
+	bergen_memcpy(result, path, length);
+	bergen_strcpy(result + length, extension);
+	return result;
+}
+
+static void trace_path(uint64_t start, enum trace_category category, const char *path)
+{
+	if (start)
+		trace_end(start, category, path, bergen_strlen(path));
+}
+
+static struct error *write_output(const struct object_output *obj, const char *path, enum output_format format)
+{
+	FILE *file = bergen_fopen(path, "wb");
+	struct error *err;
+	uint64_t start = trace_begin();
+
+	if (!file)
+		return error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+
+	if (format == OUTPUT_FORMAT_INTEL_HEX)
+		err = object_output_write_to_intel_hex(obj, file);
+	else
+		err = object_output_write_to_binary(obj, file);
+
+	if (!err && bergen_ferror(file))
+		err = error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	if (bergen_fclose(file) && !err)
+		err = error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	trace_path(start, TRACE_CATEGORY_OUTPUT, path);
+	return err;
+}
+
+static struct error *write_image(const struct object_output *obj, struct job *job, enum output_format format)
+{
+	FILE *file = bergen_open_memstream(&job->image, &job->image_length);
+	struct error *err;
+	uint64_t start = trace_begin();
+
+	if (!file)
+		return error_create_span_value(ERROR_IO, job->output, bergen_strlen(job->output), errno);
+
+	if (format == OUTPUT_FORMAT_INTEL_HEX)
+		err = object_output_write_to_intel_hex(obj, file);
+	else
+		err = object_output_write_to_binary(obj, file);
+
+	bergen_fclose(file);
+	trace_path(start, TRACE_CATEGORY_OUTPUT, job->output);
+	return err;
+}
+
+/* The dependency file and the stamp, once the output is there */
+static struct error *write_extras(const struct options *options, const struct job *job, uint64_t options_hash, const char *stamp)
+{
+	struct error *err = NULL;
+	char *path = NULL;
+	uint64_t start;
+
+	if (options->depend) {
+		path = options->depend_path ? bergen_strdup(options->depend_path) : replace_extension(job->output, ".d");
+		start = trace_begin();
+		err = depend_write_makefile(&job->files, job->input, path, job->output, options->depend_phony);
+		trace_path(start, TRACE_CATEGORY_OUTPUT, path);
+	}
+	if (!err && stamp) {
+		start = trace_begin();
+		err = depend_write_stamp(&job->files, stamp, options_hash);
+		trace_path(start, TRACE_CATEGORY_OUTPUT, stamp);
+	}
+
+	/* Neither path outlives the job */
+	if (err)
+		error_get_message(err);
+	bergen_free(path);
+	return err;
+}
+
+static void run_job(void *data, size_t index)
+{
+	struct batch *batch = data;
+	const struct options *options = batch->options;
+	struct job *job = &batch->jobs[index];
+	struct include_file *file;
+	struct include_file_list files;
+	struct assembler as;
+	struct arena arena;
+	struct error *err = NULL;
+	struct object_cache_key key;
+	uint64_t options_hash = 0, start = trace_begin(), step;
+	int cached = 0;
+	char *stamp = NULL;
+
+	if (options->if_changed) {
+		stamp = append_extension(job->output, ".stamp");
+		options_hash = depend_options_hash(job->input, job->output, options->format, options->include_paths, options->num_include_paths);
+		if (depend_stamp_is_current(stamp, job->output, options_hash)) {
+			job->skipped = 1;
+			bergen_free(stamp);
+			trace_path(start, TRACE_CATEGORY_JOB, job->input);
+			return;
+		}
+	}
+
+	object_cache_key_init(&key);
+
+	/* Whatever the assembler allocates goes away with it */
+	arena_init(&arena);
+	arena_begin_session(&arena);
+	assembler_init(&as, batch->im);
+	if (options->jobs > options->num_inputs)
+		as.num_threads = options->jobs / options->num_inputs;
+	if (!(job->err = include_manager_load(batch->im, job->input, &file)) && batch->cache) {
+		/* Without a key, the input is assembled as if there were no cache */
+		if ((err = object_cache_make_key(batch->im, file, &as.files, &key))) {
+			error_free(err);
+			include_file_list_clear(&as.files);
+		} else {
+			step = trace_begin();
+			stats_phase_begin(STATS_PHASE_READ);
+			cached = object_cache_load(batch->cache, &key, &as.output, &as.labels);
+			stats_phase_end();
+			trace_end(step, TRACE_CATEGORY_READ, "cache", 5);
+		}
+	}
+	if (!job->err && !cached)
+		job->err = assembler_assemble(&as, file);
+
+	stats_phase_begin(STATS_PHASE_OUTPUT);
+	if (!job->err && !cached && batch->cache && !err) {
+		step = trace_begin();
+		error_free(object_cache_store(batch->cache, &key, &as.output, &as.labels));
+		trace_end(step, TRACE_CATEGORY_OUTPUT, "cache", 5);
+	}
+	object_cache_key_destroy(&key);
+	if (!job->err) {
+		if (batch->in_memory)
+			job->err = write_image(&as.output, job, options->format);
+		else
+			job->err = write_output(&as.output, job->output, options->format);
+	}
+	stats_phase_end();
+
+	/* The error may point into the assembler's lines */
+	if (job->err)
+		error_get_message(job->err);
+
+	files = job->files;
+	job->files = as.files;
+	as.files = files;
+	assembler_destroy(&as);
+	arena_end_session();
+	arena_destroy(&arena);
+
+	if (!job->err) {
+		stats_phase_begin(STATS_PHASE_OUTPUT);
+		job->err = write_extras(options, job, options_hash, stamp);
+		stats_phase_end();
+	}
+	bergen_free(stamp);
+	trace_path(start, TRACE_CATEGORY_JOB, job->input);
+}
+
+char *batch_output_path(const struct options *options, const char *input)
+{
+	if (options->output)
+		return bergen_strdup(options->output);
+	return replace_extension(input, options->format == OUTPUT_FORMAT_INTEL_HEX ? ".hex" : ".bin");
+}
+
+void batch_init(struct batch *batch, const struct options *options, struct include_manager *im, int in_memory)
+{
+	struct job *job;
+	size_t i;
+
+	for (i = 0; i < options->num_include_paths; i++)
+		include_manager_add_search_path(im, options->include_paths[i]);
+
+	batch->options = options;
+	batch->im = im;
+	batch->in_memory = in_memory;
+	batch->cache = NULL;
+	bergen_memset(&batch->stats, 0, sizeof(batch->stats));
+	if (options->cache_dir) {
+		batch->cache = bergen_malloc(sizeof(*batch->cache));
+		object_cache_init(batch->cache, options->cache_dir);
+	}
+	batch->jobs = bergen_malloc(sizeof(*batch->jobs) * options->num_inputs);
+	for (i = 0; i < options->num_inputs; i++) {
+		job = &batch->jobs[i];
+		job->input = options->inputs[i];
+		job->output = batch_output_path(options, job->input);
+		job->err = NULL;
+		include_file_list_init(&job->files);
+		job->skipped = 0;
+		job->image = NULL;
+		job->image_length = 0;
+	}
+}
+
+void batch_destroy(struct batch *batch)
+{
+	struct job *job;
+	size_t i;
+
+	for (i = 0; i < batch->options->num_inputs; i++) {
+		job = &batch->jobs[i];
+		error_free(job->err);
+		include_file_list_destroy(&job->files);
+		bergen_free(job->output);
+		bergen_free_libc(job->image);
+	}
+	bergen_free(batch->jobs);
+	if (batch->cache) {
+		object_cache_destroy(batch->cache);
+		bergen_free(batch->cache);
+	}
+}
+
+static uint64_t elapsed_ns(clockid_t clock, const struct timespec *start)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(clock, &now);
+	return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000u + now.tv_nsec - start->tv_nsec;
+}
+
+void batch_run(struct batch *batch)
+{
+	struct timespec wall, cpu;
+	int stats = batch->options->stats_format != STATS_FORMAT_NONE;
+
+	if (batch->options->trace_path)
+		trace_enable(batch->options->trace_threshold_ns);
+	if (batch->options->profile_top) {
+		profile_enable();
+		profile_reset();
+	}
+
+	if (stats) {
+		stats_enable();
+		stats_reset();
+		bergen_clock_gettime(CLOCK_MONOTONIC, &wall);
+		bergen_clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	}
+
+	thread_pool_run(batch->options->jobs, batch->options->num_inputs, run_job, batch);
+
+	if (stats) {
+		stats_collect(&batch->stats);
+		batch->stats.total_wall_ns = elapsed_ns(CLOCK_MONOTONIC, &wall);
+		batch->stats.total_cpu_ns = elapsed_ns(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	}
+}
+
+int batch_report(const struct batch *batch, FILE *file)
+{
+	int status = EXIT_SUCCESS;
+	size_t i;
+
+	for (i = 0; i < batch->options->num_inputs; i++) {
+		if (batch->jobs[i].err) {
+			error_print(batch->jobs[i].err, &batch->im->sources, file);
+			status = EXIT_FAILURE;
+		}
+	}
+	return status;
+}
+
+void batch_report_stats(const struct batch *batch, FILE *file)
+{
+	if (batch->options->stats_format == STATS_FORMAT_TEXT)
+		stats_print(&batch->stats, file);
+	else if (batch->options->stats_format == STATS_FORMAT_JSON)
+		stats_print_json(&batch->stats, file);
+}
+
+void batch_report_profile(const struct batch *batch, FILE *file)
+{
+	struct profile profile;
+
+	if (!batch->options->profile_top)
+		return;
+
+	profile_init(&profile);
+	profile_collect(&profile);
+	profile_print(&profile, &batch->im->sources, batch->options->profile_top, file);
+	profile_destroy(&profile);
+}
+
+int batch_report_trace(const struct batch *batch)
+{
+	const char *path = batch->options->trace_path;
+	FILE *file;
+	int err;
+
+	if (!path)
+		return EXIT_SUCCESS;
+
+	if (!(file = bergen_fopen(path, "w"))) {
+		bergen_fprintf(stderr, "bergen: %s: %s\n", path, bergen_strerror(errno));
+		return EXIT_FAILURE;
+	}
+	trace_write(file);
+	err = bergen_ferror(file);
+	if (bergen_fclose(file) || err) {
+		bergen_fprintf(stderr, "bergen: %s: %s\n", path, bergen_strerror(errno));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
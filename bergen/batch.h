@@ -0,0 +1,123 @@
+/*
+ * bergen/batch.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_BATCH_H
+#define BERGEN_BATCH_H
+
+#include <bergen/cache.h>
+#include <bergen/error.h>
+#include <bergen/include.h>
+#include <bergen/profile.h>
+#include <bergen/stats.h>
+#include <bergen/trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EXIT_USAGE 2
+
+enum output_format {
+	OUTPUT_FORMAT_BINARY,
+	OUTPUT_FORMAT_INTEL_HEX,
+};
+
+enum stats_format {
+	STATS_FORMAT_NONE,
+	STATS_FORMAT_TEXT,
+	STATS_FORMAT_JSON,
+};
+
+struct options {
+	const char **inputs;
+	size_t num_inputs;
+	const char *output; /* NULL to derive it from the input */
+	enum output_format format;
+	const char **include_paths;
+	size_t num_include_paths;
+	size_t jobs; /* 0 if --jobs wasn't given */
+	int depend; /* -MD */
+	const char *depend_path; /* -MF, NULL to derive it from the output */
+	int depend_phony; /* -MP */
+	int if_changed;
+	const char *cache_dir; /* NULL for no cache */
+	enum stats_format stats_format;
+	size_t profile_top; /* Lines and macros listed by --profile, 0 without it */
+	const char *trace_path; /* NULL for no trace */
+	uint64_t trace_threshold_ns; /* Macro expansions taking less aren't traced */
+
+	int watch;
+	int server;
+	int client;
+	const char *socket_path; /* NULL for the default */
+};
+
+/* Returns -1 if bergen should go on, or the exit code */
+int options_parse(struct options *options, int argc, char **argv);
+
+void options_destroy(struct options *options);
+
+/* Where the output of input goes, which the caller frees */
+char *batch_output_path(const struct options *options, const char *input);
+
+/* Assembling one input, which shares nothing but the include manager */
+struct job {
+	const char *input;
+	char *output;
+	struct error *err;
+	struct include_file_list files; /* Read to assemble input */
+	int skipped; /* Nothing changed since the last time */
+
+	/* Formatted output, if the batch keeps it in memory */
+	char *image;
+	size_t image_length;
+};
+
+struct batch {
+	const struct options *options;
+	struct include_manager *im; /* Not owned */
+	int in_memory; /* Keep outputs in images instead of writing them */
+	struct object_cache *cache; /* NULL if there is no cache */
+	struct job *jobs;
+	struct stats stats; /* Of the last batch_run, with --stats */
+};
+
+/* Also adds the include paths of options to im */
+void batch_init(struct batch *batch, const struct options *options, struct include_manager *im, int in_memory);
+
+void batch_destroy(struct batch *batch);
+
+void batch_run(struct batch *batch);
+
+/* Prints diagnostics in the order of the inputs, and returns the exit code */
+int batch_report(const struct batch *batch, FILE *file);
+
+/* Does nothing without --stats */
+void batch_report_stats(const struct batch *batch, FILE *file);
+
+/* Prints the lines and macros that took longest. Does nothing without --profile. */
+void batch_report_profile(const struct batch *batch, FILE *file);
+
+/* Writes every event traced so far, and returns the exit code. Does nothing without --trace. */
+int batch_report_trace(const struct batch *batch);
+
+#endif /* BERGEN_BATCH_H */
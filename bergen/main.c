@@ -21,7 +21,51 @@
  * THE SOFTWARE.
  */
 
+#include "batch.h"
+#include "server.h"
+#include "watch.h"
+
+#include <bergen/libc.h>
+
+static int run_local(const struct options *options)
+{
+	struct include_manager im;
+	struct batch batch;
+	int status;
+
+	include_manager_init(&im);
+	batch_init(&batch, options, &im, 0);
+	batch_run(&batch);
+	status = batch_report(&batch, stderr);
+	batch_report_stats(&batch, stdout);
+	batch_report_profile(&batch, stdout);
+	if (batch_report_trace(&batch) != EXIT_SUCCESS)
+		status = EXIT_FAILURE;
+	batch_destroy(&batch);
+	include_manager_destroy(&im);
+	return status;
+}
+
 int main(int argc, char **argv)
 {
-	return 0;
+	struct options options;
+	int status;
+
+	if ((status = options_parse(&options, argc, argv)) >= 0) {
+		options_destroy(&options);
+		return status;
+	}
+
+	if (options.watch)
+		status = watch_run(&options);
+	else if (options.server)
+		status = server_run(&options);
+	else if (!options.client || (status = client_run(&options, argc, argv)) < 0)
+		status = run_local(&options);
+
+	stats_disable();
+	trace_disable();
+	profile_disable();
+	options_destroy(&options);
+	return status;
 }
@@ -0,0 +1,468 @@
+/*
+ * bergen/server.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* For struct ucred */
+#endif
+
+#include "server.h"
+
+#include <bergen/libc.h>
+
+/*
+ * Everything on the socket is a record: a type byte, a 32 bit big endian
+ * length and that many bytes. A request is one RECORD_ARG for the working
+ * directory and one for each argument, then RECORD_RUN. The response is a
+ * RECORD_OUTPUT for each output ("path\0data"), RECORD_DIAGNOSTICS if there
+ * are any and RECORD_EXIT with the exit code as its only byte.
+ */
+enum record_type {
+	RECORD_ARG = 'a',
+	RECORD_RUN = 'r',
+	RECORD_OUTPUT = 'o',
+	RECORD_DIAGNOSTICS = 'e',
+	RECORD_EXIT = 'x',
+};
+
+#define RECORD_HEADER_LENGTH 5
+#define MAX_REQUEST_RECORD_LENGTH (1 << 20)
+#define MAX_RESPONSE_RECORD_LENGTH (1 << 30)
+
+static volatile sig_atomic_t stopping;
+
+static int write_all(int fd, const void *buf, size_t length)
+{
+	const char *ptr = buf;
+	ssize_t written;
+
+	while (length > 0) {
+		if ((written = bergen_write(fd, ptr, length)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		ptr += written;
+		length -= written;
+	}
+	return 1;
+}
+
+static int read_all(int fd, void *buf, size_t length)
+{
+	char *ptr = buf;
+	ssize_t got;
+
+	while (length > 0) {
+		if ((got = bergen_read(fd, ptr, length)) <= 0) {
+			if (got < 0 && errno == EINTR)
+				continue;
+			return 0;
+		}
+		ptr += got;
+		length -= got;
+	}
+	return 1;
+}
+
+static int send_record(int fd, enum record_type type, const void *data, size_t length)
+{
+	unsigned char header[RECORD_HEADER_LENGTH];
+
+	header[0] = type;
+	header[1] = length >> 24;
+	header[2] = length >> 16;
+	header[3] = length >> 8;
+	header[4] = length;
+	return write_all(fd, header, sizeof(header)) && write_all(fd, data, length);
+}
+
+/* The payload is NUL terminated for convenience, NULL on EOF or garbage */
+static char *receive_record(int fd, enum record_type *type, size_t *length, size_t max_length)
+{
+	unsigned char header[RECORD_HEADER_LENGTH];
+	char *payload;
+
+	if (!read_all(fd, header, sizeof(header)))
+		return NULL;
+	*type = header[0];
+	*length = (size_t) header[1] << 24 | (size_t) header[2] << 16 | (size_t) header[3] << 8 | header[4];
+	if (*length > max_length)
+		return NULL;
+
+	payload = bergen_malloc(*length + 1);
+	if (!read_all(fd, payload, *length)) {
+		bergen_free(payload);
+		return NULL;
+	}
+	payload[*length] = '\0';
+	return payload;
+}
+
+/* Somewhere only we can get into, so that nobody else can put a socket there first */
+static int private_directory(const char *path)
+{
+	struct stat st;
+
+	if (bergen_mkdir(path, 0700) && errno != EEXIST) {
+		bergen_fprintf(stderr, "bergen: %s: %s\n", path, bergen_strerror(errno));
+		return 0;
+	}
+	if (bergen_lstat(path, &st) || !S_ISDIR(st.st_mode) || st.st_uid != bergen_getuid() || (st.st_mode & 077)) {
+		bergen_fprintf(stderr, "bergen: %s isn't a directory that only you can use\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+/* The default is bergen.sock in $XDG_RUNTIME_DIR, or in /tmp/bergen-UID without it */
+static int socket_address(const struct options *options, struct sockaddr_un *addr)
+{
+	const char *runtime_dir = bergen_getenv("XDG_RUNTIME_DIR");
+	char dir[sizeof(addr->sun_path)];
+	int length;
+
+	bergen_memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (options->socket_path) {
+		length = bergen_snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", options->socket_path);
+	} else {
+		if (runtime_dir && runtime_dir[0])
+			length = bergen_snprintf(dir, sizeof(dir), "%s", runtime_dir);
+		else
+			length = bergen_snprintf(dir, sizeof(dir), "/tmp/bergen-%u", (unsigned int) bergen_getuid());
+		if (length >= 0 && (size_t) length < sizeof(dir) && !private_directory(dir))
+			return 0;
+		length = bergen_snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/bergen.sock", dir);
+	}
+
+	if (length < 0 || (size_t) length >= sizeof(addr->sun_path)) {
+		bergen_fprintf(stderr, "bergen: socket path is too long\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* Whoever is on the other end of fd has to be running as us */
+static int peer_is_us(int fd)
+{
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t length = sizeof(cred);
+
+	if (bergen_getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) || length != sizeof(cred))
+		return 0;
+	return cred.uid == bergen_getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+	if (bergen_getpeereid(fd, &uid, &gid))
+		return 0;
+	return uid == bergen_getuid();
+#endif
+}
+
+static int connect_to(const struct sockaddr_un *addr)
+{
+	int fd = bergen_socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+	if (bergen_connect(fd, (const struct sockaddr *) addr, sizeof(*addr))) {
+		bergen_close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int listen_on(const struct sockaddr_un *addr)
+{
+	int fd;
+
+	/* A socket nobody answers on is left over from a server that died */
+	if ((fd = connect_to(addr)) >= 0) {
+		bergen_close(fd);
+		bergen_fprintf(stderr, "bergen: a server is already running on %s\n", addr->sun_path);
+		return -1;
+	}
+	bergen_unlink(addr->sun_path);
+
+	if ((fd = bergen_socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || bergen_bind(fd, (const struct sockaddr *) addr, sizeof(*addr))
+	    || bergen_listen(fd, 16)) {
+		bergen_fprintf(stderr, "bergen: %s: %s\n", addr->sun_path, bergen_strerror(errno));
+		if (fd >= 0)
+			bergen_close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void send_diagnostic(int fd, const char *fmt, const char *arg)
+{
+	char buf[PATH_MAX + 256];
+	int length = bergen_snprintf(buf, sizeof(buf), fmt, arg);
+
+	if (length > 0)
+		send_record(fd, RECORD_DIAGNOSTICS, buf, (size_t) length < sizeof(buf) ? (size_t) length : sizeof(buf) - 1);
+}
+
+static int send_outputs(int fd, const struct batch *batch)
+{
+	const struct job *job;
+	size_t i, path_length;
+	char *buf;
+	int ok = 1;
+
+	for (i = 0; ok && i < batch->options->num_inputs; i++) {
+		job = &batch->jobs[i];
+		if (job->err || !job->image)
+			continue;
+
+		path_length = bergen_strlen(job->output) + 1;
+		buf = bergen_malloc(path_length + job->image_length);
+		bergen_memcpy(buf, job->output, path_length);
+		bergen_memcpy(buf + path_length, job->image, job->image_length);
+		ok = send_record(fd, RECORD_OUTPUT, buf, path_length + job->image_length);
+		bergen_free(buf);
+	}
+	return ok;
+}
+
+static int assemble_request(int fd, struct include_manager *im, const struct options *server_options, int argc, char **argv)
+{
+	struct options options;
+	struct batch batch;
+	char *diagnostics = NULL;
+	size_t length = 0;
+	FILE *file;
+	int status;
+
+	if ((status = options_parse(&options, argc, argv)) >= 0) {
+		options_destroy(&options);
+		return status;
+	}
+	if (options.server) {
+		options_destroy(&options);
+		send_diagnostic(fd, "bergen: %s can't be sent to a server\n", "--server");
+		return EXIT_USAGE;
+	}
+	if (!options.jobs)
+		options.jobs = server_options->jobs;
+
+	/* Paths are looked at afresh, but unchanged files are kept */
+	include_manager_reset(im);
+	batch_init(&batch, &options, im, 1);
+	batch_run(&batch);
+
+	if ((file = bergen_open_memstream(&diagnostics, &length))) {
+		status = batch_report(&batch, file);
+		bergen_fclose(file);
+	} else {
+		status = EXIT_FAILURE;
+	}
+
+	if (send_outputs(fd, &batch) && length > 0)
+		send_record(fd, RECORD_DIAGNOSTICS, diagnostics, length);
+
+	bergen_free_libc(diagnostics);
+	batch_destroy(&batch);
+	options_destroy(&options);
+	return status;
+}
+
+static void serve(int fd, struct include_manager *im, const struct options *server_options)
+{
+	char **args = NULL, *payload;
+	size_t num_args = 0, args_buffer_size = 0, length, i;
+	enum record_type type;
+	unsigned char status;
+
+	/* args[0] is the working directory, which stands in for argv[0] too */
+	while ((payload = receive_record(fd, &type, &length, MAX_REQUEST_RECORD_LENGTH))) {
+		if (type != RECORD_ARG) {
+			bergen_free(payload);
+			break;
+		}
+		if (num_args >= args_buffer_size) {
+			args_buffer_size = args_buffer_size ? args_buffer_size * 2 : 16;
+			args = bergen_realloc(args, sizeof(*args) * (args_buffer_size + 1));
+		}
+		args[num_args++] = payload;
+	}
+
+	if (payload && type == RECORD_RUN && num_args > 0) {
+		if (bergen_chdir(args[0])) {
+			send_diagnostic(fd, "bergen: can't enter %s\n", args[0]);
+			status = EXIT_FAILURE;
+		} else {
+			args[num_args] = NULL;
+			status = assemble_request(fd, im, server_options, num_args, args);
+		}
+		send_record(fd, RECORD_EXIT, &status, 1);
+	}
+
+	for (i = 0; i < num_args; i++)
+		bergen_free(args[i]);
+	bergen_free(args);
+}
+
+static void stop(int sig)
+{
+	(void) sig;
+	stopping = 1;
+}
+
+int server_run(const struct options *options)
+{
+	struct sockaddr_un addr;
+	struct include_manager im;
+	struct sigaction sa;
+	int fd, client;
+
+	if (!socket_address(options, &addr) || (fd = listen_on(&addr)) < 0)
+		return EXIT_FAILURE;
+
+	/* No SA_RESTART, so that accept() gives up when told to stop */
+	sa.sa_handler = stop;
+	bergen_sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	bergen_sigaction(SIGINT, &sa, NULL);
+	bergen_sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	bergen_sigaction(SIGPIPE, &sa, NULL);
+
+	include_manager_init(&im);
+	while (!stopping) {
+		if ((client = bergen_accept(fd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			bergen_fprintf(stderr, "bergen: accept(): %s\n", bergen_strerror(errno));
+			break;
+		}
+		if (peer_is_us(client))
+			serve(client, &im, options);
+		else
+			bergen_fprintf(stderr, "bergen: turned away a client running as another user\n");
+		bergen_close(client);
+	}
+	include_manager_destroy(&im);
+
+	bergen_close(fd);
+	bergen_unlink(addr.sun_path);
+	return stopping ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Only outputs that a local run would have written are accepted */
+static int write_received_output(const char *payload, size_t length, char **outputs, size_t num_outputs)
+{
+	size_t path_length = bergen_strlen(payload), i;
+	struct error *err = NULL;
+	FILE *file;
+
+	if (path_length >= length)
+		return 0;
+	for (i = 0; i < num_outputs && bergen_strcmp(outputs[i], payload); i++)
+		;
+	if (i == num_outputs) {
+		bergen_fprintf(stderr, "bergen: the server sent %s, which isn't an output\n", payload);
+		return 0;
+	}
+
+	/* Reported just like a local run would */
+	if (!(file = bergen_fopen(payload, "wb"))) {
+		err = error_create_span_value(ERROR_IO, payload, path_length, errno);
+	} else {
+		bergen_fwrite(payload + path_length + 1, 1, length - path_length - 1, file);
+		if (bergen_ferror(file))
+			err = error_create_span_value(ERROR_IO, payload, path_length, errno);
+		if (bergen_fclose(file) && !err)
+			err = error_create_span_value(ERROR_IO, payload, path_length, errno);
+	}
+
+	if (err) {
+		error_print(err, NULL, stderr);
+		error_free(err);
+		return 0;
+	}
+	return 1;
+}
+
+int client_run(const struct options *options, int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	char cwd[PATH_MAX], *payload, **outputs;
+	enum record_type type;
+	size_t length, j;
+	int fd, i, status = -1, ok = 1;
+
+	if (!socket_address(options, &addr) || !bergen_getcwd(cwd, sizeof(cwd)) || (fd = connect_to(&addr)) < 0)
+		return -1;
+	if (!peer_is_us(fd)) {
+		bergen_fprintf(stderr, "bergen: the server on %s is running as another user\n", addr.sun_path);
+		bergen_close(fd);
+		return -1;
+	}
+
+	/* The server works in cwd too, so it comes up with the same paths */
+	outputs = bergen_malloc(sizeof(*outputs) * options->num_inputs);
+	for (j = 0; j < options->num_inputs; j++)
+		outputs[j] = batch_output_path(options, options->inputs[j]);
+
+	ok = send_record(fd, RECORD_ARG, cwd, bergen_strlen(cwd));
+	for (i = 1; ok && i < argc; i++)
+		ok = send_record(fd, RECORD_ARG, argv[i], bergen_strlen(argv[i]));
+	if (ok)
+		ok = send_record(fd, RECORD_RUN, NULL, 0);
+
+	while (ok && status < 0 && (payload = receive_record(fd, &type, &length, MAX_RESPONSE_RECORD_LENGTH))) {
+		switch (type) {
+		case RECORD_OUTPUT:
+			ok = write_received_output(payload, length, outputs, options->num_inputs);
+			break;
+
+		case RECORD_DIAGNOSTICS:
+			bergen_fwrite(payload, 1, length, stderr);
+			break;
+
+		case RECORD_EXIT:
+			status = length == 1 ? (unsigned char) payload[0] : EXIT_FAILURE;
+			break;
+
+		default:
+			break;
+		}
+		bergen_free(payload);
+	}
+	bergen_close(fd);
+
+	for (j = 0; j < options->num_inputs; j++)
+		bergen_free(outputs[j]);
+	bergen_free(outputs);
+
+	if (ok && status < 0)
+		bergen_fprintf(stderr, "bergen: lost the connection to the server\n");
+	if (!ok || status < 0)
+		return EXIT_FAILURE;
+	return status;
+}
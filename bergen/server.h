@@ -0,0 +1,46 @@
+/*
+ * bergen/server.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_SERVER_H
+#define BERGEN_SERVER_H
+
+#include "batch.h"
+
+/*
+ * The server keeps one include manager for its whole life, so includes are
+ * only read again once they change. Clients send their working directory
+ * and command line, and get back every output and diagnostic, which they
+ * write out themselves. Requests are handled one at a time, each one
+ * running its inputs on --jobs threads like a local batch would.
+ */
+
+/* Runs until SIGINT or SIGTERM, and returns the exit code */
+int server_run(const struct options *options);
+
+/*
+ * Has the server assemble argv, which options was parsed from, and returns
+ * the exit code. Returns -1 if there is no server to connect to.
+ */
+int client_run(const struct options *options, int argc, char **argv);
+
+#endif /* BERGEN_SERVER_H */
@@ -0,0 +1,227 @@
+/*
+ * bergen/watch.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "watch.h"
+
+#include <bergen/libc.h>
+
+#ifdef __linux__
+
+/* Edits often land a few writes or a rename apart, so wait for them all */
+#define SETTLE_MS 30
+
+/*
+ * Directories are watched rather than files, because editors often save by
+ * writing a new file and renaming it over the old one.
+ */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM)
+
+struct watch_target {
+	int wd;
+	char *name; /* File name within the watched directory */
+};
+
+struct watcher {
+	int fd;
+	struct watch_target *targets;
+	size_t targets_buffer_size; /* Number of targets in buffer */
+	size_t num_targets;
+};
+
+static int watcher_init(struct watcher *watcher)
+{
+	if ((watcher->fd = bergen_inotify_init()) < 0) {
+		bergen_fprintf(stderr, "bergen: inotify_init(): %s\n", bergen_strerror(errno));
+		return 0;
+	}
+	watcher->targets_buffer_size = 16;
+	watcher->targets = bergen_malloc(sizeof(*watcher->targets) * watcher->targets_buffer_size);
+	watcher->num_targets = 0;
+	return 1;
+}
+
+static void watcher_destroy(struct watcher *watcher)
+{
+	size_t i;
+
+	for (i = 0; i < watcher->num_targets; i++)
+		bergen_free(watcher->targets[i].name);
+	bergen_free(watcher->targets);
+	bergen_close(watcher->fd);
+}
+
+static int watcher_find(const struct watcher *watcher, int wd, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < watcher->num_targets; i++) {
+		if (watcher->targets[i].wd == wd && !bergen_strcmp(watcher->targets[i].name, name))
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns 1 if path wasn't watched before */
+static int watcher_add(struct watcher *watcher, const char *path)
+{
+	const char *slash = bergen_strrchr(path, '/');
+	char *dir;
+	int wd;
+
+	if (!slash)
+		dir = bergen_strdup(".");
+	else if (slash == path)
+		dir = bergen_strdup("/");
+	else
+		dir = bergen_strndup_null(path, slash - path);
+	wd = bergen_inotify_add_watch(watcher->fd, dir, WATCH_EVENTS);
+	bergen_free(dir);
+
+	path = slash ? slash + 1 : path;
+	if (wd < 0 || watcher_find(watcher, wd, path))
+		return 0;
+
+	if (watcher->num_targets >= watcher->targets_buffer_size) {
+		watcher->targets_buffer_size *= 2;
+		watcher->targets = bergen_realloc(watcher->targets, sizeof(*watcher->targets) * watcher->targets_buffer_size);
+	}
+	watcher->targets[watcher->num_targets].wd = wd;
+	watcher->targets[watcher->num_targets].name = bergen_strdup(path);
+	watcher->num_targets++;
+	return 1;
+}
+
+/* Returns 1 if a watched file changed, 0 if reading events failed */
+static int watcher_read(const struct watcher *watcher, int *changed)
+{
+	union {
+		struct inotify_event event;
+		char buf[4096];
+	} events;
+	const struct inotify_event *event;
+	ssize_t length;
+	const char *ptr;
+
+	if ((length = bergen_read(watcher->fd, events.buf, sizeof(events.buf))) <= 0)
+		return errno == EINTR;
+
+	for (ptr = events.buf; ptr < events.buf + length; ptr += sizeof(*event) + event->len) {
+		event = (const struct inotify_event *) ptr;
+		if (event->len > 0 && watcher_find(watcher, event->wd, event->name))
+			*changed = 1;
+	}
+	return 1;
+}
+
+static int watcher_wait(const struct watcher *watcher)
+{
+	struct pollfd pfd;
+	int changed = 0;
+
+	while (!changed) {
+		if (!watcher_read(watcher, &changed))
+			return 0;
+	}
+
+	/* Then let the rest of the edit arrive */
+	pfd.fd = watcher->fd;
+	pfd.events = POLLIN;
+	while (bergen_poll(&pfd, 1, SETTLE_MS) > 0) {
+		if (!watcher_read(watcher, &changed))
+			return 0;
+	}
+	return 1;
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/*
+ * The watcher lives across rebuilds, so saves made during a build are
+ * waiting for it afterwards. Files only watched once a build has read them
+ * are checked by hand instead. Nothing is ever unwatched, which at worst
+ * costs a rebuild when a file that is no longer included changes.
+ */
+int watch_run(const struct options *options)
+{
+	struct include_manager im;
+	struct batch batch;
+	struct watcher watcher;
+	struct timespec start;
+	const struct job *job;
+	char canonical[PATH_MAX];
+	size_t i, j;
+	int watching = 1, stale;
+
+	if (!watcher_init(&watcher))
+		return EXIT_FAILURE;
+	/* Under the canonical name that the include manager will give them */
+	for (i = 0; i < options->num_inputs; i++)
+		watcher_add(&watcher, bergen_realpath(options->inputs[i], canonical) ? canonical : options->inputs[i]);
+
+	include_manager_init(&im);
+	while (watching) {
+		bergen_clock_gettime(CLOCK_MONOTONIC, &start);
+		include_manager_reset(&im);
+		batch_init(&batch, options, &im, 0);
+		batch_run(&batch);
+		batch_report(&batch, stderr);
+		batch_report_stats(&batch, stdout);
+		batch_report_profile(&batch, stdout);
+		bergen_fflush(stdout);
+		/* The trace covers every rebuild so far */
+		batch_report_trace(&batch);
+
+		stale = 0;
+		for (i = 0; i < options->num_inputs; i++) {
+			job = &batch.jobs[i];
+			for (j = 0; j < job->files.num_files; j++) {
+				if (watcher_add(&watcher, job->files.files[j]->path) && !include_file_is_current(job->files.files[j]))
+					stale = 1;
+			}
+		}
+		bergen_fprintf(stderr, "bergen: assembled in %.1f ms, watching %lu files\n", elapsed_ms(&start), (unsigned long) watcher.num_targets);
+		batch_destroy(&batch);
+
+		watching = stale || watcher_wait(&watcher);
+	}
+	include_manager_destroy(&im);
+	watcher_destroy(&watcher);
+	return EXIT_FAILURE;
+}
+
+#else /* __linux__ */
+
+int watch_run(const struct options *options)
+{
+	(void) options;
+	bergen_fprintf(stderr, "bergen: --watch needs inotify, which this system doesn't have\n");
+	return EXIT_FAILURE;
+}
+
+#endif /* __linux__ */
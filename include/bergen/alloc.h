@@ -0,0 +1,102 @@
+/*
+ * include/bergen/alloc.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_ALLOC_H
+#define BERGEN_ALLOC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Built with BERGEN_ALLOC_STATS defined, bergen_malloc, bergen_realloc and
+ * bergen_free count every allocation under the tag of the file it was made
+ * in. A file picks its tag by defining BERGEN_ALLOC_TAG before its first
+ * #include; the others are ALLOC_TAG_OTHER. BERGEN_ARENA sends them through
+ * here too, see arena.h. Otherwise they are plain libc.
+ */
+#ifdef BERGEN_ALLOC_STATS
+#define ALLOC_ACCOUNTING 1
+#else
+#define ALLOC_ACCOUNTING 0
+#endif
+
+#if defined(BERGEN_ALLOC_STATS) || defined(BERGEN_ARENA)
+#define BERGEN_ALLOC_HOOKS
+#endif
+
+enum alloc_tag {
+	ALLOC_TAG_OTHER,
+	ALLOC_TAG_LABELS,
+	ALLOC_TAG_TOKENS,
+	ALLOC_TAG_MACROS,
+	ALLOC_TAG_OBJECT,
+	ALLOC_TAG_ERRORS,
+	ALLOC_TAG_FILES,
+
+	ALLOC_NUM_TAGS,
+};
+
+/* Bucket i holds sizes up to 16 << i, the last one everything bigger */
+#define ALLOC_NUM_BUCKETS 13
+
+struct alloc_tag_stats {
+	uint64_t allocs;
+	uint64_t reallocs;
+	uint64_t frees;
+	uint64_t bytes; /* Asked for by allocs and reallocs */
+	uint64_t live;
+	uint64_t peak_live;
+	uint64_t sizes[ALLOC_NUM_BUCKETS];
+};
+
+struct alloc_stats {
+	struct alloc_tag_stats tags[ALLOC_NUM_TAGS];
+	uint64_t live;
+	uint64_t peak_live;
+};
+
+void *alloc_malloc(enum alloc_tag tag, size_t size);
+
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size);
+
+void alloc_free(void *ptr);
+
+char *alloc_strdup(enum alloc_tag tag, const char *s);
+
+char *alloc_strndup(enum alloc_tag tag, const char *s, size_t n);
+
+char *alloc_strndup_null(enum alloc_tag tag, const char *s, size_t n);
+
+/* Everything since the process started, all zeroes without accounting */
+void alloc_collect(struct alloc_stats *stats);
+
+/* Starts the peaks over from what is live now */
+void alloc_reset_peak(void);
+
+void alloc_print(const struct alloc_stats *stats, FILE *file);
+
+/* A JSON object, without a newline so it can go inside another */
+void alloc_print_json(const struct alloc_stats *stats, FILE *file);
+
+#endif /* BERGEN_ALLOC_H */
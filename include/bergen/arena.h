@@ -0,0 +1,68 @@
+/*
+ * include/bergen/arena.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_ARENA_H
+#define BERGEN_ARENA_H
+
+#include <stdlib.h>
+
+struct arena_chunk;
+
+/*
+ * A region that memory is bumped out of and given back all at once. Only
+ * the most recent allocation can be resized or given back on its own, which
+ * is enough for the lists that come and go with each line.
+ *
+ * Built with BERGEN_ARENA defined, bergen_malloc takes labels, tokens,
+ * macros and object output from the arena the thread is in, if any, and
+ * bergen_free of them does nothing else. Those only live as long as an
+ * assembly, which is what a session is meant to cover.
+ */
+struct arena {
+	struct arena_chunk *chunks; /* Newest first */
+	char *next, *end; /* Free space in the newest chunk */
+	size_t chunk_size; /* Of the next chunk */
+};
+
+void arena_init(struct arena *arena);
+
+/* Frees everything allocated from arena */
+void arena_destroy(struct arena *arena);
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* Returns 1 if ptr was the most recent allocation, and now has size bytes */
+int arena_resize(struct arena *arena, void *ptr, size_t old_size, size_t size);
+
+/* Does nothing unless ptr is the most recent allocation */
+void arena_release(struct arena *arena, void *ptr, size_t size);
+
+/* Sessions don't nest; arena must outlive the session */
+void arena_begin_session(struct arena *arena);
+
+void arena_end_session(void);
+
+/* The arena of the calling thread's session, or NULL */
+struct arena *arena_current(void);
+
+#endif /* BERGEN_ARENA_H */
@@ -0,0 +1,166 @@
+/*
+ * include/bergen/assembler.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_ASSEMBLER_H
+#define BERGEN_ASSEMBLER_H
+
+#include <bergen/error.h>
+#include <bergen/expression.h>
+#include <bergen/include.h>
+#include <bergen/label.h>
+#include <bergen/object.h>
+#include <bergen/stream.h>
+#include <bergen/types.h>
+#include <bergen/z80.h>
+
+#include <stdlib.h>
+
+#define ASSEMBLER_MAX_OPERANDS 4
+#define ASSEMBLER_NO_PROGRAM ((size_t) -1)
+
+enum assembler_fixup_type {
+	ASSEMBLER_FIXUP_TYPE_BYTE, /* .db and .fill */
+	ASSEMBLER_FIXUP_TYPE_WORD,
+	ASSEMBLER_FIXUP_TYPE_INSTRUCTION, /* Encoded again, with every operand */
+};
+
+/* Output written before a label it uses was defined, patched at the end of pass 1 */
+struct assembler_fixup {
+	enum assembler_fixup_type type;
+	size_t offset; /* In the output's buffer */
+	size_t count; /* Times the byte is written, for .fill */
+	expr_value address; /* Of the line */
+	struct source_location location; /* Of the line */
+	size_t region; /* Scope of the local labels */
+
+	char mnemonic[Z80_MAX_MNEMONIC_LENGTH];
+	size_t mnemonic_length;
+	struct z80_operand operands[ASSEMBLER_MAX_OPERANDS];
+	size_t num_operands;
+
+	size_t first_program; /* In the assembler's fixup_programs */
+	size_t num_programs;
+};
+
+struct assembler_fixup_program {
+	size_t operand; /* Index in the fixup's operands, 0 for data */
+	struct expr_program program;
+};
+
+enum assembler_record_type {
+	ASSEMBLER_RECORD_TYPE_LABEL, /* At the address */
+	ASSEMBLER_RECORD_TYPE_EQU,
+	ASSEMBLER_RECORD_TYPE_ORG,
+	ASSEMBLER_RECORD_TYPE_BLOCK,
+	ASSEMBLER_RECORD_TYPE_FILL, /* value times byte */
+	ASSEMBLER_RECORD_TYPE_DATA, /* Bytes of record_data, instructions included */
+};
+
+/*
+ * What a line of the first pass did, kept for the second one. Values that
+ * depend on what the second pass may change are programs, evaluated again
+ * then.
+ */
+struct assembler_record {
+	enum assembler_record_type type;
+	size_t program; /* Of the value, ASSEMBLER_NO_PROGRAM if it's a constant */
+	expr_value value;
+	uint8_t byte; /* FILL */
+	size_t data; /* In record_data, the bytes of DATA or the name of LABEL and EQU */
+	size_t length; /* The second pass sets it to the count of FILL */
+	size_t offset; /* In the output, where the second pass put FILL and DATA */
+	size_t first_fixup; /* That patch the output of FILL and DATA */
+	size_t num_fixups;
+};
+
+/*
+ * Assembles a program in one pass over the line stream when it can. Lengths
+ * never depend on operand values, so an operand that refers to a label not
+ * defined yet is written as 0 and compiled into a fixup, which is patched once
+ * every label is known. Only an .equ that refers forward needs a second pass:
+ * lines after it may have used its value before it was right. From that line
+ * on, the first pass records what each line does, and the second pass goes
+ * over the records with the labels of the first instead of reading, expanding
+ * and lexing the source again. Only values that depend on the .equ, or on
+ * addresses it may move, are kept as programs; the rest are already right.
+ *
+ * The second pass only works out addresses and labels, and makes room in
+ * the output for each record. Once every label is known the bytes of each
+ * line can be worked out on their own, so the fixups and records are then
+ * encoded in chunks on up to num_threads threads, each into its own part of
+ * the output.
+ */
+struct assembler {
+	struct include_manager *im; /* Not owned */
+	char local_label_char;
+	size_t num_threads; /* 1 unless set after assembler_init() */
+
+	struct label_list labels;
+
+	/* Local labels are scoped to the lines between two global labels */
+	struct label_list *local_labels;
+	size_t local_labels_buffer_size; /* Number of lists in buffer */
+	size_t num_local_labels;
+	size_t region; /* Index in local_labels of the current scope */
+
+	struct object_output output;
+	struct include_file_list files; /* Every file read, the one assembled first */
+
+	struct assembler_fixup *fixups;
+	size_t fixups_buffer_size; /* Number of fixups in buffer */
+	size_t num_fixups;
+	struct assembler_fixup_program *fixup_programs;
+	size_t fixup_programs_buffer_size; /* Number of programs in buffer */
+	size_t num_fixup_programs;
+	size_t fixup_operand; /* Operand being evaluated, for its program */
+
+	struct assembler_record *records;
+	size_t records_buffer_size; /* Number of records in buffer */
+	size_t num_records;
+	uint8_t *record_data;
+	size_t record_data_buffer_size;
+	size_t record_data_length;
+	expr_value record_address; /* Where the records start */
+	size_t record_region;
+	size_t record_fixup; /* The first fixup made while recording */
+
+	/* What the second pass may give other values, so is kept as programs */
+	struct label_list changing_labels; /* Global labels, with any value */
+	int local_labels_change;
+	int address_changes;
+
+	/* State of the current pass */
+	int pass;
+	expr_value address;
+	int ended; /* .end was seen */
+	int needs_second_pass; /* An .equ referred forward, lines are recorded from it on */
+};
+
+void assembler_init(struct assembler *as, struct include_manager *im);
+
+void assembler_destroy(struct assembler *as);
+
+/* Runs one or two passes over file, leaving the result in as->output */
+struct error *assembler_assemble(struct assembler *as, const struct include_file *file);
+
+#endif /* BERGEN_ASSEMBLER_H */
@@ -0,0 +1,77 @@
+/*
+ * include/bergen/cache.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_CACHE_H
+#define BERGEN_CACHE_H
+
+#include <bergen/error.h>
+#include <bergen/include.h>
+#include <bergen/label.h>
+#include <bergen/object.h>
+
+#include <stdint.h>
+
+/*
+ * A directory of assembled programs, keyed by a hash of what the assembler
+ * would see after preprocessing. The same code reached through different
+ * paths, worktrees or branches has the same key, so it is only assembled
+ * once. Entries are written to a temporary file and renamed into place, so
+ * any number of processes may share a cache.
+ */
+struct object_cache {
+	char *dir;
+};
+
+void object_cache_init(struct object_cache *cache, const char *dir);
+
+void object_cache_destroy(struct object_cache *cache);
+
+/*
+ * The hash names the entry, and the data it was made from is stored in the
+ * entry too, so that a hit is checked against the input and two programs
+ * with the same hash can't be mixed up.
+ */
+struct object_cache_key {
+	uint64_t hash;
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+void object_cache_key_init(struct object_cache_key *key);
+
+void object_cache_key_destroy(struct object_cache_key *key);
+
+/*
+ * Preprocesses file to find its key, adding every file read to files if it
+ * isn't NULL. This is much cheaper than assembling, but not free.
+ */
+struct error *object_cache_make_key(struct include_manager *im, const struct include_file *file, struct include_file_list *files, struct object_cache_key *key);
+
+/* Returns 1 and fills output and labels if key is in the cache */
+int object_cache_load(const struct object_cache *cache, const struct object_cache_key *key, struct object_output *output, struct label_list *labels);
+
+/* Only labels of type LABEL_TYPE_LABEL are stored */
+struct error *object_cache_store(const struct object_cache *cache, const struct object_cache_key *key, const struct object_output *output, const struct label_list *labels);
+
+#endif /* BERGEN_CACHE_H */
@@ -0,0 +1,56 @@
+/*
+ * include/bergen/depend.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_DEPEND_H
+#define BERGEN_DEPEND_H
+
+#include <bergen/error.h>
+#include <bergen/include.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Escapes the spaces, '#', '$' and ':' that make would treat specially */
+void depend_write_escaped(FILE *file, const char *path);
+
+/*
+ * Writes a makefile rule making target depend on input and every other file
+ * read, which start with the input itself. With phony, every include also
+ * gets a rule of its own, so make doesn't stop when one is deleted.
+ */
+struct error *depend_write_makefile(const struct include_file_list *files, const char *input, const char *path, const char *target, int phony);
+
+/* Covers everything besides the files read which decides an output */
+uint64_t depend_options_hash(const char *input, const char *output, int format, const char *const *include_paths, size_t num_include_paths);
+
+/*
+ * A stamp lists every file read with a hash of its contents, and the hash
+ * of the options. An output is current if it is there and the stamp still
+ * matches. A file newly created where an #include would now find it first
+ * goes unnoticed, like it would with a makefile rule.
+ */
+int depend_stamp_is_current(const char *path, const char *output, uint64_t options_hash);
+
+struct error *depend_write_stamp(const struct include_file_list *files, const char *path, uint64_t options_hash);
+
+#endif /* BERGEN_DEPEND_H */
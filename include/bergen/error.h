@@ -24,21 +24,93 @@
 #ifndef BERGEN_ERROR_H
 #define BERGEN_ERROR_H
 
-#include <stdarg.h>
+#include <bergen/source.h>
+#include <bergen/types.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+
+enum error_code {
+	ERROR_FSEEK,				/* value: errno */
+	ERROR_UNEXPECTED_RPAREN,
+	ERROR_INVALID_BINARY_CONSTANT,		/* span: constant */
+	ERROR_INVALID_OCTAL_CONSTANT,		/* span: constant */
+	ERROR_INVALID_DECIMAL_CONSTANT,		/* span: constant */
+	ERROR_INVALID_HEXADECIMAL_CONSTANT,	/* span: constant */
+	ERROR_INVALID_CONSTANT_PREFIX,		/* value: character */
+	ERROR_INVALID_CONSTANT_SUFFIX,		/* value: character */
+	ERROR_LABEL_NOT_FOUND,			/* span: label name */
+	ERROR_INVALID_BINARY_OPERATOR,		/* span: operator */
+	ERROR_UNEXPECTED_CHAR_EXPR_BEGIN,	/* value: character */
+	ERROR_EXPECTED_EXPRESSION,
+	ERROR_UNEXPECTED_CHAR_EXPR_END,		/* value: character */
+	ERROR_EXPECTED_RPARENS,			/* value: number of missing ')'s */
+	ERROR_EXPECTED_SINGLE_QUOTE,		/* value: character */
+	ERROR_UNTERMINATED_CHAR_CONSTANT,
+	ERROR_MACRO_HAS_NO_ARGS,
+	ERROR_MACRO_DUPLICATE_ARG,		/* span: argument name */
+	ERROR_INVALID_MACRO_DEFINITION,		/* span: definition */
+	ERROR_MACRO_ARG_COUNT,			/* span: macro name, value: expected number of arguments */
+	ERROR_UNTERMINATED_MACRO_ARGS,		/* span: macro name */
+	ERROR_UNKNOWN_DIRECTIVE,		/* span: directive */
+	ERROR_UNEXPECTED_DIRECTIVE,		/* span: directive */
+	ERROR_EXPECTED_NAME,			/* span: directive */
+	ERROR_UNTERMINATED_CONDITIONAL,		/* value: number of missing #endifs */
+	ERROR_FILE_NOT_FOUND,			/* span: file name */
+	ERROR_IO,				/* span: file name, value: errno */
+	ERROR_INCLUDE_DEPTH,			/* span: file name, value: maximum depth */
+	ERROR_UNKNOWN_INSTRUCTION,		/* span: mnemonic */
+	ERROR_INVALID_OPERANDS,			/* span: mnemonic */
+	ERROR_VALUE_OUT_OF_RANGE,		/* value: value */
+	ERROR_DUPLICATE_LABEL,			/* span: label name */
+	ERROR_EXPECTED_STRING,
+	ERROR_DIVISION_BY_ZERO,
+	ERROR_DIVISION_OVERFLOW,		/* value: dividend */
+};
+
+/*
+ * Errors are cheap to create: they only record a code and its arguments. The
+ * message text is formatted when it is actually needed, so errors which are
+ * expected and thrown away (such as forward references in the first pass)
+ * never pay for it.
+ *
+ * The span is not copied, so the text it points to must outlive the error,
+ * or at least the first call to error_get_message().
+ */
 struct error {
-	int dummy_; /* fixes "flexible array member in otherwise empty struct" */
-	char message[];
+	enum error_code code;
+	struct source_location location;
+	const char *str;
+	size_t length;
+	expr_value value;
+	char *message; /* Cached by error_get_message() */
 };
 
-static inline const char *error_get_message(const struct error *error)
+static inline enum error_code error_get_code(const struct error *error)
+{
+	return error->code;
+}
+
+static inline void error_set_location(struct error *error, struct source_location location)
 {
-	return error->message;
+	error->location = location;
 }
 
-struct error *error_create(const char *fmt, ...);
+struct error *error_create(enum error_code code);
+
+struct error *error_create_span(enum error_code code, const char *str, size_t length);
+
+struct error *error_create_value(enum error_code code, expr_value value);
+
+struct error *error_create_span_value(enum error_code code, const char *str, size_t length, expr_value value);
+
+/* Same semantics as snprintf() */
+int error_format_message(const struct error *error, char *buf, size_t size);
+
+const char *error_get_message(struct error *error);
 
-struct error *error_create_vargs(const char *fmt, va_list args);
+/* Prefixes the message with "file:line:column: " if sources is given */
+void error_print(const struct error *error, struct source_list *sources, FILE *file);
 
 void error_free(struct error *err);
 
@@ -26,7 +26,9 @@
 
 #include <bergen/error.h>
 #include <bergen/label.h>
+#include <bergen/lexer.h>
 #include <bergen/libc.h>
+#include <bergen/source.h>
 #include <bergen/types.h>
 
 #include <stdlib.h>
@@ -34,11 +36,22 @@
 struct expr_data {
 	const char *str;
 	size_t length;
+	struct source_location location; /* Where str starts, for error reporting */
 	char local_label_char;
 	expr_value location_counter;
 
-	struct label_list labels;
-	struct label_list local_labels;
+	/* Not owned, either may be NULL */
+	const struct label_list *labels;
+	const struct label_list *local_labels;
+
+	/*
+	 * When compiling, what can still change is referenced even though it is
+	 * known: the labels also in changing_labels, which may be NULL, and local
+	 * labels and $ if the flags say so
+	 */
+	const struct label_list *changing_labels;
+	int local_labels_change;
+	int location_counter_changes;
 };
 
 void expr_data_init(struct expr_data *data, const char *str, size_t length, char local_label_char);
@@ -50,6 +63,56 @@ static inline void expr_data_init_easy(struct expr_data *data, const char *str,
 
 void expr_data_destroy(struct expr_data *data);
 
+/* Lexes data->str and evaluates it */
 struct error *expr_evaluate(struct expr_data *data, expr_value *result);
 
+struct expr_token;
+
+/* A label that wasn't defined yet when an expression was compiled */
+struct expr_reference {
+	size_t token; /* Index in the program's tokens */
+	char *name; /* Without the local label character, NULL for $ */
+	size_t length;
+	int owns_name; /* Else it's the name of the label, which outlives the program */
+	int is_local;
+	struct source_location location; /* Where it was named, for errors */
+};
+
+/*
+ * An expression kept to be evaluated once the labels it refers to are
+ * defined. Everything else in it has the value it had when it was compiled,
+ * so can be evaluated any number of times.
+ */
+struct expr_program {
+	struct expr_token *tokens; /* Private to the evaluator */
+	size_t num_tokens;
+	struct expr_reference *references;
+	size_t references_buffer_size; /* Number of references in buffer */
+	size_t num_references;
+	size_t num_missing; /* References to labels that weren't defined when compiled */
+	struct source_location location; /* Of the expression, for errors in evaluating it */
+};
+
+/*
+ * Evaluates tokens which were already lexed, up to the first comment. Errors
+ * in tokens which point into data->str are located relative to it, anything
+ * else (such as tokens from a macro body) at the start of the expression.
+ */
+struct error *expr_evaluate_tokens(struct expr_data *data, const struct lex_token *tokens, size_t num_tokens, expr_value *result);
+
+void expr_program_init(struct expr_program *program);
+
+void expr_program_destroy(struct expr_program *program);
+
+/*
+ * Like expr_evaluate_tokens(), but labels which can't be found, and what
+ * data says can change, are referenced in program instead; they count as
+ * what they are now in *result, or 0 if missing. A program that references
+ * nothing is left empty. The tokens need not outlive the program.
+ */
+struct error *expr_compile_tokens(struct expr_data *data, const struct lex_token *tokens, size_t num_tokens, struct expr_program *program, expr_value *result);
+
+/* Errors are located where the label that is still missing was named */
+struct error *expr_program_evaluate(struct expr_program *program, const struct label_list *labels, const struct label_list *local_labels, expr_value location_counter, expr_value *result);
+
 #endif /* BERGEN_EXPRESSION_H */
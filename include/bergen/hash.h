@@ -0,0 +1,59 @@
+/*
+ * include/bergen/hash.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_HASH_H
+#define BERGEN_HASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * 64 bit FNV-1a, for telling whether contents changed. Use intern_hash() for
+ * hash tables, where 32 bits are plenty.
+ */
+#define HASH64_INIT 14695981039346656037ull
+
+static inline uint64_t hash64_update(uint64_t hash, const void *data, size_t length)
+{
+	const unsigned char *ptr = data;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= ptr[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+/* Strings are hashed with their NUL, so that ("ab", "c") and ("a", "bc") differ */
+static inline uint64_t hash64_update_string(uint64_t hash, const char *str)
+{
+	const char *ptr = str;
+
+	while (*ptr)
+		ptr++;
+	return hash64_update(hash, str, ptr - str + 1);
+}
+
+#endif /* BERGEN_HASH_H */
@@ -0,0 +1,139 @@
+/*
+ * include/bergen/include.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_INCLUDE_H
+#define BERGEN_INCLUDE_H
+
+#include <bergen/error.h>
+#include <bergen/intern.h>
+#include <bergen/preprocessor.h>
+#include <bergen/source.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct include_file {
+	char *path; /* Canonical */
+	dev_t dev;
+	ino_t ino;
+	off_t size; /* As stat()ed when it was found, which may differ from length */
+	struct timespec mtime;
+
+	const char *data; /* mmap()ed */
+	size_t length;
+	source_file_id source_id;
+
+	char *guard; /* Include guard macro, NULL if the file has none */
+};
+
+/* Returns 0 if the file at path is no longer the one that was loaded */
+int include_file_is_current(const struct include_file *file);
+
+/* Files a program was made from, each listed once in the order first seen */
+struct include_file_list {
+	const struct include_file **files;
+	size_t files_buffer_size; /* Number of files in buffer */
+	size_t num_files;
+};
+
+void include_file_list_init(struct include_file_list *list);
+
+void include_file_list_destroy(struct include_file_list *list);
+
+void include_file_list_add(struct include_file_list *list, const struct include_file *file);
+
+static inline void include_file_list_clear(struct include_file_list *list)
+{
+	list->num_files = 0;
+}
+
+/*
+ * Result of stat()ing a path, so that each candidate is only looked at once.
+ * Which file it is comes from the fstat() of the file once it's opened.
+ */
+struct include_stat {
+	int exists;
+	struct include_file *file; /* NULL if not loaded yet */
+};
+
+/*
+ * Loads every file at most once, no matter how many times or by which path
+ * it is included, and keeps it mapped until a reset finds it has changed.
+ *
+ * Loading and finding files may be done from several threads at once, so
+ * that jobs assembling different programs share their includes. A loaded
+ * include_file never changes again and may be read without the lock.
+ * Search paths must all be added before any thread starts.
+ */
+struct include_manager {
+	char **search_paths;
+	size_t search_paths_buffer_size; /* Number of paths in buffer */
+	size_t num_search_paths;
+
+	struct include_file **files;
+	size_t files_buffer_size; /* Number of files in buffer */
+	size_t num_files;
+	struct intern_table files_by_key; /* Keys are the raw bytes of (dev, ino, size, mtime), id == index in files */
+
+	struct include_stat *stats;
+	size_t stats_buffer_size; /* Number of stats in buffer */
+	struct intern_table stats_by_path; /* id == index in stats */
+
+	struct source_list sources;
+
+	pthread_mutex_t lock; /* Guards files, stats and sources */
+};
+
+void include_manager_init(struct include_manager *im);
+
+void include_manager_destroy(struct include_manager *im);
+
+void include_manager_add_search_path(struct include_manager *im, const char *path);
+
+/*
+ * Forgets the search paths and what was found at every path, but keeps the
+ * files loaded so far that haven't changed. A file which has changed since
+ * it was loaded is freed, along with its source, and loaded again the next
+ * time it is found. Like adding search paths, only do this while no other
+ * thread is using the manager, and once nothing holds the files it gave out.
+ */
+void include_manager_reset(struct include_manager *im);
+
+/* Loads a file given on the command line */
+struct error *include_manager_load(struct include_manager *im, const char *path, struct include_file **file);
+
+/*
+ * Finds the file named by an #include, looking in the directory of the
+ * including file (if any) first and then in the search paths.
+ */
+struct error *include_manager_find(struct include_manager *im, const char *name, size_t length, const struct include_file *parent, struct include_file **file);
+
+/* A guarded file whose guard is already defined has nothing left to give */
+static inline int include_file_is_guarded(const struct include_file *file, const struct preprocessor *pp)
+{
+	return file->guard && pp_macro_table_find_easy(&pp->macros, file->guard);
+}
+
+#endif /* BERGEN_INCLUDE_H */
@@ -0,0 +1,87 @@
+/*
+ * include/bergen/intern.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_INTERN_H
+#define BERGEN_INTERN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef uint32_t intern_id;
+
+#define INTERN_NONE ((intern_id) -1)
+
+struct intern_entry {
+	char *name;
+	size_t length;
+	uint32_t hash;
+};
+
+/* Maps names to small dense ids, so that users can index arrays by name */
+struct intern_table {
+	struct intern_entry *entries; /* Indexed by id */
+	size_t buffer_size; /* Number of entries in buffer */
+	size_t num_entries;
+
+	intern_id *slots; /* Open addressing, INTERN_NONE if empty */
+	size_t num_slots; /* Always a power of 2 */
+};
+
+/* FNV-1a */
+static inline uint32_t intern_hash(const char *str, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+void intern_table_init(struct intern_table *table);
+
+void intern_table_destroy(struct intern_table *table);
+
+intern_id intern_table_intern(struct intern_table *table, const char *name, size_t length);
+
+intern_id intern_table_find_hashed(const struct intern_table *table, const char *name, size_t length, uint32_t hash);
+
+static inline intern_id intern_table_find(const struct intern_table *table, const char *name, size_t length)
+{
+	return intern_table_find_hashed(table, name, length, intern_hash(name, length));
+}
+
+static inline const char *intern_table_get_name(const struct intern_table *table, intern_id id)
+{
+	return table->entries[id].name;
+}
+
+static inline size_t intern_table_get_length(const struct intern_table *table, intern_id id)
+{
+	return table->entries[id].length;
+}
+
+#endif /* BERGEN_INTERN_H */
@@ -24,20 +24,35 @@
 #ifndef BERGEN_LABEL_H
 #define BERGEN_LABEL_H
 
+#include <bergen/intern.h>
 #include <bergen/libc.h>
 #include <bergen/types.h>
 
 #include <stdlib.h>
 
+enum label_type {
+	LABEL_TYPE_LABEL,
+	LABEL_TYPE_CONSTANT, /* Promoted from an object-like #define */
+};
+
 struct label {
 	char *name;
+	size_t length;
+	uint32_t hash;
 	expr_value value;
+	enum label_type type;
 };
 
+#define LABEL_NONE ((size_t) -1)
+
+/* Labels are found by hash, since programs have thousands of them */
 struct label_list {
 	struct label *labels;
 	size_t buffer_size; /* Number of labels in buffer */
 	size_t num_labels;
+
+	size_t *slots; /* Open addressing, index in labels or LABEL_NONE */
+	size_t num_slots; /* 0 or a power of 2, at least twice num_labels */
 };
 
 void label_init(struct label *label, const char *name, size_t length, expr_value value);
@@ -50,7 +65,12 @@ void label_list_destroy(struct label_list *list);
 
 void label_list_append_copy(struct label_list *list, const struct label *label);
 
-void label_list_append(struct label_list *list, const char *name, size_t length, expr_value value);
+void label_list_append_type(struct label_list *list, const char *name, size_t length, expr_value value, enum label_type type);
+
+static inline void label_list_append(struct label_list *list, const char *name, size_t length, expr_value value)
+{
+	label_list_append_type(list, name, length, value, LABEL_TYPE_LABEL);
+}
 
 static inline void label_list_append_easy(struct label_list *list, const char *name, expr_value value)
 {
@@ -59,4 +79,10 @@ static inline void label_list_append_easy(struct label_list *list, const char *n
 
 struct label *label_list_find_label(const struct label_list *list, const char *name, size_t length);
 
+/* Returns 0 if there was no such label */
+int label_list_remove(struct label_list *list, const char *name, size_t length);
+
+/* Removes every label of the given type */
+void label_list_remove_type(struct label_list *list, enum label_type type);
+
 #endif /* BERGEN_LABEL_H */
@@ -0,0 +1,73 @@
+/*
+ * include/bergen/lexer.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_LEXER_H
+#define BERGEN_LEXER_H
+
+#include <stdlib.h>
+
+enum lex_token_type {
+	LEX_TOKEN_TYPE_IDENTIFIER,
+	LEX_TOKEN_TYPE_NUMBER,		/* Including prefixed constants like $FF and the location counter $ */
+	LEX_TOKEN_TYPE_CHAR,		/* 'c' */
+	LEX_TOKEN_TYPE_STRING,		/* "...", may be unterminated */
+	LEX_TOKEN_TYPE_OPERATOR,	/* Punctuation and one or two character operators */
+	LEX_TOKEN_TYPE_WHITESPACE,
+	LEX_TOKEN_TYPE_COMMENT,		/* ; to end of line */
+	LEX_TOKEN_TYPE_MACRO_ARG,	/* Only in macro bodies, see arg */
+};
+
+/* Tokens point into the text they were lexed from, which must outlive them */
+struct lex_token {
+	enum lex_token_type type;
+	const char *str;
+	size_t length;
+	size_t arg; /* Argument slot for LEX_TOKEN_TYPE_MACRO_ARG */
+};
+
+struct lex_token_list {
+	struct lex_token *tokens;
+	size_t buffer_size; /* Number of tokens in buffer */
+	size_t num_tokens;
+};
+
+void lex_token_list_init(struct lex_token_list *list);
+
+void lex_token_list_destroy(struct lex_token_list *list);
+
+static inline void lex_token_list_clear(struct lex_token_list *list)
+{
+	list->num_tokens = 0;
+}
+
+void lex_token_list_append(struct lex_token_list *list, const struct lex_token *tokens, size_t num_tokens);
+
+static inline int lex_token_is(const struct lex_token *token, enum lex_token_type type, char c)
+{
+	return token->type == type && token->length == 1 && token->str[0] == c;
+}
+
+/* Appends the tokens of str to list */
+void lex_line(const char *str, size_t length, struct lex_token_list *list);
+
+#endif /* BERGEN_LEXER_H */
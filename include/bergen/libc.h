@@ -24,45 +24,167 @@
 #ifndef BERGEN_LIBC_H
 #define BERGEN_LIBC_H
 
+#include <bergen/alloc.h>
+
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 /* ctype.h */
 #define bergen_isspace		isspace
+#define bergen_tolower		tolower
+
+/* fcntl.h */
+#define bergen_open		open
+
+/* poll.h */
+#define bergen_poll		poll
+
+/* pthread.h */
+#define bergen_pthread_create		pthread_create
+#define bergen_pthread_getspecific	pthread_getspecific
+#define bergen_pthread_join		pthread_join
+#define bergen_pthread_key_create	pthread_key_create
+#define bergen_pthread_key_delete	pthread_key_delete
+#define bergen_pthread_mutex_destroy	pthread_mutex_destroy
+#define bergen_pthread_mutex_init	pthread_mutex_init
+#define bergen_pthread_mutex_lock	pthread_mutex_lock
+#define bergen_pthread_mutex_unlock	pthread_mutex_unlock
+#define bergen_pthread_once		pthread_once
+#define bergen_pthread_setspecific	pthread_setspecific
+
+/* signal.h */
+#define bergen_sigaction		sigaction
+#define bergen_sigemptyset		sigemptyset
 
 /* stdio.h */
 #define bergen_fclose		fclose
+#define bergen_fdopen		fdopen
+#define bergen_fflush		fflush
+#define bergen_fgetc		fgetc
 #define bergen_feof		feof
 #define bergen_ferror		ferror
+#define bergen_fgets		fgets
+#define bergen_fileno		fileno
+#define bergen_fopen		fopen
+#define bergen_fprintf		fprintf
+#define bergen_fputc		fputc
+#define bergen_fputs		fputs
 #define bergen_fread		fread
 #define bergen_fseek		fseek
 #define bergen_fwrite		fwrite
+#define bergen_open_memstream	open_memstream
+#define bergen_rename		rename
+#define bergen_rewind		rewind
+#define bergen_snprintf		snprintf
 #define bergen_tmpfile		tmpfile
 #define bergen_vsnprintf	vsnprintf
 
 /* stdlib.h */
+#ifndef BERGEN_ALLOC_TAG
+#define BERGEN_ALLOC_TAG	ALLOC_TAG_OTHER
+#endif
+#ifdef BERGEN_ALLOC_HOOKS
+#define bergen_free(ptr)		alloc_free(ptr)
+#define bergen_malloc(size)		alloc_malloc(BERGEN_ALLOC_TAG, size)
+#define bergen_realloc(ptr, size)	alloc_realloc(BERGEN_ALLOC_TAG, ptr, size)
+#else
 #define bergen_free		free
 #define bergen_malloc		malloc
 #define bergen_realloc		realloc
+#endif
+#define bergen_free_libc	free /* Memory that libc allocated, like open_memstream's */
+#define bergen_getenv		getenv
+#define bergen_mkdtemp		mkdtemp
+#define bergen_mkstemp		mkstemp
+#define bergen_qsort		qsort
+#define bergen_realpath		realpath
 #define bergen_strtoll		strtoll
+#define bergen_strtoull		strtoull
 
 /* string.h */
 #define bergen_memchr		memchr
 #define bergen_memcmp		memcmp
 #define bergen_memcpy		memcpy
+#define bergen_memmove		memmove
 #define bergen_memset		memset
 #define bergen_strchr		strchr
+#define bergen_strcmp		strcmp
 #define bergen_strcpy		strcpy
 #define bergen_strerror		strerror
 #define bergen_strlen		strlen
 #define bergen_strncmp		strncmp
 #define bergen_strncpy		strncpy
+#define bergen_strrchr		strrchr
+#define bergen_strstr		strstr
+#ifdef BERGEN_ALLOC_HOOKS
+#define bergen_strdup(s)		alloc_strdup(BERGEN_ALLOC_TAG, s)
+#define bergen_strndup(s, n)		alloc_strndup(BERGEN_ALLOC_TAG, s, n)
+#define bergen_strndup_null(s, n)	alloc_strndup_null(BERGEN_ALLOC_TAG, s, n)
+#else
 char *bergen_strdup(const char *s);
 char *bergen_strndup(const char *s, size_t n);
 char *bergen_strndup_null(const char *s, size_t n); /* Puts null terminator at the end */
+#endif
+
+/* sys/mman.h */
+#define bergen_mmap		mmap
+#define bergen_munmap		munmap
+
+/* sys/socket.h */
+#define bergen_accept		accept
+#define bergen_bind		bind
+#define bergen_connect		connect
+#define bergen_getsockopt	getsockopt
+#define bergen_listen		listen
+#define bergen_socket		socket
+
+/* sys/stat.h */
+#define bergen_mkdir		mkdir
+#define bergen_fstat		fstat
+#define bergen_lstat		lstat
+#define bergen_stat		stat
+
+/* sys/inotify.h */
+#ifdef __linux__
+#define bergen_inotify_add_watch	inotify_add_watch
+#define bergen_inotify_init		inotify_init
+#endif
+
+/* time.h */
+#define bergen_clock_gettime	clock_gettime
+
+/* unistd.h */
+#define bergen_chdir		chdir
+#define bergen_close		close
+#define bergen_getcwd		getcwd
+#ifndef __linux__
+#define bergen_getpeereid	getpeereid
+#endif
+#define bergen_getuid		getuid
+#define bergen_read		read
+#define bergen_rmdir		rmdir
+#define bergen_unlink		unlink
+#define bergen_write		write
 
 #endif /* BERGEN_LIBC_H */
@@ -52,13 +52,35 @@ void object_output_set_address(struct object_output *obj, expr_value address);
 
 void object_output_write(struct object_output *obj, const void *mem, size_t length);
 
+/*
+ * Makes room for length bytes, as if they were written, and returns their
+ * offset in the buffer. They are left for object_output_patch() to fill in,
+ * which may be done by several threads at once as long as nothing grows
+ * the buffer meanwhile.
+ */
+size_t object_output_reserve(struct object_output *obj, size_t length);
+
+/* Overwrites length bytes that were already written, starting at offset in the buffer */
+void object_output_patch(struct object_output *obj, size_t offset, const void *mem, size_t length);
+
 struct error *object_output_write_to_binary(const struct object_output *obj, FILE *file);
 
+/* Writes each segment as 16 byte data records, followed by the end of file record */
+struct error *object_output_write_to_intel_hex(const struct object_output *obj, FILE *file);
+
 static inline void *object_output_get_segment_ptr(const struct object_output *obj, const struct object_segment *segment)
 {
 	return (char *) obj->buffer + segment->index;
 }
 
+/* Where in the buffer the next byte written goes, for object_output_patch() */
+static inline size_t object_output_get_offset(const struct object_output *obj)
+{
+	const struct object_segment *last_segment = &obj->segments[obj->num_segments - 1];
+
+	return obj->address - last_segment->address + last_segment->index;
+}
+
 static inline size_t object_output_get_segment_length(const struct object_output *obj, const struct object_segment *segment)
 {
 	if (segment == &obj->segments[obj->num_segments - 1])
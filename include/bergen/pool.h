@@ -0,0 +1,40 @@
+/*
+ * include/bergen/pool.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_POOL_H
+#define BERGEN_POOL_H
+
+#include <stdlib.h>
+
+typedef void (*thread_pool_func)(void *data, size_t index);
+
+/*
+ * Calls func(data, i) for every i below num_jobs on up to num_threads
+ * threads, the calling thread included, and returns when all are done. Each
+ * thread starts on its own contiguous share of the jobs and steals from the
+ * end of the others' shares once it runs out, so a few slow jobs don't leave
+ * the other threads idle. With a single thread, jobs run in order.
+ */
+void thread_pool_run(size_t num_threads, size_t num_jobs, thread_pool_func func, void *data);
+
+#endif /* BERGEN_POOL_H */
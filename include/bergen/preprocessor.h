@@ -25,13 +25,39 @@
 #define BERGEN_PREPROCESSOR_H
 
 #include <bergen/error.h>
+#include <bergen/intern.h>
+#include <bergen/label.h>
+#include <bergen/lexer.h>
 #include <bergen/libc.h>
 
+#include <stdint.h>
+
 struct pp_macro_definition {
 	char *name;
-	char **args;
+	char **args; /* NULL if the macro has no arguments, names are owned by arg_names */
 	size_t args_buffer_size; /* Number of arguments in buffer */
 	size_t num_args;
+	struct intern_table arg_names; /* Only initialized if args is not NULL, id == slot */
+
+	/*
+	 * The body is lexed once when it is set, and uses of arguments are
+	 * resolved to their slots, so expanding never has to look at text.
+	 */
+	char *body;
+	struct lex_token_list body_tokens;
+
+	/*
+	 * Set if the body is a constant expression which was evaluated once
+	 * and added to the label table. Such a macro is left alone when
+	 * expanding, and expressions find it as a label instead.
+	 */
+	int is_constant;
+};
+
+/* Actual argument of a macro invocation */
+struct pp_macro_arg {
+	const struct lex_token *tokens;
+	size_t num_tokens;
 };
 
 void pp_macro_definition_init(struct pp_macro_definition *macro, const char *name, size_t length, int have_args);
@@ -50,7 +76,141 @@ static inline struct error *pp_macro_definition_add_arg_easy(struct pp_macro_def
 	return pp_macro_definition_add_arg(macro, name, bergen_strlen(name));
 }
 
-/* Note that this initializes the macro! */
+/* Arguments must be added before the body is set */
+void pp_macro_definition_set_body(struct pp_macro_definition *macro, const char *body, size_t length);
+
+static inline void pp_macro_definition_set_body_easy(struct pp_macro_definition *macro, const char *body)
+{
+	pp_macro_definition_set_body(macro, body, bergen_strlen(body));
+}
+
+/* Parses "name body" or "name(arg, ...) body". Note that this initializes the macro! */
 struct error *pp_macro_definition_parse(struct pp_macro_definition *macro, const char *str, size_t length);
 
+/*
+ * Collects the arguments of an invocation. tokens[*index] must be the "("
+ * after the macro name, and *index is left after the matching ")". args must
+ * have room for macro->num_args arguments.
+ */
+struct error *pp_macro_parse_args(const struct pp_macro_definition *macro, const struct lex_token *tokens, size_t num_tokens, size_t *index, struct pp_macro_arg *args);
+
+/* Appends the expansion of the macro to output. The argument tokens are copied as is. */
+void pp_macro_expand(const struct pp_macro_definition *macro, const struct pp_macro_arg *args, struct lex_token_list *output);
+
+/*
+ * Macros are indexed by interned name. Since almost every identifier that is
+ * looked up is not a macro, a bloom filter over the name hashes rejects those
+ * before the hash table is probed.
+ */
+struct pp_macro_table {
+	struct intern_table names;
+	struct pp_macro_definition **macros; /* Indexed by intern_id, NULL if not defined */
+	size_t macros_buffer_size; /* Number of pointers in macros */
+	size_t num_macros;
+
+	uint64_t *bloom;
+	size_t bloom_bits; /* Always a power of 2 */
+};
+
+void pp_macro_table_init(struct pp_macro_table *table);
+
+void pp_macro_table_destroy(struct pp_macro_table *table);
+
+/* Takes ownership of the macro's contents, replacing any previous definition */
+void pp_macro_table_define(struct pp_macro_table *table, struct pp_macro_definition *macro);
+
+/* Returns 0 if the macro was not defined */
+int pp_macro_table_undefine(struct pp_macro_table *table, const char *name, size_t length);
+
+static inline int pp_macro_table_bloom_test(const struct pp_macro_table *table, uint32_t hash)
+{
+	size_t mask = table->bloom_bits - 1;
+	size_t bit1 = hash & mask, bit2 = (hash >> 16 ^ hash * 31) & mask;
+
+	return (table->bloom[bit1 / 64] >> (bit1 % 64) & 1) && (table->bloom[bit2 / 64] >> (bit2 % 64) & 1);
+}
+
+struct pp_macro_definition *pp_macro_table_find_hashed(const struct pp_macro_table *table, const char *name, size_t length, uint32_t hash);
+
+static inline struct pp_macro_definition *pp_macro_table_find(const struct pp_macro_table *table, const char *name, size_t length)
+{
+	uint32_t hash = intern_hash(name, length);
+
+	if (!pp_macro_table_bloom_test(table, hash))
+		return NULL;
+	return pp_macro_table_find_hashed(table, name, length, hash);
+}
+
+static inline struct pp_macro_definition *pp_macro_table_find_easy(const struct pp_macro_table *table, const char *name)
+{
+	return pp_macro_table_find(table, name, bergen_strlen(name));
+}
+
+struct pp_conditional {
+	int parent_active;
+	int taken; /* Some branch of this conditional was (or is being) assembled */
+	int seen_else;
+};
+
+struct preprocessor {
+	struct pp_macro_table macros;
+	struct label_list *labels; /* Where constant macros go, not owned, may be NULL */
+	char local_label_char; /* Macros named like a local label are never made constants */
+
+	struct pp_conditional *conditionals;
+	size_t conditionals_buffer_size; /* Number of conditionals in buffer */
+	size_t num_conditionals;
+	int active; /* Lines are currently being assembled */
+};
+
+void preprocessor_init(struct preprocessor *pp, struct label_list *labels);
+
+void preprocessor_destroy(struct preprocessor *pp);
+
+/* Handles the rest of a #define line */
+struct error *preprocessor_define(struct preprocessor *pp, const char *str, size_t length);
+
+/* Handles the rest of an #undef line. Returns 0 if the macro was not defined. */
+int preprocessor_undefine(struct preprocessor *pp, const char *name, size_t length);
+
+/* Appends tokens to output with all macros except constant ones expanded */
+struct error *preprocessor_expand(const struct preprocessor *pp, const struct lex_token *tokens, size_t num_tokens, struct lex_token_list *output);
+
+static inline int preprocessor_is_active(const struct preprocessor *pp)
+{
+	return pp->active;
+}
+
+/* Returns a pointer to the '#' if the first non-blank character of the line is one */
+const char *preprocessor_find_directive(const char *str, size_t length);
+
+/*
+ * Handles a line that preprocessor_find_directive() accepted, which may still
+ * have its leading blanks. While inactive only conditionals are looked at.
+ */
+struct error *preprocessor_directive(struct preprocessor *pp, const char *str, size_t length);
+
+/*
+ * While inactive, nothing but the conditional directives matters, so rather
+ * than handing every line to the preprocessor, skip straight to the next line
+ * which could end the inactive block. Only lines starting with '#' are looked
+ * at, and nested conditionals are counted without being evaluated. str must
+ * be at the start of a line. Returns the offset of the #else, #elif or #endif
+ * line to pass to preprocessor_directive(), or length if there is none.
+ */
+size_t preprocessor_skip(const char *str, size_t length);
+
+/* Returns the file name if the line is an #include, which the caller handles */
+const char *preprocessor_parse_include(const char *str, size_t length, size_t *name_length);
+
+/*
+ * Returns the guard macro if the whole file is wrapped in
+ * "#ifndef NAME / #define NAME / ... / #endif", with nothing but blank lines
+ * and comments outside of it.
+ */
+const char *preprocessor_find_include_guard(const char *str, size_t length, size_t *name_length);
+
+/* Call at the end of input */
+struct error *preprocessor_finish(struct preprocessor *pp);
+
 #endif /* BERGEN_PREPROCESSOR_H */
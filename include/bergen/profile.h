@@ -0,0 +1,121 @@
+/*
+ * include/bergen/profile.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_PROFILE_H
+#define BERGEN_PROFILE_H
+
+#include <bergen/intern.h>
+#include <bergen/source.h>
+#include <bergen/trace.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Everything done for one source line, in every pass */
+struct profile_line {
+	struct source_location location; /* file is SOURCE_FILE_NONE if the slot is empty */
+	struct source_location from; /* The #include that read the file, none for an input */
+	uint64_t ns;
+	uint64_t count;
+};
+
+struct profile_macro {
+	uint64_t ns; /* Not counting the macros it expanded to */
+	uint64_t count;
+};
+
+/* Where the time went, by source line and by macro */
+struct profile {
+	struct profile_line *lines; /* Open addressing by location */
+	size_t num_slots; /* Always a power of 2, or 0 before the first line */
+	size_t num_lines;
+
+	struct intern_table macro_names;
+	struct profile_macro *macros; /* Indexed by the id of the name */
+	size_t macros_buffer_size; /* Number of macros in buffer */
+};
+
+void profile_init(struct profile *profile);
+
+void profile_destroy(struct profile *profile);
+
+void profile_add_line(struct profile *profile, struct source_location location, struct source_location from, uint64_t ns, uint64_t count);
+
+void profile_add_macro(struct profile *profile, const char *name, size_t length, uint64_t ns, uint64_t count);
+
+/* NULL if the line was never seen */
+const struct profile_line *profile_find_line(const struct profile *profile, struct source_location location);
+
+/* Nonzero once profile_enable has been called, read it through the inlines */
+extern int profile_enabled;
+
+/* Must be called before any thread that should be profiled starts */
+void profile_enable(void);
+
+void profile_disable(void);
+
+void profile_line_slow(uint64_t start, struct source_location location, struct source_location from);
+
+uint64_t profile_macro_begin_slow(void);
+
+void profile_macro_end_slow(uint64_t start, const char *name, size_t length);
+
+/* Gives the start of a line, or 0 if profiling is off */
+static inline uint64_t profile_begin(void)
+{
+	return profile_enabled ? trace_now() : 0;
+}
+
+/* Adds the time since start to the line */
+static inline void profile_line(uint64_t start, struct source_location location, struct source_location from)
+{
+	if (start)
+		profile_line_slow(start, location, from);
+}
+
+/* Expansions nest, so every begin needs its end, even if the expansion failed */
+static inline uint64_t profile_macro_begin(void)
+{
+	return profile_enabled ? profile_macro_begin_slow() : 0;
+}
+
+/* Adds the time since start, less that of the expansions inside, to the macro */
+static inline void profile_macro_end(uint64_t start, const char *name, size_t length)
+{
+	if (start)
+		profile_macro_end_slow(start, name, length);
+}
+
+/* Adds up what every thread, running or exited, has measured since the last reset into profile, which must be initialized */
+void profile_collect(struct profile *profile);
+
+/* Starts measuring from nothing again */
+void profile_reset(void);
+
+/*
+ * Prints the top lines and macros by time taken, with where each line's file
+ * was included from. Line numbers are looked up in sources.
+ */
+void profile_print(const struct profile *profile, struct source_list *sources, size_t top, FILE *file);
+
+#endif /* BERGEN_PROFILE_H */
@@ -0,0 +1,82 @@
+/*
+ * include/bergen/source.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_SOURCE_H
+#define BERGEN_SOURCE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef uint32_t source_file_id;
+
+#define SOURCE_FILE_NONE ((source_file_id) -1)
+
+/* Locations are only a file and a byte offset; lines are found on demand */
+struct source_location {
+	source_file_id file;
+	size_t offset;
+};
+
+static inline struct source_location source_location_none(void)
+{
+	struct source_location location = {SOURCE_FILE_NONE, 0};
+	return location;
+}
+
+struct source_file {
+	char *name;
+	const char *data; /* Not owned */
+	size_t length;
+
+	/* Newline index, built the first time a line number is asked for */
+	size_t *line_starts;
+	size_t num_lines;
+};
+
+/* Ids stay put when a file is removed; its slot goes to a later file instead */
+struct source_list {
+	struct source_file *files;
+	size_t buffer_size; /* Number of files in buffer */
+	size_t num_files; /* Including removed ones */
+	size_t num_removed;
+};
+
+void source_list_init(struct source_list *list);
+
+void source_list_destroy(struct source_list *list);
+
+source_file_id source_list_add(struct source_list *list, const char *name, const char *data, size_t length);
+
+void source_list_remove(struct source_list *list, source_file_id id);
+
+static inline struct source_file *source_list_get_file(const struct source_list *list, source_file_id id)
+{
+	if (id >= list->num_files || !list->files[id].name)
+		return NULL;
+	return &list->files[id];
+}
+
+/* Line and column are 1-based */
+void source_file_get_line_column(struct source_file *file, size_t offset, size_t *line, size_t *column);
+
+#endif /* BERGEN_SOURCE_H */
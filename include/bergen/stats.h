@@ -0,0 +1,122 @@
+/*
+ * include/bergen/stats.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_STATS_H
+#define BERGEN_STATS_H
+
+#include <bergen/alloc.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Time spent in a phase doesn't include the phases started inside it */
+enum stats_phase {
+	STATS_PHASE_READ,
+	STATS_PHASE_PREPROCESS,
+	STATS_PHASE_PASS1,
+	STATS_PHASE_PASS2,
+	STATS_PHASE_OUTPUT,
+
+	STATS_NUM_PHASES,
+};
+
+enum stats_counter {
+	STATS_COUNTER_FILES_READ,
+	STATS_COUNTER_BYTES_READ,
+	STATS_COUNTER_LINES,
+	STATS_COUNTER_EXPRESSIONS,
+	STATS_COUNTER_TOKENS, /* Produced by the expression tokenizer */
+	STATS_COUNTER_LABEL_LOOKUPS,
+	STATS_COUNTER_LABEL_PROBES, /* Slots looked at by the lookups */
+	STATS_COUNTER_OBJECT_WRITES,
+	STATS_COUNTER_OBJECT_REGROWS,
+	STATS_COUNTER_FIXUPS,
+
+	STATS_NUM_COUNTERS,
+};
+
+/*
+ * Totals of every thread. Reading the CPU clock takes a system call, so only
+ * phases started outside any other one have their CPU time measured; the CPU
+ * time of the others is part of the phase they were started in.
+ */
+struct stats {
+	uint64_t wall_ns[STATS_NUM_PHASES];
+	uint64_t cpu_ns[STATS_NUM_PHASES];
+	int has_cpu[STATS_NUM_PHASES];
+	uint64_t counters[STATS_NUM_COUNTERS];
+	size_t num_threads;
+	struct alloc_stats allocations; /* Since the process started, with ALLOC_ACCOUNTING */
+
+	/* Filled in by the caller, who knows what the whole run was */
+	uint64_t total_wall_ns;
+	uint64_t total_cpu_ns;
+};
+
+/* Nonzero once stats_enable has been called, read it through the inlines */
+extern int stats_enabled;
+
+/* Must be called before any thread that should be counted starts */
+void stats_enable(void);
+
+void stats_disable(void);
+
+void stats_count_slow(enum stats_counter counter, uint64_t n);
+
+void stats_phase_begin_slow(enum stats_phase phase);
+
+void stats_phase_end_slow(void);
+
+static inline void stats_count(enum stats_counter counter, uint64_t n)
+{
+	if (stats_enabled)
+		stats_count_slow(counter, n);
+}
+
+static inline void stats_phase_begin(enum stats_phase phase)
+{
+	if (stats_enabled)
+		stats_phase_begin_slow(phase);
+}
+
+static inline void stats_phase_end(void)
+{
+	if (stats_enabled)
+		stats_phase_end_slow();
+}
+
+/*
+ * Sums what every thread has counted since the last reset, including those
+ * that have exited since, and how many threads counted anything. No phase
+ * may be running.
+ */
+void stats_collect(struct stats *stats);
+
+/* Starts counting from zero again */
+void stats_reset(void);
+
+void stats_print(const struct stats *stats, FILE *file);
+
+void stats_print_json(const struct stats *stats, FILE *file);
+
+#endif /* BERGEN_STATS_H */
@@ -0,0 +1,92 @@
+/*
+ * include/bergen/stream.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_STREAM_H
+#define BERGEN_STREAM_H
+
+#include <bergen/error.h>
+#include <bergen/include.h>
+#include <bergen/lexer.h>
+#include <bergen/preprocessor.h>
+#include <bergen/profile.h>
+#include <bergen/source.h>
+#include <bergen/trace.h>
+
+#include <stdlib.h>
+
+#define LINE_STREAM_MAX_DEPTH 64
+
+/* A file being read, the bottom one is the file given on the command line */
+struct line_stream_frame {
+	const struct include_file *file;
+	size_t offset; /* Start of the next line */
+	struct source_location from; /* The #include that pushed the file, none for the bottom one */
+	uint64_t trace_start; /* Of the file's trace event */
+};
+
+/* A preprocessed line, only valid until the next call to line_stream_next() */
+struct stream_line {
+	struct source_location location;
+	const char *str; /* The line as written, without the newline */
+	size_t length;
+	const struct lex_token *tokens; /* With macros expanded */
+	size_t num_tokens;
+
+	/* For the consumer to finish the line's profile_line() with */
+	struct source_location from;
+	uint64_t profile_start;
+};
+
+/*
+ * Hands out preprocessed lines one at a time. Directives, inactive blocks and
+ * #includes are dealt with inside, so the consumer only ever sees lines to
+ * assemble. Files stay mapped by the include manager and the token buffers
+ * are reused for every line, so memory depends on the longest line and the
+ * include depth, never on the size of the program.
+ */
+struct line_stream {
+	struct preprocessor *pp; /* Not owned */
+	struct include_manager *im; /* Not owned */
+	struct include_file_list *files; /* Not owned, every file pushed or found is added if not NULL */
+
+	struct line_stream_frame *frames;
+	size_t frames_buffer_size; /* Number of frames in buffer */
+	size_t num_frames;
+
+	struct lex_token_list tokens;
+	struct lex_token_list expanded;
+	struct stream_line line;
+	int finished;
+};
+
+void line_stream_init(struct line_stream *stream, struct preprocessor *pp, struct include_manager *im);
+
+void line_stream_destroy(struct line_stream *stream);
+
+/* Starts reading a file, which is read to the end before anything pushed before it */
+void line_stream_push(struct line_stream *stream, const struct include_file *file);
+
+/* Sets *line to NULL at the end of input */
+struct error *line_stream_next(struct line_stream *stream, const struct stream_line **line);
+
+#endif /* BERGEN_STREAM_H */
@@ -0,0 +1,76 @@
+/*
+ * include/bergen/trace.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_TRACE_H
+#define BERGEN_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum trace_category {
+	TRACE_CATEGORY_JOB,
+	TRACE_CATEGORY_PHASE,
+	TRACE_CATEGORY_READ,
+	TRACE_CATEGORY_INCLUDE,
+	TRACE_CATEGORY_MACRO, /* Only kept if they took at least the threshold */
+	TRACE_CATEGORY_OUTPUT,
+
+	TRACE_NUM_CATEGORIES,
+};
+
+/* Nonzero once trace_enable has been called, read it through the inlines */
+extern int trace_enabled;
+
+/* Must be called before any thread that should be traced starts */
+void trace_enable(uint64_t macro_threshold_ns);
+
+/* Throws away every event */
+void trace_disable(void);
+
+uint64_t trace_now(void);
+
+void trace_end_slow(uint64_t start, enum trace_category category, const char *name, size_t length);
+
+/* Gives the start of an event, or 0 if tracing is off */
+static inline uint64_t trace_begin(void)
+{
+	return trace_enabled ? trace_now() : 0;
+}
+
+/* Records an event from start until now. name is copied. */
+static inline void trace_end(uint64_t start, enum trace_category category, const char *name, size_t length)
+{
+	if (trace_enabled && start)
+		trace_end_slow(start, category, name, length);
+}
+
+/* Number of events recorded by every thread so far */
+size_t trace_num_events(void);
+
+/*
+ * Writes the events in the Chrome trace event format, which chrome://tracing
+ * and Perfetto can open. No event may be running.
+ */
+void trace_write(FILE *file);
+
+#endif /* BERGEN_TRACE_H */
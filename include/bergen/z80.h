@@ -0,0 +1,101 @@
+/*
+ * include/bergen/z80.h
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef BERGEN_Z80_H
+#define BERGEN_Z80_H
+
+#include <bergen/error.h>
+#include <bergen/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define Z80_MAX_INSTRUCTION_LENGTH 4
+#define Z80_MAX_MNEMONIC_LENGTH 4
+
+enum z80_register {
+	Z80_REGISTER_B,
+	Z80_REGISTER_C,
+	Z80_REGISTER_D,
+	Z80_REGISTER_E,
+	Z80_REGISTER_H,
+	Z80_REGISTER_L,
+	Z80_REGISTER_A,
+	Z80_REGISTER_I,
+	Z80_REGISTER_R,
+	Z80_REGISTER_IXH,
+	Z80_REGISTER_IXL,
+	Z80_REGISTER_IYH,
+	Z80_REGISTER_IYL,
+	Z80_REGISTER_BC,
+	Z80_REGISTER_DE,
+	Z80_REGISTER_HL,
+	Z80_REGISTER_SP,
+	Z80_REGISTER_AF,
+	Z80_REGISTER_AF_ALT, /* AF' */
+	Z80_REGISTER_IX,
+	Z80_REGISTER_IY,
+
+	/* Conditions, except for C which is also a register */
+	Z80_REGISTER_NZ,
+	Z80_REGISTER_Z,
+	Z80_REGISTER_NC,
+	Z80_REGISTER_PO,
+	Z80_REGISTER_PE,
+	Z80_REGISTER_P,
+	Z80_REGISTER_M,
+
+	Z80_REGISTER_NONE,
+};
+
+enum z80_operand_type {
+	Z80_OPERAND_TYPE_REGISTER,		/* reg */
+	Z80_OPERAND_TYPE_INDIRECT_REGISTER,	/* (reg), or (IX+value) and (IY+value) */
+	Z80_OPERAND_TYPE_IMMEDIATE,		/* value */
+	Z80_OPERAND_TYPE_INDIRECT,		/* (value) */
+};
+
+struct z80_operand {
+	enum z80_operand_type type;
+	enum z80_register reg;
+	expr_value value; /* Immediate, address or index displacement */
+};
+
+/* Returns Z80_REGISTER_NONE if name is not a register or condition. Case is ignored. */
+enum z80_register z80_find_register(const char *name, size_t length);
+
+/* Case is ignored */
+int z80_is_mnemonic(const char *name, size_t length);
+
+/* Whether the encoding depends on the address, as for jr. Case is ignored. */
+int z80_is_relative(const char *name, size_t length);
+
+/*
+ * Encodes one instruction at address into buf, which must have room for
+ * Z80_MAX_INSTRUCTION_LENGTH bytes. The length only depends on the mnemonic
+ * and the kinds of operands, never on their values, so *length is set even
+ * when a value is out of range and ERROR_VALUE_OUT_OF_RANGE is returned.
+ */
+struct error *z80_encode(const char *mnemonic, size_t mnemonic_length, const struct z80_operand *operands, size_t num_operands, expr_value address, uint8_t *buf, size_t *length);
+
+#endif /* BERGEN_Z80_H */
@@ -0,0 +1,347 @@
+/*
+ * libbergen/alloc.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/alloc.h>
+
+#include <bergen/arena.h>
+#include <bergen/libc.h>
+
+static const char *const tag_names[ALLOC_NUM_TAGS] = {
+	"other",
+	"labels",
+	"tokens",
+	"macros",
+	"object",
+	"errors",
+	"files",
+};
+
+#ifdef BERGEN_ALLOC_HOOKS
+
+/* In front of every block, as aligned as anything malloc returns */
+union alloc_header {
+	struct {
+		size_t size;
+		unsigned char tag;
+		unsigned char in_arena;
+	} info;
+	long double align_ld;
+	long long align_ll;
+	void *align_ptr;
+};
+
+#ifdef BERGEN_ALLOC_STATS
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct alloc_stats totals;
+
+static size_t get_bucket(size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < ALLOC_NUM_BUCKETS - 1; i++) {
+		if (size <= (size_t) 16 << i)
+			break;
+	}
+	return i;
+}
+
+static void count_alloc(enum alloc_tag tag, size_t old_size, size_t size, int is_realloc)
+{
+	struct alloc_tag_stats *stats;
+
+	bergen_pthread_mutex_lock(&stats_lock);
+	stats = &totals.tags[tag];
+	if (is_realloc)
+		stats->reallocs++;
+	else
+		stats->allocs++;
+	stats->bytes += size;
+	stats->sizes[get_bucket(size)]++;
+
+	stats->live += size - old_size;
+	totals.live += size - old_size;
+	if (stats->live > stats->peak_live)
+		stats->peak_live = stats->live;
+	if (totals.live > totals.peak_live)
+		totals.peak_live = totals.live;
+	bergen_pthread_mutex_unlock(&stats_lock);
+}
+
+static void count_free(enum alloc_tag tag, size_t size)
+{
+	bergen_pthread_mutex_lock(&stats_lock);
+	totals.tags[tag].frees++;
+	totals.tags[tag].live -= size;
+	totals.live -= size;
+	bergen_pthread_mutex_unlock(&stats_lock);
+}
+
+void alloc_collect(struct alloc_stats *stats)
+{
+	bergen_pthread_mutex_lock(&stats_lock);
+	*stats = totals;
+	bergen_pthread_mutex_unlock(&stats_lock);
+}
+
+void alloc_reset_peak(void)
+{
+	size_t i;
+
+	bergen_pthread_mutex_lock(&stats_lock);
+	for (i = 0; i < ALLOC_NUM_TAGS; i++)
+		totals.tags[i].peak_live = totals.tags[i].live;
+	totals.peak_live = totals.live;
+	bergen_pthread_mutex_unlock(&stats_lock);
+}
+
+#else /* BERGEN_ALLOC_STATS */
+
+static void count_alloc(enum alloc_tag tag, size_t old_size, size_t size, int is_realloc)
+{
+	(void) tag;
+	(void) old_size;
+	(void) size;
+	(void) is_realloc;
+}
+
+static void count_free(enum alloc_tag tag, size_t size)
+{
+	(void) tag;
+	(void) size;
+}
+
+void alloc_collect(struct alloc_stats *stats)
+{
+	bergen_memset(stats, 0, sizeof(*stats));
+}
+
+void alloc_reset_peak(void)
+{
+}
+
+#endif /* BERGEN_ALLOC_STATS */
+
+/* Only what dies with the assembly may go in a session's arena */
+static struct arena *get_arena(enum alloc_tag tag)
+{
+#ifdef BERGEN_ARENA
+	switch (tag) {
+	case ALLOC_TAG_LABELS:
+	case ALLOC_TAG_TOKENS:
+	case ALLOC_TAG_MACROS:
+	case ALLOC_TAG_OBJECT:
+		return arena_current();
+
+	default:
+		return NULL;
+	}
+#else
+	(void) tag;
+	return NULL;
+#endif
+}
+
+/* The real allocator is called directly, everything else goes through libc.h */
+void *alloc_malloc(enum alloc_tag tag, size_t size)
+{
+	struct arena *arena = get_arena(tag);
+	union alloc_header *header;
+
+	if (arena)
+		header = arena_alloc(arena, sizeof(*header) + size);
+	else if (!(header = malloc(sizeof(*header) + size)))
+		return NULL;
+	header->info.size = size;
+	header->info.tag = tag;
+	header->info.in_arena = arena != NULL;
+
+	count_alloc(tag, 0, size, 0);
+	return header + 1;
+}
+
+/* A block keeps the tag it was first allocated with */
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size)
+{
+	union alloc_header *header, *new_header;
+	struct arena *arena;
+	size_t old_size;
+
+	if (!ptr)
+		return alloc_malloc(tag, size);
+
+	header = (union alloc_header *) ptr - 1;
+	old_size = header->info.size;
+	if (header->info.in_arena) {
+		/* Still in the session it was allocated in */
+		arena = arena_current();
+		if (!arena_resize(arena, header, sizeof(*header) + old_size, sizeof(*header) + size)) {
+			new_header = arena_alloc(arena, sizeof(*header) + size);
+			bergen_memcpy(new_header, header, sizeof(*header) + (old_size < size ? old_size : size));
+			header = new_header;
+		}
+	} else if (!(header = realloc(header, sizeof(*header) + size))) {
+		return NULL;
+	}
+	header->info.size = size;
+
+	count_alloc(header->info.tag, old_size, size, 1);
+	return header + 1;
+}
+
+void alloc_free(void *ptr)
+{
+	union alloc_header *header;
+	struct arena *arena;
+
+	if (!ptr)
+		return;
+
+	header = (union alloc_header *) ptr - 1;
+	count_free(header->info.tag, header->info.size);
+	if (!header->info.in_arena)
+		free(header);
+	else if ((arena = arena_current()))
+		arena_release(arena, header, sizeof(*header) + header->info.size);
+}
+
+char *alloc_strdup(enum alloc_tag tag, const char *s)
+{
+	size_t length = bergen_strlen(s);
+	char *buf = alloc_malloc(tag, length + 1);
+
+	bergen_memcpy(buf, s, length + 1);
+	return buf;
+}
+
+char *alloc_strndup(enum alloc_tag tag, const char *s, size_t n)
+{
+	char *buf = alloc_malloc(tag, n);
+
+	bergen_strncpy(buf, s, n);
+	return buf;
+}
+
+char *alloc_strndup_null(enum alloc_tag tag, const char *s, size_t n)
+{
+	char *buf = alloc_malloc(tag, n + 1);
+
+	bergen_strncpy(buf, s, n);
+	buf[n] = '\0';
+	return buf;
+}
+
+#else /* BERGEN_ALLOC_HOOKS */
+
+void *alloc_malloc(enum alloc_tag tag, size_t size)
+{
+	(void) tag;
+	return malloc(size);
+}
+
+void *alloc_realloc(enum alloc_tag tag, void *ptr, size_t size)
+{
+	(void) tag;
+	return realloc(ptr, size);
+}
+
+void alloc_free(void *ptr)
+{
+	free(ptr);
+}
+
+char *alloc_strdup(enum alloc_tag tag, const char *s)
+{
+	(void) tag;
+	return bergen_strdup(s);
+}
+
+char *alloc_strndup(enum alloc_tag tag, const char *s, size_t n)
+{
+	(void) tag;
+	return bergen_strndup(s, n);
+}
+
+char *alloc_strndup_null(enum alloc_tag tag, const char *s, size_t n)
+{
+	(void) tag;
+	return bergen_strndup_null(s, n);
+}
+
+void alloc_collect(struct alloc_stats *stats)
+{
+	bergen_memset(stats, 0, sizeof(*stats));
+}
+
+void alloc_reset_peak(void)
+{
+}
+
+#endif /* BERGEN_ALLOC_HOOKS */
+
+void alloc_print(const struct alloc_stats *stats, FILE *file)
+{
+	const struct alloc_tag_stats *tag;
+	size_t i, j;
+
+	bergen_fprintf(file, "%-8s %10s %10s %10s %12s %12s %12s\n", "memory", "allocs", "reallocs", "frees", "bytes", "live", "peak live");
+	for (i = 0; i < ALLOC_NUM_TAGS; i++) {
+		tag = &stats->tags[i];
+		bergen_fprintf(file, "%-8s %10llu %10llu %10llu %12llu %12llu %12llu\n", tag_names[i],
+			(unsigned long long) tag->allocs, (unsigned long long) tag->reallocs, (unsigned long long) tag->frees,
+			(unsigned long long) tag->bytes, (unsigned long long) tag->live, (unsigned long long) tag->peak_live);
+	}
+	bergen_fprintf(file, "%-8s %10s %10s %10s %12s %12llu %12llu\n", "total", "", "", "", "",
+		(unsigned long long) stats->live, (unsigned long long) stats->peak_live);
+
+	/* Sizes of allocs and reallocs, one column per bucket */
+	bergen_fprintf(file, "\n%-8s", "sizes");
+	for (j = 0; j < ALLOC_NUM_BUCKETS - 1; j++)
+		bergen_fprintf(file, " %7lu", (unsigned long) 16 << j);
+	bergen_fprintf(file, " %7s\n", "more");
+	for (i = 0; i < ALLOC_NUM_TAGS; i++) {
+		bergen_fprintf(file, "%-8s", tag_names[i]);
+		for (j = 0; j < ALLOC_NUM_BUCKETS; j++)
+			bergen_fprintf(file, " %7llu", (unsigned long long) stats->tags[i].sizes[j]);
+		bergen_fprintf(file, "\n");
+	}
+}
+
+void alloc_print_json(const struct alloc_stats *stats, FILE *file)
+{
+	const struct alloc_tag_stats *tag;
+	size_t i, j;
+
+	bergen_fprintf(file, "{\"live\": %llu, \"peak_live\": %llu, \"tags\": {",
+		(unsigned long long) stats->live, (unsigned long long) stats->peak_live);
+	for (i = 0; i < ALLOC_NUM_TAGS; i++) {
+		tag = &stats->tags[i];
+		bergen_fprintf(file, "%s\"%s\": {\"allocs\": %llu, \"reallocs\": %llu, \"frees\": %llu, \"bytes\": %llu, \"live\": %llu, \"peak_live\": %llu, \"sizes\": [",
+			i ? ", " : "", tag_names[i], (unsigned long long) tag->allocs, (unsigned long long) tag->reallocs, (unsigned long long) tag->frees,
+			(unsigned long long) tag->bytes, (unsigned long long) tag->live, (unsigned long long) tag->peak_live);
+		for (j = 0; j < ALLOC_NUM_BUCKETS; j++)
+			bergen_fprintf(file, "%s%llu", j ? ", " : "", (unsigned long long) tag->sizes[j]);
+		bergen_fprintf(file, "]}");
+	}
+	bergen_fprintf(file, "}}");
+}
@@ -0,0 +1,142 @@
+/*
+ * libbergen/arena.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/arena.h>
+
+#include <bergen/libc.h>
+
+#define ARENA_MIN_CHUNK_SIZE ((size_t) 64 * 1024)
+#define ARENA_MAX_CHUNK_SIZE ((size_t) 4 * 1024 * 1024)
+
+/* As aligned as anything malloc returns */
+union arena_align {
+	long double align_ld;
+	long long align_ll;
+	void *align_ptr;
+};
+
+#define ARENA_ALIGN (sizeof(union arena_align))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	union arena_align data[1];
+};
+
+static pthread_once_t session_once = PTHREAD_ONCE_INIT;
+static pthread_key_t session_key;
+
+void arena_init(struct arena *arena)
+{
+	arena->chunks = NULL;
+	arena->next = arena->end = NULL;
+	arena->chunk_size = ARENA_MIN_CHUNK_SIZE;
+}
+
+/* Chunks come straight from libc, bergen_malloc may be the arena itself */
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena_init(arena);
+}
+
+static size_t align_size(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+static void add_chunk(struct arena *arena, size_t size)
+{
+	size_t chunk_size = arena->chunk_size;
+	struct arena_chunk *chunk;
+
+	/* Big allocations get a chunk of their own size */
+	if (size > chunk_size)
+		chunk_size = size;
+	else if (arena->chunk_size < ARENA_MAX_CHUNK_SIZE)
+		arena->chunk_size *= 2;
+
+	chunk = malloc(offsetof(struct arena_chunk, data) + chunk_size);
+	if (!chunk)
+		abort();
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->next = (char *) chunk->data;
+	arena->end = arena->next + chunk_size;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	size = align_size(size ? size : 1);
+	if ((size_t) (arena->end - arena->next) < size)
+		add_chunk(arena, size);
+
+	arena->next += size;
+	return arena->next - size;
+}
+
+static int is_most_recent(const struct arena *arena, const void *ptr, size_t size)
+{
+	return (const char *) ptr + align_size(size ? size : 1) == arena->next;
+}
+
+int arena_resize(struct arena *arena, void *ptr, size_t old_size, size_t size)
+{
+	if (!is_most_recent(arena, ptr, old_size) || (size_t) (arena->end - (char *) ptr) < align_size(size ? size : 1))
+		return 0;
+
+	arena->next = (char *) ptr + align_size(size ? size : 1);
+	return 1;
+}
+
+void arena_release(struct arena *arena, void *ptr, size_t size)
+{
+	if (is_most_recent(arena, ptr, size))
+		arena->next = ptr;
+}
+
+static void create_session_key(void)
+{
+	bergen_pthread_key_create(&session_key, NULL);
+}
+
+void arena_begin_session(struct arena *arena)
+{
+	bergen_pthread_once(&session_once, create_session_key);
+	bergen_pthread_setspecific(session_key, arena);
+}
+
+void arena_end_session(void)
+{
+	bergen_pthread_setspecific(session_key, NULL);
+}
+
+struct arena *arena_current(void)
+{
+	bergen_pthread_once(&session_once, create_session_key);
+	return bergen_pthread_getspecific(session_key);
+}
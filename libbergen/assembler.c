@@ -0,0 +1,1095 @@
+/*
+ * libbergen/assembler.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/assembler.h>
+
+#include <bergen/expression.h>
+#include <bergen/libc.h>
+#include <bergen/parse.h>
+#include <bergen/pool.h>
+#include <bergen/preprocessor.h>
+#include <bergen/stats.h>
+#include <bergen/trace.h>
+#include <bergen/z80.h>
+
+#define ENCODE_CHUNK_SIZE 4096 /* Fixups or records encoded by one job */
+
+struct directive {
+	const char *name; /* Lower case */
+	struct error *(*handler)(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens);
+};
+
+void assembler_init(struct assembler *as, struct include_manager *im)
+{
+	as->im = im;
+	as->local_label_char = '_';
+	as->num_threads = 1;
+
+	label_list_init(&as->labels);
+
+	as->local_labels_buffer_size = 32;
+	as->local_labels = bergen_malloc(sizeof(*as->local_labels) * as->local_labels_buffer_size);
+	as->num_local_labels = 1;
+	label_list_init(&as->local_labels[0]);
+	as->region = 0;
+
+	object_output_init(&as->output);
+	include_file_list_init(&as->files);
+
+	/* Most programs have forward references, but a cached one never gets this far */
+	as->fixups = NULL;
+	as->fixups_buffer_size = 0;
+	as->num_fixups = 0;
+	as->fixup_programs = NULL;
+	as->fixup_programs_buffer_size = 0;
+	as->num_fixup_programs = 0;
+	as->fixup_operand = 0;
+	as->records = NULL;
+	as->records_buffer_size = 0;
+	as->num_records = 0;
+	as->record_data = NULL;
+	as->record_data_buffer_size = 0;
+	as->record_data_length = 0;
+	as->record_address = 0;
+	as->record_region = 0;
+	as->record_fixup = 0;
+	label_list_init(&as->changing_labels);
+	as->local_labels_change = 0;
+	as->address_changes = 0;
+
+	as->pass = 0;
+	as->address = 0;
+	as->ended = 0;
+	as->needs_second_pass = 0;
+}
+
+static void clear_fixups(struct assembler *as)
+{
+	size_t i;
+
+	for (i = 0; i < as->num_fixup_programs; i++)
+		expr_program_destroy(&as->fixup_programs[i].program);
+	as->num_fixup_programs = 0;
+	as->num_fixups = 0;
+}
+
+static void clear_records(struct assembler *as)
+{
+	as->num_records = 0;
+	as->record_data_length = 0;
+	label_list_destroy(&as->changing_labels);
+	label_list_init(&as->changing_labels);
+	as->local_labels_change = 0;
+	as->address_changes = 0;
+}
+
+void assembler_destroy(struct assembler *as)
+{
+	size_t i;
+
+	clear_fixups(as);
+	clear_records(as);
+	bergen_free(as->fixup_programs);
+	bergen_free(as->fixups);
+	bergen_free(as->records);
+	bergen_free(as->record_data);
+	label_list_destroy(&as->changing_labels);
+	include_file_list_destroy(&as->files);
+	object_output_destroy(&as->output);
+	for (i = 0; i < as->num_local_labels; i++)
+		label_list_destroy(&as->local_labels[i]);
+	bergen_free(as->local_labels);
+	label_list_destroy(&as->labels);
+}
+
+/* Like the preprocessor, points the error at its span if it is in the line */
+static struct error *locate_error(const struct stream_line *line, struct error *err)
+{
+	struct source_location location = line->location;
+
+	if (err->location.file != SOURCE_FILE_NONE)
+		return err;
+	if (err->str >= line->str && err->str < line->str + line->length)
+		location.offset += err->str - line->str;
+	error_set_location(err, location);
+	return err;
+}
+
+static int is_name(const struct lex_token *token, const char *lower)
+{
+	size_t i;
+
+	for (i = 0; i < token->length; i++) {
+		if (!lower[i] || bergen_tolower((unsigned char) token->str[i]) != lower[i])
+			return 0;
+	}
+	return !lower[i];
+}
+
+static size_t skip_space(const struct lex_token *tokens, size_t index, size_t num_tokens)
+{
+	while (index < num_tokens && tokens[index].type == LEX_TOKEN_TYPE_WHITESPACE)
+		index++;
+	return index;
+}
+
+/*
+ * Finds the next comma separated operand starting at *index, without the
+ * whitespace around it. Commas inside parentheses don't count. Returns 0 at
+ * the end of the line or at a comment.
+ */
+static int next_operand(const struct lex_token *tokens, size_t num_tokens, size_t *index, const struct lex_token **operand, size_t *length)
+{
+	size_t i = skip_space(tokens, *index, num_tokens), start = i, end, paren_levels = 0;
+
+	if (i >= num_tokens || tokens[i].type == LEX_TOKEN_TYPE_COMMENT)
+		return 0;
+
+	for (; i < num_tokens && tokens[i].type != LEX_TOKEN_TYPE_COMMENT; i++) {
+		if (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '('))
+			paren_levels++;
+		else if (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ')') && paren_levels > 0)
+			paren_levels--;
+		else if (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ',') && paren_levels == 0)
+			break;
+	}
+
+	end = i;
+	while (end > start && tokens[end - 1].type == LEX_TOKEN_TYPE_WHITESPACE)
+		end--;
+	*operand = tokens + start;
+	*length = end - start;
+
+	/* Step over the comma */
+	*index = i < num_tokens && lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ',') ? i + 1 : i;
+	return 1;
+}
+
+/* What evaluate() does with labels that aren't defined yet */
+enum forward {
+	FORWARD_NONE, /* The value decides addresses, so it's an error */
+	FORWARD_FIXUP, /* The value is output, so a fixup patches it later */
+	FORWARD_PASS, /* The value of an .equ, which only a second pass gets right */
+};
+
+/* Whether this pass records its lines for the second, instead of writing output */
+static int is_recording(const struct assembler *as)
+{
+	return as->pass == 1 && as->needs_second_pass;
+}
+
+static void start_recording(struct assembler *as)
+{
+	as->needs_second_pass = 1;
+	as->record_address = as->address;
+	as->record_region = as->region;
+	as->record_fixup = as->num_fixups;
+}
+
+/* Where the next byte goes, in the output or in record_data */
+static size_t get_offset(const struct assembler *as)
+{
+	return is_recording(as) ? as->record_data_length : object_output_get_offset(&as->output);
+}
+
+/* The program of the value just evaluated, if it got one */
+static size_t get_program(const struct assembler *as, size_t first_program)
+{
+	return as->num_fixup_programs > first_program ? first_program : ASSEMBLER_NO_PROGRAM;
+}
+
+/* The program is dropped if it references nothing, since the value is all there is */
+static struct error *add_fixup_program(struct assembler *as, struct expr_data *expr, const struct lex_token *tokens, size_t num_tokens, expr_value *value)
+{
+	struct assembler_fixup_program *program;
+	struct error *err;
+
+	if (as->num_fixup_programs >= as->fixup_programs_buffer_size) {
+		as->fixup_programs_buffer_size = as->fixup_programs_buffer_size ? as->fixup_programs_buffer_size * 2 : 32;
+		as->fixup_programs = bergen_realloc(as->fixup_programs, sizeof(*as->fixup_programs) * as->fixup_programs_buffer_size);
+	}
+
+	program = &as->fixup_programs[as->num_fixup_programs];
+	program->operand = as->fixup_operand;
+	expr_program_init(&program->program);
+	err = expr_compile_tokens(expr, tokens, num_tokens, &program->program, value);
+	if (err || program->program.num_references == 0)
+		expr_program_destroy(&program->program);
+	else
+		as->num_fixup_programs++;
+	return err;
+}
+
+/*
+ * While recording, anything that depends on a label or the address is kept as
+ * a program, which also gives the value for this pass. Constants need none.
+ */
+static struct error *evaluate_recorded(struct assembler *as, struct expr_data *expr, const struct lex_token *tokens, size_t num_tokens, enum forward forward, expr_value *value)
+{
+	struct expr_program *program;
+	struct error *err;
+	size_t first_program = as->num_fixup_programs;
+
+	expr->changing_labels = &as->changing_labels;
+	expr->local_labels_change = as->local_labels_change;
+	expr->location_counter_changes = as->address_changes;
+	if ((err = add_fixup_program(as, expr, tokens, num_tokens, value)) || as->num_fixup_programs == first_program)
+		return err;
+
+	program = &as->fixup_programs[first_program].program;
+	if (program->num_missing > 0) {
+		*value = 0;
+		/* Reports the label where it was named */
+		if (forward == FORWARD_NONE)
+			return expr_program_evaluate(program, expr->labels, expr->local_labels, expr->location_counter, value);
+	}
+	return NULL;
+}
+
+/*
+ * Labels defined further down are not known yet. Where forward allows it
+ * they count as 0, and the expression is either compiled for a fixup or,
+ * for an .equ, recorded along with every line after it for a second pass.
+ */
+static struct error *evaluate(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens, enum forward forward, expr_value *value)
+{
+	struct expr_data expr;
+	struct error *err;
+
+	expr_data_init(&expr, line->str, line->length, as->local_label_char);
+	expr.location = line->location;
+	expr.location_counter = as->address;
+	expr.labels = &as->labels;
+	expr.local_labels = &as->local_labels[as->region];
+
+	if (is_recording(as)) {
+		err = evaluate_recorded(as, &expr, tokens, num_tokens, forward, value);
+	} else {
+		err = expr_evaluate_tokens(&expr, tokens, num_tokens, value);
+		if (err && forward != FORWARD_NONE && error_get_code(err) == ERROR_LABEL_NOT_FOUND) {
+			error_free(err);
+			err = NULL;
+			*value = 0;
+			if (forward == FORWARD_PASS) {
+				start_recording(as);
+				err = evaluate_recorded(as, &expr, tokens, num_tokens, forward, value);
+			} else {
+				err = add_fixup_program(as, &expr, tokens, num_tokens, value);
+			}
+		}
+	}
+	expr_data_destroy(&expr);
+	return err;
+}
+
+/* Called before the line's output is emitted, if evaluating it added programs */
+static struct assembler_fixup *add_fixup(struct assembler *as, const struct stream_line *line, enum assembler_fixup_type type, size_t first_program)
+{
+	struct assembler_fixup *fixup;
+
+	if (as->num_fixups >= as->fixups_buffer_size) {
+		as->fixups_buffer_size = as->fixups_buffer_size ? as->fixups_buffer_size * 2 : 32;
+		as->fixups = bergen_realloc(as->fixups, sizeof(*as->fixups) * as->fixups_buffer_size);
+	}
+
+	fixup = &as->fixups[as->num_fixups++];
+	fixup->type = type;
+	fixup->offset = get_offset(as);
+	fixup->count = 1;
+	fixup->address = as->address;
+	fixup->location = line->location;
+	fixup->region = as->region;
+	fixup->mnemonic_length = 0;
+	fixup->num_operands = 0;
+	fixup->first_program = first_program;
+	fixup->num_programs = as->num_fixup_programs - first_program;
+	stats_count(STATS_COUNTER_FIXUPS, 1);
+	return fixup;
+}
+
+static void add_record_data(struct assembler *as, const void *data, size_t length)
+{
+	while (as->record_data_length + length > as->record_data_buffer_size) {
+		as->record_data_buffer_size = as->record_data_buffer_size ? as->record_data_buffer_size * 2 : 1024;
+		as->record_data = bergen_realloc(as->record_data, as->record_data_buffer_size);
+	}
+	bergen_memcpy(as->record_data + as->record_data_length, data, length);
+	as->record_data_length += length;
+}
+
+static struct assembler_record *add_record(struct assembler *as, enum assembler_record_type type, size_t program, expr_value value)
+{
+	struct assembler_record *record;
+
+	if (as->num_records >= as->records_buffer_size) {
+		as->records_buffer_size = as->records_buffer_size ? as->records_buffer_size * 2 : 256;
+		as->records = bergen_realloc(as->records, sizeof(*as->records) * as->records_buffer_size);
+	}
+
+	record = &as->records[as->num_records++];
+	record->type = type;
+	record->program = program;
+	record->value = value;
+	record->byte = 0;
+	record->data = 0;
+	record->length = 0;
+	record->offset = 0;
+	record->first_fixup = as->num_fixups;
+	record->num_fixups = 0;
+	return record;
+}
+
+/* So that what refers to it is evaluated again in the second pass */
+static void set_changing(struct assembler *as, const struct lex_token *label)
+{
+	if (label->str[0] == as->local_label_char)
+		as->local_labels_change = 1;
+	else if (!label_list_find_label(&as->changing_labels, label->str, label->length))
+		label_list_append(&as->changing_labels, label->str, label->length, 0);
+}
+
+static void add_label_record(struct assembler *as, enum assembler_record_type type, const struct lex_token *label, size_t program, expr_value value)
+{
+	struct assembler_record *record = add_record(as, type, program, value);
+
+	record->data = as->record_data_length;
+	record->length = label->length;
+	add_record_data(as, label->str, label->length);
+	if (program != ASSEMBLER_NO_PROGRAM || (type == ASSEMBLER_RECORD_TYPE_LABEL && as->address_changes))
+		set_changing(as, label);
+}
+
+/* A global label starts a new scope for local labels */
+static void start_region(struct assembler *as)
+{
+	as->region++;
+	if (as->region < as->num_local_labels)
+		return;
+
+	if (as->num_local_labels >= as->local_labels_buffer_size) {
+		as->local_labels_buffer_size *= 2;
+		as->local_labels = bergen_realloc(as->local_labels, sizeof(*as->local_labels) * as->local_labels_buffer_size);
+	}
+	label_list_init(&as->local_labels[as->num_local_labels++]);
+}
+
+static struct error *define_label(struct assembler *as, const char *name, size_t length, expr_value value)
+{
+	const char *str = name;
+	size_t str_length = length;
+	struct label_list *list = &as->labels;
+	struct label *label;
+
+	if (name[0] == as->local_label_char) {
+		list = &as->local_labels[as->region];
+		name++;
+		length--;
+	} else {
+		start_region(as);
+	}
+
+	label = label_list_find_label(list, name, length);
+	if (as->pass == 1) {
+		if (label)
+			return error_create_span(ERROR_DUPLICATE_LABEL, str, str_length);
+		label_list_append(list, name, length, value);
+	} else if (label) {
+		/* Values of .equs with forward references are only right now */
+		label->value = value;
+	}
+	return NULL;
+}
+
+static void emit(struct assembler *as, const void *data, size_t length)
+{
+	if (!is_recording(as))
+		object_output_write(&as->output, data, length);
+	else
+		add_record_data(as, data, length);
+	as->address += length;
+}
+
+static void set_address(struct assembler *as, expr_value address)
+{
+	if (!is_recording(as))
+		object_output_set_address(&as->output, address);
+	as->address = address;
+}
+
+/* The operand of .org and friends decides addresses, so it can't refer forward */
+static struct error *evaluate_single(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens, enum forward forward, expr_value *value)
+{
+	const struct lex_token *operand;
+	size_t index = 0, length;
+
+	if (!next_operand(tokens, num_tokens, &index, &operand, &length))
+		return error_create(ERROR_EXPECTED_EXPRESSION);
+	return evaluate(as, line, operand, length, forward, value);
+}
+
+static struct error *directive_org(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t first_program = as->num_fixup_programs;
+	struct error *err;
+	expr_value address;
+
+	if ((err = evaluate_single(as, line, tokens, num_tokens, FORWARD_NONE, &address)))
+		return err;
+	if (is_recording(as)) {
+		add_record(as, ASSEMBLER_RECORD_TYPE_ORG, get_program(as, first_program), address);
+		as->address_changes = get_program(as, first_program) != ASSEMBLER_NO_PROGRAM;
+	}
+	set_address(as, address);
+	return NULL;
+}
+
+static struct error *directive_block(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t first_program = as->num_fixup_programs;
+	struct error *err;
+	expr_value length;
+
+	if ((err = evaluate_single(as, line, tokens, num_tokens, FORWARD_NONE, &length)))
+		return err;
+	if (is_recording(as)) {
+		add_record(as, ASSEMBLER_RECORD_TYPE_BLOCK, get_program(as, first_program), length);
+		as->address_changes |= get_program(as, first_program) != ASSEMBLER_NO_PROGRAM;
+	}
+	set_address(as, as->address + length);
+	return NULL;
+}
+
+static struct error *directive_fill(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	const struct lex_token *operand;
+	size_t index = 0, length, count_program = as->num_fixup_programs, value_program;
+	struct assembler_record *record;
+	struct error *err;
+	expr_value count, value = 0xFF;
+	uint8_t byte;
+
+	if (!next_operand(tokens, num_tokens, &index, &operand, &length))
+		return error_create(ERROR_EXPECTED_EXPRESSION);
+	if ((err = evaluate(as, line, operand, length, FORWARD_NONE, &count)))
+		return err;
+	value_program = as->num_fixup_programs;
+	if (next_operand(tokens, num_tokens, &index, &operand, &length) && (err = evaluate(as, line, operand, length, FORWARD_FIXUP, &value)))
+		return err;
+	byte = value;
+
+	/* The count may change, so the second pass writes the bytes */
+	if (is_recording(as)) {
+		record = add_record(as, ASSEMBLER_RECORD_TYPE_FILL, value_program > count_program ? count_program : ASSEMBLER_NO_PROGRAM, count);
+		record->byte = byte;
+		record->data = as->record_data_length; /* Where the fixup thinks it goes */
+		as->address_changes |= value_program > count_program;
+		if (as->num_fixup_programs > value_program) {
+			add_fixup(as, line, ASSEMBLER_FIXUP_TYPE_BYTE, value_program);
+			record->num_fixups = 1;
+		}
+		as->address += count > 0 ? count : 0;
+		return NULL;
+	}
+
+	if (as->num_fixup_programs > value_program && count > 0)
+		add_fixup(as, line, ASSEMBLER_FIXUP_TYPE_BYTE, value_program)->count = count;
+	for (; count > 0; count--)
+		emit(as, &byte, 1);
+	return NULL;
+}
+
+static struct error *emit_string(struct assembler *as, const struct lex_token *token)
+{
+	uint8_t stack_buf[256], *buf = stack_buf;
+	size_t length = token->length;
+
+	if (length > sizeof(stack_buf))
+		buf = bergen_malloc(length);
+	if (!parse_string_data(token->str, token->length, buf, &length)) {
+		if (buf != stack_buf)
+			bergen_free(buf);
+		return error_create(ERROR_EXPECTED_STRING);
+	}
+
+	emit(as, buf, length);
+	if (buf != stack_buf)
+		bergen_free(buf);
+	return NULL;
+}
+
+static int is_in_range(expr_value value, size_t size)
+{
+	return value >= (size == 1 ? -128 : -32768) && value <= (size == 1 ? 0xFF : 0xFFFF);
+}
+
+/* .db and .byte take strings and expressions, .text only strings */
+static struct error *emit_data(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens, size_t size, int strings_only)
+{
+	const struct lex_token *operand;
+	size_t index = 0, length, first_program;
+	struct error *err;
+	expr_value value;
+	uint8_t buf[2];
+
+	while (next_operand(tokens, num_tokens, &index, &operand, &length)) {
+		if (length == 1 && operand->type == LEX_TOKEN_TYPE_STRING && size == 1) {
+			if ((err = emit_string(as, operand)))
+				return err;
+			continue;
+		}
+		if (strings_only)
+			return error_create(ERROR_EXPECTED_STRING);
+
+		first_program = as->num_fixup_programs;
+		if ((err = evaluate(as, line, operand, length, FORWARD_FIXUP, &value)))
+			return err;
+		if (as->num_fixup_programs > first_program)
+			add_fixup(as, line, size == 1 ? ASSEMBLER_FIXUP_TYPE_BYTE : ASSEMBLER_FIXUP_TYPE_WORD, first_program);
+		else if (!is_in_range(value, size))
+			return error_create_value(ERROR_VALUE_OUT_OF_RANGE, value);
+		buf[0] = value;
+		buf[1] = value >> 8;
+		emit(as, buf, size);
+	}
+	return NULL;
+}
+
+static struct error *directive_byte(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	return emit_data(as, line, tokens, num_tokens, 1, 0);
+}
+
+static struct error *directive_word(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	return emit_data(as, line, tokens, num_tokens, 2, 0);
+}
+
+static struct error *directive_text(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	return emit_data(as, line, tokens, num_tokens, 1, 1);
+}
+
+static struct error *directive_end(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	as->ended = 1;
+	return NULL;
+}
+
+static const struct directive DIRECTIVES[] = {
+	{"block",	directive_block},
+	{"byte",	directive_byte},
+	{"db",		directive_byte},
+	{"ds",		directive_block},
+	{"dw",		directive_word},
+	{"end",		directive_end},
+	{"fill",	directive_fill},
+	{"org",		directive_org},
+	{"text",	directive_text},
+	{"word",	directive_word},
+};
+
+static struct error *assemble_directive(struct assembler *as, const struct stream_line *line, const struct lex_token *name, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(DIRECTIVES) / sizeof(*DIRECTIVES); i++) {
+		if (is_name(name, DIRECTIVES[i].name))
+			return DIRECTIVES[i].handler(as, line, tokens, num_tokens);
+	}
+	return error_create_span(ERROR_UNKNOWN_DIRECTIVE, name->str, name->length);
+}
+
+static struct error *parse_operand(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens, struct z80_operand *op)
+{
+	enum z80_register reg;
+	size_t i;
+
+	/* AF' is lexed as AF followed by a quote */
+	if (num_tokens == 2 && tokens[0].type == LEX_TOKEN_TYPE_IDENTIFIER && lex_token_is(&tokens[1], LEX_TOKEN_TYPE_OPERATOR, '\'')
+			&& z80_find_register(tokens[0].str, tokens[0].length) == Z80_REGISTER_AF) {
+		op->type = Z80_OPERAND_TYPE_REGISTER;
+		op->reg = Z80_REGISTER_AF_ALT;
+		return NULL;
+	}
+
+	if (num_tokens == 1 && tokens[0].type == LEX_TOKEN_TYPE_IDENTIFIER && (reg = z80_find_register(tokens[0].str, tokens[0].length)) != Z80_REGISTER_NONE) {
+		op->type = Z80_OPERAND_TYPE_REGISTER;
+		op->reg = reg;
+		return NULL;
+	}
+
+	if (num_tokens >= 2 && lex_token_is(&tokens[0], LEX_TOKEN_TYPE_OPERATOR, '(') && lex_token_is(&tokens[num_tokens - 1], LEX_TOKEN_TYPE_OPERATOR, ')')) {
+		/* Only parentheses around the whole operand make it indirect, not "(1 + 2) * 3" */
+		size_t paren_levels = 0;
+
+		for (i = 0; i < num_tokens - 1; i++) {
+			if (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '('))
+				paren_levels++;
+			else if (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ')') && --paren_levels == 0)
+				break;
+		}
+
+		if (i == num_tokens - 1) {
+			tokens++;
+			num_tokens -= 2;
+			i = skip_space(tokens, 0, num_tokens);
+			while (num_tokens > i && tokens[num_tokens - 1].type == LEX_TOKEN_TYPE_WHITESPACE)
+				num_tokens--;
+
+			if (i < num_tokens && tokens[i].type == LEX_TOKEN_TYPE_IDENTIFIER && (reg = z80_find_register(tokens[i].str, tokens[i].length)) != Z80_REGISTER_NONE) {
+				op->type = Z80_OPERAND_TYPE_INDIRECT_REGISTER;
+				op->reg = reg;
+				op->value = 0;
+
+				/* (IX+d) and (IY-d) */
+				i = skip_space(tokens, i + 1, num_tokens);
+				if (i >= num_tokens)
+					return NULL;
+				if ((reg != Z80_REGISTER_IX && reg != Z80_REGISTER_IY) || !(lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '+') || lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '-')))
+					return error_create(ERROR_INVALID_OPERANDS);
+				if (tokens[i].str[0] == '+')
+					i++;
+				return evaluate(as, line, tokens + i, num_tokens - i, FORWARD_FIXUP, &op->value);
+			}
+
+			op->type = Z80_OPERAND_TYPE_INDIRECT;
+			return evaluate(as, line, tokens, num_tokens, FORWARD_FIXUP, &op->value);
+		}
+	}
+
+	op->type = Z80_OPERAND_TYPE_IMMEDIATE;
+	return evaluate(as, line, tokens, num_tokens, FORWARD_FIXUP, &op->value);
+}
+
+static struct error *assemble_instruction(struct assembler *as, const struct stream_line *line, const struct lex_token *mnemonic, const struct lex_token *tokens, size_t num_tokens)
+{
+	struct z80_operand ops[ASSEMBLER_MAX_OPERANDS];
+	const struct lex_token *operand;
+	size_t index = 0, length, num_ops = 0, first_program = as->num_fixup_programs;
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	struct assembler_fixup *fixup;
+	struct error *err;
+
+	while (next_operand(tokens, num_tokens, &index, &operand, &length)) {
+		if (num_ops >= ASSEMBLER_MAX_OPERANDS || length == 0)
+			return error_create_span(ERROR_INVALID_OPERANDS, mnemonic->str, mnemonic->length);
+		as->fixup_operand = num_ops;
+		if ((err = parse_operand(as, line, operand, length, &ops[num_ops++]))) {
+			if (error_get_code(err) == ERROR_INVALID_OPERANDS) {
+				error_free(err);
+				return error_create_span(ERROR_INVALID_OPERANDS, mnemonic->str, mnemonic->length);
+			}
+			return err;
+		}
+	}
+
+	err = z80_encode(mnemonic->str, mnemonic->length, ops, num_ops, as->address, buf, &length);
+	if (err && (is_recording(as) || as->num_fixup_programs > first_program) && error_get_code(err) == ERROR_VALUE_OUT_OF_RANGE) {
+		/* Values can still change, the length can't */
+		error_free(err);
+		err = NULL;
+	}
+	if (err)
+		return err;
+
+	/* Relative jumps depend on the address, which the second pass may change */
+	if (as->num_fixup_programs > first_program || (is_recording(as) && as->address_changes && z80_is_relative(mnemonic->str, mnemonic->length))) {
+		/* The mnemonic was found, so it fits */
+		fixup = add_fixup(as, line, ASSEMBLER_FIXUP_TYPE_INSTRUCTION, first_program);
+		bergen_memcpy(fixup->mnemonic, mnemonic->str, mnemonic->length);
+		fixup->mnemonic_length = mnemonic->length;
+		bergen_memcpy(fixup->operands, ops, sizeof(*ops) * num_ops);
+		fixup->num_operands = num_ops;
+	}
+
+	emit(as, buf, length);
+	return NULL;
+}
+
+/* A directive or an instruction */
+static struct error *assemble_statement(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	if (lex_token_is(&tokens[0], LEX_TOKEN_TYPE_OPERATOR, '.') && num_tokens > 1 && tokens[1].type == LEX_TOKEN_TYPE_IDENTIFIER)
+		return assemble_directive(as, line, &tokens[1], tokens + 2, num_tokens - 2);
+
+	if (tokens[0].type != LEX_TOKEN_TYPE_IDENTIFIER)
+		return error_create_span(ERROR_UNKNOWN_INSTRUCTION, tokens[0].str, tokens[0].length);
+	return assemble_instruction(as, line, &tokens[0], tokens + 1, num_tokens - 1);
+}
+
+/* What the statement emitted is a record of its own, with the fixups that patch it */
+static struct error *assemble_recorded_statement(struct assembler *as, const struct stream_line *line, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t data = as->record_data_length, first_fixup = as->num_fixups;
+	struct assembler_record *record;
+	struct error *err;
+
+	if ((err = assemble_statement(as, line, tokens, num_tokens)))
+		return err;
+	if (as->record_data_length > data) {
+		record = add_record(as, ASSEMBLER_RECORD_TYPE_DATA, ASSEMBLER_NO_PROGRAM, 0);
+		record->data = data;
+		record->length = as->record_data_length - data;
+		record->first_fixup = first_fixup;
+		record->num_fixups = as->num_fixups - first_fixup;
+	}
+	return NULL;
+}
+
+static struct error *assemble_line(struct assembler *as, const struct stream_line *line)
+{
+	const struct lex_token *tokens = line->tokens, *label = NULL;
+	size_t num_tokens = line->num_tokens, i, first_program;
+	struct error *err;
+	expr_value value;
+
+	/* Labels start in the first column, or anywhere when followed by ':' */
+	i = skip_space(tokens, 0, num_tokens);
+	if (i < num_tokens && tokens[i].type == LEX_TOKEN_TYPE_IDENTIFIER
+			&& (i == 0 || (i + 1 < num_tokens && lex_token_is(&tokens[i + 1], LEX_TOKEN_TYPE_OPERATOR, ':')))) {
+		label = &tokens[i++];
+		if (i < num_tokens && lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ':'))
+			i++;
+	}
+	i = skip_space(tokens, i, num_tokens);
+
+	/* "label = value" and "label .equ value" */
+	if (i < num_tokens && (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '=')
+			|| (lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '.') && i + 1 < num_tokens && is_name(&tokens[i + 1], "equ")))) {
+		i += tokens[i].str[0] == '=' ? 1 : 2;
+		if (!label)
+			return error_create_span(ERROR_EXPECTED_NAME, tokens[i - 1].str, tokens[i - 1].length);
+		first_program = as->num_fixup_programs;
+		if ((err = evaluate_single(as, line, tokens + i, num_tokens - i, FORWARD_PASS, &value)))
+			return err;
+		if (is_recording(as))
+			add_label_record(as, ASSEMBLER_RECORD_TYPE_EQU, label, get_program(as, first_program), value);
+		return define_label(as, label->str, label->length, value);
+	}
+
+	if (label) {
+		if (is_recording(as))
+			add_label_record(as, ASSEMBLER_RECORD_TYPE_LABEL, label, ASSEMBLER_NO_PROGRAM, 0);
+		if ((err = define_label(as, label->str, label->length, as->address)))
+			return err;
+	}
+
+	if (i >= num_tokens || tokens[i].type == LEX_TOKEN_TYPE_COMMENT)
+		return NULL;
+
+	if (!is_recording(as))
+		return assemble_statement(as, line, tokens + i, num_tokens - i);
+	return assemble_recorded_statement(as, line, tokens + i, num_tokens - i);
+}
+
+static struct error *next_line(struct line_stream *stream, const struct stream_line **line)
+{
+	struct error *err;
+
+	stats_phase_begin(STATS_PHASE_PREPROCESS);
+	err = line_stream_next(stream, line);
+	stats_phase_end();
+	return err;
+}
+
+/* Reads, expands and assembles the source */
+static struct error *run_first_pass(struct assembler *as, const struct include_file *file)
+{
+	struct preprocessor pp;
+	struct line_stream stream;
+	const struct stream_line *line;
+	struct error *err = NULL;
+	uint64_t start;
+
+	as->pass = 1;
+	as->address = 0;
+	as->region = 0;
+	as->ended = 0;
+
+	/* Constant #defines come back as they are defined again */
+	label_list_remove_type(&as->labels, LABEL_TYPE_CONSTANT);
+
+	preprocessor_init(&pp, &as->labels);
+	pp.local_label_char = as->local_label_char;
+	line_stream_init(&stream, &pp, as->im);
+	stream.files = &as->files;
+	start = trace_begin();
+	line_stream_push(&stream, file);
+
+	stats_phase_begin(STATS_PHASE_PASS1);
+	while (!as->ended && !(err = next_line(&stream, &line)) && line) {
+		stats_count(STATS_COUNTER_LINES, 1);
+		if ((err = assemble_line(as, line))) {
+			locate_error(line, err);
+			break;
+		}
+		profile_line(line->profile_start, line->location, line->from);
+	}
+	stats_phase_end();
+
+	line_stream_destroy(&stream);
+	preprocessor_destroy(&pp);
+	trace_end(start, TRACE_CATEGORY_PHASE, "pass1", 5);
+	return err;
+}
+
+static struct error *record_value(struct assembler *as, const struct assembler_record *record, expr_value *value)
+{
+	if (record->program == ASSEMBLER_NO_PROGRAM) {
+		*value = record->value;
+		return NULL;
+	}
+	return expr_program_evaluate(&as->fixup_programs[record->program].program, &as->labels, &as->local_labels[as->region], as->address, value);
+}
+
+/*
+ * Makes room in the output for length bytes of record. Its fixups were made
+ * for record_data, now they go where it will be written.
+ */
+static void place_record(struct assembler *as, struct assembler_record *record, size_t length)
+{
+	struct assembler_fixup *fixup;
+	size_t i;
+
+	record->offset = object_output_reserve(&as->output, length);
+	for (i = 0; i < record->num_fixups; i++) {
+		fixup = &as->fixups[record->first_fixup + i];
+		fixup->offset = record->offset + fixup->offset - record->data;
+		fixup->address = as->address + fixup->offset - record->offset;
+		if (record->type == ASSEMBLER_RECORD_TYPE_FILL)
+			fixup->count = length;
+	}
+	as->address += length;
+}
+
+/* Goes over the records of the first pass, with its labels, leaving the bytes for encode() */
+static struct error *run_second_pass(struct assembler *as)
+{
+	struct assembler_record *record;
+	struct error *err = NULL;
+	expr_value value;
+	uint64_t start = trace_begin();
+	size_t i;
+
+	as->pass = 2;
+	as->address = as->record_address;
+	as->region = as->record_region;
+
+	stats_phase_begin(STATS_PHASE_PASS2);
+	for (i = 0; i < as->num_records && !err; i++) {
+		record = &as->records[i];
+		switch (record->type) {
+		case ASSEMBLER_RECORD_TYPE_LABEL:
+			err = define_label(as, (const char *) as->record_data + record->data, record->length, as->address);
+			break;
+
+		case ASSEMBLER_RECORD_TYPE_EQU:
+			if (!(err = record_value(as, record, &value)))
+				err = define_label(as, (const char *) as->record_data + record->data, record->length, value);
+			break;
+
+		case ASSEMBLER_RECORD_TYPE_ORG:
+			if (!(err = record_value(as, record, &value)))
+				set_address(as, value);
+			break;
+
+		case ASSEMBLER_RECORD_TYPE_BLOCK:
+			if (!(err = record_value(as, record, &value)))
+				set_address(as, as->address + value);
+			break;
+
+		case ASSEMBLER_RECORD_TYPE_FILL:
+			if ((err = record_value(as, record, &value)))
+				break;
+			record->length = value > 0 ? value : 0;
+			place_record(as, record, record->length);
+			break;
+
+		case ASSEMBLER_RECORD_TYPE_DATA:
+			place_record(as, record, record->length);
+			break;
+		}
+	}
+	stats_phase_end();
+
+	trace_end(start, TRACE_CATEGORY_PHASE, "pass2", 5);
+	return err;
+}
+
+/* Every label is known by now, so the value of the fixup can be worked out */
+static struct error *apply_fixup(struct assembler *as, const struct assembler_fixup *fixup)
+{
+	struct assembler_fixup_program *program;
+	struct z80_operand ops[ASSEMBLER_MAX_OPERANDS];
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	size_t i, length;
+	struct error *err;
+	expr_value value = 0;
+
+	bergen_memcpy(ops, fixup->operands, sizeof(*ops) * fixup->num_operands);
+	for (i = 0; i < fixup->num_programs; i++) {
+		program = &as->fixup_programs[fixup->first_program + i];
+		if ((err = expr_program_evaluate(&program->program, &as->labels, &as->local_labels[fixup->region], fixup->address, &value)))
+			return err;
+		ops[program->operand].value = value;
+	}
+
+	if (fixup->type == ASSEMBLER_FIXUP_TYPE_INSTRUCTION) {
+		err = z80_encode(fixup->mnemonic, fixup->mnemonic_length, ops, fixup->num_operands, fixup->address, buf, &length);
+	} else {
+		length = fixup->type == ASSEMBLER_FIXUP_TYPE_BYTE ? 1 : 2;
+		err = is_in_range(value, length) ? NULL : error_create_value(ERROR_VALUE_OUT_OF_RANGE, value);
+		buf[0] = value;
+		buf[1] = value >> 8;
+	}
+	if (err) {
+		error_set_location(err, fixup->location);
+		return err;
+	}
+
+	for (i = 0; i < fixup->count; i++)
+		object_output_patch(&as->output, fixup->offset + i * length, buf, length);
+	return NULL;
+}
+
+/* Writes the bytes of a FILL or DATA record where the second pass put them, then its fixups */
+static struct error *encode_record(struct assembler *as, const struct assembler_record *record)
+{
+	uint8_t buf[256];
+	size_t i, length;
+	struct error *err;
+
+	if (record->type == ASSEMBLER_RECORD_TYPE_DATA) {
+		object_output_patch(&as->output, record->offset, as->record_data + record->data, record->length);
+	} else if (record->type == ASSEMBLER_RECORD_TYPE_FILL) {
+		bergen_memset(buf, record->byte, sizeof(buf));
+		for (i = 0; i < record->length; i += length) {
+			length = record->length - i < sizeof(buf) ? record->length - i : sizeof(buf);
+			object_output_patch(&as->output, record->offset + i, buf, length);
+		}
+	}
+
+	for (i = 0; i < record->num_fixups; i++) {
+		if ((err = apply_fixup(as, &as->fixups[record->first_fixup + i])))
+			return err;
+	}
+	return NULL;
+}
+
+/* A share of encode(), which touches no part of the output that another one does */
+struct encode_chunk {
+	size_t begin, end;
+	int is_records; /* Else fixups of lines that weren't recorded */
+	struct error *err;
+};
+
+struct encode_data {
+	struct assembler *as;
+	struct encode_chunk *chunks;
+};
+
+static void encode_chunk(void *data, size_t index)
+{
+	struct encode_data *encode = data;
+	struct encode_chunk *chunk = &encode->chunks[index];
+	struct assembler *as = encode->as;
+	uint64_t start = trace_begin();
+	size_t i;
+
+	stats_phase_begin(STATS_PHASE_PASS2);
+	for (i = chunk->begin; i < chunk->end && !chunk->err; i++) {
+		if (chunk->is_records)
+			chunk->err = encode_record(as, &as->records[i]);
+		else
+			chunk->err = apply_fixup(as, &as->fixups[i]);
+	}
+	stats_phase_end();
+	trace_end(start, TRACE_CATEGORY_PHASE, "encode", 6);
+}
+
+static size_t add_chunks(struct encode_chunk *chunks, size_t begin, size_t end, int is_records)
+{
+	size_t num_chunks = 0;
+
+	for (; begin < end; begin += ENCODE_CHUNK_SIZE) {
+		chunks[num_chunks].begin = begin;
+		chunks[num_chunks].end = end - begin < ENCODE_CHUNK_SIZE ? end : begin + ENCODE_CHUNK_SIZE;
+		chunks[num_chunks].is_records = is_records;
+		chunks[num_chunks].err = NULL;
+		num_chunks++;
+	}
+	return num_chunks;
+}
+
+/*
+ * Applies the fixups of the lines that weren't recorded, and writes out the
+ * records with theirs, on as->num_threads threads. The chunks are in the
+ * order of their fixups, so the first error is the one a single thread
+ * would have found.
+ */
+static struct error *encode(struct assembler *as)
+{
+	struct encode_data encode;
+	struct error *err = NULL;
+	size_t num_fixups = as->needs_second_pass ? as->record_fixup : as->num_fixups;
+	size_t num_chunks, i;
+
+	encode.as = as;
+	encode.chunks = bergen_malloc(sizeof(*encode.chunks) * ((num_fixups + as->num_records) / ENCODE_CHUNK_SIZE + 2));
+	num_chunks = add_chunks(encode.chunks, 0, num_fixups, 0);
+	num_chunks += add_chunks(encode.chunks + num_chunks, 0, as->num_records, 1);
+
+	thread_pool_run(as->num_threads, num_chunks, encode_chunk, &encode);
+
+	for (i = 0; i < num_chunks; i++) {
+		if (!err)
+			err = encode.chunks[i].err;
+		else
+			error_free(encode.chunks[i].err);
+	}
+	bergen_free(encode.chunks);
+	return err;
+}
+
+struct error *assembler_assemble(struct assembler *as, const struct include_file *file)
+{
+	struct error *err;
+
+	include_file_list_clear(&as->files);
+	clear_fixups(as);
+	clear_records(as);
+	as->needs_second_pass = 0;
+
+	err = run_first_pass(as, file);
+	if (!err && as->needs_second_pass)
+		err = run_second_pass(as);
+	if (!err)
+		err = encode(as);
+
+	/* Errors may point at names in the programs, which go with them */
+	if (err)
+		error_get_message(err);
+	clear_fixups(as);
+	clear_records(as);
+	return err;
+}
@@ -0,0 +1,305 @@
+/*
+ * libbergen/cache.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/cache.h>
+
+#include <bergen/hash.h>
+#include <bergen/libc.h>
+#include <bergen/stats.h>
+#include <bergen/stream.h>
+#include <bergen/version.h>
+
+#define CACHE_MAGIC "bergen-cache 2\n"
+
+/* Compared a piece at a time, so a hit doesn't need a second copy of the key */
+#define CACHE_COMPARE_SIZE 4096
+
+void object_cache_init(struct object_cache *cache, const char *dir)
+{
+	cache->dir = bergen_strdup(dir);
+}
+
+void object_cache_destroy(struct object_cache *cache)
+{
+	bergen_free(cache->dir);
+}
+
+void object_cache_key_init(struct object_cache_key *key)
+{
+	key->hash = HASH64_INIT;
+	key->data = NULL;
+	key->length = 0;
+	key->capacity = 0;
+}
+
+void object_cache_key_destroy(struct object_cache_key *key)
+{
+	bergen_free(key->data);
+}
+
+static void add_key(struct object_cache_key *key, const void *data, size_t length)
+{
+	if (length == 0)
+		return;
+	key->hash = hash64_update(key->hash, data, length);
+	if (key->length + length > key->capacity) {
+		if (key->capacity == 0)
+			key->capacity = 256;
+		while (key->length + length > key->capacity)
+			key->capacity *= 2;
+		key->data = bergen_realloc(key->data, key->capacity);
+	}
+	bergen_memcpy(key->data + key->length, data, length);
+	key->length += length;
+}
+
+struct error *object_cache_make_key(struct include_manager *im, const struct include_file *file, struct include_file_list *files, struct object_cache_key *key)
+{
+	struct preprocessor pp;
+	struct line_stream stream;
+	const struct stream_line *line;
+	struct error *err;
+	size_t i;
+
+	key->hash = HASH64_INIT;
+	key->length = 0;
+	add_key(key, BERGEN_VERSION, sizeof(BERGEN_VERSION));
+
+	/* Without labels, constant #defines are expanded like any other macro */
+	preprocessor_init(&pp, NULL);
+	line_stream_init(&stream, &pp, im);
+	stream.files = files;
+	line_stream_push(&stream, file);
+
+	stats_phase_begin(STATS_PHASE_PREPROCESS);
+	/* Labels are in the raw line, everything else in the expanded tokens */
+	while (!(err = line_stream_next(&stream, &line)) && line) {
+		add_key(key, &line->length, sizeof(line->length));
+		add_key(key, line->str, line->length);
+		add_key(key, &line->num_tokens, sizeof(line->num_tokens));
+		for (i = 0; i < line->num_tokens; i++) {
+			add_key(key, &line->tokens[i].type, sizeof(line->tokens[i].type));
+			add_key(key, &line->tokens[i].length, sizeof(line->tokens[i].length));
+			add_key(key, line->tokens[i].str, line->tokens[i].length);
+		}
+	}
+	stats_phase_end();
+
+	line_stream_destroy(&stream);
+	preprocessor_destroy(&pp);
+	return err;
+}
+
+/* "dir/ab/cdef...", a level of directories keeps each one small */
+static void entry_path(const struct object_cache *cache, uint64_t hash, char *path, size_t size)
+{
+	bergen_snprintf(path, size, "%s/%02x/%014" PRIx64, cache->dir, (unsigned int) (hash >> 56), (uint64_t) (hash & 0xFFFFFFFFFFFFFFull));
+}
+
+static int read_u64(FILE *file, uint64_t *value)
+{
+	unsigned char buf[8];
+	int i;
+
+	if (bergen_fread(buf, 1, sizeof(buf), file) != sizeof(buf))
+		return 0;
+	*value = 0;
+	for (i = 0; i < 8; i++)
+		*value = *value << 8 | buf[i];
+	return 1;
+}
+
+static void write_u64(FILE *file, uint64_t value)
+{
+	unsigned char buf[8];
+	int i;
+
+	for (i = 7; i >= 0; i--) {
+		buf[i] = value;
+		value >>= 8;
+	}
+	bergen_fwrite(buf, 1, sizeof(buf), file);
+}
+
+static int read_key(FILE *file, const struct object_cache_key *key)
+{
+	char buf[CACHE_COMPARE_SIZE];
+	uint64_t length;
+	size_t offset, size;
+
+	if (!read_u64(file, &length) || length != key->length)
+		return 0;
+	for (offset = 0; offset < key->length; offset += size) {
+		size = key->length - offset < sizeof(buf) ? key->length - offset : sizeof(buf);
+		if (bergen_fread(buf, 1, size, file) != size || bergen_memcmp(buf, key->data + offset, size))
+			return 0;
+	}
+	return 1;
+}
+
+/* Nothing in an entry can be longer than the entry, whatever it claims */
+static int read_data(FILE *file, uint64_t max_length, char **buf, size_t *buf_size, uint64_t *length)
+{
+	char *new_buf;
+
+	if (!read_u64(file, length) || *length > max_length)
+		return 0;
+	if (*length > *buf_size) {
+		if (!(new_buf = bergen_realloc(*buf, *length)))
+			return 0;
+		*buf = new_buf;
+		*buf_size = *length;
+	}
+	return bergen_fread(*buf, 1, *length, file) == *length;
+}
+
+static int read_entry(FILE *file, const struct object_cache_key *key, struct object_output *output, struct label_list *labels)
+{
+	char magic[sizeof(CACHE_MAGIC) - 1], *buf = NULL;
+	uint64_t count, address, length, value, max_length;
+	size_t buf_size = 0;
+	struct stat st;
+	int ok = 0;
+
+	if (bergen_fstat(bergen_fileno(file), &st) || st.st_size < 0)
+		return 0;
+	max_length = st.st_size;
+
+	if (bergen_fread(magic, 1, sizeof(magic), file) != sizeof(magic) || bergen_memcmp(magic, CACHE_MAGIC, sizeof(magic)))
+		return 0;
+	if (!read_key(file, key))
+		return 0;
+
+	/* Segments: address, length and data */
+	if (!read_u64(file, &count))
+		return 0;
+	for (; count > 0; count--) {
+		if (!read_u64(file, &address) || !read_data(file, max_length, &buf, &buf_size, &length))
+			goto done;
+		object_output_set_address(output, (expr_value) address);
+		object_output_write(output, buf, length);
+	}
+
+	/* Labels: name length, name and value */
+	if (!read_u64(file, &count))
+		goto done;
+	for (; count > 0; count--) {
+		if (!read_data(file, max_length, &buf, &buf_size, &length) || !read_u64(file, &value))
+			goto done;
+		label_list_append(labels, buf, length, (expr_value) value);
+	}
+
+	/* Anything after the labels means this isn't what was written */
+	ok = bergen_fgetc(file) == EOF;
+
+done:
+	bergen_free(buf);
+	return ok;
+}
+
+int object_cache_load(const struct object_cache *cache, const struct object_cache_key *key, struct object_output *output, struct label_list *labels)
+{
+	char path[PATH_MAX];
+	struct object_output loaded_output;
+	struct label_list loaded_labels;
+	FILE *file;
+	size_t i;
+	int ok;
+
+	entry_path(cache, key->hash, path, sizeof(path));
+	if (!(file = bergen_fopen(path, "rb")))
+		return 0;
+
+	/* Nothing is touched unless the whole entry is good */
+	object_output_init(&loaded_output);
+	label_list_init(&loaded_labels);
+	ok = read_entry(file, key, &loaded_output, &loaded_labels);
+	bergen_fclose(file);
+
+	if (ok) {
+		object_output_destroy(output);
+		*output = loaded_output;
+		for (i = 0; i < loaded_labels.num_labels; i++)
+			label_list_append_copy(labels, &loaded_labels.labels[i]);
+	} else {
+		object_output_destroy(&loaded_output);
+	}
+	label_list_destroy(&loaded_labels);
+	return ok;
+}
+
+struct error *object_cache_store(const struct object_cache *cache, const struct object_cache_key *key, const struct object_output *output, const struct label_list *labels)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	const struct object_segment *segment;
+	const struct label *label;
+	uint64_t num_labels = 0;
+	size_t i, length;
+	FILE *file;
+	int fd;
+
+	entry_path(cache, key->hash, path, sizeof(path));
+	bergen_mkdir(cache->dir, 0777);
+	length = bergen_strrchr(path, '/') - path;
+	bergen_snprintf(tmp, sizeof(tmp), "%.*s", (int) length, path);
+	bergen_mkdir(tmp, 0777);
+
+	bergen_snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if ((fd = bergen_mkstemp(tmp)) < 0)
+		return error_create_span_value(ERROR_IO, cache->dir, bergen_strlen(cache->dir), errno);
+	if (!(file = bergen_fdopen(fd, "wb"))) {
+		bergen_close(fd);
+		bergen_unlink(tmp);
+		return error_create_span_value(ERROR_IO, cache->dir, bergen_strlen(cache->dir), errno);
+	}
+
+	bergen_fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC) - 1, file);
+	write_u64(file, key->length);
+	bergen_fwrite(key->data, 1, key->length, file);
+	write_u64(file, output->num_segments);
+	for (i = 0; i < output->num_segments; i++) {
+		segment = &output->segments[i];
+		length = object_output_get_segment_length(output, segment);
+		write_u64(file, (uint64_t) segment->address);
+		write_u64(file, length);
+		bergen_fwrite(object_output_get_segment_ptr(output, segment), 1, length, file);
+	}
+
+	for (i = 0; i < labels->num_labels; i++)
+		num_labels += labels->labels[i].type == LABEL_TYPE_LABEL;
+	write_u64(file, num_labels);
+	for (i = 0; i < labels->num_labels; i++) {
+		label = &labels->labels[i];
+		if (label->type != LABEL_TYPE_LABEL)
+			continue;
+		write_u64(file, label->length);
+		bergen_fwrite(label->name, 1, label->length, file);
+		write_u64(file, (uint64_t) label->value);
+	}
+
+	if (bergen_ferror(file) | bergen_fclose(file) || bergen_rename(tmp, path)) {
+		bergen_unlink(tmp);
+		return error_create_span_value(ERROR_IO, cache->dir, bergen_strlen(cache->dir), errno);
+	}
+	return NULL;
+}
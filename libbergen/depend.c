@@ -0,0 +1,168 @@
+/*
+ * libbergen/depend.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/depend.h>
+
+#include <bergen/hash.h>
+#include <bergen/libc.h>
+#include <bergen/version.h>
+
+#define STAMP_MAGIC "bergen-stamp 1\n"
+
+static struct error *finish_file(FILE *file, const char *path)
+{
+	struct error *err = NULL;
+
+	if (bergen_ferror(file))
+		err = error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	if (bergen_fclose(file) && !err)
+		err = error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	return err;
+}
+
+void depend_write_escaped(FILE *file, const char *path)
+{
+	for (; *path; path++) {
+		if (*path == ' ' || *path == '#' || *path == ':')
+			bergen_fputc('\\', file);
+		else if (*path == '$')
+			bergen_fputc('$', file);
+		bergen_fputc(*path, file);
+	}
+}
+
+struct error *depend_write_makefile(const struct include_file_list *files, const char *input, const char *path, const char *target, int phony)
+{
+	FILE *file = bergen_fopen(path, "w");
+	size_t i;
+
+	if (!file)
+		return error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+
+	/* The first file read is the input itself, named as it was given */
+	depend_write_escaped(file, target);
+	bergen_fputs(": ", file);
+	depend_write_escaped(file, input);
+	for (i = 1; i < files->num_files; i++) {
+		bergen_fputs(" \\\n  ", file);
+		depend_write_escaped(file, files->files[i]->path);
+	}
+	bergen_fputc('\n', file);
+
+	for (i = 1; phony && i < files->num_files; i++) {
+		bergen_fputc('\n', file);
+		depend_write_escaped(file, files->files[i]->path);
+		bergen_fputs(":\n", file);
+	}
+
+	return finish_file(file, path);
+}
+
+uint64_t depend_options_hash(const char *input, const char *output, int format, const char *const *include_paths, size_t num_include_paths)
+{
+	uint64_t hash = hash64_update_string(HASH64_INIT, BERGEN_VERSION);
+	char cwd[PATH_MAX];
+	size_t i;
+
+	/* Relative paths mean something else elsewhere */
+	hash = hash64_update_string(hash, bergen_getcwd(cwd, sizeof(cwd)) ? cwd : "");
+	hash = hash64_update_string(hash, input);
+	hash = hash64_update_string(hash, output);
+	hash = hash64_update(hash, &format, sizeof(format));
+	for (i = 0; i < num_include_paths; i++)
+		hash = hash64_update_string(hash, include_paths[i]);
+	return hash;
+}
+
+static int hash_file(const char *path, uint64_t *hash)
+{
+	char buf[65536];
+	FILE *file = bergen_fopen(path, "rb");
+	size_t length;
+	int ok;
+
+	if (!file)
+		return 0;
+
+	*hash = HASH64_INIT;
+	while ((length = bergen_fread(buf, 1, sizeof(buf), file)) > 0)
+		*hash = hash64_update(*hash, buf, length);
+	ok = !bergen_ferror(file);
+	bergen_fclose(file);
+	return ok;
+}
+
+int depend_stamp_is_current(const char *path, const char *output, uint64_t options_hash)
+{
+	char line[PATH_MAX + 32], *end;
+	struct stat buf;
+	uint64_t hash, file_hash;
+	size_t length;
+	FILE *file;
+	int current = 0;
+
+	if (bergen_stat(output, &buf) || !(file = bergen_fopen(path, "r")))
+		return 0;
+
+	if (!bergen_fgets(line, sizeof(line), file) || bergen_strcmp(line, STAMP_MAGIC))
+		goto done;
+	if (!bergen_fgets(line, sizeof(line), file) || bergen_strtoull(line, &end, 16) != options_hash || *end != '\n')
+		goto done;
+
+	/* "hash path", one for each file read */
+	while (bergen_fgets(line, sizeof(line), file)) {
+		length = bergen_strlen(line);
+		if (length == 0 || line[length - 1] != '\n')
+			goto done;
+		line[length - 1] = '\0';
+
+		hash = bergen_strtoull(line, &end, 16);
+		if (*end != ' ' || !hash_file(end + 1, &file_hash) || file_hash != hash)
+			goto done;
+	}
+	current = !bergen_ferror(file);
+
+done:
+	bergen_fclose(file);
+	return current;
+}
+
+struct error *depend_write_stamp(const struct include_file_list *files, const char *path, uint64_t options_hash)
+{
+	FILE *file = bergen_fopen(path, "w");
+	const struct include_file *read;
+	size_t i;
+
+	if (!file)
+		return error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+
+	/* The files are hashed as they were assembled, not as they are now */
+	bergen_fputs(STAMP_MAGIC, file);
+	bergen_fprintf(file, "%016" PRIx64 "\n", options_hash);
+	for (i = 0; i < files->num_files; i++) {
+		read = files->files[i];
+		bergen_fprintf(file, "%016" PRIx64 " %s\n", hash64_update(HASH64_INIT, read->data, read->length), read->path);
+	}
+
+	return finish_file(file, path);
+}
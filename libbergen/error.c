@@ -21,46 +21,251 @@
  * THE SOFTWARE.
  */
 
+#define BERGEN_ALLOC_TAG ALLOC_TAG_ERRORS
+
 #include <bergen/error.h>
 
 #include <bergen/libc.h>
 
-struct error *error_create(const char *fmt, ...)
+enum error_arg_type {
+	ERROR_ARG_TYPE_NONE,
+	ERROR_ARG_TYPE_SPAN,
+	ERROR_ARG_TYPE_CHAR,
+	ERROR_ARG_TYPE_VALUE,
+	ERROR_ARG_TYPE_ERRNO,
+	ERROR_ARG_TYPE_SPAN_VALUE,
+	ERROR_ARG_TYPE_SPAN_ERRNO,
+};
+
+struct error_format {
+	const char *fmt;
+	enum error_arg_type arg_type;
+};
+
+static const struct error_format ERROR_FORMATS[] = {
+	[ERROR_FSEEK]				= {"Unable to fseek(): %s", ERROR_ARG_TYPE_ERRNO},
+	[ERROR_UNEXPECTED_RPAREN]		= {"Unexpected ')' while evaluating expression", ERROR_ARG_TYPE_NONE},
+	[ERROR_INVALID_BINARY_CONSTANT]		= {"Invalid binary constant: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_OCTAL_CONSTANT]		= {"Invalid octal constant: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_DECIMAL_CONSTANT]	= {"Invalid decimal constant: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_HEXADECIMAL_CONSTANT]	= {"Invalid hexadecimal constant: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_CONSTANT_PREFIX]		= {"Invalid constant prefix: '%c'", ERROR_ARG_TYPE_CHAR},
+	[ERROR_INVALID_CONSTANT_SUFFIX]		= {"Invalid constant suffix: '%c'", ERROR_ARG_TYPE_CHAR},
+	[ERROR_LABEL_NOT_FOUND]			= {"Could not find label: %.*s", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_BINARY_OPERATOR]		= {"Invalid binary operator: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_UNEXPECTED_CHAR_EXPR_BEGIN]	= {"Unexpected character at beginning of expression: '%c'", ERROR_ARG_TYPE_CHAR},
+	[ERROR_EXPECTED_EXPRESSION]		= {"Expected expression but reached end of string", ERROR_ARG_TYPE_NONE},
+	[ERROR_UNEXPECTED_CHAR_EXPR_END]	= {"Unexpected character at end of expression: '%c'", ERROR_ARG_TYPE_CHAR},
+	[ERROR_EXPECTED_RPARENS]		= {"Expected %" PRId64 " ')'s at end of expression", ERROR_ARG_TYPE_VALUE},
+	[ERROR_EXPECTED_SINGLE_QUOTE]		= {"Expected single quote but got '%c'", ERROR_ARG_TYPE_CHAR},
+	[ERROR_UNTERMINATED_CHAR_CONSTANT]	= {"Reached end of expression in middle of char constant", ERROR_ARG_TYPE_NONE},
+	[ERROR_MACRO_HAS_NO_ARGS]		= {"Cannot add arguments to a macro that has no arguments", ERROR_ARG_TYPE_NONE},
+	[ERROR_MACRO_DUPLICATE_ARG]		= {"Argument \"%.*s\" already exists", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_MACRO_DEFINITION]	= {"Invalid macro definition: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_MACRO_ARG_COUNT]			= {"Macro \"%.*s\" takes %" PRId64 " argument(s)", ERROR_ARG_TYPE_SPAN_VALUE},
+	[ERROR_UNTERMINATED_MACRO_ARGS]		= {"Missing ')' after arguments to macro \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_UNKNOWN_DIRECTIVE]		= {"Unknown directive: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_UNEXPECTED_DIRECTIVE]		= {"Unexpected \"%.*s\" outside of a conditional", ERROR_ARG_TYPE_SPAN},
+	[ERROR_EXPECTED_NAME]			= {"Expected a name after \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_UNTERMINATED_CONDITIONAL]	= {"Expected %" PRId64 " #endif(s) at end of input", ERROR_ARG_TYPE_VALUE},
+	[ERROR_FILE_NOT_FOUND]			= {"File not found: \"%.*s\"", ERROR_ARG_TYPE_SPAN},
+	[ERROR_IO]				= {"\"%.*s\": %s", ERROR_ARG_TYPE_SPAN_ERRNO},
+	[ERROR_INCLUDE_DEPTH]			= {"Including \"%.*s\" exceeds the maximum depth of %" PRId64, ERROR_ARG_TYPE_SPAN_VALUE},
+	[ERROR_UNKNOWN_INSTRUCTION]		= {"Unknown instruction: %.*s", ERROR_ARG_TYPE_SPAN},
+	[ERROR_INVALID_OPERANDS]		= {"Invalid operands for %.*s", ERROR_ARG_TYPE_SPAN},
+	[ERROR_VALUE_OUT_OF_RANGE]		= {"Value out of range: %" PRId64, ERROR_ARG_TYPE_VALUE},
+	[ERROR_DUPLICATE_LABEL]			= {"Duplicate label: %.*s", ERROR_ARG_TYPE_SPAN},
+	[ERROR_EXPECTED_STRING]			= {"Expected a string", ERROR_ARG_TYPE_NONE},
+	[ERROR_DIVISION_BY_ZERO]		= {"Division by zero", ERROR_ARG_TYPE_NONE},
+	[ERROR_DIVISION_OVERFLOW]		= {"Dividing %" PRId64 " by -1 overflows", ERROR_ARG_TYPE_VALUE},
+};
+
+/*
+ * Most errors are thrown away right after they're created, like forward
+ * references in the first pass, so each thread keeps a few freed ones around
+ * for reuse instead of going back to malloc every time.
+ */
+#define ERROR_CACHE_SIZE 8
+
+struct error_cache {
+	struct error *errors[ERROR_CACHE_SIZE];
+	size_t count;
+};
+
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+
+static void free_cache(void *data)
+{
+	struct error_cache *cache = data;
+
+	while (cache->count > 0)
+		bergen_free(cache->errors[--cache->count]);
+	bergen_free(cache);
+}
+
+static void create_cache_key(void)
+{
+	bergen_pthread_key_create(&cache_key, free_cache);
+}
+
+static struct error_cache *get_cache(void)
+{
+	struct error_cache *cache;
+
+	bergen_pthread_once(&cache_once, create_cache_key);
+	if ((cache = bergen_pthread_getspecific(cache_key)))
+		return cache;
+
+	cache = bergen_malloc(sizeof(*cache));
+	cache->count = 0;
+	bergen_pthread_setspecific(cache_key, cache);
+	return cache;
+}
+
+static struct error *error_alloc(enum error_code code)
 {
-	va_list args;
+	struct error_cache *cache = get_cache();
 	struct error *err;
 
-	va_start(args, fmt);
-	err = error_create_vargs(fmt, args);
-	va_end(args);
+	if (cache->count > 0)
+		err = cache->errors[--cache->count];
+	else
+		err = bergen_malloc(sizeof(*err));
 
+	err->code = code;
+	err->location = source_location_none();
+	err->str = NULL;
+	err->length = 0;
+	err->value = 0;
+	err->message = NULL;
 	return err;
 }
 
-struct error *error_create_vargs(const char *fmt, va_list args)
+struct error *error_create(enum error_code code)
+{
+	return error_alloc(code);
+}
+
+struct error *error_create_span(enum error_code code, const char *str, size_t length)
+{
+	struct error *err = error_alloc(code);
+
+	err->str = str;
+	err->length = length;
+	return err;
+}
+
+struct error *error_create_value(enum error_code code, expr_value value)
+{
+	struct error *err = error_alloc(code);
+
+	err->value = value;
+	return err;
+}
+
+struct error *error_create_span_value(enum error_code code, const char *str, size_t length, expr_value value)
+{
+	struct error *err = error_create_span(code, str, length);
+
+	err->value = value;
+	return err;
+}
+
+int error_format_message(const struct error *error, char *buf, size_t size)
+{
+	const struct error_format *format = &ERROR_FORMATS[error->code];
+
+	switch (format->arg_type) {
+	case ERROR_ARG_TYPE_SPAN:
+		return bergen_snprintf(buf, size, format->fmt, (int) error->length, error->str);
+
+	case ERROR_ARG_TYPE_CHAR:
+		return bergen_snprintf(buf, size, format->fmt, (char) error->value);
+
+	case ERROR_ARG_TYPE_VALUE:
+		return bergen_snprintf(buf, size, format->fmt, error->value);
+
+	case ERROR_ARG_TYPE_SPAN_VALUE:
+		return bergen_snprintf(buf, size, format->fmt, (int) error->length, error->str, error->value);
+
+	case ERROR_ARG_TYPE_SPAN_ERRNO:
+		return bergen_snprintf(buf, size, format->fmt, (int) error->length, error->str, bergen_strerror(error->value));
+
+	case ERROR_ARG_TYPE_ERRNO:
+		return bergen_snprintf(buf, size, format->fmt, bergen_strerror(error->value));
+
+	default:
+		return bergen_snprintf(buf, size, "%s", format->fmt);
+	}
+}
+
+const char *error_get_message(struct error *error)
 {
-	struct error *err;
-	va_list args2;
 	int size;
 
-	va_copy(args2, args);
-	size = bergen_vsnprintf(NULL, 0, fmt, args2) + 1;
-	va_end(args2);
+	if (error->message)
+		return error->message;
 
-	if (size <= 0) { /* vsnprinf() returns -1 on error, + 1 = 0 */
-		return NULL;
-	} else {
-		err = bergen_malloc(sizeof(*err) + size);
+	size = error_format_message(error, NULL, 0) + 1;
+	if (size <= 0) /* snprintf() returns -1 on error, + 1 = 0 */
+		return "";
+
+	error->message = bergen_malloc(size);
+	error_format_message(error, error->message, size);
+	return error->message;
+}
+
+static void print_location(const struct error *error, struct source_list *sources, FILE *file)
+{
+	struct source_file *source;
+	size_t line, column;
+
+	if (!sources || !(source = source_list_get_file(sources, error->location.file)))
+		return;
+
+	source_file_get_line_column(source, error->location.offset, &line, &column);
+	bergen_fprintf(file, "%s:%" PRIuPTR ":%" PRIuPTR ": ", source->name, line, column);
+}
+
+void error_print(const struct error *error, struct source_list *sources, FILE *file)
+{
+	char buf[256];
+	int size;
+	char *tmp;
+
+	/* The span may be gone by now if the message was cached beforehand */
+	if (error->message) {
+		print_location(error, sources, file);
+		bergen_fprintf(file, "%s\n", error->message);
+		return;
 	}
 
-	va_copy(args2, args);
-	bergen_vsnprintf(err->message, size, fmt, args2);
-	va_end(args2);
+	if ((size = error_format_message(error, buf, sizeof(buf))) < 0)
+		return;
 
-	return err;
+	print_location(error, sources, file);
+	if ((size_t) size < sizeof(buf)) {
+		bergen_fprintf(file, "%s\n", buf);
+	} else {
+		tmp = bergen_malloc(size + 1);
+		error_format_message(error, tmp, size + 1);
+		bergen_fprintf(file, "%s\n", tmp);
+		bergen_free(tmp);
+	}
 }
 
 void error_free(struct error *err)
 {
-	bergen_free(err);
+	struct error_cache *cache;
+
+	if (!err)
+		return;
+	bergen_free(err->message);
+
+	cache = get_cache();
+	if (cache->count < ERROR_CACHE_SIZE)
+		cache->errors[cache->count++] = err;
+	else
+		bergen_free(err);
 }
@@ -21,9 +21,12 @@
  * THE SOFTWARE.
  */
 
+#define BERGEN_ALLOC_TAG ALLOC_TAG_TOKENS
+
 #include <bergen/expression.h>
 
 #include <bergen/libc.h>
+#include <bergen/stats.h>
 
 enum token_type {
 	TOKEN_TYPE_CONSTANT,
@@ -58,8 +61,8 @@ enum binary_operator_type {
 	BINARY_OPERATOR_TYPE_XOR,
 };
 
-struct token {
-	size_t index;
+struct expr_token {
+	const char *str;
 	size_t length;
 	enum token_type type;
 	union {
@@ -70,7 +73,7 @@ struct token {
 };
 
 struct token_list {
-	struct token *tokens;
+	struct expr_token *tokens;
 	size_t buffer_size; /* Number of tokens in buffer */
 	size_t num_tokens;
 };
@@ -87,9 +90,9 @@ static void token_list_destroy(struct token_list *list)
 	bergen_free(list->tokens);
 }
 
-static void token_list_append(struct token_list *list, const struct token *token)
+static void token_list_append(struct token_list *list, const struct expr_token *token)
 {
-	struct token *ptr;
+	struct expr_token *ptr;
 
 	if (list->num_tokens >= list->buffer_size) {
 		list->buffer_size *= 2;
@@ -97,7 +100,7 @@ static void token_list_append(struct token_list *list, const struct token *token
 	}
 
 	ptr = &list->tokens[list->num_tokens++];
-	ptr->index = token->index;
+	ptr->str = token->str;
 	ptr->length = token->length;
 	ptr->type = token->type;
 	ptr->extra = token->extra;
@@ -105,59 +108,54 @@ static void token_list_append(struct token_list *list, const struct token *token
 
 void expr_data_init(struct expr_data *data, const char *str, size_t length, char local_label_char)
 {
-	label_list_init(&data->labels);
-	label_list_init(&data->local_labels);
+	data->labels = NULL;
+	data->local_labels = NULL;
+	data->changing_labels = NULL;
+	data->local_labels_change = 0;
+	data->location_counter_changes = 0;
+	data->location_counter = 0;
 	data->str = str;
 	data->length = length;
+	data->location = source_location_none();
 	data->local_label_char = local_label_char;
 }
 
 void expr_data_destroy(struct expr_data *data)
 {
-	label_list_destroy(&data->local_labels);
-	label_list_destroy(&data->labels);
+	/* The label lists are borrowed, nothing to do */
 }
 
 struct tokenize_data {
 	/* Constants */
 	struct expr_data *data;
 	struct token_list *tokens;
+	const struct lex_token *lex_tokens;
+	size_t num_lex_tokens;
+
+	struct expr_program *program; /* If compiling, labels not found are referenced in it */
 
 	/* Mutables */
-	size_t index;
-	char current_char;
-	int consumed_char;
+	size_t index; /* In lex_tokens */
 	size_t paren_levels;
-	struct token token;
+	struct expr_token token;
 	const struct tokenize_state *state;
 };
 
+/*
+ * The lexer has already classified every character, so the tokenizer only
+ * has to check that operands and operators alternate and give them meaning.
+ */
 struct tokenize_state {
-	struct error *(*consume)(struct tokenize_data *data, char c);
+	struct error *(*consume)(struct tokenize_data *data, const struct lex_token *lex_token);
 	struct error *(*end)(struct tokenize_data *data);
 };
 
-static struct error *tokenize_state_expr_begin_consume(struct tokenize_data *data, char c);
+static struct error *tokenize_state_expr_begin_consume(struct tokenize_data *data, const struct lex_token *lex_token);
 static struct error *tokenize_state_expr_begin_end(struct tokenize_data *data);
 
-static struct error *tokenize_state_expr_end_consume(struct tokenize_data *data, char c);
+static struct error *tokenize_state_expr_end_consume(struct tokenize_data *data, const struct lex_token *lex_token);
 static struct error *tokenize_state_expr_end_end(struct tokenize_data *data);
 
-static struct error *tokenize_state_constant_consume(struct tokenize_data *data, char c);
-static struct error *tokenize_state_constant_end(struct tokenize_data *data);
-
-static struct error *tokenize_state_prefix_constant_consume(struct tokenize_data *data, char c);
-static struct error *tokenize_state_prefix_constant_end(struct tokenize_data *data);
-
-static struct error *tokenize_state_char_constant_consume(struct tokenize_data *data, char c);
-static struct error *tokenize_state_char_constant_end(struct tokenize_data *data);
-
-static struct error *tokenize_state_binary_operator_consume(struct tokenize_data *data, char c);
-static struct error *tokenize_state_binary_operator_end(struct tokenize_data *data);
-
-static struct error *tokenize_state_label_consume(struct tokenize_data *data, char c);
-static struct error *tokenize_state_label_end(struct tokenize_data *data);
-
 static const struct tokenize_state TOKENIZE_STATE_EXPR_BEGIN = {
 	.consume	= tokenize_state_expr_begin_consume,
 	.end		= tokenize_state_expr_begin_end,
@@ -168,36 +166,38 @@ static const struct tokenize_state TOKENIZE_STATE_EXPR_END = {
 	.end		= tokenize_state_expr_end_end,
 };
 
-static const struct tokenize_state TOKENIZE_STATE_CONSTANT = {
-	.consume	= tokenize_state_constant_consume,
-	.end		= tokenize_state_constant_end,
-};
-
-static const struct tokenize_state TOKENIZE_STATE_PREFIX_CONSTANT = {
-	.consume	= tokenize_state_prefix_constant_consume,
-	.end		= tokenize_state_prefix_constant_end,
-};
-
-static const struct tokenize_state TOKENIZE_STATE_CHAR_CONSTANT = {
-	.consume	= tokenize_state_char_constant_consume,
-	.end		= tokenize_state_char_constant_end,
-};
+#define TOKENIZE_STATE_INITIAL_STATE TOKENIZE_STATE_EXPR_BEGIN
 
-static const struct tokenize_state TOKENIZE_STATE_BINARY_OPERATOR = {
-	.consume	= tokenize_state_binary_operator_consume,
-	.end		= tokenize_state_binary_operator_end,
+struct binary_operator {
+	const char *str;
+	enum binary_operator_type type;
 };
 
-static const struct tokenize_state TOKENIZE_STATE_LABEL = {
-	.consume	= tokenize_state_label_consume,
-	.end		= tokenize_state_label_end,
+static const struct binary_operator BINARY_OPERATORS[] = {
+	{"+",	BINARY_OPERATOR_TYPE_PLUS},
+	{"-",	BINARY_OPERATOR_TYPE_MINUS},
+	{"*",	BINARY_OPERATOR_TYPE_TIMES},
+	{"/",	BINARY_OPERATOR_TYPE_DIV},
+	{"%",	BINARY_OPERATOR_TYPE_MODULO},
+	{"<<",	BINARY_OPERATOR_TYPE_LSL},
+	{">>",	BINARY_OPERATOR_TYPE_LSR},
+	{"=",	BINARY_OPERATOR_TYPE_EQ},
+	{"==",	BINARY_OPERATOR_TYPE_EQ},
+	{"!=",	BINARY_OPERATOR_TYPE_NE},
+	{"<",	BINARY_OPERATOR_TYPE_LT},
+	{">",	BINARY_OPERATOR_TYPE_GT},
+	{"<=",	BINARY_OPERATOR_TYPE_LE},
+	{">=",	BINARY_OPERATOR_TYPE_GE},
+	{"&",	BINARY_OPERATOR_TYPE_AND},
+	{"|",	BINARY_OPERATOR_TYPE_OR},
+	{"^",	BINARY_OPERATOR_TYPE_XOR},
 };
 
-#define TOKENIZE_STATE_INITIAL_STATE TOKENIZE_STATE_EXPR_BEGIN
-
-static void token_calc_length(struct tokenize_data *data, size_t additional_chars)
+static void token_begin(struct tokenize_data *data, const struct lex_token *lex_token, enum token_type type)
 {
-	data->token.length = data->index - data->token.index + additional_chars;
+	data->token.str = lex_token->str;
+	data->token.length = lex_token->length;
+	data->token.type = type;
 }
 
 static void token_append(struct tokenize_data *data)
@@ -205,84 +205,10 @@ static void token_append(struct tokenize_data *data)
 	token_list_append(data->tokens, &data->token);
 }
 
-static inline int is_constant_begin(char c)
+static struct error *do_unary_operator(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	return !!bergen_strchr("0123456789", c);
-}
-
-static inline int is_constant_prefix(char c)
-{
-	return !!bergen_strchr("%@$", c);
-}
-
-static inline int is_constant_middle(char c)
-{
-	return !!bergen_strchr("0123456789abcdefABCDEF", c);
-}
-
-static inline int is_constant_suffix(char c)
-{
-	return !!bergen_strchr("BODHbodh", c);
-}
-
-static inline int is_unary_operator(char c)
-{
-	return !!bergen_strchr("~-", c);
-}
-
-static inline int is_binary_operator_begin(char c)
-{
-	return !!bergen_strchr("+-*/%<>=!&|^", c);
-}
-
-static inline int is_binary_operator_second(char c)
-{
-	return !!bergen_strchr("<>=", c);
-}
-
-static inline int is_label_begin(char c, char local_label_char)
-{
-	return !!bergen_strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", c) || c == local_label_char;
-}
-
-static inline int is_label_middle(char c)
-{
-	return !!bergen_strchr("_0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", c);
-}
-
-static struct error *do_constant_begin(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.type = TOKEN_TYPE_CONSTANT;
-
-	data->state = &TOKENIZE_STATE_CONSTANT;
-	return NULL;
-}
-
-static struct error *do_prefix_constant_begin(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.type = TOKEN_TYPE_CONSTANT;
-
-	data->state = &TOKENIZE_STATE_PREFIX_CONSTANT;
-	return NULL;
-}
-
-static struct error *do_char_constant_begin(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.type = TOKEN_TYPE_CONSTANT;
-
-	data->state = &TOKENIZE_STATE_CHAR_CONSTANT;
-	return NULL;
-}
-
-static struct error *do_unary_operator(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.length = 1;
-	data->token.type = TOKEN_TYPE_UNARY_OPERATOR;
-	switch (data->current_char) {
+	token_begin(data, lex_token, TOKEN_TYPE_UNARY_OPERATOR);
+	switch (lex_token->str[0]) {
 	case '~':
 		data->token.extra.unary_operator_type = UNARY_OPERATOR_TYPE_INVERT;
 		break;
@@ -297,20 +223,9 @@ static struct error *do_unary_operator(struct tokenize_data *data)
 	return NULL;
 }
 
-static struct error *do_binary_operator_begin(struct tokenize_data *data)
+static struct error *do_lparen(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	data->token.index = data->index;
-	data->token.type = TOKEN_TYPE_BINARY_OPERATOR;
-
-	data->state = &TOKENIZE_STATE_BINARY_OPERATOR;
-	return NULL;
-}
-
-static struct error *do_lparen(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.length = 1;
-	data->token.type = TOKEN_TYPE_LPAREN;
+	token_begin(data, lex_token, TOKEN_TYPE_LPAREN);
 	token_append(data);
 
 	data->paren_levels++;
@@ -318,103 +233,110 @@ static struct error *do_lparen(struct tokenize_data *data)
 	return NULL;
 }
 
-static struct error *do_rparen(struct tokenize_data *data)
+static struct error *do_rparen(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	data->token.index = data->index;
-	data->token.length = 1;
-	data->token.type = TOKEN_TYPE_RPAREN;
+	token_begin(data, lex_token, TOKEN_TYPE_RPAREN);
 	token_append(data);
 
 	if (data->paren_levels <= 0)
-		return error_create("Unexpected ')' while evaluating expression");
+		return error_create(ERROR_UNEXPECTED_RPAREN);
 
 	data->paren_levels--;
 	data->state = &TOKENIZE_STATE_EXPR_END;
 	return NULL;
 }
 
-static struct error *do_label_begin(struct tokenize_data *data)
-{
-	data->token.index = data->index;
-	data->token.type = TOKEN_TYPE_CONSTANT;
+/*
+ * Tokens point into the source, which isn't NUL terminated, so strtoll()
+ * could read past the end of one. Every character has to be a digit.
+ */
+static struct error *evaluate_constant(const char *str, size_t length, int base, enum error_code code, expr_value *result)
+{
+	uint64_t value = 0;
+	size_t i;
+	int c, digit;
+
+	if (length == 0)
+		return error_create_span(code, str, length);
+	for (i = 0; i < length; i++) {
+		c = bergen_tolower((unsigned char) str[i]);
+		digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : base;
+		if (digit >= base || value > ((uint64_t) INT64_MAX - digit) / base)
+			return error_create_span(code, str, length);
+		value = value * base + digit;
+	}
 
-	data->state = &TOKENIZE_STATE_LABEL;
+	*result = (expr_value) value;
 	return NULL;
 }
 
 static struct error *evaluate_binary_constant(const char *str, size_t length, expr_value *result)
 {
-	char *end, *tmp;
-	struct error *err;
-
-	*result = bergen_strtoll(str, &end, 2);
-	if (end < str + length) {
-		tmp = bergen_strndup_null(str, length);
-		err = error_create("Invalid binary constant: \"%s\"", tmp);
-		bergen_free(tmp);
-		return err;
-	}
-
-	return NULL;
+	return evaluate_constant(str, length, 2, ERROR_INVALID_BINARY_CONSTANT, result);
 }
 
 static struct error *evaluate_octal_constant(const char *str, size_t length, expr_value *result)
 {
-	char *end, *tmp;
-	struct error *err;
-
-	*result = bergen_strtoll(str, &end, 8);
-	if (end < str + length) {
-		tmp = bergen_strndup_null(str, length);
-		err = error_create("Invalid octal constant: \"%s\"", tmp);
-		bergen_free(tmp);
-		return err;
-	}
-
-	return NULL;
+	return evaluate_constant(str, length, 8, ERROR_INVALID_OCTAL_CONSTANT, result);
 }
 
 static struct error *evaluate_decimal_constant(const char *str, size_t length, expr_value *result)
 {
-	char *end, *tmp;
-	struct error *err;
+	return evaluate_constant(str, length, 10, ERROR_INVALID_DECIMAL_CONSTANT, result);
+}
 
-	*result = bergen_strtoll(str, &end, 10);
-	if (end < str + length) {
-		tmp = bergen_strndup_null(str, length);
-		err = error_create("Invalid decimal constant: \"%s\"", tmp);
-		bergen_free(tmp);
-		return err;
-	}
+static struct error *evaluate_hexadecimal_constant(const char *str, size_t length, expr_value *result)
+{
+	return evaluate_constant(str, length, 16, ERROR_INVALID_HEXADECIMAL_CONSTANT, result);
+}
 
-	return NULL;
+static int is_in_str(const struct expr_data *data, const char *ptr)
+{
+	return ptr >= data->str && ptr < data->str + data->length;
 }
 
-static struct error *evaluate_hexadecimal_constant(const char *str, size_t length, expr_value *result)
+/*
+ * The value of the current token may not be right yet, so the program will
+ * look it up later. label is where it is now, if it was found.
+ */
+static void add_reference(struct tokenize_data *data, const struct label *label)
 {
-	char *end, *tmp;
-	struct error *err;
+	struct expr_program *program = data->program;
+	struct expr_reference *reference;
+	int is_counter = data->token.str[0] == '$';
+	int is_local = data->token.str[0] == data->data->local_label_char;
 
-	*result = bergen_strtoll(str, &end, 16);
-	if (end < str + length) {
-		tmp = bergen_strndup_null(str, length);
-		err = error_create("Invalid hexadecimal constant: \"%s\"", tmp);
-		bergen_free(tmp);
-		return err;
+	if (program->num_references >= program->references_buffer_size) {
+		program->references_buffer_size = program->references_buffer_size ? program->references_buffer_size * 2 : 1;
+		program->references = bergen_realloc(program->references, sizeof(*program->references) * program->references_buffer_size);
 	}
 
-	return NULL;
+	reference = &program->references[program->num_references++];
+	reference->token = data->tokens->num_tokens;
+	reference->owns_name = !is_counter && !label;
+	if (label)
+		reference->name = label->name;
+	else
+		reference->name = is_counter ? NULL : bergen_strndup(data->token.str + is_local, data->token.length - is_local);
+	reference->length = is_counter ? 0 : data->token.length - is_local;
+	reference->is_local = is_local;
+	reference->location = data->data->location;
+	if (reference->location.file != SOURCE_FILE_NONE && is_in_str(data->data, data->token.str))
+		reference->location.offset += data->token.str - data->data->str;
+	program->num_missing += reference->owns_name;
 }
 
 static struct error *evaluate_location_counter(struct tokenize_data *data, expr_value *result)
 {
 	*result = data->data->location_counter;
+	if (data->program && data->data->location_counter_changes)
+		add_reference(data, NULL);
 	return NULL;
 }
 
 static struct error *evaluate_prefix_constant(struct tokenize_data *data)
 {
-	const char *str = data->data->str + data->token.index;
+	const char *str = data->token.str;
 	size_t length = data->token.length;
 	char c = str[0];
 	expr_value *result = &data->token.extra.value;
@@ -433,13 +355,13 @@ static struct error *evaluate_prefix_constant(struct tokenize_data *data)
 			return evaluate_hexadecimal_constant(str + 1, length - 1, result);
 
 	default: /* Will never happen */
-		return error_create("Invalid constant prefix: '%c'", c);
+		return error_create_value(ERROR_INVALID_CONSTANT_PREFIX, c);
 	}
 }
 
 static struct error *evaluate_suffix_constant(struct tokenize_data *data)
 {
-	const char *str = data->data->str + data->token.index;
+	const char *str = data->token.str;
 	size_t length = data->token.length;
 	char c = str[length - 1];
 	expr_value *result = &data->token.extra.value;
@@ -464,369 +386,280 @@ static struct error *evaluate_suffix_constant(struct tokenize_data *data)
 
 	if (!!bergen_strchr("0123456789", c))
 		return evaluate_decimal_constant(str, length, result);
-	else /* Will never happen */
-		return error_create("Invalid constant suffix: '%c'", c);
-}
-
-static struct error *evaluate_char_constant(struct tokenize_data *data)
-{
-	data->token.extra.value = data->data->str[data->token.index + 1];
-	return NULL;
+	else
+		return error_create_value(ERROR_INVALID_CONSTANT_SUFFIX, c);
 }
 
 static struct error *evaluate_label_type_known(const struct label_list *labels, const char *str, size_t length, expr_value *result)
 {
-	const struct label *label = label_list_find_label(labels, str, length);
-	char *tmp;
-	struct error *err;
+	const struct label *label = labels ? label_list_find_label(labels, str, length) : NULL;
 
 	if (label) {
 		*result = label->value;
 		return NULL;
 	} else {
-		tmp = bergen_strndup_null(str, length);
-		err = error_create("Could not find label: %s", tmp);
-		bergen_free(tmp);
-		return err;
+		return error_create_span(ERROR_LABEL_NOT_FOUND, str, length);
 	}
 }
 
 static struct error *evaluate_label(struct tokenize_data *data)
 {
-	const char *str = data->data->str + data->token.index;
+	const char *str = data->token.str;
 	char c = str[0];
 
 	if (c == data->data->local_label_char)
-		return evaluate_label_type_known(&data->data->local_labels, str + 1, data->token.length - 1, &data->token.extra.value);
+		return evaluate_label_type_known(data->data->local_labels, str + 1, data->token.length - 1, &data->token.extra.value);
 	else
-		return evaluate_label_type_known(&data->data->labels, str, data->token.length, &data->token.extra.value);
+		return evaluate_label_type_known(data->data->labels, str, data->token.length, &data->token.extra.value);
 }
 
-static struct error *evaluate_binary_operator_1(struct tokenize_data *data)
+static struct error *do_constant(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	char c = data->data->str[data->token.index];
-
-	switch (c) {
-	case '+':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_PLUS;
-		break;
-
-	case '-':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_MINUS;
-		break;
-
-	case '*':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_TIMES;
-		break;
-
-	case '/':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_DIV;
-		break;
-
-	case '%':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_MODULO;
-		break;
-
-	case '=':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_EQ;
-		break;
-
-	case '<':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_LT;
-		break;
-
-	case '>':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_GT;
-		break;
-
-	case '&':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_AND;
-		break;
-
-	case '|':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_OR;
-		break;
-
-	case '^':
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_XOR;
-		break;
-	}
-
-	return NULL;
-}
-
-static struct error *evaluate_binary_operator_2(struct tokenize_data *data)
-{
-	const char *str = data->data->str + data->token.index;
-	char *buf;
 	struct error *err;
 
-	if (!bergen_strncmp(str, "<<", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_LSL;
-	else if (!bergen_strncmp(str, ">>", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_LSR;
-	else if (!bergen_strncmp(str, "==", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_EQ;
-	else if (!bergen_strncmp(str, "!=", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_NE;
-	else if (!bergen_strncmp(str, "<=", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_LE;
-	else if (!bergen_strncmp(str, ">=", 2))
-		data->token.extra.binary_operator_type = BINARY_OPERATOR_TYPE_GE;
-	else {
-		buf = bergen_strndup_null(str, 2);
-		err = error_create("Invalid binary operator: \"%s\"", buf);
-		bergen_free(buf);
+	token_begin(data, lex_token, TOKEN_TYPE_CONSTANT);
+	if (bergen_strchr("%@$", lex_token->str[0]))
+		err = evaluate_prefix_constant(data);
+	else
+		err = evaluate_suffix_constant(data);
+	if (err)
 		return err;
-	}
+	token_append(data);
 
+	data->state = &TOKENIZE_STATE_EXPR_END;
 	return NULL;
 }
 
-static struct error *evaluate_binary_operator(struct tokenize_data *data)
+static struct error *do_char_constant(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	if (data->token.length == 1)
-		return evaluate_binary_operator_1(data);
-	else
-		return evaluate_binary_operator_2(data);
-}
+	token_begin(data, lex_token, TOKEN_TYPE_CONSTANT);
+	data->token.extra.value = lex_token->str[1];
+	token_append(data);
 
-static struct error *tokenize_state_expr_begin_consume(struct tokenize_data *data, char c)
-{
-	if (bergen_isspace(c)) {
-		return NULL;
-	} else if (is_unary_operator(c)) {
-		return do_unary_operator(data);
-	} else if (is_constant_begin(c)) {
-		return do_constant_begin(data);
-	} else if (is_constant_prefix(c)) {
-		return do_prefix_constant_begin(data);
-	} else if (c == '\'') {
-		return do_char_constant_begin(data);
-	} else if (c == '(') {
-		return do_lparen(data);
-	} else if (is_label_begin(c, data->data->local_label_char)) {
-		return do_label_begin(data);
-	} else {
-		return error_create("Unexpected character at beginning of expression: '%c'", c);
-	}
+	data->state = &TOKENIZE_STATE_EXPR_END;
+	return NULL;
 }
 
-static struct error *tokenize_state_expr_begin_end(struct tokenize_data *data)
+static const struct label *find_label(struct tokenize_data *data)
 {
-	return error_create("Expected expression but reached end of string");
-}
+	const struct label_list *labels = data->data->labels;
+	const char *str = data->token.str;
+	size_t length = data->token.length;
 
-static struct error *tokenize_state_expr_end_consume(struct tokenize_data *data, char c)
-{
-	if (bergen_isspace(c)) {
-		return NULL;
-	} else if (is_binary_operator_begin(c)) {
-		return do_binary_operator_begin(data);
-	} else if (c == ')') {
-		return do_rparen(data);
-	} else {
-		return error_create("Unexpected character at end of expression: '%c'", c);
+	if (str[0] == data->data->local_label_char) {
+		labels = data->data->local_labels;
+		str++;
+		length--;
 	}
+	return labels ? label_list_find_label(labels, str, length) : NULL;
 }
 
-static struct error *tokenize_state_expr_end_end(struct tokenize_data *data)
+/* #defines stay what they were where they were used */
+static int is_changing(struct tokenize_data *data, const struct label *label)
 {
-	if (data->paren_levels > 0)
-		return error_create("Expected %" PRIuPTR " ')'s at end of expression", data->paren_levels);
-	return NULL;
+	const struct expr_data *expr = data->data;
+
+	if (!label)
+		return 1;
+	if (label->type != LABEL_TYPE_LABEL)
+		return 0;
+	if (data->token.str[0] == expr->local_label_char)
+		return expr->local_labels_change;
+	return expr->changing_labels && label_list_find_label(expr->changing_labels, label->name, label->length);
 }
 
-static struct error *tokenize_state_constant_consume(struct tokenize_data *data, char c)
+static struct error *resolve_label(struct tokenize_data *data)
 {
-	struct error *err;
+	const struct label *label;
 
-	if (is_constant_middle(c)) {
-		return NULL;
-	} else if (is_constant_suffix(c)) {
-		token_calc_length(data, 1);
-		if ((err = evaluate_suffix_constant(data)))
-			return err;
-		token_append(data);
-
-		data->state = &TOKENIZE_STATE_EXPR_END;
-		return NULL;
-	} else {
-		token_calc_length(data, 0);
-		if ((err = evaluate_suffix_constant(data)))
-			return err;
-		token_append(data);
+	if (!data->program)
+		return evaluate_label(data);
 
-		data->consumed_char = 0;
-		data->state = &TOKENIZE_STATE_EXPR_END;
-		return NULL;
-	}
+	label = find_label(data);
+	data->token.extra.value = label ? label->value : 0;
+	if (is_changing(data, label))
+		add_reference(data, label);
+	return NULL;
 }
 
-static struct error *tokenize_state_constant_end(struct tokenize_data *data)
+static struct error *do_label(struct tokenize_data *data, const struct lex_token *lex_token)
 {
 	struct error *err;
 
-	token_calc_length(data, 0);
-	if ((err = evaluate_suffix_constant(data)))
+	token_begin(data, lex_token, TOKEN_TYPE_CONSTANT);
+	if ((err = resolve_label(data)))
 		return err;
 	token_append(data);
 
-	data->consumed_char = 0;
 	data->state = &TOKENIZE_STATE_EXPR_END;
 	return NULL;
 }
 
-static struct error *tokenize_state_prefix_constant_consume(struct tokenize_data *data, char c)
+/* The local label character may be punctuation, which the lexer keeps apart from the name */
+static int is_local_label_prefix(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	struct error *err;
+	const struct lex_token *next = lex_token + 1;
 
-	if (is_constant_middle(c)) {
-		return NULL;
-	} else {
-		token_calc_length(data, 0);
-		if ((err = evaluate_prefix_constant(data)))
-			return err;
-		token_append(data);
-
-		data->consumed_char = 0;
-		data->state = &TOKENIZE_STATE_EXPR_END;
-		return NULL;
-	}
+	return data->data->local_label_char && lex_token_is(lex_token, LEX_TOKEN_TYPE_OPERATOR, data->data->local_label_char)
+		&& data->index + 1 < data->num_lex_tokens && next->type == LEX_TOKEN_TYPE_IDENTIFIER && next->str == lex_token->str + 1;
 }
 
-static struct error *tokenize_state_prefix_constant_end(struct tokenize_data *data)
+static struct error *do_local_label(struct tokenize_data *data, const struct lex_token *lex_token)
 {
 	struct error *err;
 
-	token_calc_length(data, 0);
-	if ((err = evaluate_prefix_constant(data)))
+	token_begin(data, lex_token, TOKEN_TYPE_CONSTANT);
+	data->token.length += lex_token[1].length;
+	if ((err = resolve_label(data)))
 		return err;
 	token_append(data);
 
-	data->consumed_char = 0;
+	data->index++;
 	data->state = &TOKENIZE_STATE_EXPR_END;
 	return NULL;
 }
 
-static struct error *tokenize_state_char_constant_consume(struct tokenize_data *data, char c)
+static struct error *do_binary_operator(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	struct error *err;
-	size_t length = data->index - data->token.index;
+	size_t i;
 
-	if (length == 1) {
-		return NULL;
-	} else if (c == '\'') {
-		token_calc_length(data, 1);
-		if ((err = evaluate_char_constant(data)))
-			return err;
-		token_append(data);
+	for (i = 0; i < sizeof(BINARY_OPERATORS) / sizeof(*BINARY_OPERATORS); i++) {
+		if (bergen_strlen(BINARY_OPERATORS[i].str) == lex_token->length && !bergen_memcmp(BINARY_OPERATORS[i].str, lex_token->str, lex_token->length)) {
+			token_begin(data, lex_token, TOKEN_TYPE_BINARY_OPERATOR);
+			data->token.extra.binary_operator_type = BINARY_OPERATORS[i].type;
+			token_append(data);
 
-		data->state = &TOKENIZE_STATE_EXPR_END;
-		return NULL;
-	} else {
-		return error_create("Expected single quote but got '%c'", c);
+			data->state = &TOKENIZE_STATE_EXPR_BEGIN;
+			return NULL;
+		}
 	}
-}
 
-static struct error *tokenize_state_char_constant_end(struct tokenize_data *data)
-{
-	return error_create("Reached end of expression in middle of char constant");
+	if (lex_token->length > 1)
+		return error_create_span(ERROR_INVALID_BINARY_OPERATOR, lex_token->str, lex_token->length);
+	return error_create_value(ERROR_UNEXPECTED_CHAR_EXPR_END, lex_token->str[0]);
 }
 
-static struct error *tokenize_state_binary_operator_consume(struct tokenize_data *data, char c)
+static struct error *tokenize_state_expr_begin_consume(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	struct error *err;
+	switch (lex_token->type) {
+	case LEX_TOKEN_TYPE_WHITESPACE:
+		return NULL;
 
-	if (is_binary_operator_second(c)) {
-		token_calc_length(data, 1);
-		if ((err = evaluate_binary_operator(data)))
-			return err;
-		token_append(data);
+	case LEX_TOKEN_TYPE_NUMBER:
+		return do_constant(data, lex_token);
 
-		data->state = &TOKENIZE_STATE_EXPR_BEGIN;
-		return NULL;
-	} else {
-		token_calc_length(data, 0);
-		if ((err = evaluate_binary_operator(data)))
-			return err;
-		token_append(data);
+	case LEX_TOKEN_TYPE_CHAR:
+		return do_char_constant(data, lex_token);
 
-		data->consumed_char = 0;
-		data->state = &TOKENIZE_STATE_EXPR_BEGIN;
-		return NULL;
+	case LEX_TOKEN_TYPE_IDENTIFIER:
+		return do_label(data, lex_token);
+
+	case LEX_TOKEN_TYPE_OPERATOR:
+		if (lex_token_is(lex_token, LEX_TOKEN_TYPE_OPERATOR, '~') || lex_token_is(lex_token, LEX_TOKEN_TYPE_OPERATOR, '-'))
+			return do_unary_operator(data, lex_token);
+		else if (lex_token_is(lex_token, LEX_TOKEN_TYPE_OPERATOR, '('))
+			return do_lparen(data, lex_token);
+		else if (is_local_label_prefix(data, lex_token))
+			return do_local_label(data, lex_token);
+		break;
+
+	default:
+		break;
 	}
+
+	return error_create_value(ERROR_UNEXPECTED_CHAR_EXPR_BEGIN, lex_token->str[0]);
 }
 
-static struct error *tokenize_state_binary_operator_end(struct tokenize_data *data)
+static struct error *tokenize_state_expr_begin_end(struct tokenize_data *data)
 {
-	data->consumed_char = 0;
-	data->state = &TOKENIZE_STATE_EXPR_BEGIN;
-	return NULL;
+	return error_create(ERROR_EXPECTED_EXPRESSION);
 }
 
-static struct error *tokenize_state_label_consume(struct tokenize_data *data, char c)
+static struct error *tokenize_state_expr_end_consume(struct tokenize_data *data, const struct lex_token *lex_token)
 {
-	struct error *err;
-
-	if (is_label_middle(c)) {
+	switch (lex_token->type) {
+	case LEX_TOKEN_TYPE_WHITESPACE:
 		return NULL;
-	} else {
-		token_calc_length(data, 0);
-		if ((err = evaluate_label(data)))
-			return err;
-		token_append(data);
 
-		data->consumed_char = 0;
-		data->state = &TOKENIZE_STATE_EXPR_END;
-		return NULL;
+	case LEX_TOKEN_TYPE_OPERATOR:
+		if (lex_token_is(lex_token, LEX_TOKEN_TYPE_OPERATOR, ')'))
+			return do_rparen(data, lex_token);
+		return do_binary_operator(data, lex_token);
+
+	default:
+		return error_create_value(ERROR_UNEXPECTED_CHAR_EXPR_END, lex_token->str[0]);
 	}
 }
 
-static struct error *tokenize_state_label_end(struct tokenize_data *data)
+static struct error *tokenize_state_expr_end_end(struct tokenize_data *data)
 {
-	struct error *err;
+	if (data->paren_levels > 0)
+		return error_create_value(ERROR_EXPECTED_RPARENS, data->paren_levels);
+	return NULL;
+}
 
-	token_calc_length(data, 0);
-	if ((err = evaluate_label(data)))
-		return err;
-	token_append(data);
+static struct error *tokenize_error(struct tokenize_data *data, struct error *err)
+{
+	struct source_location location = data->data->location;
+	const char *ptr = data->data->str + data->data->length;
 
-	data->consumed_char = 0;
-	data->state = &TOKENIZE_STATE_EXPR_END;
-	return NULL;
+	if (location.file != SOURCE_FILE_NONE) {
+		/*
+		 * Point at the offending text if the error has it, otherwise at
+		 * the current token. Tokens from macro bodies are not in str, so
+		 * those are reported at the start of the expression.
+		 */
+		if (is_in_str(data->data, err->str))
+			ptr = err->str;
+		else if (data->index < data->num_lex_tokens)
+			ptr = is_in_str(data->data, data->lex_tokens[data->index].str) ? data->lex_tokens[data->index].str : data->data->str;
+		location.offset += ptr - data->data->str;
+		error_set_location(err, location);
+	}
+	return err;
 }
 
-static struct error *tokenize(struct expr_data *data, struct token_list *tokens)
+static struct error *tokenize(struct expr_data *data, const struct lex_token *lex_tokens, size_t num_lex_tokens, struct token_list *tokens, struct expr_program *program)
 {
 	struct error *err;
 	struct tokenize_data tdata;
 
 	tdata.data = data;
 	tdata.tokens = tokens;
+	tdata.lex_tokens = lex_tokens;
+	tdata.num_lex_tokens = num_lex_tokens;
+	tdata.program = program;
 
 	tdata.paren_levels = 0;
 	tdata.state = &TOKENIZE_STATE_INITIAL_STATE;
 
-	for (tdata.index = 0; tdata.index < data->length; tdata.index++) {
-		tdata.current_char = data->str[tdata.index];
-		do {
-			tdata.consumed_char = 1; /* Must be overridden by state function */
-			if ((err = tdata.state->consume(&tdata, tdata.current_char)))
-				return err;
-		} while (!tdata.consumed_char);
+	for (tdata.index = 0; tdata.index < num_lex_tokens; tdata.index++) {
+		/* A comment ends the expression */
+		if (lex_tokens[tdata.index].type == LEX_TOKEN_TYPE_COMMENT)
+			break;
+		if ((err = tdata.state->consume(&tdata, &lex_tokens[tdata.index])))
+			return tokenize_error(&tdata, err);
 	}
 
-	do {
-		tdata.consumed_char = 1;
-		if ((err = tdata.state->end(&tdata)))
-			return err;
-	} while (!tdata.consumed_char);
+	if ((err = tdata.state->end(&tdata)))
+		return tokenize_error(&tdata, err);
 
 	return NULL;
 }
 
-static void apply_binary_operator(enum binary_operator_type op_type, expr_value *result, expr_value rvalue)
+/* Division by zero, and of the lowest value by -1, would trap */
+static int can_divide(expr_value lvalue, expr_value rvalue, struct error **err)
+{
+	if (*err)
+		return 0;
+	if (rvalue == 0)
+		*err = error_create(ERROR_DIVISION_BY_ZERO);
+	else if (rvalue == -1 && lvalue == INT64_MIN)
+		*err = error_create_value(ERROR_DIVISION_OVERFLOW, lvalue);
+	return !*err;
+}
+
+static void apply_binary_operator(enum binary_operator_type op_type, expr_value *result, expr_value rvalue, struct error **err)
 {
 	switch (op_type) {
 	case BINARY_OPERATOR_TYPE_ASSIGN:
@@ -846,11 +679,13 @@ static void apply_binary_operator(enum binary_operator_type op_type, expr_value
 		break;
 
 	case BINARY_OPERATOR_TYPE_DIV:
-		*result /= rvalue;
+		if (can_divide(*result, rvalue, err))
+			*result /= rvalue;
 		break;
 
 	case BINARY_OPERATOR_TYPE_MODULO:
-		*result %= rvalue;
+		if (can_divide(*result, rvalue, err))
+			*result %= rvalue;
 		break;
 
 	case BINARY_OPERATOR_TYPE_LSL:
@@ -899,22 +734,23 @@ static void apply_binary_operator(enum binary_operator_type op_type, expr_value
 	}
 }
 
-static size_t expr_evaluate_r(struct expr_data *data, struct token_list *tokens, size_t start_index, expr_value *result);
+/* Evaluation goes on past an error, but only the first is kept in *err */
+static size_t expr_evaluate_r(struct token_list *tokens, size_t start_index, expr_value *result, struct error **err);
 
-static size_t apply_unary_operator(struct expr_data *data, struct token_list *tokens, size_t start_index, expr_value *result)
+static size_t apply_unary_operator(struct token_list *tokens, size_t start_index, expr_value *result, struct error **err)
 {
 	size_t index = start_index;
 	expr_value value;
-	struct token *token1 = &tokens->tokens[index];
-	struct token *token2 = &tokens->tokens[index + 1];
+	struct expr_token *token1 = &tokens->tokens[index];
+	struct expr_token *token2 = &tokens->tokens[index + 1];
 
 	if (token2->type == TOKEN_TYPE_CONSTANT) {
 		index += 2;
 		value = token2->extra.value;
 	} else if (token2->type == TOKEN_TYPE_LPAREN) {
-		index = expr_evaluate_r(data, tokens, index + 1, &value);
+		index = expr_evaluate_r(tokens, index + 1, &value, err);
 	} else if (token2->type == TOKEN_TYPE_UNARY_OPERATOR) {
-		index = apply_unary_operator(data, tokens, index + 1, &value);
+		index = apply_unary_operator(tokens, index + 1, &value, err);
 	}
 
 	switch (token1->extra.unary_operator_type) {
@@ -930,11 +766,11 @@ static size_t apply_unary_operator(struct expr_data *data, struct token_list *to
 	return index;
 }
 
-static size_t expr_evaluate_r(struct expr_data *data, struct token_list *tokens, size_t start_index, expr_value *result)
+static size_t expr_evaluate_r(struct token_list *tokens, size_t start_index, expr_value *result, struct error **err)
 {
 	size_t index = start_index;
 	expr_value value;
-	struct token *token;
+	struct expr_token *token;
 	enum binary_operator_type op_type = BINARY_OPERATOR_TYPE_ASSIGN;
 
 	for (;;) {
@@ -942,13 +778,13 @@ static size_t expr_evaluate_r(struct expr_data *data, struct token_list *tokens,
 		token = &tokens->tokens[index];
 		if (token->type == TOKEN_TYPE_CONSTANT) {
 			index++;
-			apply_binary_operator(op_type, result, token->extra.value);
+			apply_binary_operator(op_type, result, token->extra.value, err);
 		} else if (token->type == TOKEN_TYPE_LPAREN) {
-			index = expr_evaluate_r(data, tokens, index + 1, &value);
-			apply_binary_operator(op_type, result, value);
+			index = expr_evaluate_r(tokens, index + 1, &value, err);
+			apply_binary_operator(op_type, result, value, err);
 		} else if (token->type == TOKEN_TYPE_UNARY_OPERATOR) {
-			index = apply_unary_operator(data, tokens, index, &value);
-			apply_binary_operator(op_type, result, value);
+			index = apply_unary_operator(tokens, index, &value, err);
+			apply_binary_operator(op_type, result, value, err);
 		}
 
 		/* Second step */
@@ -966,20 +802,130 @@ static size_t expr_evaluate_r(struct expr_data *data, struct token_list *tokens,
 	return 0;
 }
 
-struct error *expr_evaluate(struct expr_data *data, expr_value *result)
+/* Errors found while evaluating are reported at the start of the expression */
+static struct source_location get_location(const struct expr_data *data, const struct lex_token *lex_tokens, size_t num_lex_tokens)
+{
+	struct source_location location = data->location;
+
+	if (location.file != SOURCE_FILE_NONE && num_lex_tokens > 0 && is_in_str(data, lex_tokens[0].str))
+		location.offset += lex_tokens[0].str - data->str;
+	return location;
+}
+
+static struct error *evaluation_error(struct source_location location, struct error *err)
+{
+	if (err && location.file != SOURCE_FILE_NONE)
+		error_set_location(err, location);
+	return err;
+}
+
+struct error *expr_evaluate_tokens(struct expr_data *data, const struct lex_token *lex_tokens, size_t num_lex_tokens, expr_value *result)
 {
 	struct error *err;
 	struct token_list tokens;
 
 	token_list_init(&tokens);
-	if ((err = tokenize(data, &tokens))) {
+	if ((err = tokenize(data, lex_tokens, num_lex_tokens, &tokens, NULL))) {
 		token_list_destroy(&tokens);
 		return err;
 	}
+	stats_count(STATS_COUNTER_EXPRESSIONS, 1);
+	stats_count(STATS_COUNTER_TOKENS, tokens.num_tokens);
 
 	/* Expression is guaranteed to be valid, now evaluate it */
-	expr_evaluate_r(data, &tokens, 0, result);
+	expr_evaluate_r(&tokens, 0, result, &err);
 
 	token_list_destroy(&tokens);
+	return evaluation_error(get_location(data, lex_tokens, num_lex_tokens), err);
+}
+
+struct error *expr_evaluate(struct expr_data *data, expr_value *result)
+{
+	struct lex_token_list tokens;
+	struct error *err;
+
+	lex_token_list_init(&tokens);
+	lex_line(data->str, data->length, &tokens);
+	err = expr_evaluate_tokens(data, tokens.tokens, tokens.num_tokens, result);
+	lex_token_list_destroy(&tokens);
+	return err;
+}
+
+void expr_program_init(struct expr_program *program)
+{
+	program->tokens = NULL;
+	program->num_tokens = 0;
+	program->references = NULL;
+	program->references_buffer_size = 0;
+	program->num_references = 0;
+	program->num_missing = 0;
+	program->location = source_location_none();
+}
+
+void expr_program_destroy(struct expr_program *program)
+{
+	size_t i;
+
+	for (i = 0; i < program->num_references; i++)
+		if (program->references[i].owns_name)
+			bergen_free(program->references[i].name);
+	bergen_free(program->references);
+	bergen_free(program->tokens);
+}
+
+struct error *expr_compile_tokens(struct expr_data *data, const struct lex_token *lex_tokens, size_t num_lex_tokens, struct expr_program *program, expr_value *result)
+{
+	struct error *err;
+	struct token_list tokens;
+
+	token_list_init(&tokens);
+	if ((err = tokenize(data, lex_tokens, num_lex_tokens, &tokens, program))) {
+		token_list_destroy(&tokens);
+		return err;
+	}
+	stats_count(STATS_COUNTER_EXPRESSIONS, 1);
+	stats_count(STATS_COUNTER_TOKENS, tokens.num_tokens);
+
+	expr_evaluate_r(&tokens, 0, result, &err);
+	if (program->num_references == 0) {
+		token_list_destroy(&tokens);
+		return evaluation_error(get_location(data, lex_tokens, num_lex_tokens), err);
+	}
+
+	/* The values referenced aren't final, so neither is any error they cause */
+	error_free(err);
+	program->location = get_location(data, lex_tokens, num_lex_tokens);
+
+	/* Programs are kept by the thousand, and most expressions are a token or three */
+	program->tokens = bergen_realloc(tokens.tokens, sizeof(*tokens.tokens) * tokens.num_tokens);
+	program->num_tokens = tokens.num_tokens;
 	return NULL;
 }
+
+struct error *expr_program_evaluate(struct expr_program *program, const struct label_list *labels, const struct label_list *local_labels, expr_value location_counter, expr_value *result)
+{
+	const struct expr_reference *reference;
+	struct token_list tokens;
+	struct error *err;
+	size_t i;
+
+	for (i = 0; i < program->num_references; i++) {
+		reference = &program->references[i];
+		if (!reference->name) {
+			program->tokens[reference->token].extra.value = location_counter;
+			continue;
+		}
+		err = evaluate_label_type_known(reference->is_local ? local_labels : labels, reference->name, reference->length, &program->tokens[reference->token].extra.value);
+		if (err) {
+			error_set_location(err, reference->location);
+			return err;
+		}
+	}
+
+	tokens.tokens = program->tokens;
+	tokens.buffer_size = program->num_tokens;
+	tokens.num_tokens = program->num_tokens;
+	err = NULL;
+	expr_evaluate_r(&tokens, 0, result, &err);
+	return evaluation_error(program->location, err);
+}
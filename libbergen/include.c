@@ -0,0 +1,375 @@
+/*
+ * libbergen/include.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define BERGEN_ALLOC_TAG ALLOC_TAG_FILES
+
+#include <bergen/include.h>
+
+#include <bergen/libc.h>
+#include <bergen/stats.h>
+#include <bergen/trace.h>
+
+int include_file_is_current(const struct include_file *file)
+{
+	struct stat buf;
+
+	if (bergen_stat(file->path, &buf))
+		return 0;
+	return buf.st_dev == file->dev && buf.st_ino == file->ino && buf.st_size == file->size
+	    && buf.st_mtim.tv_sec == file->mtime.tv_sec && buf.st_mtim.tv_nsec == file->mtime.tv_nsec;
+}
+
+void include_file_list_init(struct include_file_list *list)
+{
+	list->files_buffer_size = 16;
+	list->files = bergen_malloc(sizeof(*list->files) * list->files_buffer_size);
+	list->num_files = 0;
+}
+
+void include_file_list_destroy(struct include_file_list *list)
+{
+	bergen_free(list->files);
+}
+
+void include_file_list_add(struct include_file_list *list, const struct include_file *file)
+{
+	size_t i;
+
+	/* Programs include tens of files, not thousands */
+	for (i = 0; i < list->num_files; i++) {
+		if (list->files[i] == file)
+			return;
+	}
+
+	if (list->num_files >= list->files_buffer_size) {
+		list->files_buffer_size *= 2;
+		list->files = bergen_realloc(list->files, sizeof(*list->files) * list->files_buffer_size);
+	}
+	list->files[list->num_files++] = file;
+}
+
+static void free_file(struct include_file *file)
+{
+	if (file->length > 0)
+		bergen_munmap((void *) file->data, file->length);
+	bergen_free(file->guard);
+	bergen_free(file->path);
+	bergen_free(file);
+}
+
+void include_manager_init(struct include_manager *im)
+{
+	im->search_paths_buffer_size = 8;
+	im->search_paths = bergen_malloc(sizeof(*im->search_paths) * im->search_paths_buffer_size);
+	im->num_search_paths = 0;
+
+	im->files_buffer_size = 32;
+	im->files = bergen_malloc(sizeof(*im->files) * im->files_buffer_size);
+	im->num_files = 0;
+	intern_table_init(&im->files_by_key);
+
+	im->stats_buffer_size = 32;
+	im->stats = bergen_malloc(sizeof(*im->stats) * im->stats_buffer_size);
+	intern_table_init(&im->stats_by_path);
+
+	source_list_init(&im->sources);
+
+	bergen_pthread_mutex_init(&im->lock, NULL);
+}
+
+void include_manager_destroy(struct include_manager *im)
+{
+	size_t i;
+
+	for (i = 0; i < im->num_files; i++)
+		free_file(im->files[i]);
+	bergen_free(im->files);
+	intern_table_destroy(&im->files_by_key);
+
+	bergen_free(im->stats);
+	intern_table_destroy(&im->stats_by_path);
+
+	for (i = 0; i < im->num_search_paths; i++)
+		bergen_free(im->search_paths[i]);
+	bergen_free(im->search_paths);
+
+	source_list_destroy(&im->sources);
+
+	bergen_pthread_mutex_destroy(&im->lock);
+}
+
+void include_manager_add_search_path(struct include_manager *im, const char *path)
+{
+	if (im->num_search_paths >= im->search_paths_buffer_size) {
+		im->search_paths_buffer_size *= 2;
+		im->search_paths = bergen_realloc(im->search_paths, sizeof(*im->search_paths) * im->search_paths_buffer_size);
+	}
+	im->search_paths[im->num_search_paths++] = bergen_strdup(path);
+}
+
+/* A file changed in place keeps its inode, so its size and mtime are part of the key */
+struct file_key {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime_sec;
+	long mtime_nsec;
+};
+
+static void make_file_key(struct file_key *key, dev_t dev, ino_t ino, off_t size, const struct timespec *mtime)
+{
+	bergen_memset(key, 0, sizeof(*key)); /* Padding is part of the key too */
+	key->dev = dev;
+	key->ino = ino;
+	key->size = size;
+	key->mtime_sec = mtime->tv_sec;
+	key->mtime_nsec = mtime->tv_nsec;
+}
+
+/* Nothing can find a file that has changed since it was loaded, so it goes */
+static void drop_changed_files(struct include_manager *im)
+{
+	struct include_file *file;
+	struct file_key key;
+	size_t i, num_files = 0;
+
+	for (i = 0; i < im->num_files; i++) {
+		file = im->files[i];
+		if (include_file_is_current(file)) {
+			im->files[num_files++] = file;
+		} else {
+			source_list_remove(&im->sources, file->source_id);
+			free_file(file);
+		}
+	}
+	if (num_files == im->num_files)
+		return;
+
+	/* Ids in files_by_key are indices in files, so they have to be made again */
+	im->num_files = num_files;
+	intern_table_destroy(&im->files_by_key);
+	intern_table_init(&im->files_by_key);
+	for (i = 0; i < im->num_files; i++) {
+		file = im->files[i];
+		make_file_key(&key, file->dev, file->ino, file->size, &file->mtime);
+		intern_table_intern(&im->files_by_key, (const char *) &key, sizeof(key));
+	}
+}
+
+void include_manager_reset(struct include_manager *im)
+{
+	size_t i;
+
+	for (i = 0; i < im->num_search_paths; i++)
+		bergen_free(im->search_paths[i]);
+	im->num_search_paths = 0;
+
+	intern_table_destroy(&im->stats_by_path);
+	intern_table_init(&im->stats_by_path);
+
+	drop_changed_files(im);
+}
+
+static struct include_stat *get_stat(struct include_manager *im, const char *path)
+{
+	size_t num_stats = im->stats_by_path.num_entries;
+	intern_id id = intern_table_intern(&im->stats_by_path, path, bergen_strlen(path));
+	struct include_stat *st;
+	struct stat buf;
+
+	if (id < num_stats) /* Seen before */
+		return &im->stats[id];
+
+	if (id >= im->stats_buffer_size) {
+		im->stats_buffer_size *= 2;
+		im->stats = bergen_realloc(im->stats, sizeof(*im->stats) * im->stats_buffer_size);
+	}
+
+	st = &im->stats[id];
+	st->file = NULL;
+	st->exists = !bergen_stat(path, &buf) && S_ISREG(buf.st_mode);
+	return st;
+}
+
+static struct error *read_file(struct include_manager *im, const char *path, struct include_stat *st, struct include_file **result)
+{
+	struct file_key key;
+	char canonical[PATH_MAX];
+	intern_id id;
+	struct include_file *file;
+	struct stat buf;
+	void *data = NULL;
+	const char *guard;
+	size_t guard_length;
+	int fd;
+
+	if ((fd = bergen_open(path, O_RDONLY)) < 0 || bergen_fstat(fd, &buf)) {
+		if (fd >= 0)
+			bergen_close(fd);
+		return error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	}
+
+	/*
+	 * The same file may have been loaded through another path. The key comes
+	 * from what is actually mapped, the file may have changed since the stat.
+	 */
+	make_file_key(&key, buf.st_dev, buf.st_ino, buf.st_size, &buf.st_mtim);
+	if ((id = intern_table_find(&im->files_by_key, (const char *) &key, sizeof(key))) != INTERN_NONE) {
+		bergen_close(fd);
+		*result = st->file = im->files[id];
+		return NULL;
+	}
+
+	if (buf.st_size > 0 && (data = bergen_mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		bergen_close(fd);
+		return error_create_span_value(ERROR_IO, path, bergen_strlen(path), errno);
+	}
+	bergen_close(fd);
+
+	if (im->num_files >= im->files_buffer_size) {
+		im->files_buffer_size *= 2;
+		im->files = bergen_realloc(im->files, sizeof(*im->files) * im->files_buffer_size);
+	}
+
+	file = bergen_malloc(sizeof(*file));
+	file->path = bergen_strdup(bergen_realpath(path, canonical) ? canonical : path);
+	file->dev = buf.st_dev;
+	file->ino = buf.st_ino;
+	file->size = buf.st_size;
+	file->mtime = buf.st_mtim;
+	file->data = data ? data : "";
+	file->length = buf.st_size;
+	file->source_id = source_list_add(&im->sources, file->path, file->data, file->length);
+	guard = preprocessor_find_include_guard(file->data, file->length, &guard_length);
+	file->guard = guard ? bergen_strndup_null(guard, guard_length) : NULL;
+
+	intern_table_intern(&im->files_by_key, (const char *) &key, sizeof(key));
+	im->files[im->num_files++] = file;
+	*result = st->file = file;
+	stats_count(STATS_COUNTER_FILES_READ, 1);
+	stats_count(STATS_COUNTER_BYTES_READ, file->length);
+	return NULL;
+}
+
+static struct error *load_file(struct include_manager *im, const char *path, struct include_stat *st, struct include_file **result)
+{
+	struct error *err;
+	uint64_t start = trace_begin();
+
+	stats_phase_begin(STATS_PHASE_READ);
+	err = read_file(im, path, st, result);
+	stats_phase_end();
+	if (start)
+		trace_end(start, TRACE_CATEGORY_READ, path, bergen_strlen(path));
+	return err;
+}
+
+static struct error *try_path(struct include_manager *im, const char *path, struct include_file **file)
+{
+	struct include_stat *st = get_stat(im, path);
+
+	if (!st->exists) {
+		*file = NULL;
+		return NULL;
+	}
+	if (st->file) {
+		*file = st->file;
+		return NULL;
+	}
+	return load_file(im, path, st, file);
+}
+
+struct error *include_manager_load(struct include_manager *im, const char *path, struct include_file **file)
+{
+	struct error *err;
+
+	bergen_pthread_mutex_lock(&im->lock);
+	err = try_path(im, path, file);
+	bergen_pthread_mutex_unlock(&im->lock);
+
+	if (err)
+		return err;
+	if (!*file)
+		return error_create_span(ERROR_FILE_NOT_FOUND, path, bergen_strlen(path));
+	return NULL;
+}
+
+/* Frees path, so the message of any error must be made while it's still there */
+static struct error *try_owned_path(struct include_manager *im, char *path, struct include_file **file)
+{
+	struct error *err = try_path(im, path, file);
+
+	if (err)
+		error_get_message(err);
+	bergen_free(path);
+	return err;
+}
+
+static char *join_path(const char *dir, size_t dir_length, const char *name, size_t length)
+{
+	char *path = bergen_malloc(dir_length + length + 2);
+
+	bergen_memcpy(path, dir, dir_length);
+	path[dir_length] = '/';
+	bergen_memcpy(path + dir_length + 1, name, length);
+	path[dir_length + length + 1] = '\0';
+	return path;
+}
+
+static struct error *find_file(struct include_manager *im, const char *name, size_t length, const struct include_file *parent, struct include_file **file)
+{
+	const char *slash;
+	char *path;
+	size_t i;
+	struct error *err;
+
+	*file = NULL;
+	if (length > 0 && name[0] == '/') {
+		if ((err = try_owned_path(im, bergen_strndup_null(name, length), file)) || *file)
+			return err;
+	} else {
+		if (parent && (slash = bergen_strrchr(parent->path, '/'))) {
+			path = join_path(parent->path, slash - parent->path, name, length);
+			if ((err = try_owned_path(im, path, file)) || *file)
+				return err;
+		}
+
+		for (i = 0; i < im->num_search_paths; i++) {
+			path = join_path(im->search_paths[i], bergen_strlen(im->search_paths[i]), name, length);
+			if ((err = try_owned_path(im, path, file)) || *file)
+				return err;
+		}
+	}
+
+	return error_create_span(ERROR_FILE_NOT_FOUND, name, length);
+}
+
+struct error *include_manager_find(struct include_manager *im, const char *name, size_t length, const struct include_file *parent, struct include_file **file)
+{
+	struct error *err;
+
+	bergen_pthread_mutex_lock(&im->lock);
+	err = find_file(im, name, length, parent, file);
+	bergen_pthread_mutex_unlock(&im->lock);
+	return err;
+}
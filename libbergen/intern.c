@@ -0,0 +1,123 @@
+/*
+ * libbergen/intern.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/intern.h>
+
+#include <bergen/libc.h>
+
+static void init_slots(struct intern_table *table, size_t num_slots)
+{
+	size_t i;
+
+	table->num_slots = num_slots;
+	table->slots = bergen_malloc(sizeof(*table->slots) * num_slots);
+	for (i = 0; i < num_slots; i++)
+		table->slots[i] = INTERN_NONE;
+}
+
+static void insert_slot(struct intern_table *table, intern_id id)
+{
+	size_t mask = table->num_slots - 1;
+	size_t i = table->entries[id].hash & mask;
+
+	while (table->slots[i] != INTERN_NONE)
+		i = (i + 1) & mask;
+	table->slots[i] = id;
+}
+
+static void grow_slots(struct intern_table *table)
+{
+	intern_id i;
+
+	bergen_free(table->slots);
+	init_slots(table, table->num_slots * 2);
+	for (i = 0; i < table->num_entries; i++)
+		insert_slot(table, i);
+}
+
+void intern_table_init(struct intern_table *table)
+{
+	table->buffer_size = 32;
+	table->entries = bergen_malloc(sizeof(*table->entries) * table->buffer_size);
+	table->num_entries = 0;
+	init_slots(table, 64);
+}
+
+void intern_table_destroy(struct intern_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->num_entries; i++)
+		bergen_free(table->entries[i].name);
+	bergen_free(table->entries);
+	bergen_free(table->slots);
+}
+
+intern_id intern_table_find_hashed(const struct intern_table *table, const char *name, size_t length, uint32_t hash)
+{
+	size_t mask = table->num_slots - 1;
+	size_t i = hash & mask;
+	const struct intern_entry *entry;
+	intern_id id;
+
+	while ((id = table->slots[i]) != INTERN_NONE) {
+		entry = &table->entries[id];
+		if (entry->hash == hash && entry->length == length && !bergen_memcmp(entry->name, name, length))
+			return id;
+		i = (i + 1) & mask;
+	}
+
+	return INTERN_NONE;
+}
+
+intern_id intern_table_intern(struct intern_table *table, const char *name, size_t length)
+{
+	uint32_t hash = intern_hash(name, length);
+	intern_id id = intern_table_find_hashed(table, name, length, hash);
+	struct intern_entry *entry;
+
+	if (id != INTERN_NONE)
+		return id;
+
+	if (table->num_entries >= table->buffer_size) {
+		table->buffer_size *= 2;
+		table->entries = bergen_realloc(table->entries, sizeof(*table->entries) * table->buffer_size);
+	}
+
+	id = table->num_entries++;
+	entry = &table->entries[id];
+	/* Names are copied by length, so binary keys may contain NUL bytes */
+	entry->name = bergen_malloc(length + 1);
+	bergen_memcpy(entry->name, name, length);
+	entry->name[length] = '\0';
+	entry->length = length;
+	entry->hash = hash;
+
+	/* Keep the load factor at or below 1/2 */
+	if (table->num_entries * 2 > table->num_slots)
+		grow_slots(table);
+	else
+		insert_slot(table, id);
+
+	return id;
+}
@@ -21,14 +21,20 @@
  * THE SOFTWARE.
  */
 
+#define BERGEN_ALLOC_TAG ALLOC_TAG_LABELS
+
 #include <bergen/label.h>
 
 #include <bergen/libc.h>
+#include <bergen/stats.h>
 
 void label_init(struct label *label, const char *name, size_t length, expr_value value)
 {
 	label->name = bergen_strndup_null(name, length);
+	label->length = length;
+	label->hash = intern_hash(name, length);
 	label->value = value;
+	label->type = LABEL_TYPE_LABEL;
 }
 
 void label_destroy(struct label *label)
@@ -36,48 +42,130 @@ void label_destroy(struct label *label)
 	bergen_free(label->name);
 }
 
+static void init_slots(struct label_list *list, size_t num_slots)
+{
+	size_t i;
+
+	list->num_slots = num_slots;
+	list->slots = bergen_malloc(sizeof(*list->slots) * num_slots);
+	for (i = 0; i < num_slots; i++)
+		list->slots[i] = LABEL_NONE;
+}
+
+static void insert_slot(struct label_list *list, size_t index)
+{
+	size_t mask = list->num_slots - 1;
+	size_t i = list->labels[index].hash & mask;
+
+	while (list->slots[i] != LABEL_NONE)
+		i = (i + 1) & mask;
+	list->slots[i] = index;
+}
+
+/* Removing moves labels around, so every slot is filled again */
+static void rebuild_slots(struct label_list *list, size_t num_slots)
+{
+	size_t i;
+
+	bergen_free(list->slots);
+	init_slots(list, num_slots);
+	for (i = 0; i < list->num_labels; i++)
+		insert_slot(list, i);
+}
+
+/* Most local label scopes stay empty, so nothing is allocated until needed */
 void label_list_init(struct label_list *list)
 {
-	list->labels = bergen_malloc(sizeof(*list->labels) * 32);
-	list->buffer_size = 32;
+	list->labels = NULL;
+	list->buffer_size = 0;
 	list->num_labels = 0;
+	list->slots = NULL;
+	list->num_slots = 0;
 }
 
 void label_list_destroy(struct label_list *list)
 {
+	size_t i;
+
+	for (i = 0; i < list->num_labels; i++)
+		label_destroy(&list->labels[i]);
 	bergen_free(list->labels);
+	bergen_free(list->slots);
 }
 
 void label_list_append_copy(struct label_list *list, const struct label *label)
 {
-	size_t length = bergen_strlen(label->name);
-	label_list_append(list, label->name, length, label->value);
+	label_list_append_type(list, label->name, label->length, label->value, label->type);
 }
 
-void label_list_append(struct label_list *list, const char *name, size_t length, expr_value value)
+void label_list_append_type(struct label_list *list, const char *name, size_t length, expr_value value, enum label_type type)
 {
 	struct label *ptr;
 
 	if (list->num_labels >= list->buffer_size) {
-		list->buffer_size *= 2;
+		list->buffer_size = list->buffer_size ? list->buffer_size * 2 : 8;
 		list->labels = bergen_realloc(list->labels, sizeof(*list->labels) * list->buffer_size);
 	}
 
 	ptr = &list->labels[list->num_labels++];
-	ptr->name = bergen_strndup_null(name, length);
-	ptr->value = value;
+	label_init(ptr, name, length, value);
+	ptr->type = type;
+
+	if (list->num_labels * 2 > list->num_slots)
+		rebuild_slots(list, list->num_slots ? list->num_slots * 2 : 16);
+	else
+		insert_slot(list, list->num_labels - 1);
 }
 
 struct label *label_list_find_label(const struct label_list *list, const char *name, size_t length)
 {
-	size_t i;
-	struct label *ptr;
+	size_t mask = list->num_slots - 1;
+	uint32_t hash = intern_hash(name, length);
+	size_t i = hash & mask, probes = 1;
+	struct label *ptr = NULL;
 
-	for (i = 0; i < list->num_labels; i++) {
-		ptr = &list->labels[i];
-		if (length == bergen_strlen(ptr->name) && !bergen_strncmp(name, ptr->name, length))
-			return ptr;
+	if (list->num_slots == 0) {
+		stats_count(STATS_COUNTER_LABEL_LOOKUPS, 1);
+		return NULL;
 	}
 
-	return NULL;
+	for (; list->slots[i] != LABEL_NONE; i = (i + 1) & mask, probes++) {
+		ptr = &list->labels[list->slots[i]];
+		if (ptr->hash == hash && ptr->length == length && !bergen_memcmp(name, ptr->name, length))
+			break;
+		ptr = NULL;
+	}
+
+	stats_count(STATS_COUNTER_LABEL_LOOKUPS, 1);
+	stats_count(STATS_COUNTER_LABEL_PROBES, probes);
+	return ptr;
+}
+
+int label_list_remove(struct label_list *list, const char *name, size_t length)
+{
+	struct label *ptr = label_list_find_label(list, name, length);
+
+	if (!ptr)
+		return 0;
+
+	label_destroy(ptr);
+	*ptr = list->labels[--list->num_labels];
+	rebuild_slots(list, list->num_slots);
+	return 1;
+}
+
+void label_list_remove_type(struct label_list *list, enum label_type type)
+{
+	size_t i = 0, num_labels = list->num_labels;
+
+	while (i < list->num_labels) {
+		if (list->labels[i].type == type) {
+			label_destroy(&list->labels[i]);
+			list->labels[i] = list->labels[--list->num_labels];
+		} else {
+			i++;
+		}
+	}
+	if (list->num_labels != num_labels)
+		rebuild_slots(list, list->num_slots);
 }
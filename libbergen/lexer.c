@@ -0,0 +1,172 @@
+/*
+ * libbergen/lexer.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define BERGEN_ALLOC_TAG ALLOC_TAG_TOKENS
+
+#include <bergen/lexer.h>
+
+#include <bergen/libc.h>
+
+void lex_token_list_init(struct lex_token_list *list)
+{
+	list->tokens = bergen_malloc(sizeof(*list->tokens) * 32);
+	list->buffer_size = 32;
+	list->num_tokens = 0;
+}
+
+void lex_token_list_destroy(struct lex_token_list *list)
+{
+	bergen_free(list->tokens);
+}
+
+void lex_token_list_append(struct lex_token_list *list, const struct lex_token *tokens, size_t num_tokens)
+{
+	int too_small = 0;
+
+	while (list->num_tokens + num_tokens > list->buffer_size) {
+		too_small = 1;
+		list->buffer_size *= 2;
+	}
+	if (too_small)
+		list->tokens = bergen_realloc(list->tokens, sizeof(*list->tokens) * list->buffer_size);
+
+	bergen_memcpy(list->tokens + list->num_tokens, tokens, sizeof(*tokens) * num_tokens);
+	list->num_tokens += num_tokens;
+}
+
+static inline int is_identifier_begin(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline int is_identifier_middle(char c)
+{
+	return is_identifier_begin(c) || (c >= '0' && c <= '9');
+}
+
+static inline int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline int is_operand(const struct lex_token *token)
+{
+	switch (token->type) {
+	case LEX_TOKEN_TYPE_IDENTIFIER:
+	case LEX_TOKEN_TYPE_NUMBER:
+	case LEX_TOKEN_TYPE_CHAR:
+	case LEX_TOKEN_TYPE_STRING:
+	case LEX_TOKEN_TYPE_MACRO_ARG:
+		return 1;
+
+	case LEX_TOKEN_TYPE_OPERATOR:
+		return lex_token_is(token, LEX_TOKEN_TYPE_OPERATOR, ')');
+
+	default:
+		return 0;
+	}
+}
+
+static size_t scan_while(const char *str, size_t index, size_t length, int (*pred)(char))
+{
+	while (index < length && pred(str[index]))
+		index++;
+	return index;
+}
+
+static int is_space(char c)
+{
+	return !!bergen_isspace((unsigned char) c);
+}
+
+static size_t scan_string(const char *str, size_t index, size_t length)
+{
+	for (index++; index < length; index++) {
+		if (str[index] == '\\' && index + 1 < length)
+			index++;
+		else if (str[index] == '"')
+			return index + 1;
+	}
+	return length;
+}
+
+static size_t scan_operator(const char *str, size_t index, size_t length)
+{
+	static const char two_char_operators[][2] = {"<<", ">>", "==", "!=", "<=", ">="};
+	size_t i;
+
+	if (index + 1 < length) {
+		for (i = 0; i < sizeof(two_char_operators) / sizeof(*two_char_operators); i++) {
+			if (str[index] == two_char_operators[i][0] && str[index + 1] == two_char_operators[i][1])
+				return index + 2;
+		}
+	}
+	return index + 1;
+}
+
+void lex_line(const char *str, size_t length, struct lex_token_list *list)
+{
+	size_t index = 0, end;
+	struct lex_token token;
+	int operand_expected = 1;
+	char c;
+
+	token.arg = 0;
+	while (index < length) {
+		c = str[index];
+		if (is_space(c)) {
+			token.type = LEX_TOKEN_TYPE_WHITESPACE;
+			end = scan_while(str, index, length, is_space);
+		} else if (is_identifier_begin(c)) {
+			token.type = LEX_TOKEN_TYPE_IDENTIFIER;
+			end = scan_while(str, index + 1, length, is_identifier_middle);
+		} else if (is_digit(c)) {
+			token.type = LEX_TOKEN_TYPE_NUMBER;
+			end = scan_while(str, index + 1, length, is_identifier_middle);
+		} else if (c == '$' || c == '@' || (c == '%' && operand_expected && index + 1 < length && is_identifier_middle(str[index + 1]))) {
+			/* '%' is also modulo, so it is only a prefix where an operand is expected */
+			token.type = LEX_TOKEN_TYPE_NUMBER;
+			end = scan_while(str, index + 1, length, is_identifier_middle);
+		} else if (c == '\'' && index + 2 < length && str[index + 2] == '\'') {
+			token.type = LEX_TOKEN_TYPE_CHAR;
+			end = index + 3;
+		} else if (c == '"') {
+			token.type = LEX_TOKEN_TYPE_STRING;
+			end = scan_string(str, index, length);
+		} else if (c == ';') {
+			token.type = LEX_TOKEN_TYPE_COMMENT;
+			end = length;
+		} else {
+			token.type = LEX_TOKEN_TYPE_OPERATOR;
+			end = scan_operator(str, index, length);
+		}
+
+		token.str = str + index;
+		token.length = end - index;
+		lex_token_list_append(list, &token, 1);
+		if (token.type != LEX_TOKEN_TYPE_WHITESPACE && token.type != LEX_TOKEN_TYPE_COMMENT)
+			operand_expected = !is_operand(&token);
+
+		index = end;
+	}
+}
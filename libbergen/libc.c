@@ -23,6 +23,9 @@
 
 #include <bergen/libc.h>
 
+/* Counted allocations have their own copies in alloc.c */
+#ifndef BERGEN_ALLOC_HOOKS
+
 char *bergen_strdup(const char *s)
 {
 	char *buf = bergen_malloc(bergen_strlen(s) + 1);
@@ -44,3 +47,5 @@ char *bergen_strndup_null(const char *s, size_t n)
 	buf[n] = '\0';
 	return buf;
 }
+
+#endif /* BERGEN_ALLOC_HOOKS */
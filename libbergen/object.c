@@ -21,9 +21,12 @@
  * THE SOFTWARE.
  */
 
+#define BERGEN_ALLOC_TAG ALLOC_TAG_OBJECT
+
 #include <bergen/object.h>
 
 #include <bergen/libc.h>
+#include <bergen/stats.h>
 
 #include <errno.h>
 
@@ -56,32 +59,47 @@ void object_output_set_address(struct object_output *obj, expr_value address)
 		return;
 	}
 
+	/* Before the realloc, which may move last_segment */
+	next_index = obj->address - last_segment->address + last_segment->index;
 	if (obj->num_segments >= obj->segment_buffer_size) {
 		obj->segment_buffer_size *= 2;
 		obj->segments = bergen_realloc(obj->segments, sizeof(*obj->segments) * obj->segment_buffer_size);
 	}
 
-	next_index = obj->address - last_segment->address + last_segment->index;
 	last_segment = &obj->segments[obj->num_segments++];
 	last_segment->index = next_index;
 	obj->address = last_segment->address = address;
 }
 
-void object_output_write(struct object_output *obj, const void *mem, size_t length)
+size_t object_output_reserve(struct object_output *obj, size_t length)
 {
-	struct object_segment *last_segment = &obj->segments[obj->num_segments - 1];
-	size_t total_size = obj->address - last_segment->address + last_segment->index;
+	size_t total_size = object_output_get_offset(obj);
 	int too_small = 0;
 
 	while (total_size + length > obj->buffer_size) {
 		too_small = 1;
 		obj->buffer_size *= 2;
 	}
-	if (too_small)
+	if (too_small) {
 		obj->buffer = bergen_realloc(obj->buffer, sizeof(char) * obj->buffer_size);
+		stats_count(STATS_COUNTER_OBJECT_REGROWS, 1);
+	}
 
-	bergen_memcpy((char *) obj->buffer + total_size, mem, length);
 	obj->address += length;
+	return total_size;
+}
+
+void object_output_write(struct object_output *obj, const void *mem, size_t length)
+{
+	size_t offset = object_output_reserve(obj, length);
+
+	stats_count(STATS_COUNTER_OBJECT_WRITES, 1);
+	bergen_memcpy((char *) obj->buffer + offset, mem, length);
+}
+
+void object_output_patch(struct object_output *obj, size_t offset, const void *mem, size_t length)
+{
+	bergen_memcpy((char *) obj->buffer + offset, mem, length);
 }
 
 struct error *object_output_write_to_binary(const struct object_output *obj, FILE *file)
@@ -100,9 +118,42 @@ struct error *object_output_write_to_binary(const struct object_output *obj, FIL
 	for (i = 0; i < obj->num_segments; i++) {
 		segment = &obj->segments[i];
 		if (bergen_fseek(file, segment->address - lowest_address, SEEK_SET))
-			return error_create("Unable to fseek(): %s", bergen_strerror(bergen_ferror(file)));
+			return error_create_value(ERROR_FSEEK, errno);
 		bergen_fwrite(object_output_get_segment_ptr(obj, segment), sizeof(char), object_output_get_segment_length(obj, segment), file);
 	}
 
 	return NULL;
 }
+
+static void write_intel_hex_record(FILE *file, unsigned int address, unsigned int type, const uint8_t *data, size_t length)
+{
+	unsigned int checksum = length + (address >> 8) + address + type;
+	size_t i;
+
+	bergen_fprintf(file, ":%02X%04X%02X", (unsigned int) length, address & 0xFFFF, type);
+	for (i = 0; i < length; i++) {
+		bergen_fprintf(file, "%02X", data[i]);
+		checksum += data[i];
+	}
+	bergen_fprintf(file, "%02X\n", -checksum & 0xFF);
+}
+
+struct error *object_output_write_to_intel_hex(const struct object_output *obj, FILE *file)
+{
+	size_t i, offset, length, record_length;
+	const struct object_segment *segment;
+	const uint8_t *data;
+
+	for (i = 0; i < obj->num_segments; i++) {
+		segment = &obj->segments[i];
+		data = object_output_get_segment_ptr(obj, segment);
+		length = object_output_get_segment_length(obj, segment);
+		for (offset = 0; offset < length; offset += record_length) {
+			record_length = length - offset < 16 ? length - offset : 16;
+			write_intel_hex_record(file, segment->address + offset, 0x00, data + offset, record_length);
+		}
+	}
+	write_intel_hex_record(file, 0, 0x01, NULL, 0);
+
+	return NULL;
+}
@@ -0,0 +1,131 @@
+/*
+ * libbergen/pool.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/pool.h>
+
+#include <bergen/libc.h>
+
+struct thread_pool;
+
+struct pool_worker {
+	struct thread_pool *pool;
+	size_t index;
+	pthread_t thread;
+	int started;
+
+	pthread_mutex_t lock; /* Guards begin and end */
+	size_t begin, end; /* Jobs which nobody has taken yet */
+};
+
+struct thread_pool {
+	struct pool_worker *workers;
+	size_t num_workers;
+	thread_pool_func func;
+	void *data;
+};
+
+/* The owner takes from the front, thieves take from the back */
+static int take_job(struct pool_worker *worker, int steal, size_t *job)
+{
+	int found = 0;
+
+	bergen_pthread_mutex_lock(&worker->lock);
+	if (worker->begin < worker->end) {
+		*job = steal ? --worker->end : worker->begin++;
+		found = 1;
+	}
+	bergen_pthread_mutex_unlock(&worker->lock);
+	return found;
+}
+
+static int next_job(struct pool_worker *worker, size_t *job)
+{
+	struct thread_pool *pool = worker->pool;
+	size_t i;
+
+	if (take_job(worker, 0, job))
+		return 1;
+
+	/* Jobs are never added, so once every share is empty we are done */
+	for (i = 1; i < pool->num_workers; i++) {
+		if (take_job(&pool->workers[(worker->index + i) % pool->num_workers], 1, job))
+			return 1;
+	}
+	return 0;
+}
+
+static void *worker_main(void *arg)
+{
+	struct pool_worker *worker = arg;
+	size_t job;
+
+	while (next_job(worker, &job))
+		worker->pool->func(worker->pool->data, job);
+	return NULL;
+}
+
+void thread_pool_run(size_t num_threads, size_t num_jobs, thread_pool_func func, void *data)
+{
+	struct thread_pool pool;
+	struct pool_worker *worker;
+	size_t i;
+
+	if (num_threads > num_jobs)
+		num_threads = num_jobs;
+	if (num_threads <= 1) {
+		for (i = 0; i < num_jobs; i++)
+			func(data, i);
+		return;
+	}
+
+	pool.workers = bergen_malloc(sizeof(*pool.workers) * num_threads);
+	pool.num_workers = num_threads;
+	pool.func = func;
+	pool.data = data;
+
+	for (i = 0; i < num_threads; i++) {
+		worker = &pool.workers[i];
+		worker->pool = &pool;
+		worker->index = i;
+		worker->started = 0;
+		worker->begin = num_jobs * i / num_threads;
+		worker->end = num_jobs * (i + 1) / num_threads;
+		bergen_pthread_mutex_init(&worker->lock, NULL);
+	}
+
+	/* If a thread can't be started, the others steal its share */
+	for (i = 1; i < num_threads; i++) {
+		worker = &pool.workers[i];
+		worker->started = !bergen_pthread_create(&worker->thread, NULL, worker_main, worker);
+	}
+	worker_main(&pool.workers[0]);
+
+	/* Anyone may still be stealing from any share until all have stopped */
+	for (i = 1; i < num_threads; i++) {
+		if (pool.workers[i].started)
+			bergen_pthread_join(pool.workers[i].thread, NULL);
+	}
+	for (i = 0; i < num_threads; i++)
+		bergen_pthread_mutex_destroy(&pool.workers[i].lock);
+	bergen_free(pool.workers);
+}
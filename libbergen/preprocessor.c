@@ -21,9 +21,15 @@
  * THE SOFTWARE.
  */
 
+#define BERGEN_ALLOC_TAG ALLOC_TAG_MACROS
+
 #include <bergen/preprocessor.h>
 
+#include <bergen/expression.h>
 #include <bergen/libc.h>
+#include <bergen/profile.h>
+#include <bergen/trace.h>
+#include <bergen/z80.h>
 
 void pp_macro_definition_init(struct pp_macro_definition *macro, const char *name, size_t length, int have_args)
 {
@@ -32,79 +38,989 @@ void pp_macro_definition_init(struct pp_macro_definition *macro, const char *nam
 	if (have_args) {
 		macro->args_buffer_size = 32;
 		macro->args = bergen_malloc(sizeof(*macro->args) * macro->args_buffer_size);
+		intern_table_init(&macro->arg_names);
 	} else {
 		macro->args_buffer_size = 0;
 		macro->args = NULL;
 	}
+	macro->body = NULL;
+	lex_token_list_init(&macro->body_tokens);
+	macro->is_constant = 0;
 }
 
 void pp_macro_definition_destroy(struct pp_macro_definition *macro)
 {
-	size_t i;
-
-	for (i = 0; i < macro->num_args; i++)
-		bergen_free(macro->args[i]);
-	bergen_free(macro->args);
+	lex_token_list_destroy(&macro->body_tokens);
+	bergen_free(macro->body);
+	if (macro->args) {
+		intern_table_destroy(&macro->arg_names);
+		bergen_free(macro->args);
+	}
 	bergen_free(macro->name);
 }
 
 struct error *pp_macro_definition_add_arg(struct pp_macro_definition *macro, const char *name, size_t length)
 {
-	size_t i;
+	intern_id id;
 
 	if (!macro->args)
-		return error_create("Cannot add arguments to a macro that has no arguments");
+		return error_create(ERROR_MACRO_HAS_NO_ARGS);
 
-	for (i = 0; i < macro->num_args; i++) {
-		if (length == bergen_strlen(macro->args[i]) && !bergen_strncmp(macro->args[i], name, length))
-			return error_create("Argument \"%s\" already exists", macro->args[i]);
-	}
+	if (intern_table_find(&macro->arg_names, name, length) != INTERN_NONE)
+		return error_create_span(ERROR_MACRO_DUPLICATE_ARG, name, length);
 
 	if (macro->num_args >= macro->args_buffer_size) {
 		macro->args_buffer_size *= 2;
 		macro->args = bergen_realloc(macro->args, sizeof(*macro->args) * macro->args_buffer_size);
 	}
 
-	macro->args[macro->num_args++] = bergen_strndup_null(name, length);
+	id = intern_table_intern(&macro->arg_names, name, length);
+	macro->args[macro->num_args++] = (char *) intern_table_get_name(&macro->arg_names, id);
 	return NULL;
 }
 
-struct error *pp_macro_definition_parse(struct pp_macro_definition *macro, const char *str, size_t length)
+static int is_trailing_token(const struct lex_token *token)
+{
+	return token->type == LEX_TOKEN_TYPE_WHITESPACE || token->type == LEX_TOKEN_TYPE_COMMENT;
+}
+
+/* Trims the body and resolves uses of arguments to their slots */
+static void finish_body(struct pp_macro_definition *macro)
+{
+	struct lex_token_list *tokens = &macro->body_tokens;
+	struct lex_token *token;
+	intern_id id;
+	size_t i;
+
+	/* Leading and trailing whitespace and comments are not part of the body */
+	while (tokens->num_tokens > 0 && is_trailing_token(&tokens->tokens[tokens->num_tokens - 1]))
+		tokens->num_tokens--;
+	if (tokens->num_tokens > 0 && tokens->tokens[0].type == LEX_TOKEN_TYPE_WHITESPACE) {
+		tokens->num_tokens--;
+		bergen_memmove(tokens->tokens, tokens->tokens + 1, sizeof(*tokens->tokens) * tokens->num_tokens);
+	}
+
+	if (!macro->args)
+		return;
+
+	for (i = 0; i < tokens->num_tokens; i++) {
+		token = &tokens->tokens[i];
+		if (token->type != LEX_TOKEN_TYPE_IDENTIFIER)
+			continue;
+		if ((id = intern_table_find(&macro->arg_names, token->str, token->length)) != INTERN_NONE) {
+			token->type = LEX_TOKEN_TYPE_MACRO_ARG;
+			token->arg = id;
+		}
+	}
+}
+
+void pp_macro_definition_set_body(struct pp_macro_definition *macro, const char *body, size_t length)
+{
+	bergen_free(macro->body);
+	macro->body = bergen_strndup_null(body, length);
+	lex_token_list_clear(&macro->body_tokens);
+	lex_line(macro->body, length, &macro->body_tokens);
+	finish_body(macro);
+}
+
+/* Like pp_macro_definition_set_body(), but with tokens already lexed from the body text */
+static void set_body_tokens(struct pp_macro_definition *macro, const char *body, size_t length, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t i;
+
+	bergen_free(macro->body);
+	macro->body = bergen_strndup_null(body, length);
+	lex_token_list_clear(&macro->body_tokens);
+	lex_token_list_append(&macro->body_tokens, tokens, num_tokens);
+
+	/* Point the tokens at the copy */
+	for (i = 0; i < num_tokens; i++)
+		macro->body_tokens.tokens[i].str = macro->body + (tokens[i].str - body);
+	finish_body(macro);
+}
+
+static int is_name_token(const struct lex_token *token)
 {
+	return token->type != LEX_TOKEN_TYPE_WHITESPACE && token->type != LEX_TOKEN_TYPE_COMMENT && !lex_token_is(token, LEX_TOKEN_TYPE_OPERATOR, '(');
+}
+
+/* Returns the span from the first to the last non-whitespace token in [start, end) */
+static const char *get_arg_name(const struct lex_token *tokens, size_t start, size_t end, size_t *length)
+{
+	while (start < end && tokens[start].type == LEX_TOKEN_TYPE_WHITESPACE)
+		start++;
+	while (end > start && tokens[end - 1].type == LEX_TOKEN_TYPE_WHITESPACE)
+		end--;
+	if (start == end) {
+		*length = 0;
+		return tokens[start].str;
+	}
+	*length = tokens[end - 1].str + tokens[end - 1].length - tokens[start].str;
+	return tokens[start].str;
+}
+
+static struct error *parse_definition(struct pp_macro_definition *macro, const char *str, size_t length, const struct lex_token *tokens, size_t num_tokens)
+{
+	size_t i = 0, arg_start, name_length, body_index;
+	const char *name;
+	struct error *err;
 	int have_args;
-	size_t name_length, arg_index;
-	const char *ptr;
-	char *buf;
+
+	while (i < num_tokens && is_name_token(&tokens[i]))
+		i++;
+	if (i == 0)
+		return error_create_span(ERROR_INVALID_MACRO_DEFINITION, str, length);
+
+	/* Only a '(' directly after the name starts an argument list */
+	have_args = i < num_tokens && lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, '(');
+	pp_macro_definition_init(macro, str, tokens[i - 1].str + tokens[i - 1].length - str, have_args);
+
+	if (have_args) {
+		arg_start = ++i;
+		for (; i < num_tokens; i++) {
+			if (!lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ',') && !lex_token_is(&tokens[i], LEX_TOKEN_TYPE_OPERATOR, ')'))
+				continue;
+
+			name = get_arg_name(tokens, arg_start, i, &name_length);
+			/* "name()" has no arguments at all */
+			if (name_length > 0 || tokens[i].str[0] == ',' || macro->num_args > 0) {
+				if ((err = pp_macro_definition_add_arg(macro, name, name_length))) {
+					pp_macro_definition_destroy(macro);
+					return err;
+				}
+			}
+			arg_start = i + 1;
+			if (tokens[i].str[0] == ')')
+				break;
+		}
+		if (i >= num_tokens) {
+			pp_macro_definition_destroy(macro);
+			return error_create_span(ERROR_INVALID_MACRO_DEFINITION, str, length);
+		}
+		i++;
+	}
+
+	body_index = i < num_tokens ? (size_t) (tokens[i].str - str) : length;
+	set_body_tokens(macro, str + body_index, length - body_index, tokens + i, num_tokens - i);
+	return NULL;
+}
+
+struct error *pp_macro_definition_parse(struct pp_macro_definition *macro, const char *str, size_t length)
+{
+	struct lex_token_list tokens;
 	struct error *err;
 
-	if ((ptr = bergen_memchr(str, '(', length))) {
-		arg_index = ptr - str + 1;
-		name_length = arg_index - 1;
-		have_args = 1;
+	/* The line is lexed once, the body keeps its tokens */
+	lex_token_list_init(&tokens);
+	lex_line(str, length, &tokens);
+	err = parse_definition(macro, str, length, tokens.tokens, tokens.num_tokens);
+	lex_token_list_destroy(&tokens);
+	return err;
+}
+
+struct error *pp_macro_parse_args(const struct pp_macro_definition *macro, const struct lex_token *tokens, size_t num_tokens, size_t *index, struct pp_macro_arg *args)
+{
+	size_t i = *index + 1, arg_start = i, num_args = 0, paren_levels = 0;
+	const struct lex_token *token;
+	const char *name = macro->name;
+
+	for (; i < num_tokens; i++) {
+		token = &tokens[i];
+		if (token->type != LEX_TOKEN_TYPE_OPERATOR || token->length != 1)
+			continue;
+
+		if (token->str[0] == '(') {
+			paren_levels++;
+		} else if ((token->str[0] == ',' && paren_levels == 0) || (token->str[0] == ')' && paren_levels-- == 0)) {
+			/* Whitespace around an argument is not part of it */
+			while (arg_start < i && tokens[arg_start].type == LEX_TOKEN_TYPE_WHITESPACE)
+				arg_start++;
+			if (num_args < macro->num_args) {
+				args[num_args].tokens = tokens + arg_start;
+				args[num_args].num_tokens = i - arg_start;
+				while (args[num_args].num_tokens > 0 && tokens[arg_start + args[num_args].num_tokens - 1].type == LEX_TOKEN_TYPE_WHITESPACE)
+					args[num_args].num_tokens--;
+			}
+
+			/* "name()" passes one empty argument, unless the macro takes none */
+			if (token->str[0] == ',' || num_args > 0 || arg_start < i || macro->num_args > 0)
+				num_args++;
+			arg_start = i + 1;
+
+			if (token->str[0] == ')') {
+				if (num_args != macro->num_args)
+					return error_create_span_value(ERROR_MACRO_ARG_COUNT, name, bergen_strlen(name), macro->num_args);
+				*index = i + 1;
+				return NULL;
+			}
+		}
+	}
+
+	return error_create_span(ERROR_UNTERMINATED_MACRO_ARGS, name, bergen_strlen(name));
+}
+
+void pp_macro_expand(const struct pp_macro_definition *macro, const struct pp_macro_arg *args, struct lex_token_list *output)
+{
+	const struct lex_token *tokens = macro->body_tokens.tokens;
+	size_t num_tokens = macro->body_tokens.num_tokens;
+	size_t i, run_start = 0;
+	const struct pp_macro_arg *arg;
+
+	for (i = 0; i < num_tokens; i++) {
+		if (tokens[i].type != LEX_TOKEN_TYPE_MACRO_ARG)
+			continue;
+
+		/* Copy everything up to the argument in one go, then the argument */
+		lex_token_list_append(output, tokens + run_start, i - run_start);
+		arg = &args[tokens[i].arg];
+		lex_token_list_append(output, arg->tokens, arg->num_tokens);
+		run_start = i + 1;
+	}
+	lex_token_list_append(output, tokens + run_start, num_tokens - run_start);
+}
+
+static void bloom_add(struct pp_macro_table *table, uint32_t hash)
+{
+	size_t mask = table->bloom_bits - 1;
+	size_t bit1 = hash & mask, bit2 = (hash >> 16 ^ hash * 31) & mask;
+
+	table->bloom[bit1 / 64] |= (uint64_t) 1 << (bit1 % 64);
+	table->bloom[bit2 / 64] |= (uint64_t) 1 << (bit2 % 64);
+}
+
+static void bloom_init(struct pp_macro_table *table, size_t bits)
+{
+	table->bloom_bits = bits;
+	table->bloom = bergen_malloc(sizeof(*table->bloom) * (bits / 64));
+	bergen_memset(table->bloom, 0, sizeof(*table->bloom) * (bits / 64));
+}
+
+/* Also drops the bits of undefined macros, which only cost false positives */
+static void bloom_rebuild(struct pp_macro_table *table, size_t bits)
+{
+	size_t i;
+
+	bergen_free(table->bloom);
+	bloom_init(table, bits);
+	for (i = 0; i < table->names.num_entries; i++) {
+		if (table->macros[i])
+			bloom_add(table, table->names.entries[i].hash);
+	}
+}
+
+void pp_macro_table_init(struct pp_macro_table *table)
+{
+	size_t i;
+
+	intern_table_init(&table->names);
+	table->macros_buffer_size = 64;
+	table->macros = bergen_malloc(sizeof(*table->macros) * table->macros_buffer_size);
+	for (i = 0; i < table->macros_buffer_size; i++)
+		table->macros[i] = NULL;
+	table->num_macros = 0;
+	bloom_init(table, 1024);
+}
+
+void pp_macro_table_destroy(struct pp_macro_table *table)
+{
+	size_t i;
+
+	for (i = 0; i < table->names.num_entries; i++) {
+		if (table->macros[i]) {
+			pp_macro_definition_destroy(table->macros[i]);
+			bergen_free(table->macros[i]);
+		}
+	}
+	bergen_free(table->macros);
+	bergen_free(table->bloom);
+	intern_table_destroy(&table->names);
+}
+
+void pp_macro_table_define(struct pp_macro_table *table, struct pp_macro_definition *macro)
+{
+	intern_id id = intern_table_intern(&table->names, macro->name, bergen_strlen(macro->name));
+	size_t old_size = table->macros_buffer_size;
+	struct pp_macro_definition **ptr;
+
+	if (id >= table->macros_buffer_size) {
+		while (id >= table->macros_buffer_size)
+			table->macros_buffer_size *= 2;
+		table->macros = bergen_realloc(table->macros, sizeof(*table->macros) * table->macros_buffer_size);
+		bergen_memset(table->macros + old_size, 0, sizeof(*table->macros) * (table->macros_buffer_size - old_size));
+	}
+
+	ptr = &table->macros[id];
+	if (*ptr) {
+		pp_macro_definition_destroy(*ptr);
 	} else {
-		have_args = 0;
-		name_length = length;
+		*ptr = bergen_malloc(sizeof(**ptr));
+		table->num_macros++;
 	}
+	**ptr = *macro;
+
+	/* Keep at least 16 bits per macro so false positives stay rare */
+	if (table->num_macros * 16 > table->bloom_bits)
+		bloom_rebuild(table, table->bloom_bits * 2);
+	else
+		bloom_add(table, table->names.entries[id].hash);
+}
 
-	pp_macro_definition_init(macro, str, name_length, have_args);
+int pp_macro_table_undefine(struct pp_macro_table *table, const char *name, size_t length)
+{
+	intern_id id = intern_table_find(&table->names, name, length);
+	struct pp_macro_definition **ptr;
 
-	if (have_args) {
-		for (;;) {
-			if ((ptr = bergen_memchr(str + arg_index, ',', length - arg_index))) {
-				pp_macro_definition_add_arg(macro, str + arg_index, ptr - (str + arg_index));
-				arg_index = ptr - str + 1;
-			} else if ((ptr = bergen_memchr(str + arg_index, ')', length - arg_index))) {
-				pp_macro_definition_add_arg(macro, str + arg_index, ptr - (str + arg_index));
-				break;
-			} else {
-				pp_macro_definition_destroy(macro);
-				buf = bergen_strndup_null(str, length);
-				err = error_create("Invalid macro definition: \"%s\"", buf);
-				bergen_free(buf);
+	if (id == INTERN_NONE || !*(ptr = &table->macros[id]))
+		return 0;
+
+	pp_macro_definition_destroy(*ptr);
+	bergen_free(*ptr);
+	*ptr = NULL;
+	table->num_macros--;
+	return 1;
+}
+
+struct pp_macro_definition *pp_macro_table_find_hashed(const struct pp_macro_table *table, const char *name, size_t length, uint32_t hash)
+{
+	intern_id id = intern_table_find_hashed(&table->names, name, length, hash);
+
+	if (id == INTERN_NONE || id >= table->macros_buffer_size)
+		return NULL;
+	return table->macros[id];
+}
+
+void preprocessor_init(struct preprocessor *pp, struct label_list *labels)
+{
+	pp_macro_table_init(&pp->macros);
+	pp->labels = labels;
+	pp->local_label_char = '_'; /* Like the assembler's */
+
+	pp->conditionals_buffer_size = 16;
+	pp->conditionals = bergen_malloc(sizeof(*pp->conditionals) * pp->conditionals_buffer_size);
+	pp->num_conditionals = 0;
+	pp->active = 1;
+}
+
+void preprocessor_destroy(struct preprocessor *pp)
+{
+	bergen_free(pp->conditionals);
+	pp_macro_table_destroy(&pp->macros);
+}
+
+static int is_constant_token(const struct preprocessor *pp, const struct lex_token *token)
+{
+	const struct label *label;
+
+	switch (token->type) {
+	case LEX_TOKEN_TYPE_NUMBER:
+		return token->length > 1 || token->str[0] != '$'; /* The location counter is not constant */
+
+	case LEX_TOKEN_TYPE_CHAR:
+	case LEX_TOKEN_TYPE_WHITESPACE:
+		return 1;
+
+	case LEX_TOKEN_TYPE_IDENTIFIER:
+		label = label_list_find_label(pp->labels, token->str, token->length);
+		return label && label->type == LABEL_TYPE_CONSTANT;
+
+	case LEX_TOKEN_TYPE_OPERATOR:
+		return token->length > 1 || bergen_strchr("+-*/%<>=!&|^~()", token->str[0]);
+
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Only bodies that evaluate the same no matter what surrounds them can be
+ * replaced by their value. Expressions are evaluated left to right, so "2 * X"
+ * with X defined as "1 + 2" is 4 when expanded as text, but 6 as a label. The
+ * body must therefore be a single operand: a constant, possibly with unary
+ * operators in front, or an expression in parentheses.
+ */
+static int is_constant_body(const struct preprocessor *pp, const struct lex_token_list *tokens)
+{
+	size_t i = 0, paren_levels = 0;
+	const struct lex_token *token;
+
+	if (tokens->num_tokens == 0)
+		return 0;
+
+	while (i < tokens->num_tokens && (lex_token_is(&tokens->tokens[i], LEX_TOKEN_TYPE_OPERATOR, '-')
+			|| lex_token_is(&tokens->tokens[i], LEX_TOKEN_TYPE_OPERATOR, '~')
+			|| tokens->tokens[i].type == LEX_TOKEN_TYPE_WHITESPACE))
+		i++;
+
+	if (i + 1 == tokens->num_tokens) {
+		token = &tokens->tokens[i];
+		return token->type != LEX_TOKEN_TYPE_OPERATOR && token->type != LEX_TOKEN_TYPE_WHITESPACE && is_constant_token(pp, token);
+	}
+
+	if (i >= tokens->num_tokens || !lex_token_is(&tokens->tokens[i], LEX_TOKEN_TYPE_OPERATOR, '('))
+		return 0;
+
+	for (; i < tokens->num_tokens; i++) {
+		token = &tokens->tokens[i];
+		if (!is_constant_token(pp, token))
+			return 0;
+		if (lex_token_is(token, LEX_TOKEN_TYPE_OPERATOR, '(')) {
+			paren_levels++;
+		} else if (lex_token_is(token, LEX_TOKEN_TYPE_OPERATOR, ')')) {
+			/* The outer parentheses have to close at the very end */
+			if (--paren_levels == 0 && i + 1 != tokens->num_tokens)
+				return 0;
+		}
+	}
+
+	return paren_levels == 0;
+}
+
+static void try_make_constant(struct preprocessor *pp, struct pp_macro_definition *macro)
+{
+	struct expr_data expr;
+	struct error *err;
+	expr_value value;
+
+	size_t length = bergen_strlen(macro->name);
+
+	if (!pp->labels || macro->args || !is_constant_body(pp, &macro->body_tokens))
+		return;
+
+	/* An operand named B or _X is a register or a local label before it is a label */
+	if (z80_find_register(macro->name, length) != Z80_REGISTER_NONE || macro->name[0] == pp->local_label_char)
+		return;
+
+	expr_data_init(&expr, macro->body, bergen_strlen(macro->body), 0);
+	expr.labels = pp->labels;
+	err = expr_evaluate_tokens(&expr, macro->body_tokens.tokens, macro->body_tokens.num_tokens, &value);
+	expr_data_destroy(&expr);
+	if (err) {
+		error_free(err);
+		return;
+	}
+
+	label_list_append_type(pp->labels, macro->name, length, value, LABEL_TYPE_CONSTANT);
+	macro->is_constant = 1;
+}
+
+static int body_names(const struct pp_macro_definition *macro, const char *name, size_t length)
+{
+	const struct lex_token *token;
+	size_t i;
+
+	for (i = 0; i < macro->body_tokens.num_tokens; i++) {
+		token = &macro->body_tokens.tokens[i];
+		if (token->type == LEX_TOKEN_TYPE_IDENTIFIER && token->length == length && !bergen_memcmp(token->str, name, length))
+			return 1;
+	}
+	return 0;
+}
+
+static void remove_label(struct preprocessor *pp, const char *name, size_t length)
+{
+	struct label *label = label_list_find_label(pp->labels, name, length);
+
+	if (label && label->type == LABEL_TYPE_CONSTANT)
+		label_list_remove(pp->labels, name, length);
+}
+
+/* Constants made from this one have its old value, so they go back to being expanded */
+static void demote_dependents(struct preprocessor *pp, const char *name, size_t length)
+{
+	struct pp_macro_definition *macro;
+	size_t i;
+
+	for (i = 0; i < pp->macros.macros_buffer_size; i++) {
+		macro = pp->macros.macros[i];
+		if (macro && macro->is_constant && body_names(macro, name, length)) {
+			macro->is_constant = 0;
+			remove_label(pp, macro->name, bergen_strlen(macro->name));
+			demote_dependents(pp, macro->name, bergen_strlen(macro->name));
+		}
+	}
+}
+
+static void remove_constant(struct preprocessor *pp, const char *name, size_t length)
+{
+	struct pp_macro_definition *old = pp_macro_table_find(&pp->macros, name, length);
+
+	if (!old || !old->is_constant)
+		return;
+
+	remove_label(pp, name, length);
+	demote_dependents(pp, name, length);
+}
+
+struct error *preprocessor_define(struct preprocessor *pp, const char *str, size_t length)
+{
+	struct pp_macro_definition macro;
+	struct error *err;
+
+	if ((err = pp_macro_definition_parse(&macro, str, length)))
+		return err;
+
+	remove_constant(pp, macro.name, bergen_strlen(macro.name));
+	try_make_constant(pp, &macro);
+	pp_macro_table_define(&pp->macros, &macro);
+	return NULL;
+}
+
+int preprocessor_undefine(struct preprocessor *pp, const char *name, size_t length)
+{
+	remove_constant(pp, name, length);
+	return pp_macro_table_undefine(&pp->macros, name, length);
+}
+
+/* Macros currently being expanded, which must not be expanded again */
+struct expansion {
+	const struct pp_macro_definition *macro;
+	const struct expansion *parent;
+};
+
+static int is_expanding(const struct expansion *expansion, const struct pp_macro_definition *macro)
+{
+	for (; expansion; expansion = expansion->parent) {
+		if (expansion->macro == macro)
+			return 1;
+	}
+	return 0;
+}
+
+static struct error *expand_tokens(const struct preprocessor *pp, const struct lex_token *tokens, size_t num_tokens, struct lex_token_list *output, const struct expansion *parent);
+
+/* Like C, arguments are fully expanded before they are substituted */
+static struct error *expand_args(const struct preprocessor *pp, struct pp_macro_arg *args, size_t num_args, struct lex_token_list *output, const struct expansion *parent)
+{
+	size_t i, start = output->num_tokens, arg_start;
+	struct error *err;
+
+	for (i = 0; i < num_args; i++) {
+		arg_start = output->num_tokens;
+		if ((err = expand_tokens(pp, args[i].tokens, args[i].num_tokens, output, parent)))
+			return err;
+		args[i].num_tokens = output->num_tokens - arg_start;
+	}
+
+	/* Point at the expanded arguments only now, since output may have moved */
+	for (i = 0; i < num_args; i++) {
+		args[i].tokens = output->tokens + start;
+		start += args[i].num_tokens;
+	}
+	return NULL;
+}
+
+static struct error *expand_tokens(const struct preprocessor *pp, const struct lex_token *tokens, size_t num_tokens, struct lex_token_list *output, const struct expansion *parent)
+{
+	size_t i, next, run_start = 0;
+	const struct lex_token *token;
+	struct pp_macro_definition *macro;
+	struct pp_macro_arg stack_args[8], *args;
+	struct lex_token_list expanded, expanded_args;
+	struct expansion expansion;
+	struct error *err;
+	uint64_t start, profile_start;
+
+	for (i = 0; i < num_tokens; i = next) {
+		token = &tokens[i];
+		next = i + 1;
+		if (token->type != LEX_TOKEN_TYPE_IDENTIFIER || !(macro = pp_macro_table_find(&pp->macros, token->str, token->length)))
+			continue;
+		if (macro->is_constant || is_expanding(parent, macro))
+			continue;
+
+		args = stack_args;
+		if (macro->args) {
+			/* A function-like macro without arguments is just an identifier */
+			while (next < num_tokens && tokens[next].type == LEX_TOKEN_TYPE_WHITESPACE)
+				next++;
+			if (next >= num_tokens || !lex_token_is(&tokens[next], LEX_TOKEN_TYPE_OPERATOR, '(')) {
+				next = i + 1;
+				continue;
+			}
+
+			if (macro->num_args > sizeof(stack_args) / sizeof(*stack_args))
+				args = bergen_malloc(sizeof(*args) * macro->num_args);
+			if ((err = pp_macro_parse_args(macro, tokens, num_tokens, &next, args))) {
+				if (args != stack_args)
+					bergen_free(args);
 				return err;
 			}
 		}
+
+		lex_token_list_append(output, tokens + run_start, i - run_start);
+		run_start = next;
+
+		start = trace_begin();
+		profile_start = profile_macro_begin();
+		lex_token_list_init(&expanded);
+		lex_token_list_init(&expanded_args);
+		if (!(err = expand_args(pp, args, macro->num_args, &expanded_args, parent))) {
+			/* The expansion may contain other macros */
+			pp_macro_expand(macro, args, &expanded);
+			expansion.macro = macro;
+			expansion.parent = parent;
+			err = expand_tokens(pp, expanded.tokens, expanded.num_tokens, output, &expansion);
+		}
+		lex_token_list_destroy(&expanded_args);
+		lex_token_list_destroy(&expanded);
+		if (args != stack_args)
+			bergen_free(args);
+		if (profile_start)
+			profile_macro_end(profile_start, macro->name, bergen_strlen(macro->name));
+		if (err)
+			return err;
+		if (start)
+			trace_end(start, TRACE_CATEGORY_MACRO, macro->name, bergen_strlen(macro->name));
+	}
+
+	lex_token_list_append(output, tokens + run_start, num_tokens - run_start);
+	return NULL;
+}
+
+struct error *preprocessor_expand(const struct preprocessor *pp, const struct lex_token *tokens, size_t num_tokens, struct lex_token_list *output)
+{
+	return expand_tokens(pp, tokens, num_tokens, output, NULL);
+}
+
+enum directive_type {
+	DIRECTIVE_TYPE_UNKNOWN,
+	DIRECTIVE_TYPE_DEFINE,
+	DIRECTIVE_TYPE_UNDEF,
+	DIRECTIVE_TYPE_IF,
+	DIRECTIVE_TYPE_IFDEF,
+	DIRECTIVE_TYPE_IFNDEF,
+	DIRECTIVE_TYPE_ELIF,
+	DIRECTIVE_TYPE_ELSE,
+	DIRECTIVE_TYPE_ENDIF,
+	DIRECTIVE_TYPE_INCLUDE,
+};
+
+struct directive {
+	const char *name;
+	enum directive_type type;
+};
+
+static const struct directive DIRECTIVES[] = {
+	{"define",	DIRECTIVE_TYPE_DEFINE},
+	{"undef",	DIRECTIVE_TYPE_UNDEF},
+	{"if",		DIRECTIVE_TYPE_IF},
+	{"ifdef",	DIRECTIVE_TYPE_IFDEF},
+	{"ifndef",	DIRECTIVE_TYPE_IFNDEF},
+	{"elif",	DIRECTIVE_TYPE_ELIF},
+	{"else",	DIRECTIVE_TYPE_ELSE},
+	{"endif",	DIRECTIVE_TYPE_ENDIF},
+	{"include",	DIRECTIVE_TYPE_INCLUDE},
+};
+
+static inline int is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+const char *preprocessor_find_directive(const char *str, size_t length)
+{
+	size_t i = 0;
+
+	while (i < length && is_blank(str[i]))
+		i++;
+	return i < length && str[i] == '#' ? str + i : NULL;
+}
+
+/* str points at the '#'. On return, *index is just past the directive name. */
+static enum directive_type get_directive_type(const char *str, size_t length, size_t *index)
+{
+	size_t i = 1, start, j;
+
+	while (i < length && is_blank(str[i]))
+		i++;
+	start = i;
+	while (i < length && ((str[i] >= 'a' && str[i] <= 'z') || (str[i] >= 'A' && str[i] <= 'Z')))
+		i++;
+	*index = i;
+
+	for (j = 0; j < sizeof(DIRECTIVES) / sizeof(*DIRECTIVES); j++) {
+		if (bergen_strlen(DIRECTIVES[j].name) == i - start && !bergen_memcmp(DIRECTIVES[j].name, str + start, i - start))
+			return DIRECTIVES[j].type;
 	}
+	return DIRECTIVE_TYPE_UNKNOWN;
+}
+
+size_t preprocessor_skip(const char *str, size_t length)
+{
+	size_t index = 0, line_start, depth = 0, name_end;
+	const char *ptr;
+
+	while (index < length) {
+		line_start = index;
+		if ((ptr = preprocessor_find_directive(str + index, length - index))) {
+			switch (get_directive_type(ptr, length - (ptr - str), &name_end)) {
+			case DIRECTIVE_TYPE_IF:
+			case DIRECTIVE_TYPE_IFDEF:
+			case DIRECTIVE_TYPE_IFNDEF:
+				depth++;
+				break;
 
+			case DIRECTIVE_TYPE_ELIF:
+			case DIRECTIVE_TYPE_ELSE:
+				if (depth == 0)
+					return line_start;
+				break;
+
+			case DIRECTIVE_TYPE_ENDIF:
+				if (depth == 0)
+					return line_start;
+				depth--;
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		/* Jump to the start of the next line */
+		if (!(ptr = bergen_memchr(str + index, '\n', length - index)))
+			return length;
+		index = ptr - str + 1;
+	}
+
+	return length;
+}
+
+static void push_conditional(struct preprocessor *pp, int condition)
+{
+	struct pp_conditional *cond;
+
+	if (pp->num_conditionals >= pp->conditionals_buffer_size) {
+		pp->conditionals_buffer_size *= 2;
+		pp->conditionals = bergen_realloc(pp->conditionals, sizeof(*pp->conditionals) * pp->conditionals_buffer_size);
+	}
+
+	cond = &pp->conditionals[pp->num_conditionals++];
+	cond->parent_active = pp->active;
+	cond->taken = pp->active && condition;
+	cond->seen_else = 0;
+	pp->active = cond->taken;
+}
+
+/* Returns the span of the name following a directive, empty if there is none */
+static const char *get_name(const char *str, size_t length, size_t index, size_t *name_length)
+{
+	size_t start;
+
+	while (index < length && bergen_isspace((unsigned char) str[index]))
+		index++;
+	start = index;
+	while (index < length && !bergen_isspace((unsigned char) str[index]) && str[index] != ';')
+		index++;
+	*name_length = index - start;
+	return str + start;
+}
+
+static struct error *evaluate_condition(struct preprocessor *pp, const char *str, size_t length, int *result)
+{
+	struct lex_token_list tokens, expanded;
+	struct expr_data expr;
+	struct error *err;
+	expr_value value;
+
+	lex_token_list_init(&tokens);
+	lex_token_list_init(&expanded);
+	lex_line(str, length, &tokens);
+
+	if (!(err = preprocessor_expand(pp, tokens.tokens, tokens.num_tokens, &expanded))) {
+		expr_data_init(&expr, str, length, 0);
+		expr.labels = pp->labels;
+		if (!(err = expr_evaluate_tokens(&expr, expanded.tokens, expanded.num_tokens, &value)))
+			*result = value != 0;
+		expr_data_destroy(&expr);
+	}
+
+	lex_token_list_destroy(&expanded);
+	lex_token_list_destroy(&tokens);
+	return err;
+}
+
+struct error *preprocessor_directive(struct preprocessor *pp, const char *str, size_t length)
+{
+	size_t index, name_length;
+	enum directive_type type;
+	struct pp_conditional *cond = pp->num_conditionals > 0 ? &pp->conditionals[pp->num_conditionals - 1] : NULL;
+	const char *name, *hash = preprocessor_find_directive(str, length);
+	struct error *err;
+	int condition = 0;
+
+	if (!hash)
+		return error_create_span(ERROR_UNKNOWN_DIRECTIVE, str, length);
+	length -= hash - str;
+	str = hash;
+	type = get_directive_type(str, length, &index);
+
+	switch (type) {
+	case DIRECTIVE_TYPE_IF:
+		if (pp->active && (err = evaluate_condition(pp, str + index, length - index, &condition)))
+			return err;
+		push_conditional(pp, condition);
+		return NULL;
+
+	case DIRECTIVE_TYPE_IFDEF:
+	case DIRECTIVE_TYPE_IFNDEF:
+		name = get_name(str, length, index, &name_length);
+		if (name_length == 0)
+			return error_create_span(ERROR_EXPECTED_NAME, str, index);
+		condition = !!pp_macro_table_find(&pp->macros, name, name_length) == (type == DIRECTIVE_TYPE_IFDEF);
+		push_conditional(pp, condition);
+		return NULL;
+
+	case DIRECTIVE_TYPE_ELIF:
+		if (!cond || cond->seen_else)
+			return error_create_span(ERROR_UNEXPECTED_DIRECTIVE, str, index);
+		if (cond->parent_active && !cond->taken) {
+			if ((err = evaluate_condition(pp, str + index, length - index, &condition)))
+				return err;
+			cond->taken = pp->active = condition;
+		} else {
+			pp->active = 0;
+		}
+		return NULL;
+
+	case DIRECTIVE_TYPE_ELSE:
+		if (!cond || cond->seen_else)
+			return error_create_span(ERROR_UNEXPECTED_DIRECTIVE, str, index);
+		cond->seen_else = 1;
+		pp->active = cond->parent_active && !cond->taken;
+		cond->taken = 1;
+		return NULL;
+
+	case DIRECTIVE_TYPE_ENDIF:
+		if (!cond)
+			return error_create_span(ERROR_UNEXPECTED_DIRECTIVE, str, index);
+		pp->active = cond->parent_active;
+		pp->num_conditionals--;
+		return NULL;
+
+	default:
+		break;
+	}
+
+	if (!pp->active)
+		return NULL;
+
+	switch (type) {
+	case DIRECTIVE_TYPE_DEFINE:
+		name = get_name(str, length, index, &name_length);
+		if (name_length == 0)
+			return error_create_span(ERROR_EXPECTED_NAME, str, index);
+		return preprocessor_define(pp, name, length - (name - str));
+
+	case DIRECTIVE_TYPE_UNDEF:
+		name = get_name(str, length, index, &name_length);
+		if (name_length == 0)
+			return error_create_span(ERROR_EXPECTED_NAME, str, index);
+		preprocessor_undefine(pp, name, name_length);
+		return NULL;
+
+	case DIRECTIVE_TYPE_INCLUDE: /* Only the caller knows where files come from */
+		return error_create_span(ERROR_UNEXPECTED_DIRECTIVE, str, index);
+
+	default:
+		return error_create_span(ERROR_UNKNOWN_DIRECTIVE, str, index);
+	}
+}
+
+const char *preprocessor_parse_include(const char *str, size_t length, size_t *name_length)
+{
+	size_t index;
+	const char *hash = preprocessor_find_directive(str, length), *end;
+	char close;
+
+	if (!hash)
+		return NULL;
+	length -= hash - str;
+	if (get_directive_type(hash, length, &index) != DIRECTIVE_TYPE_INCLUDE)
+		return NULL;
+
+	while (index < length && is_blank(hash[index]))
+		index++;
+	if (index >= length || (hash[index] != '"' && hash[index] != '<'))
+		return NULL;
+
+	close = hash[index] == '"' ? '"' : '>';
+	index++;
+	if (!(end = bergen_memchr(hash + index, close, length - index)))
+		return NULL;
+
+	*name_length = end - (hash + index);
+	return hash + index;
+}
+
+/* Returns the offset of the next line which is not blank or only a comment, or length */
+static size_t next_significant_line(const char *str, size_t length, size_t index)
+{
+	const char *end;
+	size_t i;
+
+	while (index < length) {
+		for (i = index; i < length && is_blank(str[i]); i++);
+		if (i < length && str[i] != '\n' && str[i] != '\r' && str[i] != ';')
+			return index;
+		if (!(end = bergen_memchr(str + index, '\n', length - index)))
+			return length;
+		index = end - str + 1;
+	}
+	return length;
+}
+
+static size_t next_line(const char *str, size_t length, size_t index)
+{
+	const char *end = bergen_memchr(str + index, '\n', length - index);
+
+	return end ? (size_t) (end - str) + 1 : length;
+}
+
+static const char *get_directive_name(const char *str, size_t length, size_t index, enum directive_type type, size_t *name_length)
+{
+	size_t name_index, line_length = next_line(str, length, index) - index;
+	const char *hash = preprocessor_find_directive(str + index, line_length);
+
+	if (!hash)
+		return NULL;
+	line_length -= hash - (str + index);
+	if (get_directive_type(hash, line_length, &name_index) != type)
+		return NULL;
+	return get_name(hash, line_length, name_index, name_length);
+}
+
+const char *preprocessor_find_include_guard(const char *str, size_t length, size_t *name_length)
+{
+	size_t index, define_length, end;
+	const char *name, *define_name;
+
+	/* #ifndef NAME */
+	index = next_significant_line(str, length, 0);
+	if (index >= length || !(name = get_directive_name(str, length, index, DIRECTIVE_TYPE_IFNDEF, name_length)) || *name_length == 0)
+		return NULL;
+
+	/* #define NAME */
+	index = next_significant_line(str, length, next_line(str, length, index));
+	if (index >= length || !(define_name = get_directive_name(str, length, index, DIRECTIVE_TYPE_DEFINE, &define_length)))
+		return NULL;
+	if (define_length != *name_length || bergen_memcmp(name, define_name, define_length))
+		return NULL;
+
+	/* The matching #endif, followed by nothing */
+	index = next_line(str, length, index);
+	end = index + preprocessor_skip(str + index, length - index);
+	if (end >= length || !get_directive_name(str, length, end, DIRECTIVE_TYPE_ENDIF, &define_length))
+		return NULL;
+	if (next_significant_line(str, length, next_line(str, length, end)) < length)
+		return NULL;
+
+	return name;
+}
+
+struct error *preprocessor_finish(struct preprocessor *pp)
+{
+	if (pp->num_conditionals > 0)
+		return error_create_value(ERROR_UNTERMINATED_CONDITIONAL, pp->num_conditionals);
 	return NULL;
 }
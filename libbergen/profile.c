@@ -0,0 +1,402 @@
+/*
+ * libbergen/profile.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/profile.h>
+
+#include <bergen/libc.h>
+
+#define PROFILE_MAX_INCLUDE_DEPTH 64
+#define PROFILE_MAX_MACRO_DEPTH 64
+#define PROFILE_TEXT_WIDTH 48
+
+static size_t location_hash(struct source_location location)
+{
+	return (location.file * 2654435761u) ^ (location.offset * 40503u);
+}
+
+static int location_equal(struct source_location a, struct source_location b)
+{
+	return a.file == b.file && a.offset == b.offset;
+}
+
+static void init_slots(struct profile *profile, size_t num_slots)
+{
+	size_t i;
+
+	profile->num_slots = num_slots;
+	profile->lines = bergen_malloc(sizeof(*profile->lines) * num_slots);
+	for (i = 0; i < num_slots; i++)
+		profile->lines[i].location = source_location_none();
+}
+
+static struct profile_line *find_slot(const struct profile *profile, struct source_location location)
+{
+	size_t mask = profile->num_slots - 1;
+	size_t i = location_hash(location) & mask;
+
+	while (profile->lines[i].location.file != SOURCE_FILE_NONE && !location_equal(profile->lines[i].location, location))
+		i = (i + 1) & mask;
+	return &profile->lines[i];
+}
+
+static void grow_slots(struct profile *profile)
+{
+	struct profile_line *lines = profile->lines;
+	size_t i, num_slots = profile->num_slots;
+
+	init_slots(profile, num_slots ? num_slots * 2 : 256);
+	for (i = 0; i < num_slots; i++) {
+		if (lines[i].location.file != SOURCE_FILE_NONE)
+			*find_slot(profile, lines[i].location) = lines[i];
+	}
+	bergen_free(lines);
+}
+
+void profile_init(struct profile *profile)
+{
+	profile->lines = NULL;
+	profile->num_slots = 0;
+	profile->num_lines = 0;
+
+	intern_table_init(&profile->macro_names);
+	profile->macros_buffer_size = 32;
+	profile->macros = bergen_malloc(sizeof(*profile->macros) * profile->macros_buffer_size);
+}
+
+void profile_destroy(struct profile *profile)
+{
+	bergen_free(profile->lines);
+	intern_table_destroy(&profile->macro_names);
+	bergen_free(profile->macros);
+}
+
+void profile_add_line(struct profile *profile, struct source_location location, struct source_location from, uint64_t ns, uint64_t count)
+{
+	struct profile_line *line;
+
+	/* Keep the load factor at or below 1/2 */
+	if ((profile->num_lines + 1) * 2 > profile->num_slots)
+		grow_slots(profile);
+
+	line = find_slot(profile, location);
+	if (line->location.file == SOURCE_FILE_NONE) {
+		line->location = location;
+		line->from = from;
+		line->ns = 0;
+		line->count = 0;
+		profile->num_lines++;
+	}
+	line->ns += ns;
+	line->count += count;
+}
+
+void profile_add_macro(struct profile *profile, const char *name, size_t length, uint64_t ns, uint64_t count)
+{
+	size_t num_macros = profile->macro_names.num_entries;
+	intern_id id = intern_table_intern(&profile->macro_names, name, length);
+
+	if (id >= num_macros) {
+		if (id >= profile->macros_buffer_size) {
+			profile->macros_buffer_size *= 2;
+			profile->macros = bergen_realloc(profile->macros, sizeof(*profile->macros) * profile->macros_buffer_size);
+		}
+		profile->macros[id].ns = 0;
+		profile->macros[id].count = 0;
+	}
+	profile->macros[id].ns += ns;
+	profile->macros[id].count += count;
+}
+
+const struct profile_line *profile_find_line(const struct profile *profile, struct source_location location)
+{
+	const struct profile_line *line;
+
+	if (profile->num_slots == 0)
+		return NULL;
+	line = find_slot(profile, location);
+	return line->location.file == SOURCE_FILE_NONE ? NULL : line;
+}
+
+/* Each thread measures on its own, and they are only added up at the end */
+struct profile_thread {
+	struct profile profile;
+	uint64_t inner_ns[PROFILE_MAX_MACRO_DEPTH]; /* Of the expansions inside each running one */
+	size_t depth; /* May be more than PROFILE_MAX_MACRO_DEPTH, the rest don't count as inner */
+	struct profile_thread *next;
+};
+
+int profile_enabled = 0;
+
+static pthread_key_t thread_key;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_thread *threads = NULL;
+
+/* What threads that have exited since the last reset measured */
+static struct profile retired;
+
+static void add_profile(struct profile *total, const struct profile *profile)
+{
+	const struct profile_line *line;
+	const struct intern_table *names = &profile->macro_names;
+	size_t i;
+
+	for (i = 0; i < profile->num_slots; i++) {
+		line = &profile->lines[i];
+		if (line->location.file != SOURCE_FILE_NONE)
+			profile_add_line(total, line->location, line->from, line->ns, line->count);
+	}
+	for (i = 0; i < names->num_entries; i++)
+		profile_add_macro(total, intern_table_get_name(names, i), intern_table_get_length(names, i), profile->macros[i].ns, profile->macros[i].count);
+}
+
+/* Runs as a thread exits, so that pools started for each batch don't pile up */
+static void retire_thread(void *data)
+{
+	struct profile_thread *thread = data, **link;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (link = &threads; *link != thread; link = &(*link)->next)
+		;
+	*link = thread->next;
+	add_profile(&retired, &thread->profile);
+	bergen_pthread_mutex_unlock(&threads_lock);
+
+	profile_destroy(&thread->profile);
+	bergen_free(thread);
+}
+
+void profile_enable(void)
+{
+	if (profile_enabled)
+		return;
+	profile_init(&retired);
+	bergen_pthread_key_create(&thread_key, retire_thread);
+	profile_enabled = 1;
+}
+
+void profile_disable(void)
+{
+	struct profile_thread *thread, *next;
+
+	if (!profile_enabled)
+		return;
+	profile_enabled = 0;
+	bergen_pthread_key_delete(thread_key);
+	for (thread = threads; thread; thread = next) {
+		next = thread->next;
+		profile_destroy(&thread->profile);
+		bergen_free(thread);
+	}
+	threads = NULL;
+	profile_destroy(&retired);
+}
+
+static struct profile_thread *get_thread(void)
+{
+	struct profile_thread *thread = bergen_pthread_getspecific(thread_key);
+
+	if (thread)
+		return thread;
+
+	thread = bergen_malloc(sizeof(*thread));
+	profile_init(&thread->profile);
+	thread->depth = 0;
+	bergen_pthread_setspecific(thread_key, thread);
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	thread->next = threads;
+	threads = thread;
+	bergen_pthread_mutex_unlock(&threads_lock);
+	return thread;
+}
+
+void profile_line_slow(uint64_t start, struct source_location location, struct source_location from)
+{
+	profile_add_line(&get_thread()->profile, location, from, trace_now() - start, 1);
+}
+
+uint64_t profile_macro_begin_slow(void)
+{
+	struct profile_thread *thread = get_thread();
+
+	if (thread->depth < PROFILE_MAX_MACRO_DEPTH)
+		thread->inner_ns[thread->depth] = 0;
+	thread->depth++;
+	return trace_now();
+}
+
+void profile_macro_end_slow(uint64_t start, const char *name, size_t length)
+{
+	struct profile_thread *thread = get_thread();
+	uint64_t ns = trace_now() - start, inner_ns = 0;
+
+	if (--thread->depth < PROFILE_MAX_MACRO_DEPTH)
+		inner_ns = thread->inner_ns[thread->depth];
+	if (thread->depth > 0 && thread->depth <= PROFILE_MAX_MACRO_DEPTH)
+		thread->inner_ns[thread->depth - 1] += ns;
+	profile_add_macro(&thread->profile, name, length, ns - inner_ns, 1);
+}
+
+void profile_collect(struct profile *profile)
+{
+	const struct profile_thread *thread;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	add_profile(profile, &retired);
+	for (thread = threads; thread; thread = thread->next)
+		add_profile(profile, &thread->profile);
+	bergen_pthread_mutex_unlock(&threads_lock);
+}
+
+void profile_reset(void)
+{
+	struct profile_thread *thread;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread; thread = thread->next) {
+		profile_destroy(&thread->profile);
+		profile_init(&thread->profile);
+	}
+	profile_destroy(&retired);
+	profile_init(&retired);
+	bergen_pthread_mutex_unlock(&threads_lock);
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+	const struct profile_line *line_a = *(const struct profile_line *const *) a, *line_b = *(const struct profile_line *const *) b;
+
+	if (line_a->ns != line_b->ns)
+		return line_a->ns < line_b->ns ? 1 : -1;
+	if (line_a->location.file != line_b->location.file)
+		return line_a->location.file < line_b->location.file ? -1 : 1;
+	return line_a->location.offset < line_b->location.offset ? -1 : line_a->location.offset > line_b->location.offset;
+}
+
+static int compare_macros(const void *a, const void *b)
+{
+	const struct profile_macro *macro_a = *(const struct profile_macro *const *) a, *macro_b = *(const struct profile_macro *const *) b;
+
+	if (macro_a->ns != macro_b->ns)
+		return macro_a->ns < macro_b->ns ? 1 : -1;
+	return macro_a < macro_b ? -1 : 1;
+}
+
+static double ms(uint64_t ns)
+{
+	return ns / 1000000.0;
+}
+
+static void print_location(struct source_list *sources, struct source_location location, FILE *file)
+{
+	struct source_file *source = source_list_get_file(sources, location.file);
+	size_t line, column;
+
+	if (!source) {
+		bergen_fprintf(file, "?");
+		return;
+	}
+	source_file_get_line_column(source, location.offset, &line, &column);
+	bergen_fprintf(file, "%s:%lu", source->name, (unsigned long) line);
+}
+
+/* The line as written, without its indentation and cut short if it's long */
+static void print_text(struct source_list *sources, struct source_location location, FILE *file)
+{
+	struct source_file *source = source_list_get_file(sources, location.file);
+	const char *str, *end;
+
+	if (!source || !source->data || location.offset >= source->length)
+		return;
+	str = source->data + location.offset;
+	if (!(end = bergen_memchr(str, '\n', source->length - location.offset)))
+		end = source->data + source->length;
+	while (str < end && (*str == ' ' || *str == '\t'))
+		str++;
+	while (end > str && bergen_isspace((unsigned char) end[-1]))
+		end--;
+
+	if (end - str > PROFILE_TEXT_WIDTH)
+		bergen_fprintf(file, "  %.*s...", PROFILE_TEXT_WIDTH - 3, str);
+	else
+		bergen_fprintf(file, "  %.*s", (int) (end - str), str);
+}
+
+static void print_lines(const struct profile *profile, struct source_list *sources, size_t top, FILE *file)
+{
+	const struct profile_line **lines = bergen_malloc(sizeof(*lines) * (profile->num_lines + 1));
+	const struct profile_line *line, *include;
+	struct source_location from;
+	size_t i, num_lines = 0, depth;
+
+	for (i = 0; i < profile->num_slots; i++) {
+		if (profile->lines[i].location.file != SOURCE_FILE_NONE)
+			lines[num_lines++] = &profile->lines[i];
+	}
+	bergen_qsort(lines, num_lines, sizeof(*lines), compare_lines);
+
+	bergen_fprintf(file, "%10s %10s  %s\n", "ms", "count", "line");
+	for (i = 0; i < num_lines && i < top; i++) {
+		line = lines[i];
+		bergen_fprintf(file, "%10.3f %10llu  ", ms(line->ns), (unsigned long long) line->count);
+		print_location(sources, line->location, file);
+		print_text(sources, line->location, file);
+		bergen_fprintf(file, "\n");
+
+		/* The #include lines are profiled too, so the chain can be followed */
+		for (from = line->from, depth = 0; from.file != SOURCE_FILE_NONE && depth < PROFILE_MAX_INCLUDE_DEPTH; depth++) {
+			bergen_fprintf(file, "%10s %10s    included from ", "", "");
+			print_location(sources, from, file);
+			bergen_fprintf(file, "\n");
+			include = profile_find_line(profile, from);
+			from = include ? include->from : source_location_none();
+		}
+	}
+	bergen_free(lines);
+}
+
+static void print_macros(const struct profile *profile, size_t top, FILE *file)
+{
+	size_t i, num_macros = profile->macro_names.num_entries;
+	const struct profile_macro **macros = bergen_malloc(sizeof(*macros) * (num_macros + 1));
+
+	for (i = 0; i < num_macros; i++)
+		macros[i] = &profile->macros[i];
+	bergen_qsort(macros, num_macros, sizeof(*macros), compare_macros);
+
+	bergen_fprintf(file, "%10s %10s  %s\n", "self ms", "count", "macro");
+	for (i = 0; i < num_macros && i < top; i++) {
+		bergen_fprintf(file, "%10.3f %10llu  %s\n", ms(macros[i]->ns), (unsigned long long) macros[i]->count,
+			intern_table_get_name(&profile->macro_names, macros[i] - profile->macros));
+	}
+	bergen_free(macros);
+}
+
+void profile_print(const struct profile *profile, struct source_list *sources, size_t top, FILE *file)
+{
+	print_lines(profile, sources, top, file);
+	if (profile->macro_names.num_entries > 0) {
+		bergen_fprintf(file, "\n");
+		print_macros(profile, top, file);
+	}
+}
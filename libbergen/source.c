@@ -0,0 +1,125 @@
+/*
+ * libbergen/source.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define BERGEN_ALLOC_TAG ALLOC_TAG_FILES
+
+#include <bergen/source.h>
+
+#include <bergen/libc.h>
+
+void source_list_init(struct source_list *list)
+{
+	list->buffer_size = 8;
+	list->files = bergen_malloc(sizeof(*list->files) * list->buffer_size);
+	list->num_files = 0;
+	list->num_removed = 0;
+}
+
+void source_list_destroy(struct source_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->num_files; i++) {
+		bergen_free(list->files[i].line_starts);
+		bergen_free(list->files[i].name);
+	}
+	bergen_free(list->files);
+}
+
+source_file_id source_list_add(struct source_list *list, const char *name, const char *data, size_t length)
+{
+	struct source_file *file;
+	source_file_id id = list->num_files;
+
+	if (list->num_removed > 0) {
+		for (id = 0; list->files[id].name; id++)
+			;
+		list->num_removed--;
+	} else {
+		if (list->num_files >= list->buffer_size) {
+			list->buffer_size *= 2;
+			list->files = bergen_realloc(list->files, sizeof(*list->files) * list->buffer_size);
+		}
+		list->num_files++;
+	}
+
+	file = &list->files[id];
+	file->name = bergen_strdup(name);
+	file->data = data;
+	file->length = length;
+	file->line_starts = NULL;
+	file->num_lines = 0;
+	return id;
+}
+
+void source_list_remove(struct source_list *list, source_file_id id)
+{
+	struct source_file *file = &list->files[id];
+
+	bergen_free(file->line_starts);
+	bergen_free(file->name);
+	file->name = NULL;
+	file->line_starts = NULL;
+	list->num_removed++;
+}
+
+static void build_line_index(struct source_file *file)
+{
+	size_t buffer_size = 64;
+	const char *ptr = file->data, *end = file->data + file->length;
+
+	file->line_starts = bergen_malloc(sizeof(*file->line_starts) * buffer_size);
+	file->line_starts[0] = 0;
+	file->num_lines = 1;
+
+	/* memchr() is vectorized by any serious libc, so let it do the scan */
+	while (ptr < end && (ptr = bergen_memchr(ptr, '\n', end - ptr))) {
+		ptr++;
+		if (file->num_lines >= buffer_size) {
+			buffer_size *= 2;
+			file->line_starts = bergen_realloc(file->line_starts, sizeof(*file->line_starts) * buffer_size);
+		}
+		file->line_starts[file->num_lines++] = ptr - file->data;
+	}
+}
+
+void source_file_get_line_column(struct source_file *file, size_t offset, size_t *line, size_t *column)
+{
+	size_t low = 0, high, mid;
+
+	if (!file->line_starts)
+		build_line_index(file);
+
+	/* Find the last line that starts at or before offset */
+	high = file->num_lines;
+	while (high - low > 1) {
+		mid = low + (high - low) / 2;
+		if (file->line_starts[mid] <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	*line = low + 1;
+	*column = offset - file->line_starts[low] + 1;
+}
@@ -0,0 +1,278 @@
+/*
+ * libbergen/stats.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/stats.h>
+
+#include <bergen/libc.h>
+
+#define STATS_MAX_DEPTH 8
+
+static const char *const phase_names[STATS_NUM_PHASES] = {
+	"read",
+	"preprocess",
+	"pass1",
+	"pass2",
+	"output",
+};
+
+static const char *const counter_names[STATS_NUM_COUNTERS] = {
+	"files_read",
+	"bytes_read",
+	"lines",
+	"expressions",
+	"tokens",
+	"label_lookups",
+	"label_probes",
+	"object_writes",
+	"object_regrows",
+	"fixups",
+};
+
+/* Each thread counts on its own, and they are only added up at the end */
+struct stats_thread {
+	struct stats stats;
+	enum stats_phase phases[STATS_MAX_DEPTH];
+	size_t depth; /* May be more than STATS_MAX_DEPTH, the rest isn't timed */
+	struct timespec wall; /* When the innermost phase was last switched */
+	struct timespec cpu; /* When the outermost phase started */
+	int active; /* Counted anything since the last reset */
+	struct stats_thread *next;
+};
+
+int stats_enabled = 0;
+
+static pthread_key_t thread_key;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_thread *threads = NULL;
+
+/* What threads that have exited since the last reset counted */
+static struct stats retired;
+
+static void add_stats(struct stats *total, const struct stats *stats)
+{
+	size_t i;
+
+	for (i = 0; i < STATS_NUM_PHASES; i++) {
+		total->wall_ns[i] += stats->wall_ns[i];
+		total->cpu_ns[i] += stats->cpu_ns[i];
+		total->has_cpu[i] |= stats->has_cpu[i];
+	}
+	for (i = 0; i < STATS_NUM_COUNTERS; i++)
+		total->counters[i] += stats->counters[i];
+}
+
+/* Runs as a thread exits, so that pools started for each batch don't pile up */
+static void retire_thread(void *data)
+{
+	struct stats_thread *thread = data, **link;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (link = &threads; *link != thread; link = &(*link)->next)
+		;
+	*link = thread->next;
+	if (thread->active) {
+		add_stats(&retired, &thread->stats);
+		retired.num_threads++;
+	}
+	bergen_pthread_mutex_unlock(&threads_lock);
+	bergen_free(thread);
+}
+
+void stats_enable(void)
+{
+	if (stats_enabled)
+		return;
+	bergen_memset(&retired, 0, sizeof(retired));
+	bergen_pthread_key_create(&thread_key, retire_thread);
+	stats_enabled = 1;
+}
+
+void stats_disable(void)
+{
+	struct stats_thread *thread, *next;
+
+	if (!stats_enabled)
+		return;
+	stats_enabled = 0;
+	bergen_pthread_key_delete(thread_key);
+	for (thread = threads; thread; thread = next) {
+		next = thread->next;
+		bergen_free(thread);
+	}
+	threads = NULL;
+}
+
+static struct stats_thread *get_thread(void)
+{
+	struct stats_thread *thread = bergen_pthread_getspecific(thread_key);
+
+	if (thread) {
+		thread->active = 1;
+		return thread;
+	}
+
+	thread = bergen_malloc(sizeof(*thread));
+	bergen_memset(thread, 0, sizeof(*thread));
+	thread->active = 1;
+	bergen_pthread_setspecific(thread_key, thread);
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	thread->next = threads;
+	threads = thread;
+	bergen_pthread_mutex_unlock(&threads_lock);
+	return thread;
+}
+
+static uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (uint64_t) (end->tv_sec - start->tv_sec) * 1000000000u + end->tv_nsec - start->tv_nsec;
+}
+
+void stats_count_slow(enum stats_counter counter, uint64_t n)
+{
+	get_thread()->stats.counters[counter] += n;
+}
+
+/* Gives the time since the last switch to the innermost phase */
+static void switch_phase(struct stats_thread *thread)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(CLOCK_MONOTONIC, &now);
+	if (thread->depth > 0 && thread->depth <= STATS_MAX_DEPTH)
+		thread->stats.wall_ns[thread->phases[thread->depth - 1]] += elapsed_ns(&thread->wall, &now);
+	thread->wall = now;
+}
+
+void stats_phase_begin_slow(enum stats_phase phase)
+{
+	struct stats_thread *thread = get_thread();
+
+	switch_phase(thread);
+	if (thread->depth == 0)
+		bergen_clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread->cpu);
+	if (thread->depth < STATS_MAX_DEPTH)
+		thread->phases[thread->depth] = phase;
+	thread->depth++;
+}
+
+void stats_phase_end_slow(void)
+{
+	struct stats_thread *thread = get_thread();
+	struct timespec now;
+	enum stats_phase phase;
+
+	switch_phase(thread);
+	if (--thread->depth == 0) {
+		phase = thread->phases[0];
+		bergen_clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+		thread->stats.cpu_ns[phase] += elapsed_ns(&thread->cpu, &now);
+		thread->stats.has_cpu[phase] = 1;
+	}
+}
+
+void stats_collect(struct stats *stats)
+{
+	const struct stats_thread *thread;
+
+	bergen_memset(stats, 0, sizeof(*stats));
+	bergen_pthread_mutex_lock(&threads_lock);
+	add_stats(stats, &retired);
+	stats->num_threads = retired.num_threads;
+	for (thread = threads; thread; thread = thread->next) {
+		if (!thread->active)
+			continue;
+		add_stats(stats, &thread->stats);
+		stats->num_threads++;
+	}
+	bergen_pthread_mutex_unlock(&threads_lock);
+
+	alloc_collect(&stats->allocations);
+}
+
+void stats_reset(void)
+{
+	struct stats_thread *thread;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread; thread = thread->next) {
+		bergen_memset(&thread->stats, 0, sizeof(thread->stats));
+		thread->active = 0;
+	}
+	bergen_memset(&retired, 0, sizeof(retired));
+	bergen_pthread_mutex_unlock(&threads_lock);
+}
+
+static double ms(uint64_t ns)
+{
+	return ns / 1000000.0;
+}
+
+void stats_print(const struct stats *stats, FILE *file)
+{
+	size_t i;
+
+	bergen_fprintf(file, "%-16s %10s %10s\n", "phase", "wall ms", "cpu ms");
+	for (i = 0; i < STATS_NUM_PHASES; i++) {
+		if (stats->has_cpu[i])
+			bergen_fprintf(file, "%-16s %10.3f %10.3f\n", phase_names[i], ms(stats->wall_ns[i]), ms(stats->cpu_ns[i]));
+		else
+			bergen_fprintf(file, "%-16s %10.3f %10s\n", phase_names[i], ms(stats->wall_ns[i]), "-");
+	}
+	bergen_fprintf(file, "%-16s %10.3f %10.3f\n", "total", ms(stats->total_wall_ns), ms(stats->total_cpu_ns));
+	if (stats->num_threads > 1)
+		bergen_fprintf(file, "(phases are summed over %lu threads)\n", (unsigned long) stats->num_threads);
+
+	bergen_fprintf(file, "\n");
+	for (i = 0; i < STATS_NUM_COUNTERS; i++)
+		bergen_fprintf(file, "%-16s %21llu\n", counter_names[i], (unsigned long long) stats->counters[i]);
+
+	if (ALLOC_ACCOUNTING) {
+		bergen_fprintf(file, "\n");
+		alloc_print(&stats->allocations, file);
+	}
+}
+
+void stats_print_json(const struct stats *stats, FILE *file)
+{
+	size_t i;
+
+	bergen_fprintf(file, "{\"threads\": %lu, \"total\": {\"wall_ns\": %llu, \"cpu_ns\": %llu}, \"phases\": {",
+		(unsigned long) stats->num_threads, (unsigned long long) stats->total_wall_ns, (unsigned long long) stats->total_cpu_ns);
+	for (i = 0; i < STATS_NUM_PHASES; i++) {
+		bergen_fprintf(file, "%s\"%s\": {\"wall_ns\": %llu", i ? ", " : "", phase_names[i], (unsigned long long) stats->wall_ns[i]);
+		if (stats->has_cpu[i])
+			bergen_fprintf(file, ", \"cpu_ns\": %llu", (unsigned long long) stats->cpu_ns[i]);
+		bergen_fprintf(file, "}");
+	}
+	bergen_fprintf(file, "}, \"counters\": {");
+	for (i = 0; i < STATS_NUM_COUNTERS; i++)
+		bergen_fprintf(file, "%s\"%s\": %llu", i ? ", " : "", counter_names[i], (unsigned long long) stats->counters[i]);
+	bergen_fprintf(file, "}");
+
+	if (ALLOC_ACCOUNTING) {
+		bergen_fprintf(file, ", \"allocations\": ");
+		alloc_print_json(&stats->allocations, file);
+	}
+	bergen_fprintf(file, "}\n");
+}
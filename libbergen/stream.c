@@ -0,0 +1,193 @@
+/*
+ * libbergen/stream.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define BERGEN_ALLOC_TAG ALLOC_TAG_TOKENS
+
+#include <bergen/stream.h>
+
+#include <bergen/libc.h>
+
+void line_stream_init(struct line_stream *stream, struct preprocessor *pp, struct include_manager *im)
+{
+	stream->pp = pp;
+	stream->im = im;
+	stream->files = NULL;
+
+	stream->frames_buffer_size = 8;
+	stream->frames = bergen_malloc(sizeof(*stream->frames) * stream->frames_buffer_size);
+	stream->num_frames = 0;
+
+	lex_token_list_init(&stream->tokens);
+	lex_token_list_init(&stream->expanded);
+	stream->finished = 0;
+}
+
+/* The file is done with, or the stream is */
+static void pop_frame(struct line_stream *stream)
+{
+	const struct line_stream_frame *frame = &stream->frames[--stream->num_frames];
+
+	if (frame->trace_start)
+		trace_end(frame->trace_start, TRACE_CATEGORY_INCLUDE, frame->file->path, bergen_strlen(frame->file->path));
+}
+
+void line_stream_destroy(struct line_stream *stream)
+{
+	/* After .end or an error, the files still open end here */
+	while (stream->num_frames > 0)
+		pop_frame(stream);
+	bergen_free(stream->frames);
+	lex_token_list_destroy(&stream->tokens);
+	lex_token_list_destroy(&stream->expanded);
+}
+
+void line_stream_push(struct line_stream *stream, const struct include_file *file)
+{
+	struct line_stream_frame *frame;
+
+	if (stream->num_frames >= stream->frames_buffer_size) {
+		stream->frames_buffer_size *= 2;
+		stream->frames = bergen_realloc(stream->frames, sizeof(*stream->frames) * stream->frames_buffer_size);
+	}
+
+	if (stream->files)
+		include_file_list_add(stream->files, file);
+
+	frame = &stream->frames[stream->num_frames++];
+	frame->file = file;
+	frame->offset = 0;
+	frame->from = source_location_none();
+	frame->trace_start = trace_begin();
+	stream->finished = 0;
+}
+
+/* Points the error at its span if that is in the line, or else at the start of the line */
+static struct error *locate_error(const struct line_stream_frame *frame, size_t line_offset, struct error *err)
+{
+	struct source_location location;
+
+	if (err->location.file != SOURCE_FILE_NONE)
+		return err;
+
+	location.file = frame->file->source_id;
+	location.offset = line_offset;
+	if (err->str >= frame->file->data && err->str < frame->file->data + frame->file->length)
+		location.offset = err->str - frame->file->data;
+	error_set_location(err, location);
+	return err;
+}
+
+static struct error *include(struct line_stream *stream, const char *name, size_t length, struct source_location location)
+{
+	const struct line_stream_frame *frame = &stream->frames[stream->num_frames - 1];
+	struct include_file *file;
+	struct error *err;
+
+	if ((err = include_manager_find(stream->im, name, length, frame->file, &file)))
+		return err;
+
+	/* Whether it is skipped depends on its contents too */
+	if (include_file_is_guarded(file, stream->pp)) {
+		if (stream->files)
+			include_file_list_add(stream->files, file);
+		return NULL;
+	}
+	if (stream->num_frames >= LINE_STREAM_MAX_DEPTH)
+		return error_create_span_value(ERROR_INCLUDE_DEPTH, name, length, LINE_STREAM_MAX_DEPTH);
+
+	line_stream_push(stream, file);
+	stream->frames[stream->num_frames - 1].from = location;
+	return NULL;
+}
+
+struct error *line_stream_next(struct line_stream *stream, const struct stream_line **line)
+{
+	struct line_stream_frame *frame;
+	const char *data, *str, *end, *name;
+	size_t length, line_offset, name_length;
+	struct source_location location, from;
+	uint64_t start;
+	struct error *err;
+
+	*line = NULL;
+	while (stream->num_frames > 0) {
+		frame = &stream->frames[stream->num_frames - 1];
+		data = frame->file->data;
+		length = frame->file->length;
+
+		if (!preprocessor_is_active(stream->pp))
+			frame->offset += preprocessor_skip(data + frame->offset, length - frame->offset);
+		if (frame->offset >= length) {
+			pop_frame(stream);
+			continue;
+		}
+
+		start = profile_begin();
+		line_offset = frame->offset;
+		str = data + line_offset;
+		if ((end = bergen_memchr(str, '\n', length - line_offset))) {
+			frame->offset = end - data + 1;
+		} else {
+			end = data + length;
+			frame->offset = length;
+		}
+		if (end > str && end[-1] == '\r')
+			end--;
+
+		location.file = frame->file->source_id;
+		location.offset = line_offset;
+		from = frame->from;
+		if (preprocessor_find_directive(str, end - str)) {
+			if (preprocessor_is_active(stream->pp) && (name = preprocessor_parse_include(str, end - str, &name_length)))
+				err = include(stream, name, name_length, location);
+			else
+				err = preprocessor_directive(stream->pp, str, end - str);
+			if (err)
+				return locate_error(frame, line_offset, err);
+			/* The consumer never sees directives, so they are done here */
+			profile_line(start, location, from);
+			continue;
+		}
+
+		lex_token_list_clear(&stream->tokens);
+		lex_token_list_clear(&stream->expanded);
+		lex_line(str, end - str, &stream->tokens);
+		if ((err = preprocessor_expand(stream->pp, stream->tokens.tokens, stream->tokens.num_tokens, &stream->expanded)))
+			return locate_error(frame, line_offset, err);
+
+		stream->line.location = location;
+		stream->line.str = str;
+		stream->line.length = end - str;
+		stream->line.tokens = stream->expanded.tokens;
+		stream->line.num_tokens = stream->expanded.num_tokens;
+		stream->line.from = from;
+		stream->line.profile_start = start;
+		*line = &stream->line;
+		return NULL;
+	}
+
+	if (stream->finished)
+		return NULL;
+	stream->finished = 1;
+	return preprocessor_finish(stream->pp);
+}
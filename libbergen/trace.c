@@ -0,0 +1,235 @@
+/*
+ * libbergen/trace.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/trace.h>
+
+#include <bergen/libc.h>
+
+static const char *const category_names[TRACE_NUM_CATEGORIES] = {
+	"job",
+	"phase",
+	"read",
+	"include",
+	"macro",
+	"output",
+};
+
+struct trace_event {
+	uint64_t start;
+	uint64_t duration;
+	size_t name; /* Offset in the thread's names */
+	size_t name_length;
+	enum trace_category category;
+};
+
+/* Each thread records on its own, and they are only looked at by trace_write */
+struct trace_thread {
+	struct trace_event *events;
+	size_t events_buffer_size; /* Number of events in buffer */
+	size_t num_events;
+
+	char *names;
+	size_t names_buffer_size; /* Number of chars in buffer */
+	size_t names_length;
+
+	unsigned long tid;
+	int running; /* Otherwise its thread has exited, and another may take it over */
+	struct trace_thread *next;
+};
+
+int trace_enabled = 0;
+
+static uint64_t macro_threshold;
+static uint64_t origin; /* When tracing was enabled, the timestamps count from it */
+static pthread_key_t thread_key;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_thread *threads = NULL;
+static unsigned long num_threads = 0;
+
+uint64_t trace_now(void)
+{
+	struct timespec now;
+
+	bergen_clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/*
+ * Runs as a thread exits. Its events are kept for trace_write, but the next
+ * thread to start records after them, so that pools started for each batch
+ * don't pile up.
+ */
+static void retire_thread(void *data)
+{
+	struct trace_thread *thread = data;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	thread->running = 0;
+	bergen_pthread_mutex_unlock(&threads_lock);
+}
+
+void trace_enable(uint64_t macro_threshold_ns)
+{
+	if (trace_enabled)
+		return;
+	bergen_pthread_key_create(&thread_key, retire_thread);
+	macro_threshold = macro_threshold_ns;
+	origin = trace_now();
+	trace_enabled = 1;
+}
+
+void trace_disable(void)
+{
+	struct trace_thread *thread, *next;
+
+	if (!trace_enabled)
+		return;
+	trace_enabled = 0;
+	bergen_pthread_key_delete(thread_key);
+	for (thread = threads; thread; thread = next) {
+		next = thread->next;
+		bergen_free(thread->events);
+		bergen_free(thread->names);
+		bergen_free(thread);
+	}
+	threads = NULL;
+	num_threads = 0;
+}
+
+static struct trace_thread *get_thread(void)
+{
+	struct trace_thread *thread = bergen_pthread_getspecific(thread_key);
+
+	if (thread)
+		return thread;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread && thread->running; thread = thread->next)
+		;
+	if (!thread) {
+		thread = bergen_malloc(sizeof(*thread));
+		thread->events_buffer_size = 64;
+		thread->events = bergen_malloc(sizeof(*thread->events) * thread->events_buffer_size);
+		thread->num_events = 0;
+		thread->names_buffer_size = 1024;
+		thread->names = bergen_malloc(thread->names_buffer_size);
+		thread->names_length = 0;
+		thread->tid = ++num_threads;
+		thread->next = threads;
+		threads = thread;
+	}
+	thread->running = 1;
+	bergen_pthread_mutex_unlock(&threads_lock);
+
+	bergen_pthread_setspecific(thread_key, thread);
+	return thread;
+}
+
+void trace_end_slow(uint64_t start, enum trace_category category, const char *name, size_t length)
+{
+	uint64_t end = trace_now();
+	struct trace_thread *thread;
+	struct trace_event *event;
+
+	if (category == TRACE_CATEGORY_MACRO && end - start < macro_threshold)
+		return;
+
+	thread = get_thread();
+	if (thread->num_events >= thread->events_buffer_size) {
+		thread->events_buffer_size *= 2;
+		thread->events = bergen_realloc(thread->events, sizeof(*thread->events) * thread->events_buffer_size);
+	}
+	while (thread->names_length + length > thread->names_buffer_size) {
+		thread->names_buffer_size *= 2;
+		thread->names = bergen_realloc(thread->names, thread->names_buffer_size);
+	}
+
+	event = &thread->events[thread->num_events++];
+	event->start = start;
+	event->duration = end - start;
+	event->name = thread->names_length;
+	event->name_length = length;
+	event->category = category;
+	bergen_memcpy(thread->names + thread->names_length, name, length);
+	thread->names_length += length;
+}
+
+size_t trace_num_events(void)
+{
+	const struct trace_thread *thread;
+	size_t num_events = 0;
+
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread; thread = thread->next)
+		num_events += thread->num_events;
+	bergen_pthread_mutex_unlock(&threads_lock);
+	return num_events;
+}
+
+static void write_string(FILE *file, const char *str, size_t length)
+{
+	size_t i;
+
+	bergen_fputc('"', file);
+	for (i = 0; i < length; i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			bergen_fprintf(file, "\\%c", str[i]);
+		else if ((unsigned char) str[i] < 0x20)
+			bergen_fprintf(file, "\\u%04x", (unsigned) (unsigned char) str[i]);
+		else
+			bergen_fputc(str[i], file);
+	}
+	bergen_fputc('"', file);
+}
+
+/* Timestamps are in microseconds, with the nanoseconds after the point */
+static void write_us(FILE *file, uint64_t ns)
+{
+	bergen_fprintf(file, "%llu.%03u", (unsigned long long) (ns / 1000), (unsigned) (ns % 1000));
+}
+
+void trace_write(FILE *file)
+{
+	const struct trace_thread *thread;
+	const struct trace_event *event;
+	const char *separator = "\n";
+	size_t i;
+
+	bergen_fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	bergen_pthread_mutex_lock(&threads_lock);
+	for (thread = threads; thread; thread = thread->next) {
+		for (i = 0; i < thread->num_events; i++) {
+			event = &thread->events[i];
+			bergen_fprintf(file, "%s{\"name\": ", separator);
+			write_string(file, thread->names + event->name, event->name_length);
+			bergen_fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": ", category_names[event->category]);
+			write_us(file, event->start - origin);
+			bergen_fprintf(file, ", \"dur\": ");
+			write_us(file, event->duration);
+			bergen_fprintf(file, ", \"pid\": 1, \"tid\": %lu}", thread->tid);
+			separator = ",\n";
+		}
+	}
+	bergen_pthread_mutex_unlock(&threads_lock);
+	bergen_fprintf(file, "\n]}\n");
+}
@@ -0,0 +1,822 @@
+/*
+ * libbergen/z80.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <bergen/z80.h>
+
+#include <bergen/libc.h>
+
+struct encoder {
+	const char *mnemonic;
+	size_t mnemonic_length;
+	expr_value address;
+	uint8_t *buf;
+	size_t length;
+	struct error *err; /* First value out of range */
+};
+
+struct instruction {
+	const char *mnemonic; /* Lower case, the table is sorted by it */
+	int (*encode)(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode);
+	unsigned int opcode; /* Meaning depends on encode */
+};
+
+/* An operand which fits the 3-bit register field: r, (HL), (IX+d), IXH, ... */
+struct r8 {
+	unsigned int code;
+	uint8_t prefix; /* 0, 0xDD or 0xFD */
+	int has_displacement;
+	expr_value displacement;
+};
+
+struct register_name {
+	const char *name;
+	enum z80_register reg;
+};
+
+static const struct register_name REGISTER_NAMES[] = {
+	{"a",	Z80_REGISTER_A},
+	{"af",	Z80_REGISTER_AF},
+	{"af'",	Z80_REGISTER_AF_ALT},
+	{"b",	Z80_REGISTER_B},
+	{"bc",	Z80_REGISTER_BC},
+	{"c",	Z80_REGISTER_C},
+	{"d",	Z80_REGISTER_D},
+	{"de",	Z80_REGISTER_DE},
+	{"e",	Z80_REGISTER_E},
+	{"h",	Z80_REGISTER_H},
+	{"hl",	Z80_REGISTER_HL},
+	{"i",	Z80_REGISTER_I},
+	{"ix",	Z80_REGISTER_IX},
+	{"ixh",	Z80_REGISTER_IXH},
+	{"ixl",	Z80_REGISTER_IXL},
+	{"iy",	Z80_REGISTER_IY},
+	{"iyh",	Z80_REGISTER_IYH},
+	{"iyl",	Z80_REGISTER_IYL},
+	{"l",	Z80_REGISTER_L},
+	{"m",	Z80_REGISTER_M},
+	{"nc",	Z80_REGISTER_NC},
+	{"nz",	Z80_REGISTER_NZ},
+	{"p",	Z80_REGISTER_P},
+	{"pe",	Z80_REGISTER_PE},
+	{"po",	Z80_REGISTER_PO},
+	{"r",	Z80_REGISTER_R},
+	{"sp",	Z80_REGISTER_SP},
+	{"z",	Z80_REGISTER_Z},
+};
+
+/* Compares a name of any case to a lower case one, like strncmp() */
+static int compare_lower(const char *name, size_t length, const char *lower)
+{
+	size_t i;
+	int c;
+
+	for (i = 0; i < length; i++) {
+		if (!lower[i])
+			return 1;
+		if ((c = bergen_tolower((unsigned char) name[i]) - lower[i]))
+			return c;
+	}
+	return lower[i] ? -1 : 0;
+}
+
+enum z80_register z80_find_register(const char *name, size_t length)
+{
+	size_t i;
+
+	if (length > 3)
+		return Z80_REGISTER_NONE;
+	for (i = 0; i < sizeof(REGISTER_NAMES) / sizeof(*REGISTER_NAMES); i++) {
+		if (!compare_lower(name, length, REGISTER_NAMES[i].name))
+			return REGISTER_NAMES[i].reg;
+	}
+	return Z80_REGISTER_NONE;
+}
+
+static void emit(struct encoder *e, unsigned int byte)
+{
+	e->buf[e->length++] = byte & 0xFF;
+}
+
+static void range_error(struct encoder *e, expr_value value)
+{
+	if (!e->err)
+		e->err = error_create_value(ERROR_VALUE_OUT_OF_RANGE, value);
+}
+
+static void emit_n(struct encoder *e, expr_value value)
+{
+	if (value < -128 || value > 255)
+		range_error(e, value);
+	emit(e, value);
+}
+
+static void emit_nn(struct encoder *e, expr_value value)
+{
+	if (value < -32768 || value > 65535)
+		range_error(e, value);
+	emit(e, value);
+	emit(e, value >> 8);
+}
+
+static void emit_d(struct encoder *e, expr_value value)
+{
+	if (value < -128 || value > 127)
+		range_error(e, value);
+	emit(e, value);
+}
+
+/* Relative jumps count from the end of the two byte instruction */
+static void emit_e(struct encoder *e, expr_value target)
+{
+	emit_d(e, target - (e->address + 2));
+}
+
+static void emit_prefix(struct encoder *e, uint8_t prefix)
+{
+	if (prefix)
+		emit(e, prefix);
+}
+
+static int is_register(const struct z80_operand *op, enum z80_register reg)
+{
+	return op->type == Z80_OPERAND_TYPE_REGISTER && op->reg == reg;
+}
+
+static int is_indirect_register(const struct z80_operand *op, enum z80_register reg)
+{
+	return op->type == Z80_OPERAND_TYPE_INDIRECT_REGISTER && op->reg == reg;
+}
+
+static int get_r8(const struct z80_operand *op, struct r8 *r)
+{
+	r->prefix = 0;
+	r->has_displacement = 0;
+	r->displacement = 0;
+
+	if (op->type == Z80_OPERAND_TYPE_REGISTER) {
+		switch (op->reg) {
+		case Z80_REGISTER_B:
+		case Z80_REGISTER_C:
+		case Z80_REGISTER_D:
+		case Z80_REGISTER_E:
+		case Z80_REGISTER_H:
+		case Z80_REGISTER_L:
+			r->code = op->reg - Z80_REGISTER_B;
+			return 1;
+
+		case Z80_REGISTER_A:
+			r->code = 7;
+			return 1;
+
+		case Z80_REGISTER_IXH:
+		case Z80_REGISTER_IXL:
+			r->prefix = 0xDD;
+			r->code = op->reg == Z80_REGISTER_IXH ? 4 : 5;
+			return 1;
+
+		case Z80_REGISTER_IYH:
+		case Z80_REGISTER_IYL:
+			r->prefix = 0xFD;
+			r->code = op->reg == Z80_REGISTER_IYH ? 4 : 5;
+			return 1;
+
+		default:
+			return 0;
+		}
+	}
+
+	if (op->type == Z80_OPERAND_TYPE_INDIRECT_REGISTER) {
+		r->code = 6;
+		switch (op->reg) {
+		case Z80_REGISTER_HL:
+			return 1;
+
+		case Z80_REGISTER_IX:
+		case Z80_REGISTER_IY:
+			r->prefix = op->reg == Z80_REGISTER_IX ? 0xDD : 0xFD;
+			r->has_displacement = 1;
+			r->displacement = op->value;
+			return 1;
+
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/* BC, DE, HL, SP (or AF instead of SP for PUSH and POP), IX and IY in place of HL */
+static int get_rp(const struct z80_operand *op, enum z80_register last, unsigned int *code, uint8_t *prefix)
+{
+	*prefix = 0;
+	if (op->type != Z80_OPERAND_TYPE_REGISTER)
+		return 0;
+
+	switch (op->reg) {
+	case Z80_REGISTER_BC:
+		*code = 0;
+		return 1;
+
+	case Z80_REGISTER_DE:
+		*code = 1;
+		return 1;
+
+	case Z80_REGISTER_HL:
+		*code = 2;
+		return 1;
+
+	case Z80_REGISTER_IX:
+	case Z80_REGISTER_IY:
+		*prefix = op->reg == Z80_REGISTER_IX ? 0xDD : 0xFD;
+		*code = 2;
+		return 1;
+
+	default:
+		if (op->reg != last)
+			return 0;
+		*code = 3;
+		return 1;
+	}
+}
+
+/* HL, IX or IY */
+static int get_hl(const struct z80_operand *op, uint8_t *prefix)
+{
+	unsigned int code;
+
+	return get_rp(op, Z80_REGISTER_NONE, &code, prefix) && code == 2;
+}
+
+/* Conditions up to max (3 for JR's NZ, Z, NC and C) */
+static int get_cc(const struct z80_operand *op, unsigned int max, unsigned int *code)
+{
+	if (op->type != Z80_OPERAND_TYPE_REGISTER)
+		return 0;
+
+	if (op->reg == Z80_REGISTER_C)
+		*code = 3;
+	else if (op->reg >= Z80_REGISTER_NZ && op->reg <= Z80_REGISTER_M)
+		*code = op->reg == Z80_REGISTER_NZ ? 0 : op->reg == Z80_REGISTER_Z ? 1 : op->reg == Z80_REGISTER_NC ? 2 : op->reg - Z80_REGISTER_PO + 4;
+	else
+		return 0;
+	return *code <= max;
+}
+
+/* The prefix and displacement of an indexed operand go around the opcode */
+static void emit_r8_op(struct encoder *e, const struct r8 *r, unsigned int opcode)
+{
+	emit_prefix(e, r->prefix);
+	emit(e, opcode);
+	if (r->has_displacement)
+		emit_d(e, r->displacement);
+}
+
+static int encode_implied(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	if (num_ops != 0)
+		return 0;
+	if (opcode > 0xFF)
+		emit(e, opcode >> 8);
+	emit(e, opcode);
+	return 1;
+}
+
+static int encode_ld_r8(struct encoder *e, const struct r8 *dst, const struct r8 *src)
+{
+	uint8_t prefix = dst->prefix ? dst->prefix : src->prefix;
+
+	if (dst->code == 6 && src->code == 6)
+		return 0; /* That would be HALT */
+
+	if (dst->has_displacement || src->has_displacement) {
+		/* The other side is a plain register, H and L stay themselves */
+		if ((dst->has_displacement ? src : dst)->prefix)
+			return 0;
+	} else if (dst->prefix && src->prefix && dst->prefix != src->prefix) {
+		return 0;
+	} else if (prefix && ((!dst->prefix && dst->code >= 4) || (!src->prefix && src->code >= 4 && src->code != 7))) {
+		return 0; /* H, L and (HL) become IXH, IXL and (IX+d) with the prefix */
+	}
+
+	emit_prefix(e, prefix);
+	emit(e, 0x40 | dst->code << 3 | src->code);
+	if (dst->has_displacement)
+		emit_d(e, dst->displacement);
+	else if (src->has_displacement)
+		emit_d(e, src->displacement);
+	return 1;
+}
+
+static int encode_ld(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	const struct z80_operand *dst = &ops[0], *src = &ops[1];
+	struct r8 r1, r2;
+	unsigned int code;
+	uint8_t prefix;
+
+	if (num_ops != 2)
+		return 0;
+
+	/* Special registers */
+	if (is_register(dst, Z80_REGISTER_A) && is_register(src, Z80_REGISTER_I))
+		return encode_implied(e, NULL, 0, 0xED57);
+	if (is_register(dst, Z80_REGISTER_A) && is_register(src, Z80_REGISTER_R))
+		return encode_implied(e, NULL, 0, 0xED5F);
+	if (is_register(dst, Z80_REGISTER_I) && is_register(src, Z80_REGISTER_A))
+		return encode_implied(e, NULL, 0, 0xED47);
+	if (is_register(dst, Z80_REGISTER_R) && is_register(src, Z80_REGISTER_A))
+		return encode_implied(e, NULL, 0, 0xED4F);
+
+	/* 8 bit */
+	if (get_r8(dst, &r1)) {
+		if (get_r8(src, &r2))
+			return encode_ld_r8(e, &r1, &r2);
+		if (src->type == Z80_OPERAND_TYPE_IMMEDIATE) {
+			emit_r8_op(e, &r1, 0x06 | r1.code << 3);
+			emit_n(e, src->value);
+			return 1;
+		}
+	}
+	if (is_register(dst, Z80_REGISTER_A)) {
+		if (is_indirect_register(src, Z80_REGISTER_BC))
+			return encode_implied(e, NULL, 0, 0x0A);
+		if (is_indirect_register(src, Z80_REGISTER_DE))
+			return encode_implied(e, NULL, 0, 0x1A);
+		if (src->type == Z80_OPERAND_TYPE_INDIRECT) {
+			emit(e, 0x3A);
+			emit_nn(e, src->value);
+			return 1;
+		}
+	}
+	if (is_register(src, Z80_REGISTER_A)) {
+		if (is_indirect_register(dst, Z80_REGISTER_BC))
+			return encode_implied(e, NULL, 0, 0x02);
+		if (is_indirect_register(dst, Z80_REGISTER_DE))
+			return encode_implied(e, NULL, 0, 0x12);
+		if (dst->type == Z80_OPERAND_TYPE_INDIRECT) {
+			emit(e, 0x32);
+			emit_nn(e, dst->value);
+			return 1;
+		}
+	}
+
+	/* 16 bit */
+	if (is_register(dst, Z80_REGISTER_SP) && get_hl(src, &prefix)) {
+		emit_prefix(e, prefix);
+		emit(e, 0xF9);
+		return 1;
+	}
+	if (get_rp(dst, Z80_REGISTER_SP, &code, &prefix)) {
+		if (src->type == Z80_OPERAND_TYPE_IMMEDIATE) {
+			emit_prefix(e, prefix);
+			emit(e, 0x01 | code << 4);
+			emit_nn(e, src->value);
+			return 1;
+		}
+		if (src->type == Z80_OPERAND_TYPE_INDIRECT) {
+			if (code == 2) {
+				emit_prefix(e, prefix);
+				emit(e, 0x2A);
+			} else {
+				emit(e, 0xED);
+				emit(e, 0x4B | code << 4);
+			}
+			emit_nn(e, src->value);
+			return 1;
+		}
+	}
+	if (dst->type == Z80_OPERAND_TYPE_INDIRECT && get_rp(src, Z80_REGISTER_SP, &code, &prefix)) {
+		if (code == 2) {
+			emit_prefix(e, prefix);
+			emit(e, 0x22);
+		} else {
+			emit(e, 0xED);
+			emit(e, 0x43 | code << 4);
+		}
+		emit_nn(e, dst->value);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* opcode is the operation: ADD, ADC, SUB, SBC, AND, XOR, OR, CP */
+static int encode_alu(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	const struct z80_operand *op;
+	struct r8 r;
+	unsigned int code;
+	uint8_t prefix, prefix2;
+
+	if (num_ops == 2 && get_hl(&ops[0], &prefix) && get_rp(&ops[1], Z80_REGISTER_SP, &code, &prefix2)) {
+		/* ADD IX,IX is fine, ADD IX,HL and ADD IX,IY are not */
+		if (code == 2 && prefix != prefix2)
+			return 0;
+		if (opcode == 0) {
+			emit_prefix(e, prefix);
+			emit(e, 0x09 | code << 4);
+			return 1;
+		}
+		if ((opcode == 1 || opcode == 3) && !prefix) {
+			emit(e, 0xED);
+			emit(e, (opcode == 1 ? 0x4A : 0x42) | code << 4);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (num_ops == 2 && is_register(&ops[0], Z80_REGISTER_A))
+		op = &ops[1];
+	else if (num_ops == 1)
+		op = &ops[0];
+	else
+		return 0;
+
+	if (get_r8(op, &r)) {
+		emit_r8_op(e, &r, 0x80 | opcode << 3 | r.code);
+		return 1;
+	}
+	if (op->type == Z80_OPERAND_TYPE_IMMEDIATE) {
+		emit(e, 0xC6 | opcode << 3);
+		emit_n(e, op->value);
+		return 1;
+	}
+	return 0;
+}
+
+/* opcode is 0 for INC and 1 for DEC */
+static int encode_inc_dec(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	struct r8 r;
+	unsigned int code;
+	uint8_t prefix;
+
+	if (num_ops != 1)
+		return 0;
+
+	if (get_r8(&ops[0], &r)) {
+		emit_r8_op(e, &r, (0x04 | opcode) | r.code << 3);
+		return 1;
+	}
+	if (get_rp(&ops[0], Z80_REGISTER_SP, &code, &prefix)) {
+		emit_prefix(e, prefix);
+		emit(e, (opcode ? 0x0B : 0x03) | code << 4);
+		return 1;
+	}
+	return 0;
+}
+
+/* CB prefixed operations on r, (HL) or (IX+d), the displacement comes before the opcode */
+static int emit_cb(struct encoder *e, const struct z80_operand *op, unsigned int opcode)
+{
+	struct r8 r;
+
+	if (!get_r8(op, &r) || (r.prefix && !r.has_displacement))
+		return 0;
+
+	emit_prefix(e, r.prefix);
+	emit(e, 0xCB);
+	if (r.has_displacement)
+		emit_d(e, r.displacement);
+	emit(e, opcode | r.code);
+	return 1;
+}
+
+/* opcode is the operation: RLC, RRC, RL, RR, SLA, SRA, SLL, SRL */
+static int encode_rotate(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	return num_ops == 1 && emit_cb(e, &ops[0], opcode << 3);
+}
+
+/* opcode is 0x40 for BIT, 0x80 for RES and 0xC0 for SET */
+static int encode_bit(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	expr_value bit;
+
+	if (num_ops != 2 || ops[0].type != Z80_OPERAND_TYPE_IMMEDIATE)
+		return 0;
+
+	bit = ops[0].value;
+	if (bit < 0 || bit > 7) {
+		range_error(e, bit);
+		bit = 0;
+	}
+	return emit_cb(e, &ops[1], opcode | bit << 3);
+}
+
+/* opcode is the unconditional form of JP (0xC3) or CALL (0xCD) */
+static int encode_jp_call(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	unsigned int code;
+	uint8_t prefix;
+
+	if (num_ops == 1 && ops[0].type == Z80_OPERAND_TYPE_IMMEDIATE) {
+		emit(e, opcode);
+		emit_nn(e, ops[0].value);
+		return 1;
+	}
+	if (num_ops == 1 && opcode == 0xC3 && ops[0].type == Z80_OPERAND_TYPE_INDIRECT_REGISTER) {
+		if (ops[0].reg == Z80_REGISTER_HL) {
+			emit(e, 0xE9);
+			return 1;
+		}
+		if (ops[0].reg == Z80_REGISTER_IX || ops[0].reg == Z80_REGISTER_IY) {
+			prefix = ops[0].reg == Z80_REGISTER_IX ? 0xDD : 0xFD;
+			emit(e, prefix);
+			emit(e, 0xE9);
+			return 1;
+		}
+	}
+	if (num_ops == 2 && get_cc(&ops[0], 7, &code) && ops[1].type == Z80_OPERAND_TYPE_IMMEDIATE) {
+		emit(e, (opcode == 0xC3 ? 0xC2 : 0xC4) | code << 3);
+		emit_nn(e, ops[1].value);
+		return 1;
+	}
+	return 0;
+}
+
+/* opcode is 0x18 for JR and 0x10 for DJNZ */
+static int encode_relative(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	unsigned int code;
+
+	if (num_ops == 1 && ops[0].type == Z80_OPERAND_TYPE_IMMEDIATE) {
+		emit(e, opcode);
+		emit_e(e, ops[0].value);
+		return 1;
+	}
+	if (num_ops == 2 && opcode == 0x18 && get_cc(&ops[0], 3, &code) && ops[1].type == Z80_OPERAND_TYPE_IMMEDIATE) {
+		emit(e, 0x20 | code << 3);
+		emit_e(e, ops[1].value);
+		return 1;
+	}
+	return 0;
+}
+
+static int encode_ret(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	unsigned int code;
+
+	if (num_ops == 0) {
+		emit(e, 0xC9);
+		return 1;
+	}
+	if (num_ops == 1 && get_cc(&ops[0], 7, &code)) {
+		emit(e, 0xC0 | code << 3);
+		return 1;
+	}
+	return 0;
+}
+
+static int encode_rst(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	expr_value target;
+
+	if (num_ops != 1 || ops[0].type != Z80_OPERAND_TYPE_IMMEDIATE)
+		return 0;
+
+	target = ops[0].value;
+	if (target < 0 || target > 0x38 || target % 8) {
+		range_error(e, target);
+		target = 0;
+	}
+	emit(e, 0xC7 | target);
+	return 1;
+}
+
+static int encode_im(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	static const uint8_t modes[] = {0x46, 0x56, 0x5E};
+	expr_value mode;
+
+	if (num_ops != 1 || ops[0].type != Z80_OPERAND_TYPE_IMMEDIATE)
+		return 0;
+
+	mode = ops[0].value;
+	if (mode < 0 || mode > 2) {
+		range_error(e, mode);
+		mode = 0;
+	}
+	emit(e, 0xED);
+	emit(e, modes[mode]);
+	return 1;
+}
+
+/* opcode is 0xC5 for PUSH and 0xC1 for POP */
+static int encode_push_pop(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	unsigned int code;
+	uint8_t prefix;
+
+	if (num_ops != 1 || !get_rp(&ops[0], Z80_REGISTER_AF, &code, &prefix))
+		return 0;
+
+	emit_prefix(e, prefix);
+	emit(e, opcode | code << 4);
+	return 1;
+}
+
+static int encode_ex(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	uint8_t prefix;
+
+	if (num_ops != 2)
+		return 0;
+
+	if (is_register(&ops[0], Z80_REGISTER_DE) && is_register(&ops[1], Z80_REGISTER_HL))
+		return encode_implied(e, NULL, 0, 0xEB);
+	if (is_register(&ops[0], Z80_REGISTER_AF) && is_register(&ops[1], Z80_REGISTER_AF_ALT))
+		return encode_implied(e, NULL, 0, 0x08);
+	if (is_indirect_register(&ops[0], Z80_REGISTER_SP) && get_hl(&ops[1], &prefix)) {
+		emit_prefix(e, prefix);
+		emit(e, 0xE3);
+		return 1;
+	}
+	return 0;
+}
+
+static int encode_in(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	struct r8 r;
+
+	if (num_ops != 2)
+		return 0;
+
+	if (is_register(&ops[0], Z80_REGISTER_A) && ops[1].type == Z80_OPERAND_TYPE_INDIRECT) {
+		emit(e, 0xDB);
+		emit_n(e, ops[1].value);
+		return 1;
+	}
+	if (get_r8(&ops[0], &r) && !r.prefix && r.code != 6 && is_indirect_register(&ops[1], Z80_REGISTER_C)) {
+		emit(e, 0xED);
+		emit(e, 0x40 | r.code << 3);
+		return 1;
+	}
+	return 0;
+}
+
+static int encode_out(struct encoder *e, const struct z80_operand *ops, size_t num_ops, unsigned int opcode)
+{
+	struct r8 r;
+
+	if (num_ops != 2)
+		return 0;
+
+	if (ops[0].type == Z80_OPERAND_TYPE_INDIRECT && is_register(&ops[1], Z80_REGISTER_A)) {
+		emit(e, 0xD3);
+		emit_n(e, ops[0].value);
+		return 1;
+	}
+	if (is_indirect_register(&ops[0], Z80_REGISTER_C) && get_r8(&ops[1], &r) && !r.prefix && r.code != 6) {
+		emit(e, 0xED);
+		emit(e, 0x41 | r.code << 3);
+		return 1;
+	}
+	return 0;
+}
+
+static const struct instruction INSTRUCTIONS[] = {
+	{"adc",		encode_alu,		1},
+	{"add",		encode_alu,		0},
+	{"and",		encode_alu,		4},
+	{"bit",		encode_bit,		0x40},
+	{"call",	encode_jp_call,		0xCD},
+	{"ccf",		encode_implied,		0x3F},
+	{"cp",		encode_alu,		7},
+	{"cpd",		encode_implied,		0xEDA9},
+	{"cpdr",	encode_implied,		0xEDB9},
+	{"cpi",		encode_implied,		0xEDA1},
+	{"cpir",	encode_implied,		0xEDB1},
+	{"cpl",		encode_implied,		0x2F},
+	{"daa",		encode_implied,		0x27},
+	{"dec",		encode_inc_dec,		1},
+	{"di",		encode_implied,		0xF3},
+	{"djnz",	encode_relative,	0x10},
+	{"ei",		encode_implied,		0xFB},
+	{"ex",		encode_ex,		0},
+	{"exx",		encode_implied,		0xD9},
+	{"halt",	encode_implied,		0x76},
+	{"im",		encode_im,		0},
+	{"in",		encode_in,		0},
+	{"inc",		encode_inc_dec,		0},
+	{"ind",		encode_implied,		0xEDAA},
+	{"indr",	encode_implied,		0xEDBA},
+	{"ini",		encode_implied,		0xEDA2},
+	{"inir",	encode_implied,		0xEDB2},
+	{"jp",		encode_jp_call,		0xC3},
+	{"jr",		encode_relative,	0x18},
+	{"ld",		encode_ld,		0},
+	{"ldd",		encode_implied,		0xEDA8},
+	{"lddr",	encode_implied,		0xEDB8},
+	{"ldi",		encode_implied,		0xEDA0},
+	{"ldir",	encode_implied,		0xEDB0},
+	{"neg",		encode_implied,		0xED44},
+	{"nop",		encode_implied,		0x00},
+	{"or",		encode_alu,		6},
+	{"otdr",	encode_implied,		0xEDBB},
+	{"otir",	encode_implied,		0xEDB3},
+	{"out",		encode_out,		0},
+	{"outd",	encode_implied,		0xEDAB},
+	{"outi",	encode_implied,		0xEDA3},
+	{"pop",		encode_push_pop,	0xC1},
+	{"push",	encode_push_pop,	0xC5},
+	{"res",		encode_bit,		0x80},
+	{"ret",		encode_ret,		0},
+	{"reti",	encode_implied,		0xED4D},
+	{"retn",	encode_implied,		0xED45},
+	{"rl",		encode_rotate,		2},
+	{"rla",		encode_implied,		0x17},
+	{"rlc",		encode_rotate,		0},
+	{"rlca",	encode_implied,		0x07},
+	{"rld",		encode_implied,		0xED6F},
+	{"rr",		encode_rotate,		3},
+	{"rra",		encode_implied,		0x1F},
+	{"rrc",		encode_rotate,		1},
+	{"rrca",	encode_implied,		0x0F},
+	{"rrd",		encode_implied,		0xED67},
+	{"rst",		encode_rst,		0},
+	{"sbc",		encode_alu,		3},
+	{"scf",		encode_implied,		0x37},
+	{"set",		encode_bit,		0xC0},
+	{"sla",		encode_rotate,		4},
+	{"sll",		encode_rotate,		6},
+	{"sra",		encode_rotate,		5},
+	{"srl",		encode_rotate,		7},
+	{"sub",		encode_alu,		2},
+	{"xor",		encode_alu,		5},
+};
+
+static const struct instruction *find_instruction(const char *name, size_t length)
+{
+	size_t low = 0, high = sizeof(INSTRUCTIONS) / sizeof(*INSTRUCTIONS), mid;
+	int c;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (!(c = compare_lower(name, length, INSTRUCTIONS[mid].mnemonic)))
+			return &INSTRUCTIONS[mid];
+		if (c < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	return NULL;
+}
+
+int z80_is_mnemonic(const char *name, size_t length)
+{
+	return !!find_instruction(name, length);
+}
+
+int z80_is_relative(const char *name, size_t length)
+{
+	const struct instruction *instruction = find_instruction(name, length);
+
+	return instruction && instruction->encode == encode_relative;
+}
+
+struct error *z80_encode(const char *mnemonic, size_t mnemonic_length, const struct z80_operand *operands, size_t num_operands, expr_value address, uint8_t *buf, size_t *length)
+{
+	const struct instruction *instruction = find_instruction(mnemonic, mnemonic_length);
+	struct encoder e;
+
+	*length = 0;
+	if (!instruction)
+		return error_create_span(ERROR_UNKNOWN_INSTRUCTION, mnemonic, mnemonic_length);
+
+	e.mnemonic = mnemonic;
+	e.mnemonic_length = mnemonic_length;
+	e.address = address;
+	e.buf = buf;
+	e.length = 0;
+	e.err = NULL;
+
+	if (!instruction->encode(&e, operands, num_operands, instruction->opcode)) {
+		error_free(e.err);
+		return error_create_span(ERROR_INVALID_OPERANDS, mnemonic, mnemonic_length);
+	}
+
+	*length = e.length;
+	return e.err;
+}
@@ -0,0 +1,74 @@
+/*
+ * test/alloc.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/alloc.h>
+
+#include <bergen/libc.h>
+
+START_TEST(test_alloc)
+{
+	struct alloc_stats before, after;
+	const struct alloc_tag_stats *tag;
+	char *buf, *str;
+
+	alloc_collect(&before);
+	buf = alloc_malloc(ALLOC_TAG_LABELS, 10);
+	bergen_memcpy(buf, "abcdefghij", 10);
+	buf = alloc_realloc(ALLOC_TAG_OTHER, buf, 100);
+	ck_assert_int_eq(bergen_memcmp(buf, "abcdefghij", 10), 0);
+	str = alloc_strndup_null(ALLOC_TAG_LABELS, buf, 3);
+	ck_assert_str_eq(str, "abc");
+	alloc_collect(&after);
+
+	if (ALLOC_ACCOUNTING) {
+		/* The realloc stays with the first tag */
+		tag = &after.tags[ALLOC_TAG_LABELS];
+		ck_assert_uint_eq(tag->allocs - before.tags[ALLOC_TAG_LABELS].allocs, 2);
+		ck_assert_uint_eq(tag->reallocs - before.tags[ALLOC_TAG_LABELS].reallocs, 1);
+		ck_assert_uint_eq(tag->bytes - before.tags[ALLOC_TAG_LABELS].bytes, 114);
+		ck_assert_uint_eq(tag->live - before.tags[ALLOC_TAG_LABELS].live, 104);
+		ck_assert_uint_ge(tag->peak_live, 104);
+		ck_assert_uint_eq(tag->sizes[0] - before.tags[ALLOC_TAG_LABELS].sizes[0], 2);
+		ck_assert_uint_eq(tag->sizes[3] - before.tags[ALLOC_TAG_LABELS].sizes[3], 1);
+	} else {
+		ck_assert_uint_eq(after.peak_live, 0);
+	}
+
+	alloc_free(str);
+	alloc_free(buf);
+	alloc_free(NULL);
+	alloc_collect(&after);
+	ck_assert_uint_eq(after.tags[ALLOC_TAG_LABELS].live, before.tags[ALLOC_TAG_LABELS].live);
+}
+END_TEST
+
+TCase *tcase_alloc(void)
+{
+	TCase *tcase = tcase_create("alloc");
+
+	tcase_add_test(tcase, test_alloc);
+
+	return tcase;
+}
@@ -0,0 +1,86 @@
+/*
+ * test/arena.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/arena.h>
+
+#include <bergen/libc.h>
+
+START_TEST(test_arena)
+{
+	struct arena arena;
+	char *a, *b, *big;
+
+	arena_init(&arena);
+
+	a = arena_alloc(&arena, 3);
+	b = arena_alloc(&arena, 5);
+	ck_assert_ptr_ne(a, b);
+	ck_assert_uint_eq((uintptr_t) b % sizeof(void *), 0);
+
+	/* Only the most recent allocation grows in place */
+	ck_assert_int_eq(arena_resize(&arena, a, 3, 100), 0);
+	ck_assert_int_eq(arena_resize(&arena, b, 5, 100), 1);
+	bergen_memset(b, 'b', 100);
+
+	/* Given back in reverse order, the space is reused */
+	arena_release(&arena, a, 3);
+	arena_release(&arena, b, 100);
+	ck_assert_ptr_eq(arena_alloc(&arena, 8), b);
+	arena_release(&arena, b, 8);
+	arena_release(&arena, a, 3);
+	ck_assert_ptr_eq(arena_alloc(&arena, 1), a);
+
+	/* Bigger than a chunk */
+	big = arena_alloc(&arena, 1024 * 1024 * 16);
+	bergen_memset(big, 0, 1024 * 1024 * 16);
+	ck_assert_ptr_ne(arena_alloc(&arena, 1), NULL);
+
+	arena_destroy(&arena);
+}
+END_TEST
+
+START_TEST(test_arena_session)
+{
+	struct arena arena;
+
+	arena_init(&arena);
+	ck_assert_ptr_eq(arena_current(), NULL);
+	arena_begin_session(&arena);
+	ck_assert_ptr_eq(arena_current(), &arena);
+	arena_end_session();
+	ck_assert_ptr_eq(arena_current(), NULL);
+	arena_destroy(&arena);
+}
+END_TEST
+
+TCase *tcase_arena(void)
+{
+	TCase *tcase = tcase_create("arena");
+
+	tcase_add_test(tcase, test_arena);
+	tcase_add_test(tcase, test_arena_session);
+
+	return tcase;
+}
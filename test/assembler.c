@@ -0,0 +1,428 @@
+/*
+ * test/assembler.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/assembler.h>
+
+#include <bergen/libc.h>
+
+static struct error *assemble(struct include_manager *im, struct assembler *as, const char *source)
+{
+	struct include_file *file;
+	char path[256];
+
+	test_write_file("main.z80", source);
+	test_path(path, sizeof(path), "main.z80");
+	ck_assert_ptr_eq(include_manager_load(im, path, &file), NULL);
+	return assembler_assemble(as, file);
+}
+
+static void assert_segment(const struct assembler *as, size_t i, expr_value address, const char *data, size_t length)
+{
+	const struct object_segment *segment;
+
+	ck_assert_uint_gt(as->output.num_segments, i);
+	segment = &as->output.segments[i];
+	ck_assert_int_eq(segment->address, address);
+	ck_assert_uint_eq(object_output_get_segment_length(&as->output, segment), length);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&as->output, segment), data, length), 0);
+}
+
+#define ASSERT_SEGMENT(as, i, address, data) assert_segment(as, i, address, data, sizeof(data) - 1)
+
+START_TEST(test_assemble)
+{
+	struct include_manager im;
+	struct assembler as;
+
+	test_dir_create();
+	test_write_file("defs.inc", "#define COUNT 3\nbuffer = $C000\n");
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(assemble(&im, &as,
+		"#include \"defs.inc\"\n"
+		"\t.org $9D93\n"
+		"\t.db $BB,$6D\n"
+		"start:\n"
+		"\tld hl,message\n"
+		"\tld b,COUNT\n"
+		"_loop:\tld a,(hl)\n"
+		"\tinc hl\n"
+		"\tdjnz _loop\n"
+		"\tjr nz,start\n"
+		"\tld (buffer),a\n"
+		"\tret\n"
+		"message\t.db \"Hi!\",0\n"
+		"_loop\t.dw start\n"
+		"\t.end\n"
+		"\tnop\n"), NULL);
+
+	ck_assert_uint_eq(as.output.num_segments, 1);
+	ASSERT_SEGMENT(&as, 0, 0x9D93,
+		"\xBB\x6D"
+		"\x21\xA4\x9D"
+		"\x06\x03"
+		"\x7E"
+		"\x23"
+		"\x10\xFC"
+		"\x20\xF5"
+		"\x32\x00\xC0"
+		"\xC9"
+		"Hi!\x00"
+		"\x95\x9D");
+
+	ck_assert_uint_eq(as.files.num_files, 2);
+	ck_assert_str_eq(bergen_strrchr(as.files.files[0]->path, '/'), "/main.z80");
+	ck_assert_str_eq(bergen_strrchr(as.files.files[1]->path, '/'), "/defs.inc");
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_remove_file("defs.inc");
+	test_dir_remove();
+}
+END_TEST
+
+START_TEST(test_directives)
+{
+	struct include_manager im;
+	struct assembler as;
+
+	test_dir_create();
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(assemble(&im, &as,
+		"size .equ end-begin\n"
+		"\t.org $8000\n"
+		"begin:\n"
+		"\t.byte size\n"
+		"\t.word $1234,end\n"
+		"\t.text \"ab\"\n"
+		"\t.fill 2,$FF\n"
+		"\t.block 3\n"
+		"value = $-$8000\n"
+		"\t.db value\n"
+		"end:\n"
+		"\t.org $9000\n"
+		"\t.fill 2\n"), NULL);
+
+	ck_assert_uint_eq(as.output.num_segments, 3);
+	ASSERT_SEGMENT(&as, 0, 0x8000, "\x0D\x34\x12\x0D\x80" "ab" "\xFF\xFF");
+	ASSERT_SEGMENT(&as, 1, 0x800C, "\x0C");
+	ASSERT_SEGMENT(&as, 2, 0x9000, "\xFF\xFF");
+	/* size refers forward, so only a second pass knows it */
+	ck_assert_int_eq(as.needs_second_pass, 1);
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+START_TEST(test_fixups)
+{
+	struct include_manager im;
+	struct assembler as;
+
+	test_dir_create();
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(assemble(&im, &as,
+		"\t.org $4000\n"
+		"start:\n"
+		"\tjr nz,_skip\n"
+		"\tcall routine+1\n"
+		"\tld (ix+offset),a\n"
+		"\t.dw table,$\n"
+		"\t.fill 2,offset*2\n"
+		"_skip:\tnop\n"
+		"routine:\n"
+		"\tjr _skip\n"
+		"_skip:\tret\n"
+		"table\t.db routine-start\n"
+		"offset = 5\n"), NULL);
+
+	ck_assert_uint_eq(as.output.num_segments, 1);
+	ASSERT_SEGMENT(&as, 0, 0x4000,
+		"\x20\x0C"
+		"\xCD\x10\x40"
+		"\xDD\x77\x05"
+		"\x12\x40\x0A\x40"
+		"\x0A\x0A"
+		"\x00"
+		"\x18\x00"
+		"\xC9"
+		"\x0F");
+	ck_assert_int_eq(as.needs_second_pass, 0);
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+START_TEST(test_records)
+{
+	struct include_manager im;
+	struct assembler as;
+
+	test_dir_create();
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(assemble(&im, &as,
+		"pad .equ size-2\n"
+		"\t.org $100\n"
+		"\t.block pad\n"
+		"start:\tjr nz,end\n"
+		"\tld (ix+half),a\n"
+		"\tld hl,table\n"
+		"\t.dw $\n"
+		"end:\tret\n"
+		"table\t.db end-start\n"
+		"size = 4\n"
+		"half = pad/2\n"), NULL);
+
+	/* Everything after pad moves once it is known, forward references too */
+	ck_assert_uint_eq(as.output.num_segments, 1);
+	ASSERT_SEGMENT(&as, 0, 0x102,
+		"\x20\x08"
+		"\xDD\x77\x01"
+		"\x21\x0D\x01"
+		"\x0A\x01"
+		"\xC9"
+		"\x0A");
+	ck_assert_int_eq(as.needs_second_pass, 1);
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+/* Enough lines for several chunks of fixups before the .equ, and of records after it */
+static char *make_long_source(size_t *error_offsets)
+{
+	char *source = bergen_malloc(256 * 1024), *end = source;
+	size_t i;
+
+	end += bergen_snprintf(end, 64, "\t.org $100\n");
+	for (i = 0; i < 5000; i++) {
+		if (error_offsets && i == 4500) {
+			error_offsets[0] = end - source;
+			end += bergen_snprintf(end, 64, "\t.db later\n");
+		}
+		end += bergen_snprintf(end, 64, "\tcall later\n");
+	}
+	end += bergen_snprintf(end, 64, "size .equ later-$100\n");
+	for (i = 0; i < 5000; i++) {
+		if (error_offsets && i == 4500) {
+			error_offsets[1] = end - source;
+			end += bergen_snprintf(end, 64, "\t.db size\n");
+		}
+		end += bergen_snprintf(end, 64, "\tld hl,size\n\t.db size >> 8\n");
+	}
+	bergen_snprintf(end, 64, "later:\tret\n");
+	return source;
+}
+
+START_TEST(test_threads)
+{
+	struct include_manager im;
+	struct assembler as, threaded;
+	struct error *err;
+	size_t error_offsets[2];
+	char *source;
+	const uint8_t *data;
+
+	test_dir_create();
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	assembler_init(&threaded, &im);
+	threaded.num_threads = 4;
+	source = make_long_source(NULL);
+	ck_assert_ptr_eq(assemble(&im, &as, source), NULL);
+	ck_assert_ptr_eq(assemble(&im, &threaded, source), NULL);
+	bergen_free(source);
+
+	/* later is at $89B8 */
+	ck_assert_uint_eq(as.output.num_segments, 1);
+	ck_assert_uint_eq(object_output_get_segment_length(&as.output, &as.output.segments[0]), 35001);
+	data = object_output_get_segment_ptr(&as.output, &as.output.segments[0]);
+	ck_assert_int_eq(bergen_memcmp(data, "\xCD\xB8\x89", 3), 0);
+	ck_assert_int_eq(bergen_memcmp(data + 34996, "\x21\xB8\x88\x88\xC9", 5), 0);
+
+	ck_assert_uint_eq(threaded.output.num_segments, 1);
+	ck_assert_uint_eq(object_output_get_segment_length(&threaded.output, &threaded.output.segments[0]), 35001);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&threaded.output, &threaded.output.segments[0]), data, 35001), 0);
+
+	/* Either error could be found first, but the first in the source is reported */
+	source = make_long_source(error_offsets);
+	err = assemble(&im, &threaded, source);
+	bergen_free(source);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_VALUE_OUT_OF_RANGE);
+	ck_assert_uint_ge(err->location.offset, error_offsets[0]);
+	ck_assert_uint_lt(err->location.offset, error_offsets[1]);
+	error_free(err);
+
+	assembler_destroy(&threaded);
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+/* The last token ends the mapping, so nothing may look past it for a terminator */
+START_TEST(test_page_sized_input)
+{
+	static const char last_line[] = "\n\tld a, 5";
+	struct include_manager im;
+	struct assembler as;
+	char source[4097];
+	size_t length = sizeof(source) - sizeof(last_line);
+
+	test_dir_create();
+	source[0] = ';';
+	bergen_memset(source + 1, 'x', length - 1);
+	bergen_strcpy(source + length, last_line);
+	ck_assert_uint_eq(bergen_strlen(source), 4096);
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(assemble(&im, &as, source), NULL);
+	ASSERT_SEGMENT(&as, 0, 0, "\x3E\x05");
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+static struct error *assemble_error(const char *source)
+{
+	struct include_manager im;
+	struct assembler as;
+	struct error *err;
+
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	err = assemble(&im, &as, source);
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+	test_remove_file("main.z80");
+	return err;
+}
+
+START_TEST(test_assemble_errors)
+{
+	struct error *err;
+
+	test_dir_create();
+
+	err = assemble_error("\tnop\n\tfoo a\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_UNKNOWN_INSTRUCTION);
+	ck_assert_uint_eq(err->location.offset, 6);
+	error_free(err);
+
+	err = assemble_error("\tld a,hl\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_INVALID_OPERANDS);
+	error_free(err);
+
+	err = assemble_error("label:\n\tnop\nlabel:\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_DUPLICATE_LABEL);
+	ck_assert_uint_eq(err->location.offset, 12);
+	error_free(err);
+
+	err = assemble_error("\tld a,missing\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_LABEL_NOT_FOUND);
+	ck_assert_uint_eq(err->location.offset, 6);
+	error_free(err);
+
+	err = assemble_error("\tnop\n\tjr far\n\t.block 200\nfar:\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_VALUE_OUT_OF_RANGE);
+	ck_assert_uint_eq(err->location.offset, 5);
+	error_free(err);
+
+	err = assemble_error("\t.db big\nbig = 256\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_VALUE_OUT_OF_RANGE);
+	error_free(err);
+
+	/* Only the final values of labels referred forward can divide by zero */
+	err = assemble_error("\t.db 10/(later-here)\nhere:\nlater:\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_DIVISION_BY_ZERO);
+	ck_assert_uint_eq(err->location.offset, 5);
+	error_free(err);
+	ck_assert_ptr_eq(assemble_error("\t.db 10/(later-here)\nhere:\tnop\nlater:\n"), NULL);
+
+	err = assemble_error("#if 1/0\n#endif\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_DIVISION_BY_ZERO);
+	error_free(err);
+
+	err = assemble_error("\t.text 5\n");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_EXPECTED_STRING);
+	error_free(err);
+
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_assembler(void)
+{
+	TCase *tcase = tcase_create("assembler");
+
+	tcase_add_test(tcase, test_assemble);
+	tcase_add_test(tcase, test_directives);
+	tcase_add_test(tcase, test_fixups);
+	tcase_add_test(tcase, test_records);
+	tcase_add_test(tcase, test_threads);
+	tcase_add_test(tcase, test_page_sized_input);
+	tcase_add_test(tcase, test_assemble_errors);
+
+	return tcase;
+}
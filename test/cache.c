@@ -0,0 +1,262 @@
+/*
+ * test/cache.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/cache.h>
+
+#include <bergen/libc.h>
+
+static uint64_t get_key(struct include_manager *im, const char *name, struct include_file_list *files, struct object_cache_key *key)
+{
+	struct include_file *file;
+	char path[256];
+
+	test_path(path, sizeof(path), name);
+	ck_assert_ptr_eq(include_manager_load(im, path, &file), NULL);
+	ck_assert_ptr_eq(object_cache_make_key(im, file, files, key), NULL);
+	return key->hash;
+}
+
+static int same_key(const struct object_cache_key *a, const struct object_cache_key *b)
+{
+	return a->hash == b->hash && a->length == b->length && !bergen_memcmp(a->data, b->data, a->length);
+}
+
+/* Not what object_cache_make_key() would make, but the cache can't tell */
+static void fake_key(struct object_cache_key *key, uint64_t hash, const char *data)
+{
+	key->hash = hash;
+	key->data = (char *) data;
+	key->length = bergen_strlen(data);
+	key->capacity = 0;
+}
+
+START_TEST(test_object_cache_key)
+{
+	struct include_manager im;
+	struct include_file_list files;
+	struct object_cache_key a, b;
+
+	test_dir_create();
+	test_make_dir("a");
+	test_make_dir("b");
+	test_write_file("a/main.z80", "#include \"lib.inc\"\nstart:\n\tld a, VALUE\n");
+	test_write_file("b/main.z80", "#include \"lib.inc\"\nstart:\n\tld a, VALUE\n");
+	test_write_file("a/lib.inc", "#define VALUE 42\n");
+	test_write_file("b/lib.inc", "#define VALUE 42\n");
+
+	include_manager_init(&im);
+	include_file_list_init(&files);
+	object_cache_key_init(&a);
+	object_cache_key_init(&b);
+
+	/* The same program in two places */
+	get_key(&im, "a/main.z80", &files, &a);
+	ck_assert_uint_eq(files.num_files, 2);
+	get_key(&im, "b/main.z80", NULL, &b);
+	ck_assert(same_key(&a, &b));
+
+	/* Same size and maybe the same mtime, so load it again from scratch */
+	test_write_file("b/lib.inc", "#define VALUE 43\n");
+	include_manager_destroy(&im);
+	include_manager_init(&im);
+	ck_assert_uint_ne(get_key(&im, "b/main.z80", NULL, &b), a.hash);
+	ck_assert(!same_key(&a, &b));
+	get_key(&im, "a/main.z80", NULL, &b);
+	ck_assert(same_key(&a, &b));
+
+	object_cache_key_destroy(&b);
+	object_cache_key_destroy(&a);
+	include_file_list_destroy(&files);
+	include_manager_destroy(&im);
+
+	test_remove_file("a/main.z80");
+	test_remove_file("a/lib.inc");
+	test_remove_file("b/main.z80");
+	test_remove_file("b/lib.inc");
+	test_remove_dir("a");
+	test_remove_dir("b");
+	test_dir_remove();
+}
+END_TEST
+
+START_TEST(test_object_cache_store)
+{
+	struct object_cache cache;
+	struct object_output output, loaded;
+	struct label_list labels, loaded_labels;
+	struct object_cache_key key;
+	const struct label *label;
+	char path[256];
+
+	test_dir_create();
+	test_path(path, sizeof(path), "cache");
+	object_cache_init(&cache, path);
+	object_output_init(&output);
+	object_output_init(&loaded);
+	label_list_init(&labels);
+	label_list_init(&loaded_labels);
+	fake_key(&key, 0x0123456789ABCDEFull, "program");
+
+	ck_assert_int_eq(object_cache_load(&cache, &key, &loaded, &loaded_labels), 0);
+
+	object_output_set_address(&output, 0x9D93);
+	object_output_write(&output, "\xBB\x6D", 2);
+	object_output_set_address(&output, 0xA000);
+	object_output_write(&output, "\xC9", 1);
+	label_list_append_easy(&labels, "start", 0x9D95);
+	label_list_append_type(&labels, "VALUE", 5, 42, LABEL_TYPE_CONSTANT);
+	ck_assert_ptr_eq(object_cache_store(&cache, &key, &output, &labels), NULL);
+
+	/* A different key misses, even when the hashes collide */
+	fake_key(&key, 0x0123456789ABCDEEull, "program");
+	ck_assert_int_eq(object_cache_load(&cache, &key, &loaded, &loaded_labels), 0);
+	fake_key(&key, 0x0123456789ABCDEFull, "programs");
+	ck_assert_int_eq(object_cache_load(&cache, &key, &loaded, &loaded_labels), 0);
+	fake_key(&key, 0x0123456789ABCDEFull, "Program");
+	ck_assert_int_eq(object_cache_load(&cache, &key, &loaded, &loaded_labels), 0);
+	ck_assert_uint_eq(loaded.num_segments, 1);
+	ck_assert_uint_eq(object_output_get_segment_length(&loaded, &loaded.segments[0]), 0);
+	ck_assert_uint_eq(loaded_labels.num_labels, 0);
+
+	fake_key(&key, 0x0123456789ABCDEFull, "program");
+	ck_assert_int_eq(object_cache_load(&cache, &key, &loaded, &loaded_labels), 1);
+	ck_assert_uint_eq(loaded.num_segments, 2);
+	ck_assert_int_eq(loaded.segments[0].address, 0x9D93);
+	ck_assert_uint_eq(object_output_get_segment_length(&loaded, &loaded.segments[0]), 2);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&loaded, &loaded.segments[0]), "\xBB\x6D", 2), 0);
+	ck_assert_int_eq(loaded.segments[1].address, 0xA000);
+	ck_assert_uint_eq(object_output_get_segment_length(&loaded, &loaded.segments[1]), 1);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&loaded, &loaded.segments[1]), "\xC9", 1), 0);
+
+	/* Constants come back from the #defines, not the cache */
+	ck_assert_uint_eq(loaded_labels.num_labels, 1);
+	label = label_list_find_label(&loaded_labels, "start", 5);
+	ck_assert_ptr_ne(label, NULL);
+	ck_assert_int_eq(label->value, 0x9D95);
+
+	label_list_destroy(&loaded_labels);
+	label_list_destroy(&labels);
+	object_output_destroy(&loaded);
+	object_output_destroy(&output);
+	object_cache_destroy(&cache);
+
+	test_path(path, sizeof(path), "cache/01/23456789abcdef");
+	ck_assert_int_eq(bergen_unlink(path), 0);
+	test_path(path, sizeof(path), "cache/01");
+	bergen_rmdir(path);
+	test_path(path, sizeof(path), "cache");
+	bergen_rmdir(path);
+	test_dir_remove();
+}
+END_TEST
+
+/* Magic, the key "k", and then whatever the test wants */
+#define ENTRY_HEAD "bergen-cache 2\n" "\0\0\0\0\0\0\0\1" "k"
+
+static int load_entry(const char *contents, size_t length)
+{
+	struct object_cache cache;
+	struct object_output loaded;
+	struct label_list loaded_labels;
+	struct object_cache_key key;
+	char path[256];
+	FILE *file;
+	int ok;
+
+	test_path(path, sizeof(path), "cache/00/00000000000001");
+	file = bergen_fopen(path, "wb");
+	ck_assert_ptr_ne(file, NULL);
+	bergen_fwrite(contents, 1, length, file);
+	bergen_fclose(file);
+
+	test_path(path, sizeof(path), "cache");
+	object_cache_init(&cache, path);
+	object_output_init(&loaded);
+	label_list_init(&loaded_labels);
+	fake_key(&key, 1, "k");
+
+	ok = object_cache_load(&cache, &key, &loaded, &loaded_labels);
+	/* A miss leaves everything as it was */
+	if (!ok) {
+		ck_assert_uint_eq(loaded.num_segments, 1);
+		ck_assert_uint_eq(object_output_get_segment_length(&loaded, &loaded.segments[0]), 0);
+		ck_assert_uint_eq(loaded_labels.num_labels, 0);
+	}
+
+	label_list_destroy(&loaded_labels);
+	object_output_destroy(&loaded);
+	object_cache_destroy(&cache);
+	return ok;
+}
+
+#define LOAD_ENTRY(str) load_entry(str, sizeof(str) - 1)
+
+START_TEST(test_object_cache_corrupt)
+{
+	test_dir_create();
+	test_make_dir("cache");
+	test_make_dir("cache/00");
+
+	/* One segment of 2 bytes at 0x4000, one label "a" = 5 */
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD
+		"\0\0\0\0\0\0\0\1" "\0\0\0\0\0\0\x40\0" "\0\0\0\0\0\0\0\2" "\xC9\xC9"
+		"\0\0\0\0\0\0\0\1" "\0\0\0\0\0\0\0\1" "a" "\0\0\0\0\0\0\0\5"), 1);
+
+	/* Lengths far beyond the end of the entry */
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD
+		"\0\0\0\0\0\0\0\1" "\0\0\0\0\0\0\x40\0" "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF" "\xC9\xC9"
+		"\0\0\0\0\0\0\0\0"), 0);
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD
+		"\0\0\0\0\0\0\0\0"
+		"\0\0\0\0\0\0\0\1" "\0\0\x10\0\0\0\0\0" "a" "\0\0\0\0\0\0\0\5"), 0);
+	ck_assert_int_eq(LOAD_ENTRY("bergen-cache 2\n" "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF" "k"), 0);
+
+	/* Counts with nothing behind them */
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"), 0);
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD "\0\0\0\0\0\0\0\0" "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"), 0);
+
+	/* Cut short, or with more after the end */
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD "\0\0\0\0\0\0\0\0" "\0\0\0\0"), 0);
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0"), 1);
+	ck_assert_int_eq(LOAD_ENTRY(ENTRY_HEAD "\0\0\0\0\0\0\0\0" "\0\0\0\0\0\0\0\0" "x"), 0);
+	ck_assert_int_eq(LOAD_ENTRY("bergen-cache 1\n"), 0);
+
+	test_remove_file("cache/00/00000000000001");
+	test_remove_dir("cache/00");
+	test_remove_dir("cache");
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_cache(void)
+{
+	TCase *tcase = tcase_create("cache");
+
+	tcase_add_test(tcase, test_object_cache_key);
+	tcase_add_test(tcase, test_object_cache_store);
+	tcase_add_test(tcase, test_object_cache_corrupt);
+
+	return tcase;
+}
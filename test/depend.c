@@ -0,0 +1,190 @@
+/*
+ * test/depend.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/depend.h>
+
+#include <bergen/libc.h>
+
+/* Make treats all of these specially, and ':' is legal in a file name */
+#define ODD_NAME "my inc#$:.inc"
+
+/* Only the path and the contents of a file matter here */
+static void fake_file(struct include_file *file, char *path, const char *name, const char *contents)
+{
+	test_path(path, 256, name);
+	file->path = path;
+	file->data = contents;
+	file->length = bergen_strlen(contents);
+}
+
+static char *read_string(void (*func)(FILE *, const char *), const char *arg)
+{
+	char *str = NULL;
+	size_t length;
+	FILE *file = bergen_open_memstream(&str, &length);
+
+	ck_assert_ptr_ne(file, NULL);
+	func(file, arg);
+	bergen_fclose(file);
+	return str;
+}
+
+START_TEST(test_depend_escaped)
+{
+	char *str;
+
+	str = read_string(depend_write_escaped, "dir/plain.inc");
+	ck_assert_str_eq(str, "dir/plain.inc");
+	bergen_free_libc(str);
+
+	str = read_string(depend_write_escaped, "my dir/" ODD_NAME);
+	ck_assert_str_eq(str, "my\\ dir/my\\ inc\\#$$\\:.inc");
+	bergen_free_libc(str);
+}
+END_TEST
+
+START_TEST(test_depend_makefile)
+{
+	struct include_file files[2];
+	struct include_file_list list;
+	char paths[2][256], path[256], buf[1024];
+	size_t length;
+	FILE *file;
+
+	test_dir_create();
+	fake_file(&files[0], paths[0], "main.z80", "");
+	fake_file(&files[1], paths[1], ODD_NAME, "");
+	include_file_list_init(&list);
+	include_file_list_add(&list, &files[0]);
+	include_file_list_add(&list, &files[1]);
+
+	/* The input is named as it was given, the rest by their full paths */
+	test_path(path, sizeof(path), "main.d");
+	ck_assert_ptr_eq(depend_write_makefile(&list, "main.z80", path, "main.bin", 1), NULL);
+	file = bergen_fopen(path, "r");
+	ck_assert_ptr_ne(file, NULL);
+	length = bergen_fread(buf, 1, sizeof(buf) - 1, file);
+	buf[length] = '\0';
+	bergen_fclose(file);
+
+	bergen_snprintf(path, sizeof(path), "main.bin: main.z80 \\\n  %s/my\\ inc\\#$$\\:.inc\n\n%s/my\\ inc\\#$$\\:.inc:\n", test_dir, test_dir);
+	ck_assert_str_eq(buf, path);
+
+	include_file_list_destroy(&list);
+	test_remove_file("main.d");
+	test_dir_remove();
+}
+END_TEST
+
+START_TEST(test_depend_options_hash)
+{
+	const char *paths[] = {"inc", "lib"}, *swapped[] = {"lib", "inc"};
+	uint64_t hash = depend_options_hash("a.z80", "a.bin", 0, paths, 2);
+
+	ck_assert_uint_eq(depend_options_hash("a.z80", "a.bin", 0, paths, 2), hash);
+	ck_assert_uint_ne(depend_options_hash("b.z80", "a.bin", 0, paths, 2), hash);
+	ck_assert_uint_ne(depend_options_hash("a.z80", "a.hex", 0, paths, 2), hash);
+	ck_assert_uint_ne(depend_options_hash("a.z80", "a.bin", 1, paths, 2), hash);
+	ck_assert_uint_ne(depend_options_hash("a.z80", "a.bin", 0, paths, 1), hash);
+	ck_assert_uint_ne(depend_options_hash("a.z80", "a.bin", 0, swapped, 2), hash);
+}
+END_TEST
+
+static int stamp_is_current(uint64_t options_hash)
+{
+	char stamp[256], output[256];
+
+	test_path(stamp, sizeof(stamp), "main.bin.stamp");
+	test_path(output, sizeof(output), "main.bin");
+	return depend_stamp_is_current(stamp, output, options_hash);
+}
+
+START_TEST(test_depend_stamp)
+{
+	static const char main_contents[] = "#include \"" ODD_NAME "\"\n", inc_contents[] = "value .equ 1\n";
+	struct include_file files[2];
+	struct include_file_list list;
+	char paths[2][256], path[256];
+
+	test_dir_create();
+	test_write_file("main.z80", main_contents);
+	test_write_file(ODD_NAME, inc_contents);
+	fake_file(&files[0], paths[0], "main.z80", main_contents);
+	fake_file(&files[1], paths[1], ODD_NAME, inc_contents);
+	include_file_list_init(&list);
+	include_file_list_add(&list, &files[0]);
+	include_file_list_add(&list, &files[1]);
+
+	/* Without the output, nothing is current */
+	test_path(path, sizeof(path), "main.bin.stamp");
+	ck_assert_ptr_eq(depend_write_stamp(&list, path, 42), NULL);
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file("main.bin", "output");
+	ck_assert_int_eq(stamp_is_current(42), 1);
+	ck_assert_int_eq(stamp_is_current(43), 0);
+
+	/* Contents count, not times */
+	test_write_file(ODD_NAME, inc_contents);
+	ck_assert_int_eq(stamp_is_current(42), 1);
+	test_write_file(ODD_NAME, "value .equ 2\n");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file(ODD_NAME, inc_contents);
+	ck_assert_int_eq(stamp_is_current(42), 1);
+	test_remove_file(ODD_NAME);
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file(ODD_NAME, inc_contents);
+
+	/* A stamp that isn't quite right is never current */
+	test_write_file("main.bin.stamp", "");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file("main.bin.stamp", "bergen-stamp 0\n000000000000002a\n");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file("main.bin.stamp", "bergen-stamp 1\n2a garbage\n");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file("main.bin.stamp", "bergen-stamp 1\n000000000000002a\nnot a hash\n");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+	test_write_file("main.bin.stamp", "bergen-stamp 1\n000000000000002a\n0123456789abcdef");
+	ck_assert_int_eq(stamp_is_current(42), 0);
+
+	include_file_list_destroy(&list);
+	test_remove_file("main.bin.stamp");
+	test_remove_file("main.bin");
+	test_remove_file(ODD_NAME);
+	test_remove_file("main.z80");
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_depend(void)
+{
+	TCase *tcase = tcase_create("depend");
+
+	tcase_add_test(tcase, test_depend_escaped);
+	tcase_add_test(tcase, test_depend_makefile);
+	tcase_add_test(tcase, test_depend_options_hash);
+	tcase_add_test(tcase, test_depend_stamp);
+
+	return tcase;
+}
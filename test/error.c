@@ -0,0 +1,95 @@
+/*
+ * test/error.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/error.h>
+
+#include <bergen/libc.h>
+
+START_TEST(test_error_lazy_message)
+{
+	static const char str[] = "123a5 + 1";
+	struct error *err;
+
+	err = error_create_span(ERROR_INVALID_DECIMAL_CONSTANT, str, 5);
+	ck_assert_int_eq(error_get_code(err), ERROR_INVALID_DECIMAL_CONSTANT);
+	ck_assert_ptr_eq(err->message, NULL);
+	ck_assert_str_eq(error_get_message(err), "Invalid decimal constant: \"123a5\"");
+	ck_assert_ptr_ne(err->message, NULL);
+	error_free(err);
+
+	err = error_create_value(ERROR_EXPECTED_SINGLE_QUOTE, 'd');
+	ck_assert_str_eq(error_get_message(err), "Expected single quote but got 'd'");
+	error_free(err);
+
+	err = error_create_value(ERROR_EXPECTED_RPARENS, 2);
+	ck_assert_str_eq(error_get_message(err), "Expected 2 ')'s at end of expression");
+	error_free(err);
+
+	err = error_create(ERROR_EXPECTED_EXPRESSION);
+	ck_assert_str_eq(error_get_message(err), "Expected expression but reached end of string");
+	error_free(err);
+}
+END_TEST
+
+START_TEST(test_error_format_truncated)
+{
+	char buf[8];
+	struct error *err = error_create_span(ERROR_LABEL_NOT_FOUND, "label", 5);
+
+	ck_assert_int_eq(error_format_message(err, buf, sizeof(buf)), 27);
+	ck_assert_str_eq(buf, "Could n");
+
+	error_free(err);
+}
+END_TEST
+
+START_TEST(test_error_reuse)
+{
+	struct error *err, *reused;
+
+	err = error_create_span(ERROR_LABEL_NOT_FOUND, "label", 5);
+	ck_assert_str_eq(error_get_message(err), "Could not find label: label");
+	error_free(err);
+
+	/* Freed errors are recycled, but come back as good as new */
+	reused = error_create_value(ERROR_VALUE_OUT_OF_RANGE, 300);
+	ck_assert_ptr_eq(reused, err);
+	ck_assert_ptr_eq(reused->message, NULL);
+	ck_assert_ptr_eq(reused->str, NULL);
+	ck_assert_str_eq(error_get_message(reused), "Value out of range: 300");
+	error_free(reused);
+}
+END_TEST
+
+TCase *tcase_error(void)
+{
+	TCase *tcase = tcase_create("error");
+
+	tcase_add_test(tcase, test_error_lazy_message);
+	tcase_add_test(tcase, test_error_format_truncated);
+	tcase_add_test(tcase, test_error_reuse);
+
+	return tcase;
+}
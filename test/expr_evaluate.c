@@ -30,6 +30,7 @@
 static void assert_expr_full(const char *str, int expect_error, expr_value expected_result, expr_value location_counter, ...)
 {
 	struct expr_data expr;
+	struct label_list labels, local_labels;
 	expr_value result = ~expected_result; /* Make sure they start off different */
 	struct error *err;
 	const char *label_name;
@@ -38,6 +39,10 @@ static void assert_expr_full(const char *str, int expect_error, expr_value expec
 
 	expr_data_init_easy(&expr, str, '_');
 	expr.location_counter = location_counter;
+	label_list_init(&labels);
+	label_list_init(&local_labels);
+	expr.labels = &labels;
+	expr.local_labels = &local_labels;
 
 	va_start(args, location_counter);
 
@@ -47,7 +52,7 @@ static void assert_expr_full(const char *str, int expect_error, expr_value expec
 		if (!label_name)
 			break;
 		label_value = va_arg(args, expr_value);
-		label_list_append_easy(&expr.labels, label_name, label_value);
+		label_list_append_easy(&labels, label_name, label_value);
 	}
 
 	/* Push local labels */
@@ -56,7 +61,7 @@ static void assert_expr_full(const char *str, int expect_error, expr_value expec
 		if (!label_name)
 			break;
 		label_value = va_arg(args, expr_value);
-		label_list_append_easy(&expr.local_labels, label_name, label_value);
+		label_list_append_easy(&local_labels, label_name, label_value);
 	}
 
 	va_end(args);
@@ -70,6 +75,8 @@ static void assert_expr_full(const char *str, int expect_error, expr_value expec
 	}
 
 	expr_data_destroy(&expr);
+	label_list_destroy(&local_labels);
+	label_list_destroy(&labels);
 }
 
 static inline void assert_expr_eq(const char *str, expr_value expected_result)
@@ -110,7 +117,31 @@ START_TEST(test_decimal_constant)
 	assert_expr_eq("12345D", 12345);
 	assert_expr_eq("12345d", 12345);
 	assert_expr_eq("67890", 67890);
+	assert_expr_eq("9223372036854775807", INT64_MAX);
 	assert_expr_invalid("123a5");
+	assert_expr_invalid("9223372036854775808");
+}
+END_TEST
+
+static void assert_expr_prefix(const char *str, size_t length, expr_value expected_result)
+{
+	struct expr_data expr;
+	expr_value result;
+
+	expr_data_init(&expr, str, length, '_');
+	ck_assert_ptr_eq(expr_evaluate(&expr, &result), NULL);
+	ck_assert_int_eq(result, expected_result);
+	expr_data_destroy(&expr);
+}
+
+/* Expressions point into source lines, so nothing past length may be read */
+START_TEST(test_unterminated_constant)
+{
+	assert_expr_prefix("50", 1, 5);
+	assert_expr_prefix("$1234", 3, 0x12);
+	assert_expr_prefix("%101", 3, 2);
+	assert_expr_prefix("@777", 2, 7);
+	assert_expr_prefix("12hx", 3, 0x12);
 }
 END_TEST
 
@@ -156,12 +187,16 @@ END_TEST
 START_TEST(test_operator_div)
 {
 	assert_expr_eq("6 / 3", 2);
+	assert_expr_invalid("6 / 0");
+	assert_expr_invalid("6 / (2 - 2)");
+	assert_expr_invalid("-9223372036854775807 - 1 / -1");
 }
 END_TEST
 
 START_TEST(test_operator_modulo)
 {
 	assert_expr_eq("5 % 3", 2);
+	assert_expr_invalid("7 % 0");
 }
 END_TEST
 
@@ -307,6 +342,88 @@ START_TEST(test_spaces)
 }
 END_TEST
 
+START_TEST(test_tokens)
+{
+	static const char line[] = "ld a,(.loop - 2) ; comment";
+	struct expr_data expr;
+	struct label_list local_labels;
+	struct lex_token_list tokens;
+	struct error *err;
+	expr_value result;
+
+	label_list_init(&local_labels);
+	label_list_append_easy(&local_labels, "loop", 12);
+	lex_token_list_init(&tokens);
+	lex_line(line, sizeof(line) - 1, &tokens);
+
+	/* Skip "ld a," */
+	ck_assert(lex_token_is(&tokens.tokens[4], LEX_TOKEN_TYPE_OPERATOR, '('));
+	expr_data_init(&expr, line, sizeof(line) - 1, '.');
+	expr.local_labels = &local_labels;
+	ck_assert_ptr_eq(expr_evaluate_tokens(&expr, tokens.tokens + 4, tokens.num_tokens - 4, &result), NULL);
+	ck_assert_int_eq(result, 10);
+
+	/* Errors are located within the line */
+	expr.local_labels = NULL;
+	expr.location.file = 0;
+	expr.location.offset = 100;
+	err = expr_evaluate_tokens(&expr, tokens.tokens + 4, tokens.num_tokens - 4, &result);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_LABEL_NOT_FOUND);
+	ck_assert_uint_eq(err->location.offset, 107);
+	error_free(err);
+
+	expr_data_destroy(&expr);
+	lex_token_list_destroy(&tokens);
+	label_list_destroy(&local_labels);
+}
+END_TEST
+
+START_TEST(test_program)
+{
+	static const char line[] = "base*2 + fwd + $";
+	struct expr_data expr;
+	struct expr_program program;
+	struct label_list labels;
+	struct lex_token_list tokens;
+	expr_value result;
+
+	label_list_init(&labels);
+	label_list_append_easy(&labels, "base", 3);
+	lex_token_list_init(&tokens);
+	lex_line(line, sizeof(line) - 1, &tokens);
+	expr_data_init(&expr, line, sizeof(line) - 1, '.');
+	expr.labels = &labels;
+	expr.location_counter = 0x10;
+
+	/* base can't change, so only fwd and $ are referenced */
+	expr.location_counter_changes = 1;
+	expr_program_init(&program);
+	ck_assert_ptr_eq(expr_compile_tokens(&expr, tokens.tokens, tokens.num_tokens, &program, &result), NULL);
+	ck_assert_int_eq(result, 0x16);
+	ck_assert_uint_eq(program.num_references, 2);
+	ck_assert_uint_eq(program.num_missing, 1);
+
+	label_list_append_easy(&labels, "fwd", 0x100);
+	ck_assert_ptr_eq(expr_program_evaluate(&program, &labels, NULL, 0x20, &result), NULL);
+	ck_assert_int_eq(result, 0x126);
+	expr_program_destroy(&program);
+
+	/* Nothing can change, so there is nothing to keep */
+	expr.location_counter_changes = 0;
+	expr_program_init(&program);
+	ck_assert_ptr_eq(expr_compile_tokens(&expr, tokens.tokens, tokens.num_tokens, &program, &result), NULL);
+	ck_assert_int_eq(result, 0x116);
+	ck_assert_uint_eq(program.num_references, 0);
+	ck_assert_uint_eq(program.num_tokens, 0);
+	expr_program_destroy(&program);
+
+	expr_data_destroy(&expr);
+	lex_token_list_destroy(&tokens);
+	label_list_destroy(&labels);
+}
+END_TEST
+
 TCase *tcase_expr_evaluate(void)
 {
 	TCase *tcase = tcase_create("expr_evaluate");
@@ -315,6 +432,7 @@ TCase *tcase_expr_evaluate(void)
 	tcase_add_test(tcase, test_octal_constant);
 	tcase_add_test(tcase, test_decimal_constant);
 	tcase_add_test(tcase, test_hexadecimal_constant);
+	tcase_add_test(tcase, test_unterminated_constant);
 	tcase_add_test(tcase, test_char_constant);
 
 	tcase_add_test(tcase, test_operator_plus);
@@ -344,6 +462,8 @@ TCase *tcase_expr_evaluate(void)
 	tcase_add_test(tcase, test_operator_precedence);
 	tcase_add_test(tcase, test_parentheses);
 	tcase_add_test(tcase, test_spaces);
+	tcase_add_test(tcase, test_tokens);
+	tcase_add_test(tcase, test_program);
 
 	return tcase;
 }
@@ -0,0 +1,81 @@
+/*
+ * test/fixture.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/libc.h>
+
+char test_dir[] = "/tmp/bergen-test-XXXXXX";
+
+void test_dir_create(void)
+{
+	ck_assert_ptr_ne(bergen_mkdtemp(test_dir), NULL);
+}
+
+/* Everything in it must have been removed already */
+void test_dir_remove(void)
+{
+	bergen_rmdir(test_dir);
+	bergen_strcpy(test_dir + bergen_strlen(test_dir) - 6, "XXXXXX");
+}
+
+void test_path(char *path, size_t size, const char *name)
+{
+	bergen_snprintf(path, size, "%s/%s", test_dir, name);
+}
+
+void test_write_file(const char *name, const char *contents)
+{
+	char path[256];
+	FILE *file;
+
+	test_path(path, sizeof(path), name);
+	file = bergen_fopen(path, "w");
+	ck_assert_ptr_ne(file, NULL);
+	bergen_fwrite(contents, sizeof(char), bergen_strlen(contents), file);
+	bergen_fclose(file);
+}
+
+void test_remove_file(const char *name)
+{
+	char path[256];
+
+	test_path(path, sizeof(path), name);
+	bergen_unlink(path);
+}
+
+void test_make_dir(const char *name)
+{
+	char path[256];
+
+	test_path(path, sizeof(path), name);
+	bergen_mkdir(path, 0700);
+}
+
+void test_remove_dir(const char *name)
+{
+	char path[256];
+
+	test_path(path, sizeof(path), name);
+	bergen_rmdir(path);
+}
@@ -0,0 +1,240 @@
+/*
+ * test/include.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/include.h>
+#include <bergen/pool.h>
+
+#include <bergen/libc.h>
+
+static void setup(void)
+{
+	char path[256];
+
+	test_dir_create();
+	test_path(path, sizeof(path), "inc");
+	bergen_mkdir(path, 0700);
+
+	test_write_file("main.z80", "#include \"local.inc\"\n#include \"ti83plus.inc\"\n");
+	test_write_file("local.inc", "; no guard\nlocal .equ 1\n");
+	test_write_file("inc/ti83plus.inc", "#ifndef TI83PLUS_INC\n#define TI83PLUS_INC\n_PutS .equ 450Ah\n#endif\n");
+	test_write_file("inc/empty.inc", "");
+}
+
+static void teardown(void)
+{
+	char path[256];
+
+	test_remove_file("main.z80");
+	test_remove_file("local.inc");
+	test_remove_file("inc/ti83plus.inc");
+	test_remove_file("inc/empty.inc");
+	test_path(path, sizeof(path), "inc");
+	bergen_rmdir(path);
+	test_dir_remove();
+}
+
+START_TEST(test_include_manager)
+{
+	struct include_manager im;
+	struct include_file *main_file, *file, *file2;
+	struct preprocessor pp;
+	struct error *err;
+	char path[256];
+
+	setup();
+	include_manager_init(&im);
+	preprocessor_init(&pp, NULL);
+
+	test_path(path, sizeof(path), "main.z80");
+	err = include_manager_load(&im, path, &main_file);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_uint_eq(main_file->length, 45);
+	ck_assert_int_eq(bergen_memcmp(main_file->data, "#include", 8), 0);
+	ck_assert_ptr_eq(main_file->guard, NULL);
+	ck_assert_uint_eq(main_file->source_id, 0);
+
+	/* Relative to the including file */
+	err = include_manager_find(&im, "local.inc", 9, main_file, &file);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_ptr_eq(file->guard, NULL);
+
+	/* Search paths */
+	err = include_manager_find(&im, "ti83plus.inc", 12, main_file, &file);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_FILE_NOT_FOUND);
+	error_free(err);
+
+	test_path(path, sizeof(path), "inc");
+	include_manager_add_search_path(&im, path);
+	err = include_manager_find(&im, "ti83plus.inc", 12, main_file, &file);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_str_eq(file->guard, "TI83PLUS_INC");
+	ck_assert_uint_eq(im.num_files, 3);
+
+	/* Loaded only once, whichever way it is named */
+	err = include_manager_find(&im, "ti83plus.inc", 12, NULL, &file2);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_ptr_eq(file2, file);
+	err = include_manager_find(&im, "inc/../inc/ti83plus.inc", 23, main_file, &file2);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_ptr_eq(file2, file);
+	ck_assert_uint_eq(im.num_files, 3);
+	ck_assert_uint_eq(im.sources.num_files, 3);
+
+	/* Guarded files are skipped once their guard is defined */
+	ck_assert_int_eq(include_file_is_guarded(file, &pp), 0);
+	ck_assert_ptr_eq(preprocessor_define(&pp, "TI83PLUS_INC", 12), NULL);
+	ck_assert_int_eq(include_file_is_guarded(file, &pp), 1);
+
+	err = include_manager_find(&im, "empty.inc", 9, NULL, &file);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_uint_eq(file->length, 0);
+
+	preprocessor_destroy(&pp);
+	include_manager_destroy(&im);
+	teardown();
+}
+END_TEST
+
+START_TEST(test_include_manager_reset)
+{
+	struct include_manager im;
+	struct include_file *main_file, *local, *ti83plus, *file;
+	source_file_id local_id;
+	struct error *err;
+	char path[256];
+
+	setup();
+	include_manager_init(&im);
+	test_path(path, sizeof(path), "inc");
+	include_manager_add_search_path(&im, path);
+
+	test_path(path, sizeof(path), "main.z80");
+	ck_assert_ptr_eq(include_manager_load(&im, path, &main_file), NULL);
+	ck_assert_ptr_eq(include_manager_find(&im, "local.inc", 9, main_file, &local), NULL);
+	ck_assert_ptr_eq(include_manager_find(&im, "ti83plus.inc", 12, main_file, &ti83plus), NULL);
+
+	/* A change is only noticed after a reset */
+	ck_assert_int_eq(include_file_is_current(local), 1);
+	test_write_file("local.inc", "local .equ 2\n");
+	ck_assert_int_eq(include_file_is_current(local), 0);
+	ck_assert_int_eq(include_file_is_current(main_file), 1);
+	ck_assert_ptr_eq(include_manager_find(&im, "local.inc", 9, main_file, &file), NULL);
+	ck_assert_ptr_eq(file, local);
+
+	/* The old version is freed, and the new one takes its source id */
+	local_id = local->source_id;
+	include_manager_reset(&im);
+	ck_assert_uint_eq(im.num_files, 2);
+	ck_assert_ptr_eq(source_list_get_file(&im.sources, local_id), NULL);
+	ck_assert_ptr_eq(include_manager_find(&im, "local.inc", 9, main_file, &file), NULL);
+	ck_assert_uint_eq(file->length, 13);
+	ck_assert_int_eq(bergen_memcmp(file->data, "local .equ 2\n", 13), 0);
+	ck_assert_uint_eq(im.num_files, 3);
+	ck_assert_uint_eq(file->source_id, local_id);
+	ck_assert_uint_eq(im.sources.num_files, 3);
+
+	/* Unchanged files are still there, but the search paths are gone */
+	ck_assert_ptr_eq(include_manager_load(&im, path, &file), NULL);
+	ck_assert_ptr_eq(file, main_file);
+	err = include_manager_find(&im, "ti83plus.inc", 12, main_file, &file);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_FILE_NOT_FOUND);
+	error_free(err);
+
+	test_path(path, sizeof(path), "inc");
+	include_manager_add_search_path(&im, path);
+	ck_assert_ptr_eq(include_manager_find(&im, "ti83plus.inc", 12, main_file, &file), NULL);
+	ck_assert_ptr_eq(file, ti83plus);
+	ck_assert_uint_eq(im.num_files, 3);
+
+	include_manager_destroy(&im);
+	teardown();
+}
+END_TEST
+
+#define NUM_THREAD_JOBS 64
+
+struct thread_data {
+	struct include_manager *im;
+	const struct include_file *main_file;
+	struct include_file *files[NUM_THREAD_JOBS];
+	struct error *errors[NUM_THREAD_JOBS];
+};
+
+static void find_job(void *data, size_t index)
+{
+	struct thread_data *td = data;
+
+	if (index % 2)
+		td->errors[index] = include_manager_find(td->im, "ti83plus.inc", 12, td->main_file, &td->files[index]);
+	else
+		td->errors[index] = include_manager_find(td->im, "local.inc", 9, td->main_file, &td->files[index]);
+}
+
+START_TEST(test_include_manager_threads)
+{
+	struct include_manager im;
+	struct include_file *main_file;
+	struct thread_data td;
+	char path[256];
+	size_t i;
+
+	setup();
+	include_manager_init(&im);
+	test_path(path, sizeof(path), "inc");
+	include_manager_add_search_path(&im, path);
+
+	test_path(path, sizeof(path), "main.z80");
+	ck_assert_ptr_eq(include_manager_load(&im, path, &main_file), NULL);
+
+	td.im = &im;
+	td.main_file = main_file;
+	thread_pool_run(8, NUM_THREAD_JOBS, find_job, &td);
+
+	/* Every thread got the same file, and each was loaded once */
+	for (i = 0; i < NUM_THREAD_JOBS; i++) {
+		ck_assert_ptr_eq(td.errors[i], NULL);
+		ck_assert_ptr_eq(td.files[i], td.files[i % 2]);
+	}
+	ck_assert_ptr_ne(td.files[0], td.files[1]);
+	ck_assert_uint_eq(im.num_files, 3);
+	ck_assert_uint_eq(im.sources.num_files, 3);
+
+	include_manager_destroy(&im);
+	teardown();
+}
+END_TEST
+
+TCase *tcase_include(void)
+{
+	TCase *tcase = tcase_create("include");
+
+	tcase_add_test(tcase, test_include_manager);
+	tcase_add_test(tcase, test_include_manager_reset);
+	tcase_add_test(tcase, test_include_manager_threads);
+
+	return tcase;
+}
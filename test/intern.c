@@ -0,0 +1,81 @@
+/*
+ * test/intern.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/intern.h>
+
+#include <bergen/libc.h>
+
+START_TEST(test_intern)
+{
+	struct intern_table table;
+	intern_id id1, id2;
+
+	intern_table_init(&table);
+
+	ck_assert_uint_eq(intern_table_find(&table, "name", 4), INTERN_NONE);
+	id1 = intern_table_intern(&table, "name1", 5);
+	id2 = intern_table_intern(&table, "name2_suffix", 5);
+	ck_assert_uint_ne(id1, id2);
+	ck_assert_uint_eq(intern_table_intern(&table, "name1", 5), id1);
+	ck_assert_uint_eq(intern_table_find(&table, "name2", 5), id2);
+	ck_assert_uint_eq(intern_table_find(&table, "name", 4), INTERN_NONE);
+	ck_assert_str_eq(intern_table_get_name(&table, id2), "name2");
+	ck_assert_uint_eq(intern_table_get_length(&table, id2), 5);
+
+	intern_table_destroy(&table);
+}
+END_TEST
+
+START_TEST(test_intern_grow)
+{
+	struct intern_table table;
+	char name[16];
+	int i, length;
+
+	intern_table_init(&table);
+
+	for (i = 0; i < 1000; i++) {
+		length = bergen_snprintf(name, sizeof(name), "label%d", i);
+		ck_assert_uint_eq(intern_table_intern(&table, name, length), i);
+	}
+	for (i = 0; i < 1000; i++) {
+		length = bergen_snprintf(name, sizeof(name), "label%d", i);
+		ck_assert_uint_eq(intern_table_find(&table, name, length), i);
+	}
+	ck_assert_uint_eq(intern_table_find(&table, "label1000", 9), INTERN_NONE);
+
+	intern_table_destroy(&table);
+}
+END_TEST
+
+TCase *tcase_intern(void)
+{
+	TCase *tcase = tcase_create("intern");
+
+	tcase_add_test(tcase, test_intern);
+	tcase_add_test(tcase, test_intern_grow);
+
+	return tcase;
+}
@@ -0,0 +1,88 @@
+/*
+ * test/label.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/label.h>
+
+#include <bergen/libc.h>
+
+START_TEST(test_label_list)
+{
+	struct label_list list;
+	struct label *label;
+	char name[32];
+	int i;
+
+	label_list_init(&list);
+
+	/* Enough to grow the slots a few times */
+	for (i = 0; i < 1000; i++) {
+		bergen_snprintf(name, sizeof(name), "label%d", i);
+		label_list_append_type(&list, name, bergen_strlen(name), i, i % 3 ? LABEL_TYPE_LABEL : LABEL_TYPE_CONSTANT);
+	}
+	ck_assert_uint_eq(list.num_labels, 1000);
+	for (i = 0; i < 1000; i++) {
+		bergen_snprintf(name, sizeof(name), "label%d", i);
+		label = label_list_find_label(&list, name, bergen_strlen(name));
+		ck_assert_ptr_ne(label, NULL);
+		ck_assert_int_eq(label->value, i);
+	}
+	ck_assert_ptr_eq(label_list_find_label(&list, "label1000", 9), NULL);
+	ck_assert_ptr_eq(label_list_find_label(&list, "label", 5), NULL);
+
+	/* Names are compared by length, not up to a NUL */
+	label = label_list_find_label(&list, "label12", 6);
+	ck_assert_ptr_ne(label, NULL);
+	ck_assert_int_eq(label->value, 1);
+
+	ck_assert_int_eq(label_list_remove(&list, "label500", 8), 1);
+	ck_assert_int_eq(label_list_remove(&list, "label500", 8), 0);
+	ck_assert_ptr_eq(label_list_find_label(&list, "label500", 8), NULL);
+	ck_assert_int_eq(label_list_find_label(&list, "label999", 8)->value, 999);
+
+	label_list_remove_type(&list, LABEL_TYPE_CONSTANT);
+	ck_assert_uint_eq(list.num_labels, 665);
+	for (i = 0; i < 1000; i++) {
+		bergen_snprintf(name, sizeof(name), "label%d", i);
+		label = label_list_find_label(&list, name, bergen_strlen(name));
+		if (i % 3 == 0 || i == 500) {
+			ck_assert_ptr_eq(label, NULL);
+		} else {
+			ck_assert_ptr_ne(label, NULL);
+			ck_assert_int_eq(label->value, i);
+		}
+	}
+
+	label_list_destroy(&list);
+}
+END_TEST
+
+TCase *tcase_label(void)
+{
+	TCase *tcase = tcase_create("label");
+
+	tcase_add_test(tcase, test_label_list);
+
+	return tcase;
+}
@@ -0,0 +1,102 @@
+/*
+ * test/lexer.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/lexer.h>
+
+#include <bergen/libc.h>
+
+#include <stdarg.h>
+
+/* Expects alternating types and strings, terminated by -1 */
+static void assert_lex(const char *str, ...)
+{
+	struct lex_token_list list;
+	va_list args;
+	size_t i = 0;
+	int type;
+	const char *text;
+
+	lex_token_list_init(&list);
+	lex_line(str, bergen_strlen(str), &list);
+
+	va_start(args, str);
+	for (;;) {
+		type = va_arg(args, int);
+		if (type < 0)
+			break;
+		text = va_arg(args, const char *);
+		ck_assert_uint_lt(i, list.num_tokens);
+		ck_assert_int_eq(list.tokens[i].type, type);
+		ck_assert_uint_eq(list.tokens[i].length, bergen_strlen(text));
+		ck_assert_int_eq(bergen_memcmp(list.tokens[i].str, text, list.tokens[i].length), 0);
+		i++;
+	}
+	va_end(args);
+	ck_assert_uint_eq(list.num_tokens, i);
+
+	lex_token_list_destroy(&list);
+}
+
+#define ID	LEX_TOKEN_TYPE_IDENTIFIER
+#define NUM	LEX_TOKEN_TYPE_NUMBER
+#define CHR	LEX_TOKEN_TYPE_CHAR
+#define STR	LEX_TOKEN_TYPE_STRING
+#define OP	LEX_TOKEN_TYPE_OPERATOR
+#define WS	LEX_TOKEN_TYPE_WHITESPACE
+#define CMT	LEX_TOKEN_TYPE_COMMENT
+
+START_TEST(test_lex_line)
+{
+	assert_lex("label:\tld a,(ix+5) ; comment",
+		ID, "label", OP, ":", WS, "\t", ID, "ld", WS, " ", ID, "a", OP, ",", OP, "(", ID, "ix", OP, "+", NUM, "5", OP, ")",
+		WS, " ", CMT, "; comment", -1);
+	assert_lex(".db \"a\\\"b\", 'c'", OP, ".", ID, "db", WS, " ", STR, "\"a\\\"b\"", OP, ",", WS, " ", CHR, "'c'", -1);
+	assert_lex("\"unterminated", STR, "\"unterminated", -1);
+	assert_lex("ex af,af'", ID, "ex", WS, " ", ID, "af", OP, ",", ID, "af", OP, "'", -1);
+	assert_lex("a<<2>=b!=c", ID, "a", OP, "<<", NUM, "2", OP, ">=", ID, "b", OP, "!=", ID, "c", -1);
+	assert_lex("", -1);
+}
+END_TEST
+
+START_TEST(test_lex_constants)
+{
+	assert_lex("$FF+$", NUM, "$FF", OP, "+", NUM, "$", -1);
+	assert_lex("0FFh @17 10b", NUM, "0FFh", WS, " ", NUM, "@17", WS, " ", NUM, "10b", -1);
+	assert_lex("%1010", NUM, "%1010", -1);
+	assert_lex("(%1010)", OP, "(", NUM, "%1010", OP, ")", -1);
+	assert_lex("5%3", NUM, "5", OP, "%", NUM, "3", -1);
+	assert_lex("x % 3", ID, "x", WS, " ", OP, "%", WS, " ", NUM, "3", -1);
+}
+END_TEST
+
+TCase *tcase_lexer(void)
+{
+	TCase *tcase = tcase_create("lexer");
+
+	tcase_add_test(tcase, test_lex_line);
+	tcase_add_test(tcase, test_lex_constants);
+
+	return tcase;
+}
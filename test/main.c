@@ -28,10 +28,27 @@ int main(int argc, char **argv)
 	Suite *suite = suite_create("Unit Tests");
 	SRunner *runner;
 
+	suite_add_tcase(suite, tcase_alloc());
+	suite_add_tcase(suite, tcase_arena());
+	suite_add_tcase(suite, tcase_assembler());
+	suite_add_tcase(suite, tcase_cache());
+	suite_add_tcase(suite, tcase_depend());
+	suite_add_tcase(suite, tcase_error());
 	suite_add_tcase(suite, tcase_expr_evaluate());
+	suite_add_tcase(suite, tcase_include());
+	suite_add_tcase(suite, tcase_intern());
+	suite_add_tcase(suite, tcase_label());
+	suite_add_tcase(suite, tcase_lexer());
 	suite_add_tcase(suite, tcase_object());
 	suite_add_tcase(suite, tcase_parse());
+	suite_add_tcase(suite, tcase_pool());
 	suite_add_tcase(suite, tcase_preprocessor());
+	suite_add_tcase(suite, tcase_profile());
+	suite_add_tcase(suite, tcase_source());
+	suite_add_tcase(suite, tcase_stats());
+	suite_add_tcase(suite, tcase_stream());
+	suite_add_tcase(suite, tcase_trace());
+	suite_add_tcase(suite, tcase_z80());
 
 	runner = srunner_create(suite);
 	srunner_run_all(runner, CK_NORMAL);
@@ -81,6 +81,19 @@ START_TEST(test_object_output)
 	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&obj, &obj.segments[1]), data2, 5), 0);
 	ck_assert_uint_eq(object_output_get_segment_length(&obj, &obj.segments[0]), 5);
 	ck_assert_uint_eq(object_output_get_segment_length(&obj, &obj.segments[1]), 5);
+	ck_assert_uint_eq(object_output_get_offset(&obj), 10);
+
+	object_output_patch(&obj, 6, data1, 2);
+	ck_assert_int_eq(obj.address, 0x4005);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&obj, &obj.segments[1]), "\x34\xAB\xCD\x9A\xBC", 5), 0);
+
+	/* Reserved bytes are patched in later, past the first buffer */
+	ck_assert_uint_eq(object_output_reserve(&obj, 200), 10);
+	ck_assert_int_eq(obj.address, 0x40CD);
+	ck_assert_uint_eq(object_output_get_segment_length(&obj, &obj.segments[1]), 205);
+	object_output_patch(&obj, 208, data1, 2);
+	ck_assert_int_eq(bergen_memcmp(object_output_get_segment_ptr(&obj, &obj.segments[1]), "\x34\xAB\xCD\x9A\xBC", 5), 0);
+	ck_assert_int_eq(bergen_memcmp((char *) object_output_get_segment_ptr(&obj, &obj.segments[1]) + 203, data1, 2), 0);
 
 	object_output_destroy(&obj);
 }
@@ -110,12 +123,37 @@ START_TEST(test_write_to_binary)
 }
 END_TEST
 
+START_TEST(test_write_to_intel_hex)
+{
+	static const char expected[] =
+		":038002000405066C\n"
+		":0380000007080965\n"
+		":00000001FF\n";
+
+	struct object_output obj;
+	FILE *file;
+	char data[64];
+
+	prepare_for_write(&obj);
+	file = bergen_tmpfile();
+	object_output_write_to_intel_hex(&obj, file);
+
+	bergen_fseek(file, 0, SEEK_SET);
+	ck_assert_uint_eq(bergen_fread(data, sizeof(char), sizeof(data), file), sizeof(expected) - 1);
+	ck_assert_int_eq(bergen_memcmp(data, expected, sizeof(expected) - 1), 0);
+
+	object_output_destroy(&obj);
+	bergen_fclose(file);
+}
+END_TEST
+
 TCase *tcase_object(void)
 {
 	TCase *tcase = tcase_create("object");
 
 	tcase_add_test(tcase, test_object_output);
 	tcase_add_test(tcase, test_write_to_binary);
+	tcase_add_test(tcase, test_write_to_intel_hex);
 
 	return tcase;
 }
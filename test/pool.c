@@ -0,0 +1,104 @@
+/*
+ * test/pool.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/pool.h>
+
+#include <bergen/libc.h>
+
+#define NUM_JOBS 1000
+
+struct count_data {
+	int counts[NUM_JOBS];
+};
+
+static void count_job(void *data, size_t index)
+{
+	struct count_data *cd = data;
+	volatile size_t i;
+
+	/* Uneven jobs, so that some threads run out early and steal */
+	for (i = 0; i < (index % 7) * 1000; i++)
+		;
+	cd->counts[index]++;
+}
+
+START_TEST(test_pool)
+{
+	struct count_data cd;
+	size_t threads[] = {2, 3, 8, NUM_JOBS * 2};
+	size_t i, j;
+
+	for (i = 0; i < sizeof(threads) / sizeof(*threads); i++) {
+		bergen_memset(&cd, 0, sizeof(cd));
+		thread_pool_run(threads[i], NUM_JOBS, count_job, &cd);
+		for (j = 0; j < NUM_JOBS; j++)
+			ck_assert_int_eq(cd.counts[j], 1);
+	}
+
+	/* Nothing to do */
+	thread_pool_run(4, 0, count_job, NULL);
+}
+END_TEST
+
+struct order_data {
+	size_t order[16];
+	size_t num_done;
+};
+
+static void order_job(void *data, size_t index)
+{
+	struct order_data *od = data;
+
+	od->order[od->num_done++] = index;
+}
+
+START_TEST(test_pool_single_thread)
+{
+	struct order_data od;
+	size_t i;
+
+	od.num_done = 0;
+	thread_pool_run(1, 16, order_job, &od);
+	ck_assert_uint_eq(od.num_done, 16);
+	for (i = 0; i < 16; i++)
+		ck_assert_uint_eq(od.order[i], i);
+
+	/* 0 threads is the same as 1 */
+	od.num_done = 0;
+	thread_pool_run(0, 16, order_job, &od);
+	ck_assert_uint_eq(od.num_done, 16);
+	ck_assert_uint_eq(od.order[15], 15);
+}
+END_TEST
+
+TCase *tcase_pool(void)
+{
+	TCase *tcase = tcase_create("pool");
+
+	tcase_add_test(tcase, test_pool);
+	tcase_add_test(tcase, test_pool_single_thread);
+
+	return tcase;
+}
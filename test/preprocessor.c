@@ -23,6 +23,7 @@
 
 #include "tests.h"
 
+#include <bergen/expression.h>
 #include <bergen/preprocessor.h>
 
 #include <stdarg.h>
@@ -126,8 +127,462 @@ END_TEST
 START_TEST(test_def_parse)
 {
 	assert_def_parse_no_args("macro", "macro");
+	assert_def_parse_no_args("macro (a)", "macro");
 	assert_def_parse("macro(a)", "macro", 0, 1, 1, "a");
 	assert_def_parse("macro(a,b)", "macro", 0, 1, 2, "a", "b");
+	assert_def_parse("macro( a , b ) a + b", "macro", 0, 1, 2, "a", "b");
+	assert_def_parse("macro()", "macro", 0, 1, 0);
+	assert_def_parse_invalid("macro(a,b");
+	assert_def_parse_invalid("macro(a,a)");
+	assert_def_parse_invalid("");
+}
+END_TEST
+
+static void assert_expand(const char *def, const char *invocation, const char *expected)
+{
+	struct pp_macro_definition macro;
+	struct pp_macro_arg args[8];
+	struct lex_token_list tokens, output;
+	struct error *err;
+	size_t i, index = 1;
+	char buf[128];
+	size_t length = 0;
+
+	err = pp_macro_definition_parse(&macro, def, bergen_strlen(def));
+	ck_assert_ptr_eq(err, NULL);
+
+	lex_token_list_init(&tokens);
+	lex_token_list_init(&output);
+	lex_line(invocation, bergen_strlen(invocation), &tokens);
+
+	if (macro.args) {
+		err = pp_macro_parse_args(&macro, tokens.tokens, tokens.num_tokens, &index, args);
+		if (!expected) {
+			ck_assert_ptr_ne(err, NULL);
+			error_free(err);
+			goto out;
+		}
+		ck_assert_ptr_eq(err, NULL);
+	}
+	pp_macro_expand(&macro, args, &output);
+	lex_token_list_append(&output, tokens.tokens + index, tokens.num_tokens - index);
+
+	for (i = 0; i < output.num_tokens; i++) {
+		bergen_memcpy(buf + length, output.tokens[i].str, output.tokens[i].length);
+		length += output.tokens[i].length;
+	}
+	buf[length] = '\0';
+	ck_assert_str_eq(buf, expected);
+
+out:
+	lex_token_list_destroy(&output);
+	lex_token_list_destroy(&tokens);
+	pp_macro_definition_destroy(&macro);
+}
+
+START_TEST(test_def_body)
+{
+	struct pp_macro_definition macro;
+	struct error *err;
+
+	static const char def[] = "bcall(addr) rst 28h \\ .dw addr ; comment";
+
+	err = pp_macro_definition_parse(&macro, def, sizeof(def) - 1);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_uint_eq(macro.body_tokens.num_tokens, 10);
+	ck_assert_int_eq(macro.body_tokens.tokens[0].type, LEX_TOKEN_TYPE_IDENTIFIER);
+	ck_assert_int_eq(macro.body_tokens.tokens[9].type, LEX_TOKEN_TYPE_MACRO_ARG);
+	ck_assert_uint_eq(macro.body_tokens.tokens[9].arg, 0);
+	pp_macro_definition_destroy(&macro);
+}
+END_TEST
+
+START_TEST(test_expand)
+{
+	assert_expand("SCREEN_W 96", "SCREEN_W / 8", "96 / 8");
+	assert_expand("bcall(addr) rst 28h \\ .dw addr", "bcall(_PutS) ; print", "rst 28h \\ .dw _PutS ; print");
+	assert_expand("add(a, b) (a + b)", "add( x * 2 , (y, z) )", "(x * 2 + (y, z))");
+	assert_expand("swap(a, b) b, a", "swap(1, 2)", "2, 1");
+	assert_expand("one(a) [a]", "one()", "[]");
+	assert_expand("none() nothing", "none()", "nothing");
+	assert_expand("add(a, b) a + b", "add(1)", NULL);
+	assert_expand("add(a, b) a + b", "add(1, 2", NULL);
+	assert_expand("none() nothing", "none(1)", NULL);
+}
+END_TEST
+
+START_TEST(test_macro_table)
+{
+	struct pp_macro_table table;
+	struct pp_macro_definition macro, *found;
+
+	pp_macro_table_init(&table);
+
+	ck_assert_ptr_eq(pp_macro_table_find_easy(&table, "macro"), NULL);
+
+	pp_macro_definition_init_easy(&macro, "macro", 1);
+	pp_macro_definition_add_arg_easy(&macro, "a");
+	pp_macro_table_define(&table, &macro);
+	ck_assert_uint_eq(table.num_macros, 1);
+
+	found = pp_macro_table_find(&table, "macro_suffix", 5);
+	ck_assert_ptr_ne(found, NULL);
+	ck_assert_str_eq(found->name, "macro");
+	ck_assert_uint_eq(found->num_args, 1);
+	ck_assert_ptr_eq(pp_macro_table_find_easy(&table, "macr"), NULL);
+
+	/* Redefinition replaces */
+	pp_macro_definition_init_easy(&macro, "macro", 0);
+	pp_macro_table_define(&table, &macro);
+	ck_assert_uint_eq(table.num_macros, 1);
+	found = pp_macro_table_find_easy(&table, "macro");
+	ck_assert_ptr_ne(found, NULL);
+	ck_assert_ptr_eq(found->args, NULL);
+
+	ck_assert_int_eq(pp_macro_table_undefine(&table, "macro", 5), 1);
+	ck_assert_int_eq(pp_macro_table_undefine(&table, "macro", 5), 0);
+	ck_assert_int_eq(pp_macro_table_undefine(&table, "other", 5), 0);
+	ck_assert_ptr_eq(pp_macro_table_find_easy(&table, "macro"), NULL);
+	ck_assert_uint_eq(table.num_macros, 0);
+
+	pp_macro_table_destroy(&table);
+}
+END_TEST
+
+START_TEST(test_macro_table_many)
+{
+	struct pp_macro_table table;
+	struct pp_macro_definition macro, *found;
+	char name[16];
+	int i, length, false_positives = 0;
+
+	pp_macro_table_init(&table);
+
+	for (i = 0; i < 5000; i++) {
+		bergen_snprintf(name, sizeof(name), "MACRO_%d", i);
+		pp_macro_definition_init_easy(&macro, name, 0);
+		pp_macro_table_define(&table, &macro);
+	}
+	ck_assert_uint_eq(table.num_macros, 5000);
+
+	for (i = 0; i < 5000; i++) {
+		length = bergen_snprintf(name, sizeof(name), "MACRO_%d", i);
+		found = pp_macro_table_find(&table, name, length);
+		ck_assert_ptr_ne(found, NULL);
+		ck_assert_str_eq(found->name, name);
+
+		length = bergen_snprintf(name, sizeof(name), "label_%d", i);
+		ck_assert_ptr_eq(pp_macro_table_find(&table, name, length), NULL);
+		if (pp_macro_table_bloom_test(&table, intern_hash(name, length)))
+			false_positives++;
+	}
+	ck_assert_int_lt(false_positives, 500);
+
+	pp_macro_table_destroy(&table);
+}
+END_TEST
+
+static void define(struct preprocessor *pp, const char *str)
+{
+	struct error *err = preprocessor_define(pp, str, bergen_strlen(str));
+
+	ck_assert_ptr_eq(err, NULL);
+}
+
+static void assert_constant(struct preprocessor *pp, const char *name, int is_constant, expr_value value)
+{
+	struct pp_macro_definition *macro = pp_macro_table_find_easy(&pp->macros, name);
+	struct label *label = label_list_find_label(pp->labels, name, bergen_strlen(name));
+
+	ck_assert_ptr_ne(macro, NULL);
+	ck_assert_int_eq(macro->is_constant, is_constant);
+	if (is_constant) {
+		ck_assert_ptr_ne(label, NULL);
+		ck_assert_int_eq(label->type, LABEL_TYPE_CONSTANT);
+		ck_assert_int_eq(label->value, value);
+	} else {
+		ck_assert_ptr_eq(label, NULL);
+	}
+}
+
+static void assert_pp_expand(const struct preprocessor *pp, const char *str, const char *expected)
+{
+	struct lex_token_list tokens, output;
+	struct error *err;
+	char buf[128];
+	size_t i, length = 0;
+
+	lex_token_list_init(&tokens);
+	lex_token_list_init(&output);
+	lex_line(str, bergen_strlen(str), &tokens);
+
+	err = preprocessor_expand(pp, tokens.tokens, tokens.num_tokens, &output);
+	ck_assert_ptr_eq(err, NULL);
+	for (i = 0; i < output.num_tokens; i++) {
+		bergen_memcpy(buf + length, output.tokens[i].str, output.tokens[i].length);
+		length += output.tokens[i].length;
+	}
+	buf[length] = '\0';
+	ck_assert_str_eq(buf, expected);
+
+	lex_token_list_destroy(&output);
+	lex_token_list_destroy(&tokens);
+}
+
+START_TEST(test_constant_macros)
+{
+	struct preprocessor pp;
+	struct label_list labels;
+	struct expr_data expr;
+	expr_value result;
+
+	label_list_init(&labels);
+	preprocessor_init(&pp, &labels);
+
+	define(&pp, "SCREEN_W 96");
+	define(&pp, "HALF (SCREEN_W / 2)");
+	define(&pp, "NEG -5 ; comment");
+	define(&pp, "CHAR 'c'");
+	define(&pp, "ALIAS SCREEN_W");
+	define(&pp, "SUM 1 + 2");
+	define(&pp, "HERE $");
+	define(&pp, "REG a");
+	define(&pp, "PAREN (1) + 1");
+	define(&pp, "FUNC(x) (x)");
+	assert_constant(&pp, "SCREEN_W", 1, 96);
+	assert_constant(&pp, "HALF", 1, 48);
+	assert_constant(&pp, "NEG", 1, -5);
+	assert_constant(&pp, "CHAR", 1, 'c');
+	assert_constant(&pp, "ALIAS", 1, 96);
+	assert_constant(&pp, "SUM", 0, 0);
+	assert_constant(&pp, "HERE", 0, 0);
+	assert_constant(&pp, "REG", 0, 0);
+	assert_constant(&pp, "PAREN", 0, 0);
+	assert_constant(&pp, "FUNC", 0, 0);
+
+	/* Constants are left for expressions to look up, the rest is expanded */
+	assert_pp_expand(&pp, "ld REG,SCREEN_W*SUM", "ld a,SCREEN_W*1 + 2");
+	assert_pp_expand(&pp, "FUNC (HALF) + FUNC", "(HALF) + FUNC");
+
+	expr_data_init_easy(&expr, "2 * HALF + NEG", '_');
+	expr.labels = &labels;
+	ck_assert_ptr_eq(expr_evaluate(&expr, &result), NULL);
+	ck_assert_int_eq(result, 91);
+	expr_data_destroy(&expr);
+
+	/* Redefining and undefining keep the labels in sync */
+	define(&pp, "HALF 7");
+	assert_constant(&pp, "HALF", 1, 7);
+	define(&pp, "SCREEN_W SUM");
+	assert_constant(&pp, "SCREEN_W", 0, 0);
+	assert_constant(&pp, "ALIAS", 0, 0);
+	ck_assert_int_eq(preprocessor_undefine(&pp, "NEG", 3), 1);
+	ck_assert_ptr_eq(label_list_find_label(&labels, "NEG", 3), NULL);
+	ck_assert_uint_eq(labels.num_labels, 2);
+
+	preprocessor_destroy(&pp);
+	label_list_destroy(&labels);
+}
+END_TEST
+
+START_TEST(test_constant_dependents)
+{
+	struct preprocessor pp;
+	struct label_list labels;
+
+	label_list_init(&labels);
+	preprocessor_init(&pp, &labels);
+
+	/* Constants made from another one follow it when it is defined again */
+	define(&pp, "SCREEN_W 96");
+	define(&pp, "ALIAS SCREEN_W");
+	define(&pp, "TWICE (ALIAS * 2)");
+	define(&pp, "OTHER 5");
+	assert_constant(&pp, "TWICE", 1, 192);
+	ck_assert_int_eq(preprocessor_undefine(&pp, "SCREEN_W", 8), 1);
+	define(&pp, "SCREEN_W 100");
+	assert_constant(&pp, "SCREEN_W", 1, 100);
+	assert_constant(&pp, "ALIAS", 0, 0);
+	assert_constant(&pp, "TWICE", 0, 0);
+	assert_constant(&pp, "OTHER", 1, 5);
+	assert_pp_expand(&pp, "ld a,TWICE", "ld a,(SCREEN_W * 2)");
+
+	/* Undefined, the alias is left as the name it was given */
+	define(&pp, "ALIAS2 OTHER");
+	ck_assert_int_eq(preprocessor_undefine(&pp, "OTHER", 5), 1);
+	assert_constant(&pp, "ALIAS2", 0, 0);
+	assert_pp_expand(&pp, "ld a,ALIAS2", "ld a,OTHER");
+
+	/* Named like a register or a local label, they are expanded as text */
+	define(&pp, "B 7");
+	define(&pp, "nz 1");
+	define(&pp, "_X 5");
+	assert_constant(&pp, "B", 0, 0);
+	assert_constant(&pp, "nz", 0, 0);
+	assert_constant(&pp, "_X", 0, 0);
+	assert_pp_expand(&pp, "ld a,B", "ld a,7");
+	assert_pp_expand(&pp, "ld a,_X", "ld a,5");
+
+	preprocessor_destroy(&pp);
+	label_list_destroy(&labels);
+}
+END_TEST
+
+START_TEST(test_recursive_macros)
+{
+	struct preprocessor pp;
+
+	preprocessor_init(&pp, NULL);
+
+	define(&pp, "SELF SELF + 1");
+	define(&pp, "A B a");
+	define(&pp, "B A b");
+	define(&pp, "CALL(f, x) f(x)");
+	define(&pp, "INC(x) x + 1");
+	assert_pp_expand(&pp, "SELF", "SELF + 1");
+	assert_pp_expand(&pp, "A", "A b a");
+	assert_pp_expand(&pp, "CALL(INC, CALL(INC, 1))", "1 + 1 + 1");
+
+	preprocessor_destroy(&pp);
+}
+END_TEST
+
+/* Runs the lines of str through the preprocessor, and collects the active non-directive lines */
+static struct error *run_lines(struct preprocessor *pp, const char *str, char *output)
+{
+	size_t length = bergen_strlen(str), index = 0, line_length, output_length = 0;
+	const char *end;
+	struct error *err;
+
+	while (index < length) {
+		if (!preprocessor_is_active(pp)) {
+			index += preprocessor_skip(str + index, length - index);
+			if (index >= length)
+				break;
+		}
+
+		end = bergen_memchr(str + index, '\n', length - index);
+		line_length = end ? (size_t) (end - (str + index)) : length - index;
+		if (preprocessor_find_directive(str + index, line_length)) {
+			if ((err = preprocessor_directive(pp, str + index, line_length)))
+				return err;
+		} else if (preprocessor_is_active(pp)) {
+			bergen_memcpy(output + output_length, str + index, end ? line_length + 1 : line_length);
+			output_length += end ? line_length + 1 : line_length;
+		}
+		index += line_length + 1;
+	}
+
+	output[output_length] = '\0';
+	return preprocessor_finish(pp);
+}
+
+static void assert_run(const char *str, const char *expected)
+{
+	struct preprocessor pp;
+	struct label_list labels;
+	char output[256];
+	struct error *err;
+
+	label_list_init(&labels);
+	preprocessor_init(&pp, &labels);
+
+	err = run_lines(&pp, str, output);
+	if (!expected) {
+		ck_assert_ptr_ne(err, NULL);
+		error_free(err);
+	} else {
+		ck_assert_ptr_eq(err, NULL);
+		ck_assert_str_eq(output, expected);
+	}
+
+	preprocessor_destroy(&pp);
+	label_list_destroy(&labels);
+}
+
+START_TEST(test_conditionals)
+{
+	assert_run("#define TI83P\n#ifdef TI83P\na\n#else\nb\n#endif\nc\n", "a\nc\n");
+	assert_run("#ifdef TI83P\na\n#else\nb\n#endif\nc\n", "b\nc\n");
+	assert_run("#ifndef TI83P\na\n#endif\n", "a\n");
+	assert_run("  #  ifdef TI83P\na\n\t#endif\nb", "b");
+	assert_run("#define MODEL 2\n#if MODEL == 1\na\n#elif MODEL == 2\nb\n#elif MODEL == 2\nc\n#else\nd\n#endif\n", "b\n");
+	assert_run("#define MODEL 3\n#if MODEL == 1\na\n#elif MODEL == 2\nb\n#else\nd\n#endif\n", "d\n");
+
+	/* Nothing in an inactive block is evaluated, not even nested conditions */
+	assert_run("#ifdef X\n#if garbage (\n#define Y\n#bogus\n#else\na\n#endif\n#elif 0\n#endif\nb\n", "b\n");
+	assert_run("#ifdef X\n#ifdef Y\na\n#endif\n#else\n#ifdef Y\nb\n#else\nc\n#endif\n#endif\n", "c\n");
+
+	/* #undef */
+	assert_run("#define X\n#undef X\n#ifdef X\na\n#endif\n", "");
+
+	assert_run("#ifdef X\na\n", NULL);
+	assert_run("#endif\n", NULL);
+	assert_run("#ifdef X\n#else\n#else\n#endif\n", NULL);
+	assert_run("#ifdef\n#endif\n", NULL);
+	assert_run("#bogus\n", NULL);
+	assert_run("#if 1 +\n#endif\n", NULL);
+}
+END_TEST
+
+START_TEST(test_skip)
+{
+	static const char str[] = "a\n  #if 1\n#else\n#endif\n\t#else\nb\n";
+
+	ck_assert_uint_eq(preprocessor_skip(str, sizeof(str) - 1), 23);
+	ck_assert_uint_eq(preprocessor_skip(str, 16), 16);
+	ck_assert_uint_eq(preprocessor_skip("a\n#endif", 9), 2);
+	ck_assert_uint_eq(preprocessor_skip("#elif", 5), 0);
+	ck_assert_uint_eq(preprocessor_skip("a # endif", 9), 9);
+}
+END_TEST
+
+static void assert_guard(const char *str, const char *expected)
+{
+	size_t length;
+	const char *guard = preprocessor_find_include_guard(str, bergen_strlen(str), &length);
+
+	if (!expected) {
+		ck_assert_ptr_eq(guard, NULL);
+	} else {
+		ck_assert_ptr_ne(guard, NULL);
+		ck_assert_uint_eq(length, bergen_strlen(expected));
+		ck_assert_int_eq(bergen_memcmp(guard, expected, length), 0);
+	}
+}
+
+START_TEST(test_include_guard)
+{
+	assert_guard("#ifndef TI83PLUS_INC\n#define TI83PLUS_INC\n_PutS .equ 450Ah\n#endif\n", "TI83PLUS_INC");
+	assert_guard("; header\n\n  #ifndef G ; comment\n\n#define G\n#ifdef X\n#else\n#endif\n#endif\n; trailer\n  \n", "G");
+	assert_guard("#ifndef G\n#define G\n#endif", "G");
+	assert_guard("#ifndef G\n#define H\n#endif\n", NULL);
+	assert_guard("#ifndef G\n#define G\n#else\n#endif\n", NULL);
+	assert_guard("#ifndef G\n#define G\n#endif\nlabel:\n", NULL);
+	assert_guard("label:\n#ifndef G\n#define G\n#endif\n", NULL);
+	assert_guard("#ifdef G\n#define G\n#endif\n", NULL);
+	assert_guard("#ifndef G\n#define G\n", NULL);
+	assert_guard("", NULL);
+}
+END_TEST
+
+START_TEST(test_parse_include)
+{
+	const char *name;
+	size_t length;
+
+	name = preprocessor_parse_include("  #include \"ti83plus.inc\" ; comment", 35, &length);
+	ck_assert_ptr_ne(name, NULL);
+	ck_assert_uint_eq(length, 12);
+	ck_assert_int_eq(bergen_memcmp(name, "ti83plus.inc", 12), 0);
+
+	name = preprocessor_parse_include("#include <ion.inc>", 18, &length);
+	ck_assert_ptr_ne(name, NULL);
+	ck_assert_uint_eq(length, 7);
+
+	ck_assert_ptr_eq(preprocessor_parse_include("#include ion.inc", 16, &length), NULL);
+	ck_assert_ptr_eq(preprocessor_parse_include("#include \"ion.inc", 17, &length), NULL);
+	ck_assert_ptr_eq(preprocessor_parse_include("#define X", 9, &length), NULL);
 }
 END_TEST
 
@@ -139,6 +594,17 @@ TCase *tcase_preprocessor(void)
 	tcase_add_test(tcase, test_def_init_no_args);
 	tcase_add_test(tcase, test_def_add_args);
 	tcase_add_test(tcase, test_def_parse);
+	tcase_add_test(tcase, test_def_body);
+	tcase_add_test(tcase, test_expand);
+	tcase_add_test(tcase, test_macro_table);
+	tcase_add_test(tcase, test_macro_table_many);
+	tcase_add_test(tcase, test_constant_macros);
+	tcase_add_test(tcase, test_constant_dependents);
+	tcase_add_test(tcase, test_recursive_macros);
+	tcase_add_test(tcase, test_conditionals);
+	tcase_add_test(tcase, test_skip);
+	tcase_add_test(tcase, test_include_guard);
+	tcase_add_test(tcase, test_parse_include);
 
 	return tcase;
 }
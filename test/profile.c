@@ -0,0 +1,172 @@
+/*
+ * test/profile.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/assembler.h>
+#include <bergen/pool.h>
+#include <bergen/profile.h>
+
+#include <bergen/libc.h>
+
+static struct source_location location(source_file_id file, size_t offset)
+{
+	struct source_location result;
+
+	result.file = file;
+	result.offset = offset;
+	return result;
+}
+
+START_TEST(test_profile_table)
+{
+	struct profile profile;
+	const struct profile_line *line;
+	size_t i;
+
+	profile_init(&profile);
+	ck_assert_ptr_eq(profile_find_line(&profile, location(0, 0)), NULL);
+
+	/* Lines are added up by location, and keep the first place they were included from */
+	profile_add_line(&profile, location(1, 10), location(0, 0), 100, 1);
+	profile_add_line(&profile, location(1, 10), source_location_none(), 50, 1);
+	profile_add_line(&profile, location(0, 0), source_location_none(), 5, 1);
+	for (i = 0; i < 1000; i++)
+		profile_add_line(&profile, location(2, i), source_location_none(), 1, 1);
+	ck_assert_uint_eq(profile.num_lines, 1002);
+
+	line = profile_find_line(&profile, location(1, 10));
+	ck_assert_ptr_ne(line, NULL);
+	ck_assert_uint_eq(line->ns, 150);
+	ck_assert_uint_eq(line->count, 2);
+	ck_assert_uint_eq(line->from.file, 0);
+	ck_assert_ptr_eq(profile_find_line(&profile, location(1, 11)), NULL);
+	ck_assert_uint_eq(profile_find_line(&profile, location(2, 999))->ns, 1);
+
+	profile_add_macro(&profile, "LOAD", 4, 20, 1);
+	profile_add_macro(&profile, "STORE", 5, 30, 1);
+	profile_add_macro(&profile, "LOAD", 4, 20, 1);
+	ck_assert_uint_eq(profile.macro_names.num_entries, 2);
+	ck_assert_uint_eq(profile.macros[intern_table_find(&profile.macro_names, "LOAD", 4)].ns, 40);
+	ck_assert_uint_eq(profile.macros[intern_table_find(&profile.macro_names, "LOAD", 4)].count, 2);
+
+	profile_destroy(&profile);
+}
+END_TEST
+
+static void line_job(void *data, size_t index)
+{
+	(void) data;
+
+	profile_line(profile_begin(), location(7, index), source_location_none());
+}
+
+START_TEST(test_profile_assemble)
+{
+	struct include_manager im;
+	struct assembler as;
+	struct include_file *main_file;
+	const struct include_file *defs_file;
+	struct profile profile;
+	const struct profile_line *line;
+	char path[256], *str = NULL;
+	size_t length;
+	FILE *file;
+
+	test_dir_create();
+	test_write_file("defs.inc", "#define LOAD(r, v) ld r, v\nvalue .equ 1\n");
+	test_write_file("main.z80", "#include \"defs.inc\"\n\tLOAD(a, value)\n");
+	test_path(path, sizeof(path), "main.z80");
+
+	profile_enable();
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(include_manager_load(&im, path, &main_file), NULL);
+	ck_assert_ptr_eq(assembler_assemble(&as, main_file), NULL);
+	ck_assert_uint_eq(as.files.num_files, 2);
+	defs_file = as.files.files[1];
+
+	profile_init(&profile);
+	profile_collect(&profile);
+
+	/* Every line is counted, directives included, in the one pass */
+	ck_assert_uint_eq(profile.num_lines, 4);
+	line = profile_find_line(&profile, location(main_file->source_id, 20));
+	ck_assert_ptr_ne(line, NULL);
+	ck_assert_uint_eq(line->count, 1);
+	ck_assert_uint_eq(line->from.file, SOURCE_FILE_NONE);
+	line = profile_find_line(&profile, location(defs_file->source_id, 27));
+	ck_assert_ptr_ne(line, NULL);
+	ck_assert_uint_eq(line->count, 1);
+	ck_assert_uint_eq(line->from.file, main_file->source_id);
+	ck_assert_uint_eq(line->from.offset, 0);
+	ck_assert_uint_eq(profile.macros[intern_table_find(&profile.macro_names, "LOAD", 4)].count, 1);
+
+	file = bergen_open_memstream(&str, &length);
+	profile_print(&profile, &im.sources, 10, file);
+	bergen_fclose(file);
+	ck_assert_ptr_ne(bergen_strstr(str, "/defs.inc:2  value .equ 1\n"), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "included from "), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "/main.z80:2  LOAD(a, value)\n"), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "  LOAD\n"), NULL);
+	bergen_free_libc(str);
+	profile_destroy(&profile);
+
+	/* Reset throws away what was measured */
+	profile_reset();
+	profile_init(&profile);
+	profile_collect(&profile);
+	ck_assert_uint_eq(profile.num_lines, 0);
+	profile_destroy(&profile);
+
+	/* Threads that have exited are still there until the next reset */
+	thread_pool_run(4, 8, line_job, NULL);
+	profile_reset();
+	thread_pool_run(4, 8, line_job, NULL);
+	profile_init(&profile);
+	profile_collect(&profile);
+	ck_assert_uint_eq(profile.num_lines, 8);
+	line = profile_find_line(&profile, location(7, 5));
+	ck_assert_ptr_ne(line, NULL);
+	ck_assert_uint_eq(line->count, 1);
+	profile_destroy(&profile);
+	profile_disable();
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_remove_file("defs.inc");
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_profile(void)
+{
+	TCase *tcase = tcase_create("profile");
+
+	tcase_add_test(tcase, test_profile_table);
+	tcase_add_test(tcase, test_profile_assemble);
+
+	return tcase;
+}
@@ -0,0 +1,142 @@
+/*
+ * test/source.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/error.h>
+#include <bergen/expression.h>
+#include <bergen/source.h>
+
+#include <bergen/libc.h>
+
+static void assert_line_column(struct source_file *file, size_t offset, size_t line, size_t column)
+{
+	size_t actual_line, actual_column;
+
+	source_file_get_line_column(file, offset, &actual_line, &actual_column);
+	ck_assert_uint_eq(actual_line, line);
+	ck_assert_uint_eq(actual_column, column);
+}
+
+START_TEST(test_line_column)
+{
+	static const char data[] = "first\nsecond\n\nfourth";
+	struct source_list list;
+	struct source_file *file;
+	source_file_id id;
+
+	source_list_init(&list);
+	id = source_list_add(&list, "file.z80", data, sizeof(data) - 1);
+	ck_assert_uint_eq(id, 0);
+
+	file = source_list_get_file(&list, id);
+	ck_assert_ptr_ne(file, NULL);
+	ck_assert_ptr_eq(file->line_starts, NULL);
+	ck_assert_ptr_eq(source_list_get_file(&list, 1), NULL);
+	ck_assert_ptr_eq(source_list_get_file(&list, SOURCE_FILE_NONE), NULL);
+
+	assert_line_column(file, 0, 1, 1);
+	ck_assert_uint_eq(file->num_lines, 4);
+	assert_line_column(file, 4, 1, 5);
+	assert_line_column(file, 5, 1, 6);
+	assert_line_column(file, 6, 2, 1);
+	assert_line_column(file, 12, 2, 7);
+	assert_line_column(file, 13, 3, 1);
+	assert_line_column(file, 14, 4, 1);
+	assert_line_column(file, 19, 4, 6);
+
+	source_list_destroy(&list);
+}
+END_TEST
+
+START_TEST(test_remove)
+{
+	struct source_list list;
+	struct source_file *file;
+
+	source_list_init(&list);
+	ck_assert_uint_eq(source_list_add(&list, "a.z80", "a\n", 2), 0);
+	ck_assert_uint_eq(source_list_add(&list, "b.z80", "b\nb\n", 4), 1);
+	assert_line_column(source_list_get_file(&list, 0), 1, 1, 2);
+
+	/* Ids of other files don't move, and the slot is taken again */
+	source_list_remove(&list, 0);
+	ck_assert_ptr_eq(source_list_get_file(&list, 0), NULL);
+	ck_assert_str_eq(source_list_get_file(&list, 1)->name, "b.z80");
+	ck_assert_uint_eq(source_list_add(&list, "c.z80", "c", 1), 0);
+	file = source_list_get_file(&list, 0);
+	ck_assert_str_eq(file->name, "c.z80");
+	ck_assert_ptr_eq(file->line_starts, NULL);
+	ck_assert_uint_eq(source_list_add(&list, "d.z80", "d", 1), 2);
+	ck_assert_uint_eq(list.num_files, 3);
+
+	source_list_destroy(&list);
+}
+END_TEST
+
+START_TEST(test_error_location)
+{
+	static const char data[] = "\t.org $8000\n\t.dw 1 + missing\n";
+	static const char expected[] = "file.z80:2:10: Could not find label: missing\n";
+	struct source_list list;
+	struct expr_data expr;
+	struct error *err;
+	expr_value result;
+	FILE *file;
+	char buf[64];
+	size_t length;
+
+	source_list_init(&list);
+	expr_data_init(&expr, data + 17, 11, '_');
+	expr.location.file = source_list_add(&list, "file.z80", data, sizeof(data) - 1);
+	expr.location.offset = 17;
+
+	err = expr_evaluate(&expr, &result);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_uint_eq(err->location.file, expr.location.file);
+	ck_assert_uint_eq(err->location.offset, 21);
+
+	file = bergen_tmpfile();
+	error_print(err, &list, file);
+	bergen_fseek(file, 0, SEEK_SET);
+	length = bergen_fread(buf, sizeof(char), sizeof(buf), file);
+	ck_assert_uint_eq(length, sizeof(expected) - 1);
+	ck_assert_int_eq(bergen_memcmp(buf, expected, length), 0);
+	bergen_fclose(file);
+
+	error_free(err);
+	expr_data_destroy(&expr);
+	source_list_destroy(&list);
+}
+END_TEST
+
+TCase *tcase_source(void)
+{
+	TCase *tcase = tcase_create("source");
+
+	tcase_add_test(tcase, test_line_column);
+	tcase_add_test(tcase, test_remove);
+	tcase_add_test(tcase, test_error_location);
+
+	return tcase;
+}
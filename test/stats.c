@@ -0,0 +1,98 @@
+/*
+ * test/stats.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/pool.h>
+#include <bergen/stats.h>
+
+#include <bergen/libc.h>
+
+static void count_job(void *data, size_t index)
+{
+	(void) data;
+
+	stats_phase_begin(STATS_PHASE_PASS1);
+	stats_count(STATS_COUNTER_LINES, index + 1);
+	stats_phase_end();
+}
+
+START_TEST(test_stats)
+{
+	struct stats stats;
+	int i;
+
+	/* Nothing is counted until stats are enabled */
+	stats_count(STATS_COUNTER_LINES, 1);
+	stats_enable();
+	stats_collect(&stats);
+	ck_assert_uint_eq(stats.counters[STATS_COUNTER_LINES], 0);
+
+	/* Nested phases only have wall time of their own */
+	stats_phase_begin(STATS_PHASE_PASS1);
+	stats_phase_begin(STATS_PHASE_PREPROCESS);
+	stats_count(STATS_COUNTER_LINES, 2);
+	stats_phase_end();
+	stats_phase_end();
+	stats_collect(&stats);
+	ck_assert_uint_eq(stats.counters[STATS_COUNTER_LINES], 2);
+	ck_assert_int_eq(stats.has_cpu[STATS_PHASE_PASS1], 1);
+	ck_assert_int_eq(stats.has_cpu[STATS_PHASE_PREPROCESS], 0);
+	ck_assert_int_eq(stats.has_cpu[STATS_PHASE_PASS2], 0);
+	ck_assert_uint_eq(stats.num_threads, 1);
+
+	stats_reset();
+	stats_collect(&stats);
+	ck_assert_uint_eq(stats.counters[STATS_COUNTER_LINES], 0);
+	ck_assert_uint_eq(stats.wall_ns[STATS_PHASE_PASS1], 0);
+
+	/* Every thread counts on its own, and still counts once it has exited */
+	thread_pool_run(4, 100, count_job, NULL);
+	stats_collect(&stats);
+	ck_assert_uint_eq(stats.counters[STATS_COUNTER_LINES], 5050);
+	ck_assert_uint_ge(stats.num_threads, 1);
+	ck_assert_uint_le(stats.num_threads, 4);
+
+	/* Only the threads that ran since the reset are there */
+	for (i = 0; i < 3; i++) {
+		stats_reset();
+		thread_pool_run(4, 100, count_job, NULL);
+	}
+	stats_collect(&stats);
+	ck_assert_uint_eq(stats.counters[STATS_COUNTER_LINES], 5050);
+	ck_assert_uint_ge(stats.num_threads, 1);
+	ck_assert_uint_le(stats.num_threads, 4);
+
+	stats_disable();
+	stats_count(STATS_COUNTER_LINES, 1);
+}
+END_TEST
+
+TCase *tcase_stats(void)
+{
+	TCase *tcase = tcase_create("stats");
+
+	tcase_add_test(tcase, test_stats);
+
+	return tcase;
+}
@@ -0,0 +1,183 @@
+/*
+ * test/stream.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/stream.h>
+
+#include <bergen/libc.h>
+
+static struct include_file *load(struct include_manager *im, const char *name)
+{
+	struct include_file *file;
+	char path[256];
+
+	test_path(path, sizeof(path), name);
+	ck_assert_ptr_eq(include_manager_load(im, path, &file), NULL);
+	return file;
+}
+
+static void assert_next(struct line_stream *stream, const char *raw, const char *expanded)
+{
+	const struct stream_line *line;
+	char buf[256];
+	size_t i, length = 0;
+
+	ck_assert_ptr_eq(line_stream_next(stream, &line), NULL);
+	ck_assert_ptr_ne(line, NULL);
+	ck_assert_uint_eq(line->length, bergen_strlen(raw));
+	ck_assert_int_eq(bergen_memcmp(line->str, raw, line->length), 0);
+
+	for (i = 0; i < line->num_tokens; i++) {
+		bergen_memcpy(buf + length, line->tokens[i].str, line->tokens[i].length);
+		length += line->tokens[i].length;
+	}
+	buf[length] = '\0';
+	ck_assert_str_eq(buf, expanded);
+}
+
+START_TEST(test_stream)
+{
+	struct include_manager im;
+	struct preprocessor pp;
+	struct line_stream stream;
+	const struct stream_line *line;
+	struct include_file *main_file;
+	struct include_file_list files;
+
+	test_dir_create();
+	test_write_file("main.z80",
+		"#define VALUE(x) x+1\n"
+		"#include \"a.inc\"\n"
+		" ld a,VALUE(2) ; comment\r\n"
+		"#ifdef MISSING\n"
+		" bad\n"
+		"#include \"missing.inc\"\n"
+		"#else\n"
+		" good\n"
+		"#endif\n"
+		"#include \"a.inc\"\n"
+		"last");
+	test_write_file("a.inc", "#ifndef A_INC\n#define A_INC\nA_LINE\n#endif\n");
+
+	include_manager_init(&im);
+	preprocessor_init(&pp, NULL);
+	line_stream_init(&stream, &pp, &im);
+	include_file_list_init(&files);
+	stream.files = &files;
+	main_file = load(&im, "main.z80");
+	line_stream_push(&stream, main_file);
+
+	assert_next(&stream, "A_LINE", "A_LINE");
+	assert_next(&stream, " ld a,VALUE(2) ; comment", " ld a,2+1 ; comment");
+	ck_assert_uint_eq(stream.line.location.file, main_file->source_id);
+	ck_assert_uint_eq(stream.line.location.offset, 38);
+	assert_next(&stream, " good", " good");
+	assert_next(&stream, "last", "last");
+	ck_assert_ptr_eq(line_stream_next(&stream, &line), NULL);
+	ck_assert_ptr_eq(line, NULL);
+	ck_assert_ptr_eq(line_stream_next(&stream, &line), NULL);
+	ck_assert_ptr_eq(line, NULL);
+
+	/* The guarded file was only mapped once, and is listed once */
+	ck_assert_uint_eq(im.num_files, 2);
+	ck_assert_uint_eq(files.num_files, 2);
+	ck_assert_ptr_eq(files.files[0], main_file);
+	ck_assert_str_eq(bergen_strrchr(files.files[1]->path, '/'), "/a.inc");
+
+	include_file_list_destroy(&files);
+	line_stream_destroy(&stream);
+	preprocessor_destroy(&pp);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_remove_file("a.inc");
+	test_dir_remove();
+}
+END_TEST
+
+static struct error *run_to_error(const char *name)
+{
+	struct include_manager im;
+	struct preprocessor pp;
+	struct line_stream stream;
+	const struct stream_line *line;
+	struct error *err;
+
+	include_manager_init(&im);
+	preprocessor_init(&pp, NULL);
+	line_stream_init(&stream, &pp, &im);
+	line_stream_push(&stream, load(&im, name));
+
+	while (!(err = line_stream_next(&stream, &line)) && line)
+		;
+
+	line_stream_destroy(&stream);
+	preprocessor_destroy(&pp);
+	include_manager_destroy(&im);
+	return err;
+}
+
+START_TEST(test_stream_errors)
+{
+	struct error *err;
+
+	test_dir_create();
+	test_write_file("self.inc", "line\n#include \"self.inc\"\n");
+	test_write_file("missing.z80", "nop\n  #include \"missing.inc\"\n");
+	test_write_file("open.z80", "#if 1\nnop\n");
+
+	err = run_to_error("self.inc");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_INCLUDE_DEPTH);
+	ck_assert_uint_eq(err->location.offset, 15);
+	error_free(err);
+
+	err = run_to_error("missing.z80");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_FILE_NOT_FOUND);
+	ck_assert_uint_eq(err->location.file, 0);
+	ck_assert_uint_eq(err->location.offset, 16);
+	error_free(err);
+
+	err = run_to_error("open.z80");
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_UNTERMINATED_CONDITIONAL);
+	error_free(err);
+
+	test_remove_file("self.inc");
+	test_remove_file("missing.z80");
+	test_remove_file("open.z80");
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_stream(void)
+{
+	TCase *tcase = tcase_create("stream");
+
+	tcase_add_test(tcase, test_stream);
+	tcase_add_test(tcase, test_stream_errors);
+
+	return tcase;
+}
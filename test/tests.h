@@ -3,9 +3,39 @@
 
 #include <check.h>
 
+#include <stddef.h>
+
+/* A temporary directory for tests that need real files, see fixture.c */
+extern char test_dir[];
+
+void test_dir_create(void);
+void test_dir_remove(void);
+void test_path(char *path, size_t size, const char *name);
+void test_write_file(const char *name, const char *contents);
+void test_remove_file(const char *name);
+void test_make_dir(const char *name);
+void test_remove_dir(const char *name);
+
+TCase *tcase_alloc(void);
+TCase *tcase_arena(void);
+TCase *tcase_assembler(void);
+TCase *tcase_cache(void);
+TCase *tcase_depend(void);
+TCase *tcase_error(void);
 TCase *tcase_expr_evaluate(void);
+TCase *tcase_include(void);
+TCase *tcase_intern(void);
+TCase *tcase_label(void);
+TCase *tcase_lexer(void);
 TCase *tcase_object(void);
 TCase *tcase_parse(void);
+TCase *tcase_pool(void);
 TCase *tcase_preprocessor(void);
+TCase *tcase_profile(void);
+TCase *tcase_source(void);
+TCase *tcase_stats(void);
+TCase *tcase_stream(void);
+TCase *tcase_trace(void);
+TCase *tcase_z80(void);
 
 #endif /* BERGEN_TEST_TESTS_H */
@@ -0,0 +1,148 @@
+/*
+ * test/trace.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/assembler.h>
+#include <bergen/pool.h>
+#include <bergen/trace.h>
+
+#include <bergen/libc.h>
+
+/* The caller frees the result with bergen_free_libc() */
+static char *write_trace(void)
+{
+	char *str = NULL;
+	size_t length;
+	FILE *file = bergen_open_memstream(&str, &length);
+
+	ck_assert_ptr_ne(file, NULL);
+	trace_write(file);
+	bergen_fclose(file);
+	return str;
+}
+
+static void trace_job(void *data, size_t index)
+{
+	(void) data;
+	(void) index;
+
+	trace_end(trace_begin(), TRACE_CATEGORY_JOB, "job", 3);
+}
+
+START_TEST(test_trace)
+{
+	uint64_t start;
+	char *str;
+	int i;
+
+	/* Nothing is recorded until tracing is enabled */
+	ck_assert_uint_eq(trace_begin(), 0);
+	trace_end(trace_now(), TRACE_CATEGORY_PHASE, "pass1", 5);
+	trace_enable(1000000000);
+	ck_assert_uint_eq(trace_num_events(), 0);
+
+	start = trace_begin();
+	ck_assert_uint_ne(start, 0);
+	trace_end(start, TRACE_CATEGORY_OUTPUT, "a \"b\"\\c", 7);
+	ck_assert_uint_eq(trace_num_events(), 1);
+
+	/* Macro expansions quicker than the threshold are left out */
+	trace_end(trace_begin(), TRACE_CATEGORY_MACRO, "QUICK", 5);
+	ck_assert_uint_eq(trace_num_events(), 1);
+
+	str = write_trace();
+	ck_assert_ptr_ne(bergen_strstr(str, "\"traceEvents\": ["), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "{\"name\": \"a \\\"b\\\"\\\\c\", \"cat\": \"output\", \"ph\": \"X\", \"ts\": "), NULL);
+	ck_assert_ptr_eq(bergen_strstr(str, "QUICK"), NULL);
+	bergen_free_libc(str);
+
+	/* Every thread records on its own */
+	thread_pool_run(4, 100, trace_job, NULL);
+	ck_assert_uint_eq(trace_num_events(), 101);
+
+	/* Later threads record after those that have exited, so tids don't grow */
+	for (i = 0; i < 3; i++)
+		thread_pool_run(4, 100, trace_job, NULL);
+	ck_assert_uint_eq(trace_num_events(), 401);
+	str = write_trace();
+	ck_assert_ptr_eq(bergen_strstr(str, "\"tid\": 5}"), NULL);
+	bergen_free_libc(str);
+
+	trace_disable();
+	trace_end(trace_now(), TRACE_CATEGORY_PHASE, "pass1", 5);
+	trace_enable(0);
+	ck_assert_uint_eq(trace_num_events(), 0);
+	trace_disable();
+}
+END_TEST
+
+START_TEST(test_trace_assemble)
+{
+	struct include_manager im;
+	struct assembler as;
+	struct include_file *file;
+	char path[256], *str;
+
+	test_dir_create();
+	test_write_file("defs.inc", "#define LOAD(r, v) ld r, v\n");
+	test_write_file("main.z80", "#include \"defs.inc\"\n\tLOAD(a, 1)\n\t.end\n");
+	test_path(path, sizeof(path), "main.z80");
+
+	/* With no threshold, every expansion is traced */
+	trace_enable(0);
+	include_manager_init(&im);
+	assembler_init(&as, &im);
+	ck_assert_ptr_eq(include_manager_load(&im, path, &file), NULL);
+	ck_assert_ptr_eq(assembler_assemble(&as, file), NULL);
+
+	/* The pass, both files, the expansion and reading both files */
+	ck_assert_uint_eq(trace_num_events(), 6);
+	str = write_trace();
+	ck_assert_ptr_ne(bergen_strstr(str, "\"name\": \"pass1\", \"cat\": \"phase\""), NULL);
+	ck_assert_ptr_eq(bergen_strstr(str, "\"name\": \"pass2\", \"cat\": \"phase\""), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "/defs.inc\", \"cat\": \"include\""), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "/defs.inc\", \"cat\": \"read\""), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "/main.z80\", \"cat\": \"include\""), NULL);
+	ck_assert_ptr_ne(bergen_strstr(str, "\"name\": \"LOAD\", \"cat\": \"macro\""), NULL);
+	bergen_free_libc(str);
+	trace_disable();
+
+	assembler_destroy(&as);
+	include_manager_destroy(&im);
+
+	test_remove_file("main.z80");
+	test_remove_file("defs.inc");
+	test_dir_remove();
+}
+END_TEST
+
+TCase *tcase_trace(void)
+{
+	TCase *tcase = tcase_create("trace");
+
+	tcase_add_test(tcase, test_trace);
+	tcase_add_test(tcase, test_trace_assemble);
+
+	return tcase;
+}
@@ -0,0 +1,261 @@
+/*
+ * test/z80.c
+ * Copyright (C) 2015 Kyle Edwards <kyleedwardsny@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "tests.h"
+
+#include <bergen/z80.h>
+
+#include <bergen/libc.h>
+
+static struct z80_operand reg(enum z80_register r)
+{
+	struct z80_operand op = {Z80_OPERAND_TYPE_REGISTER, r, 0};
+	return op;
+}
+
+static struct z80_operand ind_reg(enum z80_register r, expr_value displacement)
+{
+	struct z80_operand op = {Z80_OPERAND_TYPE_INDIRECT_REGISTER, r, displacement};
+	return op;
+}
+
+static struct z80_operand imm(expr_value value)
+{
+	struct z80_operand op = {Z80_OPERAND_TYPE_IMMEDIATE, Z80_REGISTER_NONE, value};
+	return op;
+}
+
+static struct z80_operand ind(expr_value value)
+{
+	struct z80_operand op = {Z80_OPERAND_TYPE_INDIRECT, Z80_REGISTER_NONE, value};
+	return op;
+}
+
+static void assert_encode(const char *mnemonic, const struct z80_operand *ops, size_t num_ops, const char *expected, size_t expected_length)
+{
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	size_t length;
+	struct error *err;
+
+	err = z80_encode(mnemonic, bergen_strlen(mnemonic), ops, num_ops, 0x8000, buf, &length);
+	ck_assert_ptr_eq(err, NULL);
+	ck_assert_uint_eq(length, expected_length);
+	ck_assert_int_eq(bergen_memcmp(buf, expected, length), 0);
+}
+
+#define ASSERT_ENCODE(mnemonic, expected, ...) do { \
+	const struct z80_operand ops[] = {__VA_ARGS__}; \
+	assert_encode(mnemonic, ops, sizeof(ops) / sizeof(*ops), expected, sizeof(expected) - 1); \
+} while (0)
+
+static void assert_invalid(const char *mnemonic, const struct z80_operand *ops, size_t num_ops, enum error_code code)
+{
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	size_t length;
+	struct error *err;
+
+	err = z80_encode(mnemonic, bergen_strlen(mnemonic), ops, num_ops, 0x8000, buf, &length);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), code);
+	error_free(err);
+}
+
+START_TEST(test_registers)
+{
+	ck_assert_int_eq(z80_find_register("a", 1), Z80_REGISTER_A);
+	ck_assert_int_eq(z80_find_register("HL", 2), Z80_REGISTER_HL);
+	ck_assert_int_eq(z80_find_register("Ix", 2), Z80_REGISTER_IX);
+	ck_assert_int_eq(z80_find_register("po", 2), Z80_REGISTER_PO);
+	ck_assert_int_eq(z80_find_register("hlx", 3), Z80_REGISTER_NONE);
+	ck_assert_int_eq(z80_find_register("label", 5), Z80_REGISTER_NONE);
+
+	ck_assert(z80_is_mnemonic("LDIR", 4));
+	ck_assert(z80_is_mnemonic("xor", 3));
+	ck_assert(!z80_is_mnemonic("ldx", 3));
+}
+END_TEST
+
+START_TEST(test_implied)
+{
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	size_t length;
+
+	ck_assert_ptr_eq(z80_encode("NOP", 3, NULL, 0, 0, buf, &length), NULL);
+	ck_assert_uint_eq(length, 1);
+	ck_assert_uint_eq(buf[0], 0x00);
+	ck_assert_ptr_eq(z80_encode("ldir", 4, NULL, 0, 0, buf, &length), NULL);
+	ck_assert_uint_eq(length, 2);
+	ck_assert_uint_eq(buf[0], 0xED);
+	ck_assert_uint_eq(buf[1], 0xB0);
+}
+END_TEST
+
+START_TEST(test_ld)
+{
+	ASSERT_ENCODE("ld", "\x78", reg(Z80_REGISTER_A), reg(Z80_REGISTER_B));
+	ASSERT_ENCODE("ld", "\x7E", reg(Z80_REGISTER_A), ind_reg(Z80_REGISTER_HL, 0));
+	ASSERT_ENCODE("ld", "\xDD\x7E\x05", reg(Z80_REGISTER_A), ind_reg(Z80_REGISTER_IX, 5));
+	ASSERT_ENCODE("ld", "\xFD\x70\xFE", ind_reg(Z80_REGISTER_IY, -2), reg(Z80_REGISTER_B));
+	ASSERT_ENCODE("ld", "\xDD\x66\x01", reg(Z80_REGISTER_H), ind_reg(Z80_REGISTER_IX, 1));
+	ASSERT_ENCODE("ld", "\xDD\x67", reg(Z80_REGISTER_IXH), reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("ld", "\x3E\x2A", reg(Z80_REGISTER_A), imm(42));
+	ASSERT_ENCODE("ld", "\x36\xFF", ind_reg(Z80_REGISTER_HL, 0), imm(255));
+	ASSERT_ENCODE("ld", "\xDD\x36\x03\x07", ind_reg(Z80_REGISTER_IX, 3), imm(7));
+	ASSERT_ENCODE("ld", "\x0A", reg(Z80_REGISTER_A), ind_reg(Z80_REGISTER_BC, 0));
+	ASSERT_ENCODE("ld", "\x12", ind_reg(Z80_REGISTER_DE, 0), reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("ld", "\x3A\x34\x12", reg(Z80_REGISTER_A), ind(0x1234));
+	ASSERT_ENCODE("ld", "\x32\x34\x12", ind(0x1234), reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("ld", "\xED\x57", reg(Z80_REGISTER_A), reg(Z80_REGISTER_I));
+	ASSERT_ENCODE("ld", "\x21\x34\x12", reg(Z80_REGISTER_HL), imm(0x1234));
+	ASSERT_ENCODE("ld", "\xFD\x21\x34\x12", reg(Z80_REGISTER_IY), imm(0x1234));
+	ASSERT_ENCODE("ld", "\x2A\x34\x12", reg(Z80_REGISTER_HL), ind(0x1234));
+	ASSERT_ENCODE("ld", "\xED\x5B\x34\x12", reg(Z80_REGISTER_DE), ind(0x1234));
+	ASSERT_ENCODE("ld", "\xED\x73\x34\x12", ind(0x1234), reg(Z80_REGISTER_SP));
+	ASSERT_ENCODE("ld", "\xDD\x22\x34\x12", ind(0x1234), reg(Z80_REGISTER_IX));
+	ASSERT_ENCODE("ld", "\xF9", reg(Z80_REGISTER_SP), reg(Z80_REGISTER_HL));
+}
+END_TEST
+
+START_TEST(test_alu)
+{
+	ASSERT_ENCODE("add", "\x80", reg(Z80_REGISTER_A), reg(Z80_REGISTER_B));
+	ASSERT_ENCODE("sub", "\x96", ind_reg(Z80_REGISTER_HL, 0));
+	ASSERT_ENCODE("cp", "\xFE\x0A", imm(10));
+	ASSERT_ENCODE("xor", "\xAF", reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("and", "\xFD\xA6\x02", ind_reg(Z80_REGISTER_IY, 2));
+	ASSERT_ENCODE("sbc", "\xDE\x01", reg(Z80_REGISTER_A), imm(1));
+	ASSERT_ENCODE("add", "\x19", reg(Z80_REGISTER_HL), reg(Z80_REGISTER_DE));
+	ASSERT_ENCODE("add", "\xDD\x29", reg(Z80_REGISTER_IX), reg(Z80_REGISTER_IX));
+	ASSERT_ENCODE("sbc", "\xED\x52", reg(Z80_REGISTER_HL), reg(Z80_REGISTER_DE));
+	ASSERT_ENCODE("adc", "\xED\x7A", reg(Z80_REGISTER_HL), reg(Z80_REGISTER_SP));
+	ASSERT_ENCODE("inc", "\x3C", reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("dec", "\x35", ind_reg(Z80_REGISTER_HL, 0));
+	ASSERT_ENCODE("inc", "\x23", reg(Z80_REGISTER_HL));
+	ASSERT_ENCODE("dec", "\xDD\x2B", reg(Z80_REGISTER_IX));
+}
+END_TEST
+
+START_TEST(test_bits)
+{
+	ASSERT_ENCODE("rlc", "\xCB\x00", reg(Z80_REGISTER_B));
+	ASSERT_ENCODE("srl", "\xCB\x3F", reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("rr", "\xDD\xCB\x04\x1E", ind_reg(Z80_REGISTER_IX, 4));
+	ASSERT_ENCODE("bit", "\xCB\x7E", imm(7), ind_reg(Z80_REGISTER_HL, 0));
+	ASSERT_ENCODE("set", "\xCB\xC7", imm(0), reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("res", "\xFD\xCB\x09\x8E", imm(1), ind_reg(Z80_REGISTER_IY, 9));
+}
+END_TEST
+
+START_TEST(test_jumps)
+{
+	ASSERT_ENCODE("jp", "\xC3\x00\x90", imm(0x9000));
+	ASSERT_ENCODE("jp", "\xCA\x00\x90", reg(Z80_REGISTER_Z), imm(0x9000));
+	ASSERT_ENCODE("jp", "\xFA\x00\x90", reg(Z80_REGISTER_M), imm(0x9000));
+	ASSERT_ENCODE("jp", "\xE9", ind_reg(Z80_REGISTER_HL, 0));
+	ASSERT_ENCODE("jp", "\xDD\xE9", ind_reg(Z80_REGISTER_IX, 0));
+	ASSERT_ENCODE("jr", "\x18\xFE", imm(0x8000));
+	ASSERT_ENCODE("jr", "\x38\x10", reg(Z80_REGISTER_C), imm(0x8012));
+	ASSERT_ENCODE("djnz", "\x10\x80", imm(0x8002 - 128));
+	ASSERT_ENCODE("call", "\xCD\x34\x12", imm(0x1234));
+	ASSERT_ENCODE("call", "\xC4\x34\x12", reg(Z80_REGISTER_NZ), imm(0x1234));
+	assert_encode("ret", NULL, 0, "\xC9", 1);
+	ASSERT_ENCODE("ret", "\xD0", reg(Z80_REGISTER_NC));
+	ASSERT_ENCODE("rst", "\xEF", imm(0x28));
+}
+END_TEST
+
+START_TEST(test_misc)
+{
+	ASSERT_ENCODE("push", "\xF5", reg(Z80_REGISTER_AF));
+	ASSERT_ENCODE("pop", "\xFD\xE1", reg(Z80_REGISTER_IY));
+	ASSERT_ENCODE("ex", "\xEB", reg(Z80_REGISTER_DE), reg(Z80_REGISTER_HL));
+	ASSERT_ENCODE("ex", "\x08", reg(Z80_REGISTER_AF), reg(Z80_REGISTER_AF_ALT));
+	ASSERT_ENCODE("ex", "\xDD\xE3", ind_reg(Z80_REGISTER_SP, 0), reg(Z80_REGISTER_IX));
+	ASSERT_ENCODE("im", "\xED\x56", imm(1));
+	ASSERT_ENCODE("in", "\xDB\x01", reg(Z80_REGISTER_A), ind(1));
+	ASSERT_ENCODE("in", "\xED\x50", reg(Z80_REGISTER_D), ind_reg(Z80_REGISTER_C, 0));
+	ASSERT_ENCODE("out", "\xD3\x10", ind(0x10), reg(Z80_REGISTER_A));
+	ASSERT_ENCODE("out", "\xED\x79", ind_reg(Z80_REGISTER_C, 0), reg(Z80_REGISTER_A));
+}
+END_TEST
+
+START_TEST(test_errors)
+{
+	struct z80_operand ops[2];
+	uint8_t buf[Z80_MAX_INSTRUCTION_LENGTH];
+	size_t length;
+	struct error *err;
+
+	assert_invalid("foo", NULL, 0, ERROR_UNKNOWN_INSTRUCTION);
+	assert_invalid("nop", ops, (ops[0] = reg(Z80_REGISTER_A), 1), ERROR_INVALID_OPERANDS);
+
+	/* LD (HL),(HL) would be HALT */
+	ops[0] = ind_reg(Z80_REGISTER_HL, 0);
+	ops[1] = ind_reg(Z80_REGISTER_HL, 0);
+	assert_invalid("ld", ops, 2, ERROR_INVALID_OPERANDS);
+
+	/* IXH and IYH can't be mixed, nor IXH and H */
+	ops[0] = reg(Z80_REGISTER_IXH);
+	ops[1] = reg(Z80_REGISTER_IYL);
+	assert_invalid("ld", ops, 2, ERROR_INVALID_OPERANDS);
+	ops[1] = reg(Z80_REGISTER_H);
+	assert_invalid("ld", ops, 2, ERROR_INVALID_OPERANDS);
+
+	/* JR only has four conditions */
+	ops[0] = reg(Z80_REGISTER_PE);
+	ops[1] = imm(0x8000);
+	assert_invalid("jr", ops, 2, ERROR_INVALID_OPERANDS);
+
+	/* Out of range values still give the length */
+	ops[0] = imm(0x8000 + 200);
+	err = z80_encode("jr", 2, ops, 1, 0x8000, buf, &length);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_VALUE_OUT_OF_RANGE);
+	ck_assert_uint_eq(length, 2);
+	error_free(err);
+
+	ops[0] = reg(Z80_REGISTER_A);
+	ops[1] = imm(256);
+	err = z80_encode("ld", 2, ops, 2, 0, buf, &length);
+	ck_assert_ptr_ne(err, NULL);
+	ck_assert_int_eq(error_get_code(err), ERROR_VALUE_OUT_OF_RANGE);
+	ck_assert_uint_eq(length, 2);
+	error_free(err);
+}
+END_TEST
+
+TCase *tcase_z80(void)
+{
+	TCase *tcase = tcase_create("z80");
+
+	tcase_add_test(tcase, test_registers);
+	tcase_add_test(tcase, test_implied);
+	tcase_add_test(tcase, test_ld);
+	tcase_add_test(tcase, test_alu);
+	tcase_add_test(tcase, test_bits);
+	tcase_add_test(tcase, test_jumps);
+	tcase_add_test(tcase, test_misc);
+	tcase_add_test(tcase, test_errors);
+
+	return tcase;
+}